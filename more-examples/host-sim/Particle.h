@@ -0,0 +1,542 @@
+// Minimal host-side stand-in for the Device OS API used by IsolatedEthernet.
+//
+// This only covers what src/ needs to compile and run on Linux. It is not a general
+// purpose Particle emulation layer. SPI transfers are forwarded to the device attached 
+// using SPIClass::attachDevice(), normally the W5500Sim simulator.
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+// The WIZnet driver and IsolatedEthernet.cpp define these as macros, as on the device, where LwIP's are not in
+// scope. glibc also has them as enum values and functions, which remain available.
+#undef IPPROTO_IP
+#undef IPPROTO_ICMP
+#undef IPPROTO_IGMP
+#undef IPPROTO_TCP
+#undef IPPROTO_PUP
+#undef IPPROTO_UDP
+#undef IPPROTO_IDP
+#undef IPPROTO_RAW
+#undef ntohl
+#undef htonl
+#undef ntohs
+#undef htons
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+
+using std::min;
+using std::max;
+
+typedef uint32_t system_tick_t;
+typedef uint16_t pin_t;
+typedef int sock_handle_t;
+typedef int network_interface_t;
+typedef void os_thread_return_t;
+
+#define NETWORK_INTERFACE_ALL 0
+#define SOCKET_WAIT_FOREVER 0
+#define SPARK_WIRING_TCPCLIENT_DEFAULT_SEND_TIMEOUT 180000
+#define TCPCLIENT_BUF_MAX_SIZE 128
+
+#define PIN_INVALID 0xff
+#define D0 0
+#define D1 1
+#define D2 2
+#define D3 3
+#define D4 4
+#define D5 5
+#define D6 6
+#define D7 7
+#define D8 8
+#define A0 19
+#define A1 20
+#define A2 21
+#define A3 22
+#define A4 23
+#define A5 24
+enum PinMode { INPUT, OUTPUT, INPUT_PULLUP, INPUT_PULLDOWN };
+enum { LOW = 0, HIGH = 1 };
+enum InterruptMode { CHANGE, RISING, FALLING };
+
+#define MHZ 1000000
+#define MSBFIRST 1
+#define LSBFIRST 0
+#define SPI_MODE0 0
+
+#define OS_THREAD_PRIORITY_DEFAULT 2
+#define OS_THREAD_PRIORITY_CRITICAL 9
+#define OS_THREAD_STACK_SIZE_DEFAULT 3072
+#define CONCURRENT_WAIT_FOREVER ((system_tick_t)-1)
+
+#define HAL_PLATFORM_NRF52840 1
+#define HAL_IPv6 0
+
+template <typename T, size_t N> constexpr size_t arraySize(const T (&)[N]) { return N; }
+
+inline bool socket_handle_valid(sock_handle_t sock) { return sock >= 0; }
+
+//
+// Time
+//
+namespace particle_host {
+inline std::chrono::steady_clock::time_point startTime() {
+    static auto t = std::chrono::steady_clock::now();
+    return t;
+}
+}
+
+inline system_tick_t millis() {
+    return (system_tick_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - particle_host::startTime()).count();
+}
+inline uint32_t micros() {
+    return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - particle_host::startTime()).count();
+}
+inline void delay(system_tick_t ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+inline void delayMicroseconds(unsigned int us) { std::this_thread::sleep_for(std::chrono::microseconds(us)); }
+inline uint32_t HAL_RNG_GetRandomNumber(void) { static std::random_device rd; return rd(); }
+
+//
+// GPIO. The host-sim board hooks let the simulator observe CS and drive INT.
+//
+namespace particle_host {
+struct Board {
+    std::function<void(pin_t, int)> onDigitalWrite;
+    std::function<int(pin_t)> onDigitalRead;
+    std::function<void(pin_t, std::function<void()>, InterruptMode)> onAttachInterrupt;
+};
+inline Board &board() { static Board b; return b; }
+}
+
+inline void pinMode(pin_t, PinMode) {}
+inline void digitalWrite(pin_t pin, int value) { if (particle_host::board().onDigitalWrite) particle_host::board().onDigitalWrite(pin, value); }
+inline int digitalRead(pin_t pin) { return particle_host::board().onDigitalRead ? particle_host::board().onDigitalRead(pin) : HIGH; }
+inline void pinResetFast(pin_t pin) { digitalWrite(pin, LOW); }
+inline void pinSetFast(pin_t pin) { digitalWrite(pin, HIGH); }
+inline bool attachInterrupt(pin_t pin, void (*fn)(void), InterruptMode mode, int8_t priority = -1, uint8_t subpriority = 0) {
+    (void)priority; (void)subpriority;
+    if (particle_host::board().onAttachInterrupt) particle_host::board().onAttachInterrupt(pin, fn, mode);
+    return true;
+}
+inline void detachInterrupt(pin_t) {}
+
+//
+// Concurrency
+//
+namespace particle_host {
+inline std::recursive_mutex &atomicMutex() { static std::recursive_mutex m; return m; }
+struct AtomicSection {
+    AtomicSection() { atomicMutex().lock(); }
+    ~AtomicSection() { atomicMutex().unlock(); }
+};
+}
+#define SINGLE_THREADED_BLOCK() for (bool __todo = true; __todo; __todo = false) for (particle_host::AtomicSection __as; __todo; __todo = false)
+#define ATOMIC_BLOCK() SINGLE_THREADED_BLOCK()
+
+class Mutex {
+public:
+    void lock() { m.lock(); }
+    void unlock() { m.unlock(); }
+    bool trylock() { return m.try_lock(); }
+    bool try_lock() { return m.try_lock(); }
+private:
+    std::mutex m;
+};
+
+class RecursiveMutex {
+public:
+    void lock() { m.lock(); }
+    void unlock() { m.unlock(); }
+    bool trylock() { return m.try_lock(); }
+    bool try_lock() { return m.try_lock(); }
+private:
+    std::recursive_mutex m;
+};
+
+typedef void *os_thread_t;
+typedef void *os_queue_t;
+typedef os_thread_return_t (*os_thread_fn_t)(void *);
+
+inline os_thread_t os_thread_current(void *reserved = nullptr) {
+    (void)reserved;
+    static thread_local char marker;
+    return &marker;
+}
+
+namespace particle_host {
+struct Queue {
+    size_t itemSize;
+    size_t depth;
+    std::deque<std::string> items;
+    std::mutex m;
+    std::condition_variable cv;
+};
+}
+
+inline int os_queue_create(os_queue_t *queue, size_t item_size, size_t item_count, void *reserved) {
+    (void)reserved;
+    auto q = new particle_host::Queue();
+    q->itemSize = item_size;
+    q->depth = item_count;
+    *queue = q;
+    return 0;
+}
+inline int os_queue_put(os_queue_t queue, const void *item, system_tick_t delay, void *reserved) {
+    (void)reserved;
+    auto q = (particle_host::Queue *)queue;
+    std::unique_lock<std::mutex> lock(q->m);
+    if (q->items.size() >= q->depth) {
+        if (delay == 0 || !q->cv.wait_for(lock, std::chrono::milliseconds(delay), [q]() { return q->items.size() < q->depth; })) {
+            return 1;
+        }
+    }
+    q->items.push_back(std::string((const char *)item, q->itemSize));
+    q->cv.notify_all();
+    return 0;
+}
+inline int os_queue_take(os_queue_t queue, void *item, system_tick_t delay, void *reserved) {
+    (void)reserved;
+    auto q = (particle_host::Queue *)queue;
+    std::unique_lock<std::mutex> lock(q->m);
+    auto pred = [q]() { return !q->items.empty(); };
+    if (delay == CONCURRENT_WAIT_FOREVER) {
+        q->cv.wait(lock, pred);
+    }
+    else if (!q->cv.wait_for(lock, std::chrono::milliseconds(delay), pred)) {
+        return 1;
+    }
+    memcpy(item, q->items.front().data(), q->itemSize);
+    q->items.pop_front();
+    q->cv.notify_all();
+    return 0;
+}
+
+class Thread {
+public:
+    Thread(const char *name, os_thread_fn_t fn, void *param, int priority = OS_THREAD_PRIORITY_DEFAULT, size_t stackSize = OS_THREAD_STACK_SIZE_DEFAULT) {
+        (void)name; (void)priority; (void)stackSize;
+        std::thread([fn, param]() { fn(param); }).detach();
+    }
+    Thread(const char *name, std::function<void()> fn, int priority = OS_THREAD_PRIORITY_DEFAULT, size_t stackSize = OS_THREAD_STACK_SIZE_DEFAULT) {
+        (void)name; (void)priority; (void)stackSize;
+        std::thread(fn).detach();
+    }
+};
+
+//
+// String
+//
+class String {
+public:
+    String() {}
+    String(const char *s) : s_(s ? s : "") {}
+    String(const std::string &s) : s_(s) {}
+    String(int v) : s_(std::to_string(v)) {}
+    const char *c_str() const { return s_.c_str(); }
+    size_t length() const { return s_.length(); }
+    bool operator==(const char *o) const { return s_ == o; }
+    bool operator==(const String &o) const { return s_ == o.s_; }
+    String &operator+=(const String &o) { s_ += o.s_; return *this; }
+    operator const char *() const { return s_.c_str(); }
+    static String format(const char *fmt, ...) __attribute__((format(printf, 1, 2))) {
+        char buf[512];
+        va_list ap;
+        va_start(ap, fmt);
+        vsnprintf(buf, sizeof(buf), fmt, ap);
+        va_end(ap);
+        return String(buf);
+    }
+private:
+    std::string s_;
+};
+
+//
+// Print / Stream / Printable / Client
+//
+class Print;
+
+class Printable {
+public:
+    virtual ~Printable() {}
+    virtual size_t printTo(Print &p) const = 0;
+};
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t b) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size) {
+        size_t n = 0;
+        while (size--) {
+            n += write(*buffer++);
+        }
+        return n;
+    }
+    size_t write(const char *str) { return str ? write((const uint8_t *)str, strlen(str)) : 0; }
+    size_t print(const char *str) { return write(str); }
+    size_t print(const String &str) { return write(str.c_str()); }
+    size_t print(int v) { return print(String(v)); }
+    size_t println(const char *str = "") { return print(str) + write("\r\n"); }
+    size_t println(const String &str) { return print(str) + write("\r\n"); }
+    size_t printf(const char *fmt, ...) __attribute__((format(printf, 2, 3))) {
+        char buf[512];
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+        va_end(ap);
+        return write((const uint8_t *)buf, (n < (int)sizeof(buf)) ? n : sizeof(buf) - 1);
+    }
+    int getWriteError() { return write_error; }
+    void clearWriteError() { setWriteError(0); }
+protected:
+    void setWriteError(int err = 1) { write_error = err; }
+private:
+    int write_error = 0;
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() = 0;
+};
+
+class HAL_IPAddress_t;
+typedef struct {
+    union {
+        uint32_t ipv4;
+        uint32_t ipv6[4];
+    };
+    uint8_t v;
+} HAL_IPAddress;
+
+class IPAddress : public Printable {
+public:
+    IPAddress() { clear(); }
+    IPAddress(uint8_t b0, uint8_t b1, uint8_t b2, uint8_t b3) { clear(); set(b0, b1, b2, b3); }
+    IPAddress(const uint8_t *a) { clear(); set(a[0], a[1], a[2], a[3]); }
+    IPAddress(const HAL_IPAddress &a) : addr_(a) {}
+    void clear() { memset(&addr_, 0, sizeof(addr_)); addr_.v = 4; }
+    uint8_t operator[](int index) const { return (addr_.ipv4 >> (8 * (3 - index))) & 0xff; }
+    IPAddress &operator=(const uint8_t *a) { set(a[0], a[1], a[2], a[3]); return *this; }
+    bool operator==(const IPAddress &o) const { return addr_.ipv4 == o.addr_.ipv4; }
+    operator bool() const { return addr_.ipv4 != 0; }
+    const HAL_IPAddress &raw() const { return addr_; }
+    String toString() const { return String::format("%u.%u.%u.%u", (*this)[0], (*this)[1], (*this)[2], (*this)[3]); }
+    virtual size_t printTo(Print &p) const { return p.print(toString()); }
+private:
+    void set(uint8_t b0, uint8_t b1, uint8_t b2, uint8_t b3) { addr_.ipv4 = ((uint32_t)b0 << 24) | ((uint32_t)b1 << 16) | ((uint32_t)b2 << 8) | b3; }
+    HAL_IPAddress addr_;
+};
+
+class Client : public Stream {
+public:
+    virtual int connect(IPAddress ip, uint16_t port, network_interface_t nif = 0) = 0;
+    virtual int connect(const char *host, uint16_t port, network_interface_t nif = 0) = 0;
+    virtual int read(uint8_t *buf, size_t size) = 0;
+    virtual void stop() = 0;
+    virtual uint8_t connected() = 0;
+    virtual operator bool() = 0;
+    using Stream::read;
+protected:
+    network_interface_t nif_ = 0;
+};
+
+inline uint16_t inet_ntohs(uint16_t v) { return ntohs(v); }
+inline uint16_t inet_htons(uint16_t v) { return htons(v); }
+inline uint32_t inet_ntohl(uint32_t v) { return ntohl(v); }
+inline uint32_t inet_htonl(uint32_t v) { return htonl(v); }
+inline int sock_getpeername(int, struct sockaddr *, socklen_t *) { return -1; }
+
+//
+// Logging
+//
+enum LogLevel { LOG_LEVEL_ALL = 1, LOG_LEVEL_TRACE = 1, LOG_LEVEL_INFO = 30, LOG_LEVEL_WARN = 40, LOG_LEVEL_ERROR = 50, LOG_LEVEL_NONE = 70 };
+
+namespace particle_host {
+inline LogLevel &logLevel() { static LogLevel level = LOG_LEVEL_INFO; return level; }
+inline void vlog(const char *category, LogLevel level, const char *fmt, va_list ap) {
+    if (level < logLevel()) {
+        return;
+    }
+    static const char *names[] = {"TRACE", "INFO", "WARN", "ERROR"};
+    const char *name = (level >= LOG_LEVEL_ERROR) ? names[3] : (level >= LOG_LEVEL_WARN) ? names[2] : (level >= LOG_LEVEL_INFO) ? names[1] : names[0];
+    char buf[512];
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    fprintf(stderr, "%010lu [%s] %s: %s\n", (unsigned long)millis(), category, name, buf);
+}
+}
+
+class Logger {
+public:
+    explicit Logger(const char *name = "app") : name_(name) {}
+#define PARTICLE_HOST_LOG_FN(fn, level) \
+    void fn(const char *fmt, ...) const __attribute__((format(printf, 2, 3))) { va_list ap; va_start(ap, fmt); particle_host::vlog(name_, level, fmt, ap); va_end(ap); }
+    PARTICLE_HOST_LOG_FN(trace, LOG_LEVEL_TRACE)
+    PARTICLE_HOST_LOG_FN(info, LOG_LEVEL_INFO)
+    PARTICLE_HOST_LOG_FN(warn, LOG_LEVEL_WARN)
+    PARTICLE_HOST_LOG_FN(error, LOG_LEVEL_ERROR)
+#undef PARTICLE_HOST_LOG_FN
+private:
+    const char *name_;
+};
+
+#define LOG_DEBUG(level, fmt, ...) do { } while (0)
+#define DEBUG(fmt, ...) do { } while (0)
+
+//
+// SPI. Transfers are forwarded to a device model registered with SPIClass::attachDevice().
+//
+class SPISettings {
+public:
+    SPISettings() {}
+    SPISettings(unsigned clock, uint8_t bitOrder, uint8_t dataMode) : clock(clock), bitOrder(bitOrder), dataMode(dataMode) {}
+    unsigned getClock() const { return clock; }
+    bool operator==(const SPISettings &o) const { return clock == o.clock && bitOrder == o.bitOrder && dataMode == o.dataMode; }
+    bool operator!=(const SPISettings &o) const { return !(*this == o); }
+    unsigned clock = 16 * MHZ;
+    uint8_t bitOrder = MSBFIRST;
+    uint8_t dataMode = SPI_MODE0;
+};
+
+typedef void (*wiring_spi_dma_transfercomplete_callback_t)(void);
+
+class SPIDevice {
+public:
+    virtual ~SPIDevice() {}
+    // Exchange len bytes. Either buffer can be NULL.
+    virtual void transfer(const uint8_t *tx, uint8_t *rx, size_t len) = 0;
+    virtual void setClock(unsigned clock) { (void)clock; }
+};
+
+class SPIClass {
+public:
+    void begin(pin_t ss = PIN_INVALID) { (void)ss; }
+    void attachDevice(SPIDevice *dev) { device = dev; }
+    int32_t beginTransaction(const SPISettings &settings) {
+        mutex.lock();
+        if (device) {
+            device->setClock(settings.clock);
+        }
+        return 0;
+    }
+    void endTransaction() { mutex.unlock(); }
+    uint8_t transfer(uint8_t b) {
+        uint8_t r = 0xff;
+        if (device) {
+            device->transfer(&b, &r, 1);
+        }
+        return r;
+    }
+    void transfer(const void *tx, void *rx, size_t len, wiring_spi_dma_transfercomplete_callback_t cb) {
+        if (device) {
+            device->transfer((const uint8_t *)tx, (uint8_t *)rx, len);
+        }
+        if (cb) {
+            cb();
+        }
+    }
+    void transferCancel() {}
+private:
+    SPIDevice *device = nullptr;
+    std::recursive_mutex mutex;
+};
+
+inline SPIClass SPI;
+inline SPIClass SPI1;
+
+//
+// JSON (only the parts used for the config file)
+//
+class JSONString {
+public:
+    JSONString() {}
+    JSONString(const std::string &s) : s_(s) {}
+    const char *data() const { return s_.c_str(); }
+    bool operator==(const char *o) const { return s_ == o; }
+private:
+    std::string s_;
+};
+
+class JSONValue {
+public:
+    static JSONValue parseCopy(const char *str) { JSONValue v; v.text_ = str ? str : ""; return v; }
+    JSONString toString() const { return JSONString(text_); }
+    bool toBool() const { return text_ == "true"; }
+    std::string text_;
+};
+
+class JSONObjectIterator {
+public:
+    explicit JSONObjectIterator(const JSONValue &v) : text_(v.text_) {}
+    // Very small parser for flat {"key":"value",...} objects
+    bool next() {
+        size_t k = text_.find('"', pos_);
+        if (k == std::string::npos) return false;
+        size_t ke = text_.find('"', k + 1);
+        size_t colon = text_.find(':', ke);
+        if (ke == std::string::npos || colon == std::string::npos) return false;
+        name_ = text_.substr(k + 1, ke - k - 1);
+        size_t vs = text_.find_first_not_of(" \t\r\n", colon + 1);
+        size_t ve;
+        if (vs != std::string::npos && text_[vs] == '"') {
+            ve = text_.find('"', vs + 1);
+            value_.text_ = text_.substr(vs + 1, ve - vs - 1);
+            ve++;
+        }
+        else {
+            ve = text_.find_first_of(",}", vs);
+            value_.text_ = text_.substr(vs, ve - vs);
+        }
+        pos_ = ve;
+        return true;
+    }
+    JSONString name() const { return JSONString(name_); }
+    const JSONValue &value() const { return value_; }
+private:
+    std::string text_;
+    size_t pos_ = 0;
+    std::string name_;
+    JSONValue value_;
+};
+
+class JSONBufferWriter {
+public:
+    JSONBufferWriter(char *buf, size_t size) : buf_(buf), size_(size) {}
+    JSONBufferWriter &beginObject() { append("{"); first_ = true; return *this; }
+    JSONBufferWriter &endObject() { append("}"); return *this; }
+    JSONBufferWriter &name(const char *n) { if (!first_) append(","); first_ = false; append("\""); append(n); append("\":"); return *this; }
+    JSONBufferWriter &value(const char *v) { append("\""); append(v); append("\""); return *this; }
+private:
+    void append(const char *s) { while (*s && len_ < size_) buf_[len_++] = *s++; }
+    char *buf_;
+    size_t size_;
+    size_t len_ = 0;
+    bool first_ = true;
+};
+
+//
+// Device identity used by IsolatedEthernet::setMacAddress()
+//
+struct NRF_FICR_Type { uint32_t DEVICEADDR[2]; };
+inline NRF_FICR_Type *particle_host_ficr() { static NRF_FICR_Type f = {{0x12345678, 0x9abc}}; return &f; }
+#define NRF_FICR particle_host_ficr()
@@ -0,0 +1,1223 @@
+#include "W5500Sim.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/syscall.h>
+
+// The WIZnet socket functions in socket.cpp have C linkage, so in the host build their symbols
+// (socket, connect, send, recv, close, getsockopt, ...) replace the libc functions of the same
+// name. The simulator makes the system calls directly so it talks to the host network stack.
+namespace host {
+    static int socket(int domain, int type, int protocol) { return (int)syscall(SYS_socket, domain, type, protocol); }
+    static int close(int fd) { return (int)syscall(SYS_close, fd); }
+    static int listen(int fd, int backlog) { return (int)syscall(SYS_listen, fd, backlog); }
+    static int connect(int fd, const sockaddr *addr, socklen_t len) { return (int)syscall(SYS_connect, fd, addr, len); }
+    static ssize_t sendto(int fd, const void *buf, size_t len, int flags, const sockaddr *addr, socklen_t addrLen) { return syscall(SYS_sendto, fd, buf, len, flags, addr, addrLen); }
+    static ssize_t send(int fd, const void *buf, size_t len, int flags) { return host::sendto(fd, buf, len, flags, nullptr, 0); }
+    static ssize_t recvfrom(int fd, void *buf, size_t len, int flags, sockaddr *addr, socklen_t *addrLen) { return syscall(SYS_recvfrom, fd, buf, len, flags, addr, addrLen); }
+    static ssize_t recv(int fd, void *buf, size_t len, int flags) { return host::recvfrom(fd, buf, len, flags, nullptr, nullptr); }
+    static int setsockopt(int fd, int level, int name, const void *value, socklen_t len) { return (int)syscall(SYS_setsockopt, fd, level, name, value, len); }
+    static int getsockopt(int fd, int level, int name, void *value, socklen_t *len) { return (int)syscall(SYS_getsockopt, fd, level, name, value, len); }
+}
+
+// Common register block
+static const uint16_t MR = 0x0000;
+static const uint16_t IR = 0x0015;
+static const uint16_t IMR = 0x0016;
+static const uint16_t SIR = 0x0017;
+static const uint16_t SIMR = 0x0018;
+static const uint16_t RTR = 0x0019;
+static const uint16_t RCR = 0x001B;
+static const uint16_t PHYCFGR = 0x002E;
+static const uint16_t VERSIONR = 0x0039;
+
+// Socket register block
+static const uint16_t Sn_MR = 0x00;
+static const uint16_t Sn_CR = 0x01;
+static const uint16_t Sn_IR = 0x02;
+static const uint16_t Sn_SR = 0x03;
+static const uint16_t Sn_PORT = 0x04;
+static const uint16_t Sn_DHAR = 0x06;
+static const uint16_t Sn_DIPR = 0x0C;
+static const uint16_t Sn_DPORT = 0x10;
+static const uint16_t Sn_MSSR = 0x12;
+static const uint16_t Sn_TOS = 0x15;
+static const uint16_t Sn_TTL = 0x16;
+static const uint16_t Sn_RXBUF_SIZE = 0x1E;
+static const uint16_t Sn_TXBUF_SIZE = 0x1F;
+static const uint16_t Sn_TX_FSR = 0x20;
+static const uint16_t Sn_TX_RD = 0x22;
+static const uint16_t Sn_TX_WR = 0x24;
+static const uint16_t Sn_RX_RSR = 0x26;
+static const uint16_t Sn_RX_RD = 0x28;
+static const uint16_t Sn_RX_WR = 0x2A;
+static const uint16_t Sn_IMR = 0x2C;
+static const uint16_t Sn_FRAG = 0x2D;
+static const uint16_t Sn_KPALVTR = 0x2F;
+
+// Sn_MR
+static const uint8_t MR_TCP = 0x01;
+static const uint8_t MR_UDP = 0x02;
+static const uint8_t MR_MACRAW = 0x04;
+static const uint8_t MR_MULTI = 0x80;
+
+// Sn_CR
+static const uint8_t CR_OPEN = 0x01;
+static const uint8_t CR_LISTEN = 0x02;
+static const uint8_t CR_CONNECT = 0x04;
+static const uint8_t CR_DISCON = 0x08;
+static const uint8_t CR_CLOSE = 0x10;
+static const uint8_t CR_SEND = 0x20;
+static const uint8_t CR_SEND_MAC = 0x21;
+static const uint8_t CR_SEND_KEEP = 0x22;
+static const uint8_t CR_RECV = 0x40;
+
+// Sn_IR
+static const uint8_t IR_CON = 0x01;
+static const uint8_t IR_DISCON = 0x02;
+static const uint8_t IR_RECV = 0x04;
+static const uint8_t IR_TIMEOUT = 0x08;
+static const uint8_t IR_SENDOK = 0x10;
+
+// Sn_SR
+static const uint8_t SOCK_CLOSED = 0x00;
+static const uint8_t SOCK_INIT = 0x13;
+static const uint8_t SOCK_LISTEN = 0x14;
+static const uint8_t SOCK_SYNSENT = 0x15;
+static const uint8_t SOCK_ESTABLISHED = 0x17;
+static const uint8_t SOCK_CLOSE_WAIT = 0x1C;
+static const uint8_t SOCK_UDP = 0x22;
+static const uint8_t SOCK_MACRAW = 0x42;
+
+static const uint16_t DHCP_SERVER_PORT = 67;
+static const uint16_t DNS_SERVER_PORT = 53;
+
+// check_DHCP_leasedIP() in dhcp.cpp sends to this port on the leased address and expects an ARP timeout
+static const uint16_t DHCP_CONFLICT_CHECK_PORT = 5000;
+
+
+W5500Sim::W5500Sim() : W5500Sim(Options())
+{
+}
+
+W5500Sim::W5500Sim(const Options &options) : options(options)
+{
+    chipReset();
+}
+
+W5500Sim::~W5500Sim()
+{
+    if (thread)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopThread = true;
+        }
+        thread->join();
+        delete thread;
+    }
+
+    for (int sn = 0; sn < NUM_SOCKETS; sn++)
+    {
+        closeFds(sn);
+    }
+}
+
+void W5500Sim::begin(SPIClass &spi)
+{
+    spi.attachDevice(this);
+
+    auto prevDigitalWrite = particle_host::board().onDigitalWrite;
+    particle_host::board().onDigitalWrite = [this, prevDigitalWrite](pin_t pin, int value)
+    {
+        if (pin == options.pinCS)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (value == LOW && !csLow)
+            {
+                stats.frames++;
+                headerCount = 0;
+            }
+            csLow = (value == LOW);
+        }
+        else if (pin == options.pinRESET && value == LOW)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            chipReset();
+        }
+
+        if (prevDigitalWrite)
+        {
+            prevDigitalWrite(pin, value);
+        }
+    };
+
+    auto prevDigitalRead = particle_host::board().onDigitalRead;
+    particle_host::board().onDigitalRead = [this, prevDigitalRead](pin_t pin)
+    {
+        if (pin == options.pinINT)
+        {
+            return (int)(intLow ? LOW : HIGH);
+        }
+        return prevDigitalRead ? prevDigitalRead(pin) : (int)HIGH;
+    };
+
+    auto prevAttachInterrupt = particle_host::board().onAttachInterrupt;
+    particle_host::board().onAttachInterrupt = [this, prevAttachInterrupt](pin_t pin, std::function<void()> fn, InterruptMode mode)
+    {
+        if (pin == options.pinINT)
+        {
+            // INTn is active low; only the falling edge is generated
+            std::lock_guard<std::mutex> lock(mutex);
+            intHandler = (mode == FALLING || mode == CHANGE) ? fn : nullptr;
+        }
+        else if (prevAttachInterrupt)
+        {
+            prevAttachInterrupt(pin, fn, mode);
+        }
+    };
+
+    if (!thread)
+    {
+        thread = new std::thread([this]() { threadFunction(); });
+    }
+}
+
+uint8_t W5500Sim::sir() const
+{
+    uint8_t result = 0;
+    for (int sn = 0; sn < NUM_SOCKETS; sn++)
+    {
+        if (sockets[sn].regs[Sn_IR] & sockets[sn].regs[Sn_IMR])
+        {
+            result |= (1 << sn);
+        }
+    }
+    return result;
+}
+
+void W5500Sim::updateInt()
+{
+    // Called with the mutex held, after anything that can change the interrupt registers
+    bool low = (options.pinINT != PIN_INVALID) && ((common[IR] & common[IMR]) || (sir() & common[SIMR]));
+    bool wasLow = intLow.exchange(low);
+    if (low && !wasLow && intHandler)
+    {
+        intHandler();
+    }
+}
+
+W5500Sim::Stats W5500Sim::getStats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+void W5500Sim::resetStats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    stats = {0};
+}
+
+void W5500Sim::setClock(unsigned clock)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    this->clock = clock ? clock : 1;
+}
+
+void W5500Sim::transfer(const uint8_t *tx, uint8_t *rx, size_t len)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    stats.transferCalls++;
+    stats.bytes += len;
+    stats.wireNanos += (uint64_t)len * 8 * 1000000000ULL / clock;
+
+    for (size_t ii = 0; ii < len; ii++)
+    {
+        uint8_t in = tx ? tx[ii] : 0xff;
+        uint8_t out = 0;
+
+        if (!csLow)
+        {
+            // Not selected, MISO is high impedance
+            out = 0xff;
+        }
+        else if (headerCount < sizeof(header))
+        {
+            header[headerCount++] = in;
+            stats.headerBytes++;
+            if (headerCount == sizeof(header))
+            {
+                frameAddr = (uint16_t)((header[0] << 8) | header[1]);
+                frameBlock = header[2] >> 3;
+                frameWrite = (header[2] & 0x04) != 0;
+            }
+        }
+        else if (frameWrite)
+        {
+            writeByte(frameBlock, frameAddr++, in);
+            stats.writeBytes++;
+        }
+        else
+        {
+            out = readByte(frameBlock, frameAddr++);
+            stats.readBytes++;
+
+            if (options.maxReliableClock && clock > options.maxReliableClock && (++readCount % 61) == 0)
+            {
+                // Too fast for the simulated board wiring, flip a bit now and then
+                out ^= 0x08;
+            }
+        }
+
+        if (rx)
+        {
+            rx[ii] = out;
+        }
+    }
+    updateInt();
+}
+
+void W5500Sim::chipReset()
+{
+    memset(common, 0, sizeof(common));
+    common[RTR] = 0x07;
+    common[RTR + 1] = 0xd0;
+    common[RCR] = 0x08;
+    common[PHYCFGR] = 0xbf;
+    common[VERSIONR] = 0x04;
+
+    for (int sn = 0; sn < NUM_SOCKETS; sn++)
+    {
+        socketReset(sn);
+    }
+    memset(leasedAddress, 0, sizeof(leasedAddress));
+}
+
+void W5500Sim::socketReset(int sn)
+{
+    Socket &s = sockets[sn];
+
+    closeFds(sn);
+    s.peerLost = false;
+    memset(s.regs, 0, sizeof(s.regs));
+    memset(&s.regs[Sn_DHAR], 0xff, 6);
+    s.regs[Sn_TTL] = 0x80;
+    s.regs[Sn_RXBUF_SIZE] = 2;
+    s.regs[Sn_TXBUF_SIZE] = 2;
+    s.regs[Sn_IMR] = 0xff;
+    s.regs[Sn_FRAG] = 0x40;
+    s.sendPending = false;
+    s.udpSendIr = 0;
+    s.injected.clear();
+}
+
+uint8_t W5500Sim::readByte(uint8_t block, uint16_t addr)
+{
+    if (block == 0)
+    {
+        if (addr >= sizeof(common))
+        {
+            return 0;
+        }
+        if (addr == SIR)
+        {
+            return sir();
+        }
+        if (addr == PHYCFGR)
+        {
+            // Link up, 100 Mbps, full duplex
+            return (common[PHYCFGR] & 0xf8) | 0x07;
+        }
+        return common[addr];
+    }
+
+    int sn = (block - 1) / 4;
+    Socket &s = sockets[sn];
+
+    switch((block - 1) % 4)
+    {
+        case 0:
+            switch(addr)
+            {
+                case Sn_TX_FSR:
+                    return txFree(sn) >> 8;
+                case Sn_TX_FSR + 1:
+                    return txFree(sn) & 0xff;
+                case Sn_RX_RSR:
+                    return rxReceived(sn) >> 8;
+                case Sn_RX_RSR + 1:
+                    return rxReceived(sn) & 0xff;
+                default:
+                    return (addr < sizeof(s.regs)) ? s.regs[addr] : 0;
+            }
+
+        case 1:
+            return txSize(sn) ? s.txMem[addr & (txSize(sn) - 1)] : 0;
+
+        case 2:
+            return rxSize(sn) ? s.rxMem[addr & (rxSize(sn) - 1)] : 0;
+
+        default:
+            return 0;
+    }
+}
+
+void W5500Sim::writeByte(uint8_t block, uint16_t addr, uint8_t value)
+{
+    if (block == 0)
+    {
+        switch(addr)
+        {
+            case MR:
+                if (value & 0x80)
+                {
+                    chipReset();
+                }
+                else
+                {
+                    common[MR] = value;
+                }
+                break;
+
+            case IR:
+                common[IR] &= ~value;
+                break;
+
+            case SIR:
+            case VERSIONR:
+                break;
+
+            default:
+                if (addr < sizeof(common))
+                {
+                    common[addr] = value;
+                }
+                break;
+        }
+        return;
+    }
+
+    int sn = (block - 1) / 4;
+    Socket &s = sockets[sn];
+
+    switch((block - 1) % 4)
+    {
+        case 0:
+            switch(addr)
+            {
+                case Sn_CR:
+                    command(sn, value);
+                    break;
+
+                case Sn_IR:
+                    s.regs[Sn_IR] &= ~value;
+                    break;
+
+                case Sn_SR:
+                case Sn_TX_FSR:
+                case Sn_TX_FSR + 1:
+                case Sn_TX_RD:
+                case Sn_TX_RD + 1:
+                case Sn_RX_RSR:
+                case Sn_RX_RSR + 1:
+                case Sn_RX_WR:
+                case Sn_RX_WR + 1:
+                    // Read-only
+                    break;
+
+                default:
+                    if (addr < sizeof(s.regs))
+                    {
+                        s.regs[addr] = value;
+                    }
+                    break;
+            }
+            break;
+
+        case 1:
+            if (txSize(sn))
+            {
+                s.txMem[addr & (txSize(sn) - 1)] = value;
+            }
+            break;
+
+        case 2:
+            if (rxSize(sn))
+            {
+                s.rxMem[addr & (rxSize(sn) - 1)] = value;
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+uint16_t W5500Sim::getReg16(int sn, uint16_t offset) const
+{
+    return (uint16_t)((sockets[sn].regs[offset] << 8) | sockets[sn].regs[offset + 1]);
+}
+
+void W5500Sim::setReg16(int sn, uint16_t offset, uint16_t value)
+{
+    sockets[sn].regs[offset] = (uint8_t)(value >> 8);
+    sockets[sn].regs[offset + 1] = (uint8_t)value;
+}
+
+uint16_t W5500Sim::txSize(int sn) const
+{
+    return (uint16_t)(sockets[sn].regs[Sn_TXBUF_SIZE] * 1024);
+}
+
+uint16_t W5500Sim::rxSize(int sn) const
+{
+    return (uint16_t)(sockets[sn].regs[Sn_RXBUF_SIZE] * 1024);
+}
+
+uint16_t W5500Sim::txFree(int sn) const
+{
+    return txSize(sn) - (uint16_t)(getReg16(sn, Sn_TX_WR) - getReg16(sn, Sn_TX_RD));
+}
+
+uint16_t W5500Sim::rxReceived(int sn) const
+{
+    return (uint16_t)(getReg16(sn, Sn_RX_WR) - getReg16(sn, Sn_RX_RD));
+}
+
+void W5500Sim::closeFds(int sn)
+{
+    Socket &s = sockets[sn];
+
+    if (s.fd >= 0)
+    {
+        host::close(s.fd);
+        s.fd = -1;
+    }
+    if (s.listenFd >= 0)
+    {
+        host::close(s.listenFd);
+        s.listenFd = -1;
+    }
+}
+
+void W5500Sim::simulatePeerLoss(int sn)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    sockets[sn].peerLost = true;
+    sockets[sn].peerLostAt = millis();
+}
+
+uint8_t W5500Sim::readRegister(int sn, uint16_t offset)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (sn < 0)
+    {
+        return (offset < sizeof(common)) ? common[offset] : 0;
+    }
+    return (offset < sizeof(sockets[sn].regs)) ? sockets[sn].regs[offset] : 0;
+}
+
+void W5500Sim::applyIpOptions(int sn, int fd)
+{
+    // Sn_TTL, Sn_TOS and Sn_MSSR on the host socket, so they show up in a packet capture
+    int ttl = sockets[sn].regs[Sn_TTL];
+    int tos = sockets[sn].regs[Sn_TOS];
+    host::setsockopt(fd, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl));
+    host::setsockopt(fd, IPPROTO_IP, IP_TOS, &tos, sizeof(tos));
+
+    int mss = getReg16(sn, Sn_MSSR);
+    if (mss && (sockets[sn].regs[Sn_MR] & 0x0f) == MR_TCP)
+    {
+        host::setsockopt(fd, IPPROTO_TCP, TCP_MAXSEG, &mss, sizeof(mss));
+    }
+}
+
+unsigned W5500Sim::retransmissionTimeoutMs() const
+{
+    // W5500 datasheet: RTR doubles for each retransmission, up to 0xffff (100 us units)
+    unsigned long rtr = (common[RTR] << 8) | common[RTR + 1];
+    unsigned long total = 0;
+    for (int ii = 0; ii <= common[RCR]; ii++)
+    {
+        total += rtr;
+        rtr = std::min(rtr * 2, 0xfffful);
+    }
+    return (unsigned)(total / 10);
+}
+
+void W5500Sim::command(int sn, uint8_t cmd)
+{
+    Socket &s = sockets[sn];
+    uint8_t &sr = s.regs[Sn_SR];
+
+    stats.commands++;
+
+    sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+
+    switch(cmd)
+    {
+        case CR_OPEN:
+            closeFds(sn);
+            s.sendPending = false;
+            s.peerLost = false;
+            s.injected.clear();
+            setReg16(sn, Sn_TX_RD, 0);
+            setReg16(sn, Sn_TX_WR, 0);
+            setReg16(sn, Sn_RX_RD, 0);
+            setReg16(sn, Sn_RX_WR, 0);
+            s.regs[Sn_IR] = 0;
+
+            switch(s.regs[Sn_MR] & 0x0f)
+            {
+                case MR_TCP:
+                    sr = SOCK_INIT;
+                    break;
+
+                case MR_UDP:
+                {
+                    s.fd = host::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+                    int one = 1;
+                    host::setsockopt(s.fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+                    host::setsockopt(s.fd, SOL_SOCKET, SO_BROADCAST, &one, sizeof(one));
+                    applyIpOptions(sn, s.fd);
+
+                    uint16_t port = getReg16(sn, Sn_PORT);
+                    if (s.regs[Sn_MR] & MR_MULTI)
+                    {
+                        ip_mreq mreq = {0};
+                        memcpy(&mreq.imr_multiaddr, &s.regs[Sn_DIPR], 4);
+                        mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+                        host::setsockopt(s.fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+                        port = getReg16(sn, Sn_DPORT);
+                    }
+
+                    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+                    addr.sin_port = htons(port);
+                    if (bind(s.fd, (sockaddr *)&addr, sizeof(addr)) != 0)
+                    {
+                        // Privileged port (like DHCP client port 68) or in use, so let the host pick one.
+                        // Replies to packets sent from this socket will still be received.
+                        addr.sin_port = 0;
+                        bind(s.fd, (sockaddr *)&addr, sizeof(addr));
+                    }
+                    sr = SOCK_UDP;
+                    break;
+                }
+
+                case MR_MACRAW:
+                    // Accepted so the socket state is correct, but frames are neither sent nor received
+                    sr = (sn == 0) ? SOCK_MACRAW : SOCK_CLOSED;
+                    break;
+
+                default:
+                    sr = SOCK_CLOSED;
+                    break;
+            }
+            break;
+
+        case CR_LISTEN:
+            if (sr == SOCK_INIT)
+            {
+                s.listenFd = host::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+                int one = 1;
+                host::setsockopt(s.listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+                addr.sin_addr.s_addr = htonl(INADDR_ANY);
+                addr.sin_port = htons(getReg16(sn, Sn_PORT));
+                if (bind(s.listenFd, (sockaddr *)&addr, sizeof(addr)) == 0 && host::listen(s.listenFd, 1) == 0)
+                {
+                    sr = SOCK_LISTEN;
+                }
+                else
+                {
+                    closeFds(sn);
+                    sr = SOCK_CLOSED;
+                }
+            }
+            break;
+
+        case CR_CONNECT:
+            if (sr == SOCK_INIT)
+            {
+                s.fd = host::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+                int one = 1;
+                host::setsockopt(s.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                applyIpOptions(sn, s.fd);
+
+                // Use the local port from Sn_PORT, like the hardware. SO_REUSEADDR allows a port in TIME_WAIT,
+                // so only reusing the same 4-tuple fails, with EADDRNOTAVAIL from connect().
+                host::setsockopt(s.fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+                addr.sin_addr.s_addr = htonl(INADDR_ANY);
+                addr.sin_port = htons(getReg16(sn, Sn_PORT));
+                if (bind(s.fd, (sockaddr *)&addr, sizeof(addr)) != 0)
+                {
+                    // Held by a host socket that isn't part of the simulation, so let the host pick one
+                    stats.portCollisions++;
+                }
+
+                memcpy(&addr.sin_addr, &s.regs[Sn_DIPR], 4);
+                addr.sin_port = htons(getReg16(sn, Sn_DPORT));
+                if (host::connect(s.fd, (sockaddr *)&addr, sizeof(addr)) == 0 || errno == EINPROGRESS)
+                {
+                    sr = SOCK_SYNSENT;
+                }
+                else
+                {
+                    if (errno == EADDRNOTAVAIL)
+                    {
+                        stats.portCollisions++;
+                    }
+                    closeFds(sn);
+                    sr = SOCK_CLOSED;
+                    s.regs[Sn_IR] |= IR_TIMEOUT;
+                }
+            }
+            break;
+
+        case CR_DISCON:
+            if ((sr == SOCK_ESTABLISHED || sr == SOCK_CLOSE_WAIT) && s.sendPending)
+            {
+                // Data already committed with SEND goes out before the FIN, as on the hardware
+                unsigned long start = millis();
+                while(!pumpSend(sn) && s.fd >= 0 && millis() - start < 1000)
+                {
+                    pollfd pfd = {s.fd, POLLOUT, 0};
+                    poll(&pfd, 1, 10);
+                }
+            }
+            if (s.fd >= 0)
+            {
+                shutdown(s.fd, SHUT_WR);
+            }
+            closeFds(sn);
+            sr = SOCK_CLOSED;
+            s.regs[Sn_IR] |= IR_DISCON;
+            break;
+
+        case CR_CLOSE:
+            closeFds(sn);
+            s.sendPending = false;
+            s.udpSendIr = 0;
+            sr = SOCK_CLOSED;
+            break;
+
+        case CR_SEND:
+        case CR_SEND_MAC:
+            if (sr == SOCK_UDP)
+            {
+                sendUdp(sn);
+            }
+            else if (sr == SOCK_MACRAW)
+            {
+                setReg16(sn, Sn_TX_RD, getReg16(sn, Sn_TX_WR));
+                s.regs[Sn_IR] |= IR_SENDOK;
+            }
+            else if (sr == SOCK_ESTABLISHED || sr == SOCK_CLOSE_WAIT)
+            {
+                if (s.sendPending)
+                {
+                    // The hardware does not support this; the library must wait for SENDOK
+                    fprintf(stderr, "W5500Sim: socket %d SEND issued before the previous SEND completed\n", sn);
+                }
+                s.sendTarget = getReg16(sn, Sn_TX_WR);
+                s.sendStartUs = micros();
+                s.sendPending = true;
+                pumpSend(sn);
+            }
+            break;
+
+        case CR_SEND_KEEP:
+        case CR_RECV:
+            // Sn_RX_RD was already updated by the host, so Sn_RX_RSR is correct and the next
+            // pump() will fill the freed space
+            break;
+
+        default:
+            break;
+    }
+
+    s.regs[Sn_CR] = 0;
+}
+
+void W5500Sim::sendUdp(int sn)
+{
+    Socket &s = sockets[sn];
+
+    uint16_t rd = getReg16(sn, Sn_TX_RD);
+    uint16_t len = (uint16_t)(getReg16(sn, Sn_TX_WR) - rd);
+
+    std::vector<uint8_t> data(len);
+    for (uint16_t ii = 0; ii < len; ii++)
+    {
+        data[ii] = s.txMem[(uint16_t)(rd + ii) & (txSize(sn) - 1)];
+    }
+    setReg16(sn, Sn_TX_RD, getReg16(sn, Sn_TX_WR));
+
+    const uint8_t *ip = &s.regs[Sn_DIPR];
+    uint16_t port = getReg16(sn, Sn_DPORT);
+
+    if (options.dhcpServer && port == DHCP_SERVER_PORT && dhcpReply(sn, data.data(), len))
+    {
+        s.regs[Sn_IR] |= IR_SENDOK;
+        return;
+    }
+    if (options.dnsServer && port == DNS_SERVER_PORT && dnsReply(sn, data.data(), len))
+    {
+        s.regs[Sn_IR] |= IR_SENDOK;
+        return;
+    }
+    if (port == DHCP_CONFLICT_CHECK_PORT && memcmp(ip, leasedAddress, 4) == 0)
+    {
+        // Nobody else has the leased address, so the ARP request times out
+        s.regs[Sn_IR] |= IR_TIMEOUT;
+        return;
+    }
+
+    sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    memcpy(&addr.sin_addr, ip, 4);
+    addr.sin_port = htons(port);
+
+    uint8_t ir;
+    if (s.fd >= 0 && host::sendto(s.fd, data.data(), len, MSG_NOSIGNAL, (sockaddr *)&addr, sizeof(addr)) >= 0)
+    {
+        ir = IR_SENDOK;
+    }
+    else
+    {
+        // No route is reported the same way the hardware reports an ARP failure
+        ir = IR_TIMEOUT;
+    }
+
+    if (options.udpSendDelayMs)
+    {
+        // Completed later by pump()
+        s.udpSendIr = ir;
+        s.udpSendAt = millis() + options.udpSendDelayMs;
+    }
+    else
+    {
+        s.regs[Sn_IR] |= ir;
+    }
+}
+
+bool W5500Sim::pumpSend(int sn)
+{
+    Socket &s = sockets[sn];
+
+    if (s.peerLost)
+    {
+        // Never acknowledged; pump() times the socket out
+        return false;
+    }
+
+    while(s.sendPending && s.fd >= 0)
+    {
+        uint16_t rd = getReg16(sn, Sn_TX_RD);
+        if (rd == s.sendTarget)
+        {
+            if (options.tcpSendDelayUs && micros() - s.sendStartUs < options.tcpSendDelayUs)
+            {
+                return false;
+            }
+            s.sendPending = false;
+            s.regs[Sn_IR] |= IR_SENDOK;
+            break;
+        }
+
+        uint16_t mask = txSize(sn) - 1;
+        uint16_t offset = rd & mask;
+        size_t chunk = std::min<size_t>((uint16_t)(s.sendTarget - rd), (size_t)(mask + 1 - offset));
+
+        ssize_t count = host::send(s.fd, &s.txMem[offset], chunk, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (count > 0)
+        {
+            setReg16(sn, Sn_TX_RD, (uint16_t)(rd + count));
+        }
+        else if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return false;
+        }
+        else
+        {
+            closeFds(sn);
+            s.sendPending = false;
+            s.regs[Sn_SR] = SOCK_CLOSED;
+            s.regs[Sn_IR] |= IR_DISCON;
+        }
+    }
+    return !s.sendPending;
+}
+
+bool W5500Sim::rxAppend(int sn, const uint8_t *data, size_t len)
+{
+    Socket &s = sockets[sn];
+
+    if (len > (size_t)(rxSize(sn) - rxReceived(sn)))
+    {
+        return false;
+    }
+
+    uint16_t wr = getReg16(sn, Sn_RX_WR);
+    for (size_t ii = 0; ii < len; ii++)
+    {
+        s.rxMem[(uint16_t)(wr + ii) & (rxSize(sn) - 1)] = data[ii];
+    }
+    setReg16(sn, Sn_RX_WR, (uint16_t)(wr + len));
+    return true;
+}
+
+bool W5500Sim::rxAppendDatagram(int sn, const uint8_t *ip, uint16_t port, const uint8_t *data, size_t len)
+{
+    if (len + 8 > (size_t)(rxSize(sn) - rxReceived(sn)))
+    {
+        return false;
+    }
+
+    // UDP mode RX header: peer IP, peer port, data length
+    uint8_t hdr[8];
+    memcpy(hdr, ip, 4);
+    hdr[4] = (uint8_t)(port >> 8);
+    hdr[5] = (uint8_t)port;
+    hdr[6] = (uint8_t)(len >> 8);
+    hdr[7] = (uint8_t)len;
+
+    rxAppend(sn, hdr, sizeof(hdr));
+    rxAppend(sn, data, len);
+    sockets[sn].regs[Sn_IR] |= IR_RECV;
+    return true;
+}
+
+bool W5500Sim::dhcpReply(int sn, const uint8_t *req, size_t len)
+{
+    static const uint8_t magic[4] = {0x63, 0x82, 0x53, 0x63};
+
+    if (len < 240 || req[0] != 1 || memcmp(&req[236], magic, 4) != 0)
+    {
+        return false;
+    }
+
+    uint8_t type = 0;
+    for (size_t ii = 240; ii + 1 < len && req[ii] != 255; )
+    {
+        if (req[ii] == 0)
+        {
+            ii++;
+            continue;
+        }
+        if (req[ii] == 53 && ii + 2 < len)
+        {
+            type = req[ii + 2];
+        }
+        ii += 2 + req[ii + 1];
+    }
+
+    uint8_t replyType;
+    switch(type)
+    {
+        case 1: // DISCOVER
+            replyType = 2; // OFFER
+            break;
+
+        case 3: // REQUEST
+            replyType = 5; // ACK
+            memcpy(leasedAddress, options.dhcpAddress, 4);
+            break;
+
+        default:
+            // DECLINE, RELEASE, and INFORM are accepted without a reply
+            return true;
+    }
+
+    std::vector<uint8_t> reply(240, 0);
+    reply[0] = 2;                                       // op: BOOTREPLY
+    reply[1] = 1;                                       // htype: Ethernet
+    reply[2] = 6;                                       // hlen
+    memcpy(&reply[4], &req[4], 4);                      // xid
+    memcpy(&reply[10], &req[10], 2);                    // flags
+    memcpy(&reply[16], options.dhcpAddress, 4);         // yiaddr
+    memcpy(&reply[20], options.dhcpGateway, 4);         // siaddr
+    memcpy(&reply[28], &req[28], 16);                   // chaddr
+    memcpy(&reply[236], magic, 4);
+
+    auto addOption = [&reply](uint8_t code, const uint8_t *data, uint8_t optLen) {
+        reply.push_back(code);
+        reply.push_back(optLen);
+        reply.insert(reply.end(), data, data + optLen);
+    };
+    static const uint8_t leaseTime[4] = {0x00, 0x01, 0x51, 0x80}; // 1 day
+
+    addOption(53, &replyType, 1);
+    addOption(54, options.dhcpGateway, 4);
+    addOption(51, leaseTime, 4);
+    addOption(1, options.dhcpSubnetMask, 4);
+    addOption(3, options.dhcpGateway, 4);
+    addOption(6, options.dhcpDns, 4);
+    reply.push_back(255);
+
+    // Prefix the UDP mode RX header so pump() can deliver it when there is room
+    std::vector<uint8_t> datagram(options.dhcpGateway, options.dhcpGateway + 4);
+    datagram.push_back(0);
+    datagram.push_back(DHCP_SERVER_PORT);
+    datagram.insert(datagram.end(), reply.begin(), reply.end());
+    sockets[sn].injected.push_back(datagram);
+    return true;
+}
+
+bool W5500Sim::dnsReply(int sn, const uint8_t *req, size_t len)
+{
+    if (len < 12)
+    {
+        return false;
+    }
+
+    // Decode the first question name
+    std::string name;
+    size_t ii = 12;
+    while(ii < len && req[ii] != 0)
+    {
+        uint8_t labelLen = req[ii++];
+        if ((labelLen & 0xc0) != 0 || ii + labelLen > len)
+        {
+            return false;
+        }
+        if (!name.empty())
+        {
+            name += '.';
+        }
+        name.append((const char *)&req[ii], labelLen);
+        ii += labelLen;
+    }
+    size_t questionEnd = ii + 1 + 4; // terminator, QTYPE, QCLASS
+    if (questionEnd > len)
+    {
+        return false;
+    }
+
+    uint8_t answerAddr[4] = {0};
+    bool found = false;
+
+    addrinfo hints = {0};
+    hints.ai_family = AF_INET;
+    addrinfo *res = nullptr;
+    if (getaddrinfo(name.c_str(), nullptr, &hints, &res) == 0 && res)
+    {
+        memcpy(answerAddr, &((sockaddr_in *)res->ai_addr)->sin_addr, 4);
+        found = true;
+        freeaddrinfo(res);
+    }
+
+    std::vector<uint8_t> reply(req, req + questionEnd);
+    reply[2] = 0x81;                            // QR, RD
+    reply[3] = found ? 0x80 : 0x83;             // RA, NXDOMAIN if not found
+    reply[4] = 0;
+    reply[5] = 1;                               // QDCOUNT
+    reply[6] = 0;
+    reply[7] = found ? 1 : 0;                   // ANCOUNT
+    memset(&reply[8], 0, 4);                    // NSCOUNT, ARCOUNT
+
+    if (found)
+    {
+        static const uint8_t answer[] = {
+            0xc0, 0x0c,                         // Pointer to the question name
+            0x00, 0x01,                         // TYPE A
+            0x00, 0x01,                         // CLASS IN
+            0x00, 0x00, 0x00, 0x3c,             // TTL 60 seconds
+            0x00, 0x04                          // RDLENGTH
+        };
+        reply.insert(reply.end(), answer, answer + sizeof(answer));
+        reply.insert(reply.end(), answerAddr, answerAddr + 4);
+    }
+
+    std::vector<uint8_t> datagram(&sockets[sn].regs[Sn_DIPR], &sockets[sn].regs[Sn_DIPR] + 4);
+    datagram.push_back(0);
+    datagram.push_back(DNS_SERVER_PORT);
+    datagram.insert(datagram.end(), reply.begin(), reply.end());
+    sockets[sn].injected.push_back(datagram);
+    return true;
+}
+
+void W5500Sim::threadFunction()
+{
+    while(true)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopThread)
+            {
+                break;
+            }
+            pump();
+            updateInt();
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+}
+
+void W5500Sim::pump()
+{
+    for (int sn = 0; sn < NUM_SOCKETS; sn++)
+    {
+        Socket &s = sockets[sn];
+        uint8_t &sr = s.regs[Sn_SR];
+
+        switch(sr)
+        {
+            case SOCK_SYNSENT:
+            {
+                pollfd pfd = {s.fd, POLLOUT, 0};
+                if (poll(&pfd, 1, 0) == 1)
+                {
+                    int err = 0;
+                    socklen_t errLen = sizeof(err);
+                    host::getsockopt(s.fd, SOL_SOCKET, SO_ERROR, &err, &errLen);
+                    if (err == 0)
+                    {
+                        sr = SOCK_ESTABLISHED;
+                        s.regs[Sn_IR] |= IR_CON;
+                    }
+                    else
+                    {
+                        closeFds(sn);
+                        sr = SOCK_CLOSED;
+                        s.regs[Sn_IR] |= IR_TIMEOUT;
+                    }
+                }
+                break;
+            }
+
+            case SOCK_LISTEN:
+            {
+                sockaddr_in peer = {0};
+                socklen_t peerLen = sizeof(peer);
+                int fd = accept4(s.listenFd, (sockaddr *)&peer, &peerLen, SOCK_NONBLOCK);
+                if (fd >= 0)
+                {
+                    // Like the hardware, the listening socket becomes the connection
+                    host::close(s.listenFd);
+                    s.listenFd = -1;
+                    s.fd = fd;
+
+                    int one = 1;
+                    host::setsockopt(s.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+                    memcpy(&s.regs[Sn_DIPR], &peer.sin_addr, 4);
+                    setReg16(sn, Sn_DPORT, ntohs(peer.sin_port));
+                    sr = SOCK_ESTABLISHED;
+                    s.regs[Sn_IR] |= IR_CON;
+                }
+                break;
+            }
+
+            case SOCK_ESTABLISHED:
+            case SOCK_CLOSE_WAIT:
+                if (s.peerLost)
+                {
+                    // Keep-alive or the data is never acknowledged, so the retransmissions time out
+                    bool keepAliveLost = s.regs[Sn_KPALVTR] && 
+                        millis() - s.peerLostAt >= s.regs[Sn_KPALVTR] * options.keepAliveUnitMs;
+                    unsigned timeoutMs = retransmissionTimeoutMs();
+                    bool sendLost = s.sendPending && millis() - s.peerLostAt >= timeoutMs &&
+                        (micros() - s.sendStartUs) / 1000 >= timeoutMs;
+                    if (keepAliveLost || sendLost)
+                    {
+                        closeFds(sn);
+                        s.peerLost = false;
+                        s.sendPending = false;
+                        sr = SOCK_CLOSED;
+                        s.regs[Sn_IR] |= IR_TIMEOUT;
+                    }
+                    break;
+                }
+                pumpSend(sn);
+                if (sr != SOCK_ESTABLISHED)
+                {
+                    break;
+                }
+
+                while(rxReceived(sn) < rxSize(sn))
+                {
+                    uint16_t mask = rxSize(sn) - 1;
+                    uint16_t wr = getReg16(sn, Sn_RX_WR);
+                    uint16_t offset = wr & mask;
+                    size_t space = std::min<size_t>(rxSize(sn) - rxReceived(sn), (size_t)(mask + 1 - offset));
+
+                    ssize_t count = host::recv(s.fd, &s.rxMem[offset], space, MSG_DONTWAIT);
+                    if (count > 0)
+                    {
+                        setReg16(sn, Sn_RX_WR, (uint16_t)(wr + count));
+                        s.regs[Sn_IR] |= IR_RECV;
+                    }
+                    else if (count == 0)
+                    {
+                        sr = SOCK_CLOSE_WAIT;
+                        s.regs[Sn_IR] |= IR_DISCON;
+                        break;
+                    }
+                    else
+                    {
+                        if (errno != EAGAIN && errno != EWOULDBLOCK)
+                        {
+                            closeFds(sn);
+                            sr = SOCK_CLOSED;
+                            s.regs[Sn_IR] |= IR_DISCON;
+                        }
+                        break;
+                    }
+                }
+                break;
+
+            case SOCK_UDP:
+                if (s.udpSendIr && (int32_t)(millis() - s.udpSendAt) >= 0)
+                {
+                    s.regs[Sn_IR] |= s.udpSendIr;
+                    s.udpSendIr = 0;
+                }
+
+                while(!s.injected.empty())
+                {
+                    std::vector<uint8_t> &datagram = s.injected.front();
+                    uint16_t port = (uint16_t)((datagram[4] << 8) | datagram[5]);
+                    if (!rxAppendDatagram(sn, datagram.data(), port, datagram.data() + 6, datagram.size() - 6))
+                    {
+                        break;
+                    }
+                    s.injected.pop_front();
+                }
+
+                while(s.fd >= 0)
+                {
+                    uint8_t buf[2048];
+                    sockaddr_in peer = {0};
+                    socklen_t peerLen = sizeof(peer);
+
+                    ssize_t count = host::recvfrom(s.fd, buf, sizeof(buf), MSG_DONTWAIT | MSG_PEEK | MSG_TRUNC, (sockaddr *)&peer, &peerLen);
+                    if (count < 0 || (size_t)count > sizeof(buf) || (size_t)count + 8 > (size_t)(rxSize(sn) - rxReceived(sn)))
+                    {
+                        // Nothing waiting, or it doesn't fit yet. Oversize datagrams are dropped below.
+                        if (count > 0 && (size_t)count > sizeof(buf))
+                        {
+                            host::recv(s.fd, buf, sizeof(buf), MSG_DONTWAIT);
+                            continue;
+                        }
+                        break;
+                    }
+                    count = host::recvfrom(s.fd, buf, sizeof(buf), MSG_DONTWAIT, (sockaddr *)&peer, &peerLen);
+                    if (count >= 0)
+                    {
+                        rxAppendDatagram(sn, (const uint8_t *)&peer.sin_addr, ntohs(peer.sin_port), buf, count);
+                    }
+                }
+                break;
+
+            default:
+                break;
+        }
+    }
+}
@@ -0,0 +1,187 @@
+#ifndef __W5500SIM_H
+#define __W5500SIM_H
+
+#include "Particle.h"
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Register-level simulator for the WIZnet W5500, for running IsolatedEthernet on Linux
+ *
+ * The simulator is attached to an SPIClass object using SPIClass::attachDevice() and watches the
+ * CS and RESET pins and drives the INT pin using the host board hooks in Particle.h. It decodes the W5500 SPI frames
+ * (16-bit address, control byte, variable length data) and models:
+ *
+ * - The common register block, including MR reset, SIR, SIMR, PHYCFGR (link always up) and VERSIONR
+ * - INTn, asserted (LOW) while an interrupt enabled by IMR, SIMR and Sn_IMR is set
+ * - The 8 socket register blocks, including Sn_CR commands, Sn_IR write-1-to-clear and the
+ * computed Sn_TX_FSR and Sn_RX_RSR
+ * - The TX and RX ring buffer memory of each socket, sized from Sn_TXBUF_SIZE and Sn_RXBUF_SIZE
+ *
+ * TCP and UDP sockets are bridged to real Linux sockets. The destination IP address and port are
+ * used as-is, so testing is normally done against a server on 127.0.0.1. A built-in DHCP server and
+ * DNS server (which resolves using the host resolver) answer packets sent to ports 67 and 53 so the
+ * DHCP and DNS paths of the library can be run without a network.
+ *
+ * SPI frames, bytes and transfer calls are counted so the cost of library changes can be measured.
+ */
+class W5500Sim : public SPIDevice {
+public:
+    /**
+     * @brief Options, passed to the constructor
+     */
+    struct Options {
+        pin_t pinCS = D5;                               //!< CS pin, must match the library configuration
+        pin_t pinRESET = D3;                            //!< RESET pin, or PIN_INVALID
+        pin_t pinINT = D4;                              //!< INT pin, or PIN_INVALID if not connected
+        bool dhcpServer = true;                         //!< Answer DHCP requests (UDP to port 67)
+        bool dnsServer = true;                          //!< Answer DNS requests (UDP to port 53) using getaddrinfo()
+        uint8_t dhcpAddress[4] = {127, 0, 0, 1};        //!< IP address handed out by the DHCP server
+        uint8_t dhcpSubnetMask[4] = {255, 0, 0, 0};     //!< Subnet mask handed out by the DHCP server
+        uint8_t dhcpGateway[4] = {127, 0, 0, 1};        //!< Gateway and DHCP server address
+        uint8_t dhcpDns[4] = {127, 0, 0, 1};            //!< DNS server handed out by the DHCP server
+        unsigned maxReliableClock = 0;                  //!< Corrupt some read data above this SPI clock in Hz, to test calibration. 0 = never.
+        unsigned udpSendDelayMs = 0;                    //!< Delay before Sn_IR_SENDOK for UDP sends, like ARP resolution of a new destination
+        unsigned tcpSendDelayUs = 0;                    //!< Minimum time from a TCP SEND to Sn_IR_SENDOK, like transmission and ACK time on a real link
+        unsigned keepAliveUnitMs = 5000;                //!< Time for each Sn_KPALVTR unit. After simulatePeerLoss(), a socket with keep-alive times out after Sn_KPALVTR units.
+    };
+
+    /**
+     * @brief SPI counters, returned by getStats()
+     */
+    struct Stats {
+        uint64_t frames;            //!< Number of CS low periods (W5500 SPI frames)
+        uint64_t transferCalls;     //!< Number of SPIClass transfer calls (each is a DMA setup on hardware)
+        uint64_t bytes;             //!< Total bytes clocked on the bus
+        uint64_t headerBytes;       //!< Address and control phase bytes
+        uint64_t readBytes;         //!< Data phase bytes read from the W5500
+        uint64_t writeBytes;        //!< Data phase bytes written to the W5500
+        uint64_t wireNanos;         //!< Time the bytes would take on the wire at the configured SPI clock
+        uint64_t commands;          //!< Number of Sn_CR commands executed
+        uint64_t portCollisions;    //!< TCP connects whose local port was in use, or whose 4-tuple was in TIME_WAIT
+    };
+
+    W5500Sim();
+    explicit W5500Sim(const Options &options);
+    virtual ~W5500Sim();
+
+    /**
+     * @brief Attaches to the SPI object and board hooks and starts the network thread
+     *
+     * @param spi The SPIClass the library is configured to use (default SPI)
+     */
+    void begin(SPIClass &spi = SPI);
+
+    /**
+     * @brief Gets a copy of the SPI counters
+     */
+    Stats getStats();
+
+    /**
+     * @brief Resets the SPI counters to 0
+     */
+    void resetStats();
+
+    /**
+     * @brief Makes the peer of a TCP connection stop responding, as if it lost power or its link
+     *
+     * @param sn Socket number
+     *
+     * Nothing more is received or sent. If Sn_KPALVTR is set, the socket times out (Sn_SR CLOSED, Sn_IR TIMEOUT) 
+     * after Sn_KPALVTR keepAliveUnitMs units. If a SEND is in progress, it times out after the RTR and RCR
+     * retransmissions. Otherwise it stays ESTABLISHED, like a half-open connection on the hardware.
+     */
+    void simulatePeerLoss(int sn);
+
+    /**
+     * @brief Reads a register without counting it as SPI traffic
+     *
+     * @param sn Socket number, or -1 for the common register block
+     *
+     * @param offset Register address in the block, for example 0x16 for Sn_TTL
+     */
+    uint8_t readRegister(int sn, uint16_t offset);
+
+    // SPIDevice
+    virtual void transfer(const uint8_t *tx, uint8_t *rx, size_t len) override;
+    virtual void setClock(unsigned clock) override;
+
+    static const int NUM_SOCKETS = 8;
+
+protected:
+    struct Socket {
+        uint8_t regs[0x30];
+        uint8_t txMem[16 * 1024];
+        uint8_t rxMem[16 * 1024];
+        int fd = -1;
+        int listenFd = -1;
+        bool sendPending = false;
+        uint16_t sendTarget = 0;
+        uint32_t sendStartUs = 0;                       //!< micros() when the TCP SEND was issued
+        uint8_t udpSendIr = 0;                          //!< Sn_IR flag to set at udpSendAt, 0 if none
+        system_tick_t udpSendAt = 0;
+        std::deque<std::vector<uint8_t>> injected;  //!< Datagrams from the built-in servers, waiting for RX space
+        bool peerLost = false;                          //!< simulatePeerLoss() was called
+        system_tick_t peerLostAt = 0;                   //!< millis() when simulatePeerLoss() was called
+    };
+
+    void chipReset();
+    void socketReset(int sn);
+
+    uint8_t readByte(uint8_t block, uint16_t addr);
+    void writeByte(uint8_t block, uint16_t addr, uint8_t value);
+
+    uint16_t getReg16(int sn, uint16_t offset) const;
+    void setReg16(int sn, uint16_t offset, uint16_t value);
+    uint16_t txSize(int sn) const;
+    uint16_t rxSize(int sn) const;
+    uint16_t txFree(int sn) const;
+    uint16_t rxReceived(int sn) const;
+
+    void command(int sn, uint8_t cmd);
+    void closeFds(int sn);
+    void applyIpOptions(int sn, int fd);
+    unsigned retransmissionTimeoutMs() const;
+    void sendUdp(int sn);
+    bool pumpSend(int sn);
+    bool rxAppend(int sn, const uint8_t *data, size_t len);
+    bool rxAppendDatagram(int sn, const uint8_t *ip, uint16_t port, const uint8_t *data, size_t len);
+
+    bool dhcpReply(int sn, const uint8_t *req, size_t len);
+    bool dnsReply(int sn, const uint8_t *req, size_t len);
+
+    void threadFunction();
+    void pump();
+
+    uint8_t sir() const;
+    void updateInt();
+
+    Options options;
+    std::mutex mutex;
+    std::thread *thread = nullptr;
+    bool stopThread = false;
+
+    uint8_t common[0x40];
+    Socket sockets[NUM_SOCKETS];
+
+    bool csLow = false;
+    std::atomic<bool> intLow{false};
+    std::function<void()> intHandler;
+    size_t headerCount = 0;
+    uint8_t header[3];
+    uint16_t frameAddr = 0;
+    uint8_t frameBlock = 0;
+    bool frameWrite = false;
+    uint32_t readCount = 0;
+
+    unsigned clock = 32 * MHZ;
+    Stats stats = {0};
+    uint8_t leasedAddress[4] = {0};
+};
+
+#endif /* __W5500SIM_H */
@@ -0,0 +1,1192 @@
+// Host-side benchmark for IsolatedEthernet using the W5500 simulator
+//
+// Run more-examples/test-server/app.js on the same machine, then run this. See README.md.
+
+#include "Particle.h"
+#include "IsolatedEthernet.h"
+#include "W5500Sim.h"
+
+#include <atomic>
+#include <getopt.h>
+
+static IPAddress serverAddr(127, 0, 0, 1);
+static uint16_t serverPort = 4550;
+static const uint16_t largeReceivePort = serverPort + 2; // 4552, server receives from us
+static const uint16_t largeSendPort = serverPort + 3; // 4553, server sends to us
+static const uint16_t echoPort = serverPort + 4; // 4554, server echoes what it receives
+static const size_t largeSize = 1024 * 1024;
+
+static W5500Sim *sim = nullptr;
+static int errorCount = 0;
+static size_t bulkBufferSize = 0; // withSocketBufferSize() for the bulk transfer tests, set by --buffers
+static unsigned readDelayMs = 0; // Time the tcp-recv test spends "busy" after each read, set by --read-delay
+static std::atomic<int> txQueueHighCount(0);
+static std::atomic<int> txQueueLowCount(0);
+static std::atomic<int> tcpConnectCount(0);
+static std::atomic<int> tcpPeerLostSock(-1);
+static std::atomic<int> tcpPeerLostResult(0);
+static IsolatedEthernet::TCPClient *stopOnConnectFail = nullptr; // Stopped from the tcpConnectComplete callback
+static std::atomic<int> stopOnConnectFailResult(0);
+static std::atomic<unsigned long> stopOnConnectFailMs(0);
+static std::atomic<bool> stopOnConnectFailWritten(false); // The main thread is done with the object
+
+struct Measurement {
+    const char *name;
+    system_tick_t startMs;
+    W5500Sim::Stats startStats;
+    IsolatedEthernet::BusSessionStats startBus;
+};
+
+static Measurement measureStart(const char *name)
+{
+    Measurement m;
+    m.name = name;
+    m.startMs = millis();
+    m.startStats = sim->getStats();
+    m.startBus = IsolatedEthernet::instance().getBusSessionStats();
+    IsolatedEthernet::instance().resetSpiStats();
+    return m;
+}
+
+static void measureEnd(const Measurement &m, size_t bytes)
+{
+    system_tick_t elapsed = millis() - m.startMs;
+    W5500Sim::Stats s = sim->getStats();
+    IsolatedEthernet::BusSessionStats b = IsolatedEthernet::instance().getBusSessionStats();
+
+    printf("%-10s %8lu ms", m.name, (unsigned long)elapsed);
+    if (bytes && elapsed)
+    {
+        printf(" %9.1f KB/s", (double)bytes / 1024.0 / ((double)elapsed / 1000.0));
+    }
+    printf("\n");
+    printf("           frames=%llu transfers=%llu bytes=%llu (header=%llu read=%llu write=%llu) commands=%llu wire=%.1f ms bus locks=%lu\n",
+        (unsigned long long)(s.frames - m.startStats.frames),
+        (unsigned long long)(s.transferCalls - m.startStats.transferCalls),
+        (unsigned long long)(s.bytes - m.startStats.bytes),
+        (unsigned long long)(s.headerBytes - m.startStats.headerBytes),
+        (unsigned long long)(s.readBytes - m.startStats.readBytes),
+        (unsigned long long)(s.writeBytes - m.startStats.writeBytes),
+        (unsigned long long)(s.commands - m.startStats.commands),
+        (double)(s.wireNanos - m.startStats.wireNanos) / 1000000.0,
+        (unsigned long)(b.lockCount - m.startBus.lockCount));
+
+    IsolatedEthernet::SpiStats spi = IsolatedEthernet::instance().getSpiStats();
+    auto printCounters = [](const char *name, const IsolatedEthernet::SpiCounters &c) {
+        printf(" %s=%lu/%lu", name, (unsigned long)c.transactions, (unsigned long)c.payloadBytes);
+    };
+    printf("           transactions/payload:");
+    printCounters("status", spi.statusPoll);
+    printCounters("tx", spi.txData);
+    printCounters("rx", spi.rxData);
+    printCounters("command", spi.command);
+    printCounters("config", spi.config);
+    printf("\n");
+}
+
+static void testTcpSend()
+{
+    IsolatedEthernet::TCPClient client;
+    client.withSocketBufferSize(bulkBufferSize, bulkBufferSize);
+    if (!client.connect(serverAddr, largeReceivePort))
+    {
+        printf("tcp-send: connect failed\n");
+        errorCount++;
+        return;
+    }
+
+    Measurement m = measureStart("tcp-send");
+
+    uint8_t buf[1024];
+    size_t offset = 0;
+    while(offset < largeSize)
+    {
+        for (size_t ii = 0; ii < sizeof(buf); ii++)
+        {
+            buf[ii] = (uint8_t)(offset + ii);
+        }
+        // SOCKET_WAIT_FOREVER, as TCPServer::write() uses, waits whenever the TX buffer is full
+        int count = client.write(buf, sizeof(buf), SOCKET_WAIT_FOREVER);
+        if (count != (int)sizeof(buf))
+        {
+            printf("tcp-send: write failed %d at offset %lu\n", count, (unsigned long)offset);
+            errorCount++;
+            break;
+        }
+        offset += sizeof(buf);
+    }
+    client.stop();
+
+    measureEnd(m, offset);
+}
+
+static void testTcpWriteFrom()
+{
+    // Same data as tcp-send, but generated straight into the W5500 TX buffer
+    IsolatedEthernet::TCPClient client;
+    client.withSocketBufferSize(bulkBufferSize, bulkBufferSize);
+    if (!client.connect(serverAddr, largeReceivePort))
+    {
+        printf("tcp-writefrom: connect failed\n");
+        errorCount++;
+        return;
+    }
+
+    Measurement m = measureStart("tcp-wfrom");
+
+    size_t offset = 0;
+    system_tick_t lastData = millis();
+    while(offset < largeSize && millis() - lastData < 10000)
+    {
+        int count = client.writeFrom([&](IsolatedEthernet::TCPClient::TxWriter &writer) {
+            uint8_t buf[256];
+            while(writer.available() && offset + writer.written() < largeSize)
+            {
+                size_t chunk = std::min(std::min(sizeof(buf), writer.available()), largeSize - offset - writer.written());
+                for (size_t ii = 0; ii < chunk; ii++)
+                {
+                    buf[ii] = (uint8_t)(offset + writer.written() + ii);
+                }
+                writer.write(buf, chunk);
+            }
+        });
+        if (count > 0)
+        {
+            offset += count;
+            lastData = millis();
+        }
+        else if (count < 0)
+        {
+            printf("tcp-writefrom: writeFrom failed %d at offset %lu\n", count, (unsigned long)offset);
+            errorCount++;
+            break;
+        }
+        else
+        {
+            delay(1);
+        }
+    }
+    client.stop();
+
+    measureEnd(m, offset);
+
+    // The bus is released while the producer runs, and the connection can be lost meanwhile. Nothing may be sent then.
+    IsolatedEthernet::TCPClient lost;
+    lost.withKeepAlive(1);
+    if (!lost.connect(serverAddr, echoPort))
+    {
+        printf("tcp-writefrom: connect failed\n");
+        errorCount++;
+        return;
+    }
+    int lostCount = lost.writeFrom([&](IsolatedEthernet::TCPClient::TxWriter &writer) {
+        sim->simulatePeerLoss(lost.socket());
+        delay(200);
+        writer.write('x');
+    });
+    lost.stop();
+
+    printf("tcp-writefrom: writeFrom after the connection was lost returned %d\n", lostCount);
+    if (lostCount >= 0)
+    {
+        errorCount++;
+    }
+}
+
+static void testTxQueueTcp(IsolatedEthernet::TxQueuePolicy policy)
+{
+    // BLOCK sends the verified 1 MB pattern to the receive port. DROP_OLDEST writes 100-byte samples as 
+    // fast as possible to the port that ignores what it receives, so the queue overflows.
+    bool block = (policy == IsolatedEthernet::TxQueuePolicy::BLOCK);
+    const char *name = block ? "tcp-queue" : "tcp-qdrop";
+    IsolatedEthernet::TCPClient client;
+    client.withTxQueue(block ? 8192 : 4096, policy);
+    if (!client.connect(serverAddr, block ? largeReceivePort : largeSendPort))
+    {
+        printf("%s: connect failed\n", name);
+        errorCount++;
+        return;
+    }
+
+    txQueueHighCount = txQueueLowCount = 0;
+    Measurement m = measureStart(name);
+
+    uint8_t buf[block ? 1024 : 100];
+    size_t total = block ? largeSize : 256 * 1024;
+    size_t offset = 0;
+    unsigned long maxWriteUs = 0;
+    while(offset < total)
+    {
+        for (size_t ii = 0; ii < sizeof(buf); ii++)
+        {
+            buf[ii] = (uint8_t)(offset + ii);
+        }
+        unsigned long startUs = micros();
+        int count = client.write(buf, sizeof(buf));
+        maxWriteUs = std::max(maxWriteUs, (unsigned long)(micros() - startUs));
+        if (count != (int)sizeof(buf))
+        {
+            printf("%s: write failed %d at offset %lu\n", name, count, (unsigned long)offset);
+            errorCount++;
+            break;
+        }
+        offset += sizeof(buf);
+    }
+    unsigned long queuedMs = millis() - m.startMs;
+    client.stop();
+
+    printf("%s: writes done in %lu ms, longest write %lu us, high/low callbacks %d/%d\n", name, 
+        queuedMs, maxWriteUs, txQueueHighCount.load(), txQueueLowCount.load());
+    measureEnd(m, offset);
+}
+
+static void testTxQueueUdp()
+{
+    // All of the requests are queued at once, then the responses are read
+    const int iterations = 20;
+    IsolatedEthernet::UDP udp;
+    udp.withTxQueue(1024);
+    udp.begin(serverPort + 10);
+
+    Measurement m = measureStart("udp-queue");
+
+    for (int ii = 0; ii < iterations; ii++)
+    {
+        const char *msg = "testing udp";
+        if (udp.sendPacket(msg, strlen(msg), serverAddr, serverPort) != (int)strlen(msg))
+        {
+            printf("udp-queue: sendPacket %d not queued\n", ii);
+            errorCount++;
+        }
+    }
+    unsigned long queuedMs = millis() - m.startMs;
+
+    int responses = 0;
+    char buf[128];
+    while(responses < iterations && udp.receivePacket(buf, sizeof(buf) - 1, 1000) > 0)
+    {
+        responses++;
+    }
+    udp.stop();
+
+    printf("udp-queue: queued in %lu ms\n", queuedMs);
+    if (responses != iterations)
+    {
+        printf("udp-queue: %d of %d responses\n", responses, iterations);
+        errorCount++;
+    }
+    measureEnd(m, 0);
+}
+
+static void testTcpConnect()
+{
+    // Several connections in progress at once, plus one to a port nothing listens on. The first one
+    // writes before it's connected, which withTxQueue() holds until the connection is made. The refused
+    // one also writes, and is stopped from the tcpConnectComplete callback.
+    // Up to four, leaving a socket for the refused one (the four-equal preset only has four sockets)
+    const int maxClients = 4;
+    int numClients = std::min(maxClients, IsolatedEthernet::instance().getSocketsFree() - 1);
+    if (numClients < 1)
+    {
+        printf("tcp-connect: skipped, %d sockets free\n", IsolatedEthernet::instance().getSocketsFree());
+        return;
+    }
+    IsolatedEthernet::TCPClient clients[maxClients];
+    IsolatedEthernet::TCPClient refused;
+    clients[0].withTxQueue(1024);
+    refused.withTxQueue(1024);
+
+    tcpConnectCount = 0;
+    Measurement m = measureStart("tcp-connect");
+
+    for (int ii = 0; ii < numClients; ii++)
+    {
+        if (!clients[ii].connectAsync(serverAddr, largeSendPort))
+        {
+            printf("tcp-connect: connectAsync %d failed\n", ii);
+            errorCount++;
+        }
+    }
+    stopOnConnectFailResult = 0;
+    stopOnConnectFailWritten = false;
+    stopOnConnectFail = &refused;
+    refused.connectAsync(serverAddr, serverPort + 9);
+
+    // Queued, or an error if the connection was already refused
+    const char *msg = "written while connecting";
+    refused.write((const uint8_t *)msg, strlen(msg));
+    stopOnConnectFailWritten = true;
+
+    if (clients[0].write((const uint8_t *)msg, strlen(msg)) != strlen(msg))
+    {
+        printf("tcp-connect: write while connecting failed\n");
+        errorCount++;
+    }
+    unsigned long startedMs = millis() - m.startMs;
+
+    int statuses[maxClients + 1];
+    unsigned long start = millis();
+    bool busy = true;
+    while(busy && millis() - start < 5000)
+    {
+        busy = false;
+        for (int ii = 0; ii <= numClients; ii++)
+        {
+            // The callback owns refused until it has stopped it
+            statuses[ii] = (ii < numClients) ? clients[ii].connectStatus() : 
+                (stopOnConnectFailResult ? stopOnConnectFailResult.load() : IsolatedEthernet::TCPClient::CONNECT_STATUS_BUSY);
+            if (statuses[ii] == IsolatedEthernet::TCPClient::CONNECT_STATUS_BUSY)
+            {
+                busy = true;
+            }
+        }
+        delay(1);
+    }
+
+    clients[0].flush();
+    size_t queued = clients[0].txQueued();
+
+    int ok = 0;
+    for (int ii = 0; ii < numClients; ii++)
+    {
+        if (statuses[ii] == IsolatedEthernet::TCPClient::CONNECT_STATUS_OK && clients[ii].status())
+        {
+            ok++;
+        }
+        clients[ii].stop();
+    }
+
+    stopOnConnectFail = nullptr;
+
+    printf("tcp-connect: started in %lu ms, %d of %d connected, refused result %d stopped in %lu ms, %d callbacks, %lu queued\n", 
+        startedMs, ok, numClients, statuses[numClients], stopOnConnectFailMs.load(), tcpConnectCount.load(), (unsigned long)queued);
+    if (ok != numClients || statuses[numClients] >= 0 || stopOnConnectFailMs > 100 || tcpConnectCount != numClients + 1 || queued != 0)
+    {
+        errorCount++;
+    }
+    measureEnd(m, 0);
+}
+
+static bool echoTransaction(IsolatedEthernet::TCPClient &client, int ii)
+{
+    char req[32];
+    snprintf(req, sizeof(req), "request %d\n", ii);
+    size_t len = strlen(req);
+    if (client.write((const uint8_t *)req, len) != len)
+    {
+        return false;
+    }
+
+    char resp[32];
+    size_t offset = 0;
+    unsigned long start = millis();
+    while(offset < len && millis() - start < 1000)
+    {
+        int count = client.read((uint8_t *)&resp[offset], len - offset);
+        if (count > 0)
+        {
+            offset += count;
+        }
+        else
+        {
+            delay(1);
+        }
+    }
+    return offset == len && memcmp(req, resp, len) == 0;
+}
+
+static void testTcpPool()
+{
+    // Request/response transactions with a new connection for each one, then using a TCPClientPool
+    const int iterations = 50;
+    int failed = 0;
+
+    Measurement m = measureStart("tcp-nopool");
+    for (int ii = 0; ii < iterations; ii++)
+    {
+        IsolatedEthernet::TCPClient client;
+        if (!client.connect(serverAddr, echoPort) || !echoTransaction(client, ii))
+        {
+            failed++;
+        }
+        client.stop();
+    }
+    measureEnd(m, 0);
+
+    IsolatedEthernet::TCPClientPool pool;
+    m = measureStart("tcp-pool");
+    for (int ii = 0; ii < iterations; ii++)
+    {
+        IsolatedEthernet::TCPClient client = pool.lease(serverAddr, echoPort);
+        if (!client.status() || !echoTransaction(client, ii))
+        {
+            failed++;
+        }
+        pool.release(client);
+    }
+    measureEnd(m, 0);
+    IsolatedEthernet::TCPClientPool::Stats stats = pool.getStats();
+    printf("tcp-pool: %d failed, %lu leases, %lu reused\n", failed, (unsigned long)stats.leases, (unsigned long)stats.reused);
+    if (failed || stats.leases != iterations || stats.reused != iterations - 1)
+    {
+        errorCount++;
+    }
+
+    // Hold several connections so they're all idle, then use every socket for UDP. The pool has to give
+    // its sockets back.
+    pool.withMaxIdleConnections(4);
+    IsolatedEthernet::TCPClient clients[3];
+    for (auto &client : clients)
+    {
+        client = pool.lease(serverAddr, echoPort);
+    }
+    for (auto &client : clients)
+    {
+        pool.release(client);
+    }
+    size_t idleBefore = pool.idleCount();
+    int freeBefore = IsolatedEthernet::instance().getSocketsFree();
+
+    IsolatedEthernet::UDP udp[8];
+    int opened = 0;
+    for (int ii = 0; ii < freeBefore + 2; ii++)
+    {
+        if (udp[ii].begin(serverPort + 20 + ii))
+        {
+            opened++;
+        }
+    }
+    for (auto &u : udp)
+    {
+        u.stop();
+    }
+    stats = pool.getStats();
+    printf("tcp-pool: %lu idle, %d free, opened %d UDP, %lu evicted, %lu idle\n", (unsigned long)idleBefore, freeBefore, 
+        opened, (unsigned long)stats.evicted, (unsigned long)pool.idleCount());
+    if (idleBefore != 3 || opened != freeBefore + 2 || stats.evicted != 2 || pool.idleCount() != 1)
+    {
+        errorCount++;
+    }
+
+    // Idle connections expire
+    pool.withMaxIdleTime(100);
+    delay(150);
+    pool.expire();
+    stats = pool.getStats();
+    if (pool.idleCount() != 0 || stats.expired != 1)
+    {
+        printf("tcp-pool: %lu idle, %lu expired after max idle time\n", (unsigned long)pool.idleCount(), (unsigned long)stats.expired);
+        errorCount++;
+    }
+}
+
+static void testPorts()
+{
+    // Rapid reconnects to the same server. Each connection is closed from this side, so the host keeps 
+    // its local port in TIME_WAIT, and connecting from the same local port again would collide.
+    const int iterations = 50;
+    int failed = 0;
+
+    Measurement m = measureStart("ports");
+    uint64_t collisionsBefore = sim->getStats().portCollisions;
+    for (int ii = 0; ii < iterations; ii++)
+    {
+        IsolatedEthernet::TCPClient client;
+        if (!client.connect(serverAddr, echoPort) || !echoTransaction(client, ii))
+        {
+            failed++;
+        }
+        client.stop();
+    }
+    uint64_t collisions = sim->getStats().portCollisions - collisionsBefore;
+    measureEnd(m, 0);
+
+    // The allocator in a small range: every port in range, and not the same port twice in a row
+    IsolatedEthernet::instance().withEphemeralPortRange(50000, 50099);
+    int outOfRange = 0, repeated = 0;
+    uint16_t prev = 0;
+    for (int ii = 0; ii < 1000; ii++)
+    {
+        uint16_t port = IsolatedEthernet::instance().allocEphemeralPort(7);
+        if (port < 50000 || port > 50099)
+        {
+            outOfRange++;
+        }
+        if (port == prev)
+        {
+            repeated++;
+        }
+        prev = port;
+    }
+    IsolatedEthernet::instance().withEphemeralPortRange(49152, 65535);
+
+    printf("ports: %d of %d reconnects failed, %lu port collisions, %d out of range, %d repeated\n", failed, iterations, 
+        (unsigned long)collisions, outOfRange, repeated);
+    if (failed || collisions || outOfRange || repeated)
+    {
+        errorCount++;
+    }
+}
+
+static void testKeepAlive()
+{
+    // Both peers stop responding. The connection with keep-alive is reported and released, the other one
+    // stays half-open. The simulator uses 20 ms keep-alive units instead of 5 seconds.
+    IsolatedEthernet::TCPClient alive;
+    IsolatedEthernet::TCPClient halfOpen;
+    alive.withKeepAlive(5);
+    if (!alive.connect(serverAddr, echoPort) || !halfOpen.connect(serverAddr, echoPort) ||
+        !echoTransaction(alive, 0) || !echoTransaction(halfOpen, 0))
+    {
+        printf("keepalive: connect failed\n");
+        errorCount++;
+        return;
+    }
+
+    int sock = alive.socket();
+    int freeBefore = IsolatedEthernet::instance().getSocketsFree();
+    tcpPeerLostSock = -1;
+    Measurement m = measureStart("keepalive");
+
+    sim->simulatePeerLoss(alive.socket());
+    sim->simulatePeerLoss(halfOpen.socket());
+
+    while(tcpPeerLostSock < 0 && millis() - m.startMs < 2000)
+    {
+        delay(1);
+    }
+    unsigned long lostMs = millis() - m.startMs;
+    bool aliveConnected = alive.connected();
+    int freeAfter = IsolatedEthernet::instance().getSocketsFree();
+    bool halfOpenConnected = halfOpen.connected();
+    measureEnd(m, 0);
+
+    printf("keepalive: peer lost sock %d (expected %d) result %d after %lu ms, connected %d, free %d -> %d, without keep-alive connected %d\n",
+        tcpPeerLostSock.load(), sock, tcpPeerLostResult.load(), lostMs, aliveConnected, freeBefore, freeAfter, halfOpenConnected);
+    if (tcpPeerLostSock != sock || tcpPeerLostResult != IsolatedEthernet::TCPClient::CONNECT_STATUS_TIMEOUT || 
+        aliveConnected || freeAfter != freeBefore + 1 || !halfOpenConnected)
+    {
+        errorCount++;
+    }
+    alive.stop();
+
+    // The peer of the half-open connection never acknowledges, so data held behind the SEND in flight can't
+    // go out. stop() gives up after TX_QUEUE_STOP_TIMEOUT_MS (5 s) instead of the 32 s retransmission timeout.
+    halfOpen.write('x');
+    halfOpen.write('y');
+    unsigned long stopStart = millis();
+    halfOpen.stop();
+    unsigned long stopMs = millis() - stopStart;
+
+    printf("keepalive: stop with data held took %lu ms\n", stopMs);
+    if (stopMs < 4900 || stopMs > 6000)
+    {
+        errorCount++;
+    }
+}
+
+static void testSocketOptions()
+{
+    // Per-socket options are in the socket registers while connected, and the next user of the socket gets the defaults
+    IsolatedEthernet::TCPClient tuned;
+    tuned.withMss(1400).withTtl(64).withTos(0xb8);
+    if (!tuned.connect(serverAddr, echoPort) || !echoTransaction(tuned, 0))
+    {
+        printf("socket-options: connect failed\n");
+        errorCount++;
+        return;
+    }
+    int sock = tuned.socket();
+    unsigned mss = (sim->readRegister(sock, 0x12) << 8) | sim->readRegister(sock, 0x13);
+    unsigned tos = sim->readRegister(sock, 0x15);
+    unsigned ttl = sim->readRegister(sock, 0x16);
+    tuned.stop();
+
+    IsolatedEthernet::TCPClient plain;
+    plain.connect(serverAddr, echoPort);
+    sock = plain.socket();
+    unsigned plainMss = (sim->readRegister(sock, 0x12) << 8) | sim->readRegister(sock, 0x13);
+    unsigned plainTos = sim->readRegister(sock, 0x15);
+    unsigned plainTtl = sim->readRegister(sock, 0x16);
+    plain.stop();
+
+    printf("socket-options: mss %u ttl %u tos 0x%02x, next connection mss %u ttl %u tos 0x%02x\n", 
+        mss, ttl, tos, plainMss, plainTtl, plainTos);
+    if (mss != 1400 || ttl != 64 || tos != 0xb8 || plainMss != 0 || plainTtl != 128 || plainTos != 0)
+    {
+        errorCount++;
+    }
+
+    // A DNS query on a socket last used for UDP with TTL 1 must go out with the default TTL
+    IsolatedEthernet::UDP udp;
+    udp.withTtl(1).begin(5000);
+    int udpSock = -1;
+    for (int sn = 0; sn < W5500Sim::NUM_SOCKETS; sn++)
+    {
+        if (sim->readRegister(sn, 0x16) == 1)
+        {
+            udpSock = sn;
+        }
+    }
+    udp.stop();
+    IsolatedEthernet::instance().resolve("localhost");
+    unsigned dnsTtl = (udpSock >= 0) ? sim->readRegister(udpSock, 0x16) : 0;
+
+    printf("socket-options: UDP TTL 1 on socket %d, TTL %u after DNS\n", udpSock, dnsTtl);
+    if (udpSock < 0 || dnsTtl != 128)
+    {
+        errorCount++;
+    }
+
+    // LAN timing: 10 ms first retransmission and 2 retries fail in 10 + 20 + 40 ms instead of 32 seconds
+    unsigned long defaultTimeoutMs = IsolatedEthernet::instance().getTcpTimeoutMs();
+    IsolatedEthernet::instance().withRetransmission(10, 2);
+    unsigned long lanTimeoutMs = IsolatedEthernet::instance().getTcpTimeoutMs();
+    unsigned rtr = (sim->readRegister(-1, 0x19) << 8) | sim->readRegister(-1, 0x1a);
+    unsigned rcr = sim->readRegister(-1, 0x1b);
+
+    IsolatedEthernet::TCPClient client;
+    unsigned long lostMs = 0;
+    bool connected = false;
+    if (client.connect(serverAddr, echoPort) && echoTransaction(client, 0))
+    {
+        Measurement m = measureStart("socket-options");
+        sim->simulatePeerLoss(client.socket());
+        client.write('x');
+        while(client.connected() && millis() - m.startMs < 2000)
+        {
+            delay(1);
+        }
+        lostMs = millis() - m.startMs;
+        connected = client.connected();
+        measureEnd(m, 0);
+    }
+    client.stop();
+    IsolatedEthernet::instance().withRetransmission(200, 8);
+
+    printf("socket-options: timeout %lu ms default, %lu ms with RTR %u RCR %u, peer lost detected after %lu ms, connected %d\n", 
+        defaultTimeoutMs, lanTimeoutMs, rtr, rcr, lostMs, connected);
+    if (defaultTimeoutMs != 32260 || lanTimeoutMs != 70 || rtr != 100 || rcr != 2 || lostMs < 70 || lostMs > 1000 || connected)
+    {
+        errorCount++;
+    }
+}
+
+static void testTcpReceive()
+{
+    IsolatedEthernet::TCPClient client;
+    client.withSocketBufferSize(bulkBufferSize, bulkBufferSize);
+    if (!client.connect(serverAddr, largeSendPort))
+    {
+        printf("tcp-recv: connect failed\n");
+        errorCount++;
+        return;
+    }
+
+    Measurement m = measureStart("tcp-recv");
+
+    uint8_t buf[1024];
+    size_t offset = 0;
+    size_t errors = 0;
+    system_tick_t lastData = millis();
+    while(offset < largeSize && millis() - lastData < 10000)
+    {
+        int count = client.read(buf, sizeof(buf));
+        if (count > 0)
+        {
+            for (int ii = 0; ii < count; ii++)
+            {
+                if (buf[ii] != (uint8_t)(offset + ii))
+                {
+                    errors++;
+                }
+            }
+            offset += count;
+            lastData = millis();
+            if (readDelayMs)
+            {
+                delay(readDelayMs);
+            }
+        }
+        else
+        {
+            delay(1);
+        }
+    }
+    client.stop();
+
+    if (offset != largeSize || errors)
+    {
+        printf("tcp-recv: received %lu bytes, %lu errors\n", (unsigned long)offset, (unsigned long)errors);
+        errorCount++;
+    }
+    measureEnd(m, offset);
+}
+
+static void testTcpPrint(bool coalesce)
+{
+    // Line-oriented output using print() and println(), which is three writes per line. This uses the
+    // large send port because it ignores what it receives; the data it sends is not read.
+    const int lines = 200;
+    IsolatedEthernet::TCPClient client;
+    if (coalesce)
+    {
+        client.withCoalescing();
+    }
+    if (!client.connect(serverAddr, largeSendPort))
+    {
+        printf("tcp-print: connect failed\n");
+        errorCount++;
+        return;
+    }
+
+    Measurement m = measureStart(coalesce ? "tcp-coal" : "tcp-print");
+
+    size_t bytes = 0;
+    for (int ii = 0; ii < lines; ii++)
+    {
+        bytes += client.print("testing! testCounter=");
+        bytes += client.println(String(ii));
+    }
+    client.flush();
+
+    measureEnd(m, bytes);
+    client.stop();
+}
+
+static void testUdp()
+{
+    const int iterations = 20;
+    IsolatedEthernet::UDP udp;
+    udp.begin(serverPort + 10);
+
+    Measurement m = measureStart("udp");
+
+    int responses = 0;
+    for (int ii = 0; ii < iterations; ii++)
+    {
+        const char *msg = "testing udp";
+        udp.sendPacket(msg, strlen(msg), serverAddr, serverPort);
+
+        char buf[128];
+        int count = udp.receivePacket(buf, sizeof(buf) - 1, 1000);
+        if (count > 0)
+        {
+            responses++;
+        }
+    }
+    udp.stop();
+
+    if (responses != iterations)
+    {
+        printf("udp: %d of %d responses\n", responses, iterations);
+        errorCount++;
+    }
+    measureEnd(m, 0);
+}
+
+static void testUdpFanout(bool async)
+{
+    // Sends one datagram to each of several destinations, like telemetry to a set of PLCs. Run with
+    // --udp-send-delay to simulate ARP resolution of each destination.
+    const int count = 4;
+    IsolatedEthernet::UDP udp[count];
+    for (int ii = 0; ii < count; ii++)
+    {
+        udp[ii].withAsyncSend(async);
+        udp[ii].begin(serverPort + 20 + ii);
+    }
+
+    Measurement m = measureStart(async ? "udp-async" : "udp-sync");
+
+    for (int ii = 0; ii < count; ii++)
+    {
+        const char *msg = "testing udp";
+        int res = udp[ii].sendPacket(msg, strlen(msg), serverAddr, serverPort);
+        if (res <= 0)
+        {
+            printf("%s: sendPacket %d returned %d\n", m.name, ii, res);
+            errorCount++;
+        }
+    }
+    system_tick_t queuedMs = millis() - m.startMs;
+
+    for (int ii = 0; ii < count; ii++)
+    {
+        udp[ii].flush();
+        if (udp[ii].sendStatus() != IsolatedEthernet::UDP::SEND_STATUS_OK)
+        {
+            printf("%s: send %d failed %d\n", m.name, ii, udp[ii].sendStatus());
+            errorCount++;
+        }
+    }
+    printf("%s: %d datagrams handed off in %lu ms\n", m.name, count, (unsigned long)queuedMs);
+    measureEnd(m, 0);
+
+    for (int ii = 0; ii < count; ii++)
+    {
+        udp[ii].stop();
+    }
+}
+
+static void testDns(const char *hostname)
+{
+    Measurement m = measureStart("dns");
+
+    IPAddress addr = IsolatedEthernet::instance().resolve(hostname);
+    if (!addr)
+    {
+        printf("dns: %s did not resolve\n", hostname);
+        errorCount++;
+    }
+    else
+    {
+        printf("dns: %s = %s\n", hostname, addr.toString().c_str());
+    }
+    measureEnd(m, 0);
+}
+
+static void testSockets(const char *hostname)
+{
+    // Use every free socket for UDP with one reserved for DNS, then make sure DNS still works
+    IsolatedEthernet::instance().withSocketReservation(IsolatedEthernet::SOCKET_SERVICE_DNS);
+
+    Measurement m = measureStart("sockets");
+
+    int freeBefore = IsolatedEthernet::instance().getSocketsFree();
+    IsolatedEthernet::UDP udp[8];
+    int opened = 0;
+    for (int ii = 0; ii < 8; ii++)
+    {
+        if (udp[ii].begin(serverPort + 20 + ii))
+        {
+            opened++;
+        }
+    }
+    int freeDuring = IsolatedEthernet::instance().getSocketsFree();
+
+    IPAddress addr = IsolatedEthernet::instance().resolve(hostname);
+
+    for (int ii = 0; ii < 8; ii++)
+    {
+        udp[ii].stop();
+    }
+    int freeAfter = IsolatedEthernet::instance().getSocketsFree();
+
+    printf("sockets: free=%d, opened %d UDP, free=%d, dns %s, free=%d\n", freeBefore, opened, freeDuring, 
+        addr ? "resolved" : "failed", freeAfter);
+    if (opened != freeBefore - 1 || freeDuring != 1 || !addr || freeAfter != freeBefore)
+    {
+        errorCount++;
+    }
+
+    IsolatedEthernet::instance().withSocketReservation(IsolatedEthernet::SOCKET_SERVICE_DNS, 0);
+    measureEnd(m, 0);
+}
+
+static void usage()
+{
+    printf("usage: host-sim [options] [tcp-send] [tcp-writefrom] [tcp-recv] [tcp-connect] [tcp-pool] [ports] [keepalive] [socket-options] [tcp-print] [udp] [udp-fanout] [tx-queue] [dns] [sockets]\n");
+    printf("  --server a.b.c.d   test-server address (default 127.0.0.1)\n");
+    printf("  --dhcp             get the address from the simulated DHCP server instead of static 127.0.0.1\n");
+    printf("  --clock mhz        SPI clock for wire time estimates (default 32)\n");
+    printf("  --sg bytes         withSpiScatterGather() maximum length, 0 to disable (default 256)\n");
+    printf("  --hostname name    name to resolve in the dns test (default localhost)\n");
+    printf("  --trace            enable trace logging\n");
+    printf("  --calibrate mhz    enable withSpiCalibration() with this maximum clock\n");
+    printf("  --sim-max-clock mhz  simulate board wiring that corrupts reads above this clock\n");
+    printf("  --udp-send-delay ms  simulate ARP resolution time for each UDP send\n");
+    printf("  --tcp-send-delay us  simulate the minimum time from a TCP SEND to SENDOK\n");
+    printf("  --buffers preset   withSocketBufferSizes() preset: eight-equal (default), four-equal, one-bulk\n");
+    printf("  --no-interrupts    withInterrupts(false), poll every millisecond instead of using the INT pin\n");
+    printf("  --rx-drain bytes   withRxDrain() ring buffer size, 0 to disable (default)\n");
+    printf("  --read-delay ms    Time the tcp-recv test is busy after each read\n");
+    printf("  --async-dma        withSpiAsyncDma(), wait for burst transfers on a completion callback\n");
+    printf("No tests selected runs all of them.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    bool dhcp = false;
+    unsigned clockMhz = 32;
+    long sgMaxLength = 256;
+    const char *hostname = "localhost";
+    unsigned calibrateMhz = 0;
+    W5500Sim::Options simOptions;
+    bool interrupts = true;
+    size_t rxDrainSize = 0;
+    bool asyncDma = false;
+    IsolatedEthernet::SocketBufferPreset bufferPreset = IsolatedEthernet::SocketBufferPreset::EIGHT_EQUAL;
+
+    static const option longOptions[] = {
+        {"server", required_argument, nullptr, 's'},
+        {"dhcp", no_argument, nullptr, 'd'},
+        {"clock", required_argument, nullptr, 'c'},
+        {"sg", required_argument, nullptr, 'g'},
+        {"hostname", required_argument, nullptr, 'n'},
+        {"trace", no_argument, nullptr, 't'},
+        {"calibrate", required_argument, nullptr, 'C'},
+        {"sim-max-clock", required_argument, nullptr, 'M'},
+        {"udp-send-delay", required_argument, nullptr, 'U'},
+        {"tcp-send-delay", required_argument, nullptr, 'T'},
+        {"buffers", required_argument, nullptr, 'B'},
+        {"no-interrupts", no_argument, nullptr, 'I'},
+        {"rx-drain", required_argument, nullptr, 'R'},
+        {"read-delay", required_argument, nullptr, 'D'},
+        {"async-dma", no_argument, nullptr, 'A'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    int opt;
+    while((opt = getopt_long(argc, argv, "h", longOptions, nullptr)) != -1)
+    {
+        switch(opt)
+        {
+            case 's':
+            {
+                unsigned a, b, c, d;
+                if (sscanf(optarg, "%u.%u.%u.%u", &a, &b, &c, &d) != 4)
+                {
+                    usage();
+                    return 1;
+                }
+                serverAddr = IPAddress(a, b, c, d);
+                break;
+            }
+            case 'd':
+                dhcp = true;
+                break;
+            case 'c':
+                clockMhz = (unsigned)atoi(optarg);
+                break;
+            case 'g':
+                sgMaxLength = atol(optarg);
+                break;
+            case 'n':
+                hostname = optarg;
+                break;
+            case 't':
+                particle_host::logLevel() = LOG_LEVEL_TRACE;
+                break;
+            case 'C':
+                calibrateMhz = (unsigned)atoi(optarg);
+                break;
+            case 'M':
+                simOptions.maxReliableClock = (unsigned)atoi(optarg) * MHZ;
+                break;
+            case 'U':
+                simOptions.udpSendDelayMs = (unsigned)atoi(optarg);
+                break;
+            case 'T':
+                simOptions.tcpSendDelayUs = (unsigned)atoi(optarg);
+                break;
+            case 'I':
+                interrupts = false;
+                break;
+            case 'R':
+                rxDrainSize = (size_t)atol(optarg);
+                break;
+            case 'D':
+                readDelayMs = (unsigned)atoi(optarg);
+                break;
+            case 'A':
+                asyncDma = true;
+                break;
+            case 'B':
+                if (strcmp(optarg, "eight-equal") == 0)
+                {
+                    bufferPreset = IsolatedEthernet::SocketBufferPreset::EIGHT_EQUAL;
+                    bulkBufferSize = 0;
+                }
+                else if (strcmp(optarg, "four-equal") == 0)
+                {
+                    bufferPreset = IsolatedEthernet::SocketBufferPreset::FOUR_EQUAL;
+                    bulkBufferSize = 4096;
+                }
+                else if (strcmp(optarg, "one-bulk") == 0)
+                {
+                    bufferPreset = IsolatedEthernet::SocketBufferPreset::ONE_BULK;
+                    bulkBufferSize = 8192;
+                }
+                else
+                {
+                    usage();
+                    return 1;
+                }
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    // Keep-alive in 20 ms units instead of 5 seconds, so the keepalive test runs quickly
+    simOptions.keepAliveUnitMs = 20;
+    sim = new W5500Sim(simOptions);
+    sim->begin(SPI);
+
+    Measurement m = measureStart("ready");
+
+    IsolatedEthernet::instance()
+        .withEthernetFeatherWing()
+        .withSpiSettings(SPISettings(clockMhz * MHZ, MSBFIRST, SPI_MODE0))
+        .withSpiScatterGather(sgMaxLength)
+        .withSocketBufferSizes(bufferPreset)
+        .withInterrupts(interrupts)
+        .withRxDrain(rxDrainSize)
+        .withSpiAsyncDma(asyncDma)
+        .withCallback([](IsolatedEthernet::CallbackType type, void *data) {
+            if (type == IsolatedEthernet::CallbackType::txQueueHigh)
+            {
+                txQueueHighCount++;
+            }
+            else if (type == IsolatedEthernet::CallbackType::txQueueLow)
+            {
+                txQueueLowCount++;
+            }
+            else if (type == IsolatedEthernet::CallbackType::tcpConnectComplete)
+            {
+                tcpConnectCount++;
+                IsolatedEthernet::TcpConnectResult *result = (IsolatedEthernet::TcpConnectResult *)data;
+                if (stopOnConnectFail && result->result < 0 && result->sock == stopOnConnectFail->socket())
+                {
+                    while(!stopOnConnectFailWritten)
+                    {
+                        delay(1);
+                    }
+
+                    // Must not wait for the queued data, which can't be sent
+                    unsigned long start = millis();
+                    stopOnConnectFail->stop();
+                    stopOnConnectFailMs = millis() - start;
+                    stopOnConnectFail = nullptr;
+                    stopOnConnectFailResult = result->result;
+                }
+            }
+            else if (type == IsolatedEthernet::CallbackType::tcpPeerLost)
+            {
+                tcpPeerLostResult = ((IsolatedEthernet::TcpPeerLost *)data)->result;
+                tcpPeerLostSock = ((IsolatedEthernet::TcpPeerLost *)data)->sock;
+            }
+        });
+
+    if (calibrateMhz)
+    {
+        IsolatedEthernet::instance().withSpiCalibration(calibrateMhz * MHZ);
+    }
+    if (dhcp)
+    {
+        IsolatedEthernet::instance().withDHCP();
+    }
+    else
+    {
+        IsolatedEthernet::instance()
+            .withIPAddress(IPAddress(127, 0, 0, 1))
+            .withSubnetMask(IPAddress(255, 0, 0, 0))
+            .withGatewayAddress(IPAddress(127, 0, 0, 1))
+            .withDNSAddress(IPAddress(127, 0, 0, 1));
+    }
+    IsolatedEthernet::instance().setup();
+
+    system_tick_t start = millis();
+    while(!IsolatedEthernet::instance().ready())
+    {
+        if (millis() - start > 30000)
+        {
+            printf("timed out waiting for ready\n");
+            return 1;
+        }
+        delay(10);
+    }
+    measureEnd(m, 0);
+
+    bool all = (optind >= argc);
+    auto selected = [&](const char *name) {
+        if (all)
+        {
+            return true;
+        }
+        for (int ii = optind; ii < argc; ii++)
+        {
+            if (strcmp(argv[ii], name) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    if (selected("tcp-send"))
+    {
+        testTcpSend();
+    }
+    if (selected("tcp-writefrom"))
+    {
+        testTcpWriteFrom();
+    }
+    if (selected("tcp-recv"))
+    {
+        testTcpReceive();
+    }
+    if (selected("tcp-connect"))
+    {
+        testTcpConnect();
+    }
+    if (selected("tcp-pool"))
+    {
+        testTcpPool();
+    }
+    if (selected("ports"))
+    {
+        testPorts();
+    }
+    if (selected("keepalive"))
+    {
+        testKeepAlive();
+    }
+    if (selected("socket-options"))
+    {
+        testSocketOptions();
+    }
+    if (selected("tcp-print"))
+    {
+        testTcpPrint(false);
+        testTcpPrint(true);
+    }
+    if (selected("udp"))
+    {
+        testUdp();
+    }
+    if (selected("udp-fanout"))
+    {
+        testUdpFanout(false);
+        testUdpFanout(true);
+    }
+    if (selected("tx-queue"))
+    {
+        testTxQueueTcp(IsolatedEthernet::TxQueuePolicy::BLOCK);
+        testTxQueueTcp(IsolatedEthernet::TxQueuePolicy::DROP_OLDEST);
+        testTxQueueUdp();
+    }
+    if (selected("dns"))
+    {
+        testDns(hostname);
+    }
+    if (selected("sockets"))
+    {
+        testSockets(hostname);
+    }
+
+    if (IsolatedEthernet::instance().hasSpiFault())
+    {
+        printf("SPI transfer failed\n");
+        errorCount++;
+    }
+
+    printf("%s, %d errors\n", errorCount ? "FAILED" : "passed", errorCount);
+
+    // The worker thread is detached and never exits, so don't run static destructors
+    fflush(stdout);
+    _exit(errorCount ? 1 : 0);
+}
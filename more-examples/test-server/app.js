@@ -14,6 +14,8 @@ const largeReceivePort = serverPort + 2; // 4552
 
 const largeSendPort = serverPort + 3; // 4553
 
+const echoPort = serverPort + 4; // 4554
+
 const showDebug = false;
 
 {
@@ -233,3 +235,29 @@ largeSendServer.on('connection', function(socket) {
 largeSendServer.listen(largeSendPort, function() {
     if (showDebug) console.log('largeSendServer listening on port ' + largeSendPort);
 });
+
+
+// Echoes what it receives and keeps the connection open, like a request/response protocol
+const echoServer = net.createServer();
+
+let lastEchoConnNum = 0;
+
+echoServer.on('connection', function(socket) {
+    const connNum = ++lastEchoConnNum;
+    let requests = 0;
+
+    socket.on('data', function(data) {
+        requests++;
+        socket.write(data);
+    });
+    socket.on('close', function(data) {
+        console.log('echoServer connection ' + connNum + ' closed after ' + requests + ' requests');
+    });
+    socket.on('error', function(err) {
+        console.log('echoServer connection ' + connNum  + ' error', err);
+    });
+});
+
+echoServer.listen(echoPort, function() {
+    if (showDebug) console.log('echoServer listening on port ' + echoPort);
+});
@@ -3,6 +3,8 @@
 // For POSIX filesystem used for the config file
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <mutex>
+#include <algorithm>
 
 // LwIP defines these, undefine them to avoid warnings. The WIZnet code itself does not
 // include Particle.h so these conflicts don't occur there.
@@ -16,6 +18,9 @@
 
 IsolatedEthernet *IsolatedEthernet::_instance;
 
+const char * const IsolatedEthernet::SOCKET_SERVICE_DHCP = "dhcp";
+const char * const IsolatedEthernet::SOCKET_SERVICE_DNS = "dns";
+
 // [static]
 IsolatedEthernet &IsolatedEthernet::instance()
 {
@@ -59,6 +64,11 @@ void IsolatedEthernet::setup()
 
     // We manually set the CS pin, so don't do it in SPI.begin()
     spi->begin(PIN_INVALID);
+
+    if (spiAsyncDma && !spiAsyncDmaQueue)
+    {
+        os_queue_create(&spiAsyncDmaQueue, sizeof(uint8_t), 1, NULL);
+    }
     if (!hwReset())
     {
         // TODO: Implement software reset here if there is no reset pin defined
@@ -108,18 +118,53 @@ void IsolatedEthernet::setup()
             instance().wizchip_spi_writeburst(pBuf, len);
         });
 
+    reg_wizchip_clock_cbfunc(
+        [](void)
+        {
+            return (uint32_t)micros();
+        });
+
+    if (spiSgMaxLength)
+    {
+        spiSgTxBuf = new uint8_t[spiSgMaxLength + 3];
+        spiSgRxBuf = new uint8_t[spiSgMaxLength + 3];
+    }
+    if (spiSgTxBuf && spiSgRxBuf)
+    {
+        reg_wizchip_spiburst_sg_cbfunc(
+            [](uint8_t *pHdr, uint16_t hdrLen, uint8_t *pBuf, uint16_t len)
+            {
+                return instance().wizchip_spi_readburst_sg(pHdr, hdrLen, pBuf, len);
+            },
+            [](uint8_t *pHdr, uint16_t hdrLen, uint8_t *pBuf, uint16_t len)
+            {
+                return instance().wizchip_spi_writeburst_sg(pHdr, hdrLen, pBuf, len);
+            });
+    }
+
+    if (spiCalibrationMaxClock)
+    {
+        spiCalibrate();
+    }
+
     // This can only be done after setting callbacks
     wizchip_sw_reset();
+    for (int sock = 0; sock < NUM_SOCKETS; sock++)
+    {
+        socketOptionsApplied[sock] = SocketOptions();
+    }
 
     {
-        // Initialize chip using default buffer sizes (2K per socket)
-        int8_t res = wizchip_init(NULL, NULL);
+        // Initialize chip using the withSocketBufferSizes() buffer sizes (default is 2K per socket)
+        int8_t res = wizchip_init(socketTxBufKB, socketRxBufKB);
         if (res != 0)
         {
             appLog.info("wizchip_init failed res=%d", (int)res);
         }
     }
 
+    applyRetransmission();
+
     {
         wiz_PhyConf phyConfSet = {0};
         wiz_PhyConf phyConf = {0};
@@ -168,6 +213,33 @@ void IsolatedEthernet::setup()
             });
     }
 
+    if (pinINT != PIN_INVALID && interruptsEnabled)
+    {
+        os_queue_create(&interruptQueue, sizeof(uint8_t), 1, NULL);
+        os_queue_create(&anyEventQueue, sizeof(uint8_t), 1, NULL);
+        for (int sock = 0; sock < NUM_SOCKETS; sock++)
+        {
+            os_queue_create(&socketEventQueue[sock], sizeof(uint8_t), 1, NULL);
+        }
+
+        {
+            BusSession session;
+
+            // Interrupt on socket events only. The common interrupts (IP conflict, unreachable, PPPoE, magic packet)
+            // are not used.
+            setIMR(0);
+            for (int sock = 0; sock < NUM_SOCKETS; sock++)
+            {
+                setSn_IMR(sock, (Sn_IR_SENDOK | Sn_IR_TIMEOUT | Sn_IR_RECV | Sn_IR_DISCON | Sn_IR_CON));
+            }
+            setSIMR(0xff);
+        }
+
+        // INT is active low and stays asserted until the interrupt bits are cleared in serviceInterrupts()
+        attachInterrupt(pinINT, interruptHandlerStatic, FALLING);
+        interruptsActive = true;
+    }
+
     setupDone = true;
 
     if (jsonConfigFile.length()) {
@@ -185,7 +257,8 @@ void IsolatedEthernet::stateMachine()
     static unsigned long lastDhcpCheck = 0;
     static unsigned long lastDnsCheck = 0;
 
-    bool curPhyLink = (wizphy_getphylink() == PHY_LINK_ON);
+    // After an SPI failure the W5500 registers can't be trusted, so the link stays down until reset
+    bool curPhyLink = !spiFault && (wizphy_getphylink() == PHY_LINK_ON);
     if (curPhyLink != phyLink)
     {
         if (curPhyLink)
@@ -224,10 +297,13 @@ void IsolatedEthernet::stateMachine()
             {
                 dhcpBuffer = new uint8_t[548]; // RIP_MSG_SIZE, this isn't exported for some reason
             }
-            int dhcpSocket = socketGetFree();
+            int dhcpSocket = socketAlloc(SocketOwner::DHCP, SOCKET_SERVICE_DHCP);
             if (dhcpSocket >= 0)
             {
+                // Not the TTL, TOS or MSS left by the previous user of the socket
+                applySocketOptions(dhcpSocket, SocketOptions());
                 DHCP_init((uint8_t)dhcpSocket, dhcpBuffer);
+                this->dhcpSocket = dhcpSocket;
                 dhcpState = DhcpState::IN_PROGRESS;
             }
             else {
@@ -261,6 +337,8 @@ void IsolatedEthernet::stateMachine()
     case DhcpState::CLEANUP_DISABLE:
     case DhcpState::CLEANUP:
         DHCP_stop();
+        socketRelease(dhcpSocket, true);
+        dhcpSocket = -1;
         delete[] dhcpBuffer;
         dhcpBuffer = NULL;
         if (dhcpState == DhcpState::CLEANUP_DISABLE) {
@@ -299,6 +377,14 @@ bool IsolatedEthernet::hwReset()
         delay(1);
         digitalWrite(pinRESET, HIGH);
         delay(1);
+
+        // Registers are back to their defaults, so the driver's shadow copies are stale
+        wizchip_shadow_invalidate();
+        for (int sock = 0; sock < NUM_SOCKETS; sock++)
+        {
+            invalidateSocketStatus(sock);
+            socketOptionsApplied[sock] = SocketOptions();
+        }
         return true;
     }
     else
@@ -322,9 +408,10 @@ int IsolatedEthernet::inet_gethostbyname(const char *hostname, uint16_t hostname
         }
     }
 
-    int dnsSocket = socketGetFree();
+    int dnsSocket = socketAlloc(SocketOwner::DNS, SOCKET_SERVICE_DNS);
     if (dnsSocket >= 0)
     {
+        applySocketOptions(dnsSocket, SocketOptions());
         DNS_init((uint8_t)dnsSocket, dnsBuffer);
 
         uint8_t ipAddr[4];
@@ -342,6 +429,8 @@ int IsolatedEthernet::inet_gethostbyname(const char *hostname, uint16_t hostname
             appLog.trace("dns error %s %d", hostname, res);
             res = -1;
         }
+        // DNS_run() closes the socket when done
+        socketRelease(dnsSocket, true);
     }
     else
     {
@@ -350,6 +439,7 @@ int IsolatedEthernet::inet_gethostbyname(const char *hostname, uint16_t hostname
     }
 
     delete[] dnsBuffer;
+    dnsBuffer = NULL;
 
     return res;
 }
@@ -473,7 +563,7 @@ bool IsolatedEthernet::saveConfigFile()
     if (fd != -1) {
         size_t len = strlen(buf);
 
-        appLog.trace("saving config len=%d: %s", len, buf);
+        appLog.trace("saving config len=%d: %s", (int)len, buf);
         int res = write(fd, buf, len);
         if (res != (int)len) {
             appLog.error("writing config failed %d", res);
@@ -547,227 +637,2123 @@ void IsolatedEthernet::callCallbacks(CallbackType type, void *data)
     }
 }
 
-int IsolatedEthernet::socketGetFree()
+IsolatedEthernet &IsolatedEthernet::withSocketBufferSizes(const uint8_t txKB[8], const uint8_t rxKB[8])
 {
-    for (uint8_t ii = 0; ii < NUM_SOCKETS; ii++)
-    {
-        uint8_t status;
-        wiznet::getsockopt(ii, wiznet::SO_STATUS, &status);
-        if (status == SOCK_CLOSED)
+    auto valid = [](const uint8_t *sizes) {
+        int total = 0;
+        for (uint8_t ii = 0; ii < NUM_SOCKETS; ii++)
         {
-            return (int)ii;
+            if (sizes[ii] > 16 || (sizes[ii] & (sizes[ii] - 1)) != 0)
+            {
+                return false;
+            }
+            total += sizes[ii];
         }
-    }
+        return total <= 16;
+    };
 
-    return -1; // No free sockets
-}
+    if (valid(txKB) && valid(rxKB))
+    {
+        memcpy(socketTxBufKB, txKB, sizeof(socketTxBufKB));
+        memcpy(socketRxBufKB, rxKB, sizeof(socketRxBufKB));
+    }
+    else
+    {
+        appLog.error("withSocketBufferSizes invalid sizes, using defaults");
+        memset(socketTxBufKB, 2, sizeof(socketTxBufKB));
+        memset(socketRxBufKB, 2, sizeof(socketRxBufKB));
+    }
 
-void IsolatedEthernet::beginTransaction()
-{
-    spi->beginTransaction(spiSettings);
-    if (pinCS != PIN_INVALID)
+    // socketAlloc() tries the sockets with the smallest buffers first (stable, so equal sizes go in socket order)
+    for (uint8_t ii = 0; ii < NUM_SOCKETS; ii++)
     {
-        pinResetFast(pinCS);
+        socketOrder[ii] = ii;
     }
+    std::stable_sort(socketOrder, socketOrder + NUM_SOCKETS, [this](uint8_t a, uint8_t b) {
+        return (socketTxBufKB[a] + socketRxBufKB[a]) < (socketTxBufKB[b] + socketRxBufKB[b]);
+    });
+    return *this;
 }
 
-void IsolatedEthernet::endTransaction()
+IsolatedEthernet &IsolatedEthernet::withSocketBufferSizes(SocketBufferPreset preset)
 {
-    if (pinCS != PIN_INVALID)
+    static const uint8_t eightEqual[8] = {2, 2, 2, 2, 2, 2, 2, 2};
+    static const uint8_t fourEqual[8] = {4, 4, 4, 4, 0, 0, 0, 0};
+    static const uint8_t oneBulk[8] = {8, 1, 1, 1, 1, 1, 1, 1};
+
+    switch(preset)
     {
-        pinSetFast(pinCS);
+        case SocketBufferPreset::FOUR_EQUAL:
+            return withSocketBufferSizes(fourEqual, fourEqual);
+
+        case SocketBufferPreset::ONE_BULK:
+            return withSocketBufferSizes(oneBulk, oneBulk);
+
+        case SocketBufferPreset::EIGHT_EQUAL:
+        default:
+            return withSocketBufferSizes(eightEqual, eightEqual);
     }
-    spi->endTransaction();
 }
 
-void IsolatedEthernet::wizchip_cris_enter(void)
+size_t IsolatedEthernet::getSocketTxBufferSize(int sock) const
 {
-    spi->beginTransaction(spiSettings);
+    return (sock >= 0 && sock < NUM_SOCKETS) ? (size_t)socketTxBufKB[sock] * 1024 : 0;
 }
 
-void IsolatedEthernet::wizchip_cris_exit(void)
+size_t IsolatedEthernet::getSocketRxBufferSize(int sock) const
 {
-    spi->endTransaction();
+    return (sock >= 0 && sock < NUM_SOCKETS) ? (size_t)socketRxBufKB[sock] * 1024 : 0;
 }
 
-void IsolatedEthernet::wizchip_cs_select(void)
+IsolatedEthernet &IsolatedEthernet::withSocketReservation(const char *service, uint8_t count)
 {
-    if (pinCS != PIN_INVALID)
+    if (!service || strlen(service) >= sizeof(SocketReservation::service))
     {
-        pinResetFast(pinCS);
+        appLog.error("withSocketReservation service name too long");
+        return *this;
     }
-}
 
-void IsolatedEthernet::wizchip_cs_deselect(void)
-{
-    if (pinCS != PIN_INVALID)
+    std::lock_guard<Mutex> lock(socketTableMutex);
+
+    for (uint8_t ii = 0; ii < socketReservationCount; ii++)
     {
-        pinSetFast(pinCS);
+        if (strcmp(socketReservations[ii].service, service) == 0)
+        {
+            socketReservations[ii].count = count;
+            return *this;
+        }
+    }
+    if (socketReservationCount < NUM_SOCKETS)
+    {
+        SocketReservation &res = socketReservations[socketReservationCount++];
+        strcpy(res.service, service);
+        res.count = count;
+    }
+    else
+    {
+        appLog.error("withSocketReservation too many services");
     }
+    return *this;
 }
 
-uint8_t IsolatedEthernet::wizchip_spi_readbyte(void)
+IsolatedEthernet &IsolatedEthernet::withEphemeralPortRange(uint16_t first, uint16_t last)
 {
-    return spi->transfer(0xff);
+    if (first == 0 || last < first)
+    {
+        appLog.error("withEphemeralPortRange invalid range %u-%u", (unsigned)first, (unsigned)last);
+        return *this;
+    }
+
+    std::lock_guard<Mutex> lock(ephemeralPortMutex);
+    ephemeralPortFirst = first;
+    ephemeralPortLast = last;
+    ephemeralPortPrev = 0;
+    return *this;
 }
 
-void IsolatedEthernet::wizchip_spi_writebyte(uint8_t wb)
+uint16_t IsolatedEthernet::allocEphemeralPort(int sock)
 {
-    spi->transfer(wb);
+    std::lock_guard<Mutex> lock(socketTableMutex);
+    return allocEphemeralPortLocked(sock);
 }
 
-void IsolatedEthernet::wizchip_spi_readburst(uint8_t *pBuf, uint16_t len)
+uint16_t IsolatedEthernet::allocEphemeralPortLocked(int sock)
 {
-    spi->transfer(NULL, pBuf, len, NULL);
+    // socketTable is read below, so socketTableMutex is locked first
+    std::lock_guard<Mutex> lock(ephemeralPortMutex);
+
+    uint32_t range = (uint32_t)ephemeralPortLast - ephemeralPortFirst + 1;
+    uint32_t offset;
+    if (ephemeralPortPrev < ephemeralPortFirst || ephemeralPortPrev > ephemeralPortLast)
+    {
+        // Random starting point, so ports are not reused across restarts
+        offset = HAL_RNG_GetRandomNumber() % range;
+    }
+    else
+    {
+        offset = ephemeralPortPrev - ephemeralPortFirst;
+    }
+
+    // A random step keeps the ports rotating through the whole range, so a port comes up again only after
+    // about range / 8 connections, while not being predictable. Retries skip ports other sockets are using.
+    uint16_t port = 0;
+    for (int tries = 0; tries <= NUM_SOCKETS; tries++)
+    {
+        offset = (offset + 1 + HAL_RNG_GetRandomNumber() % EPHEMERAL_PORT_MAX_STEP) % range;
+        port = (uint16_t)(ephemeralPortFirst + offset);
+
+        bool inUse = false;
+        for (int ii = 0; ii < NUM_SOCKETS; ii++)
+        {
+            if (ii != sock && ephemeralPorts[ii] == port && socketTable[ii].owner != SocketOwner::FREE)
+            {
+                inUse = true;
+                break;
+            }
+        }
+        if (!inUse)
+        {
+            break;
+        }
+    }
+
+    ephemeralPortPrev = port;
+    if (sock >= 0 && sock < NUM_SOCKETS)
+    {
+        ephemeralPorts[sock] = port;
+    }
+    return port;
 }
 
-void IsolatedEthernet::wizchip_spi_writeburst(uint8_t *pBuf, uint16_t len)
+IsolatedEthernet::SocketOwner IsolatedEthernet::getSocketOwner(int sock) const
 {
-    spi->transfer(pBuf, NULL, len, NULL);
+    return (sock >= 0 && sock < NUM_SOCKETS) ? socketTable[sock].owner : SocketOwner::FREE;
 }
 
-os_thread_return_t IsolatedEthernet::threadFunction()
+int IsolatedEthernet::getSocketsFree() const
 {
-    while (true)
+    int count = 0;
+    for (uint8_t ii = 0; ii < NUM_SOCKETS; ii++)
     {
-        if (setupDone) {
-            stateMachine();
+        if ((socketTable[ii].owner == SocketOwner::FREE || socketTable[ii].owner == SocketOwner::CLOSING) &&
+            socketTxBufKB[ii] != 0 && socketRxBufKB[ii] != 0)
+        {
+            count++;
         }
-        delay(1);
     }
+    return count;
 }
 
-// [static]
-os_thread_return_t IsolatedEthernet::threadFunctionStatic(void *param)
+int IsolatedEthernet::socketAlloc(SocketOwner owner, const char *service, size_t minTxSize, size_t minRxSize)
 {
-    ((IsolatedEthernet *)param)->threadFunction();
+    int sock = socketAllocOnce(owner, service, minTxSize, minRxSize);
+    while(sock < 0 && clientPoolEvict())
+    {
+        sock = socketAllocOnce(owner, service, minTxSize, minRxSize);
+    }
+    return sock;
 }
 
-
-void IsolatedEthernet::setMacAddress() 
+bool IsolatedEthernet::clientPoolEvict()
 {
-#if HAL_PLATFORM_NRF52840
-    const uint32_t lsb = __builtin_bswap32(NRF_FICR->DEVICEADDR[0]);
-    const uint32_t msb = NRF_FICR->DEVICEADDR[1] & 0xffff;
-    memcpy(macAddr + 2, &lsb, sizeof(lsb));
-    macAddr[0] = msb >> 8;
-    macAddr[1] = msb;
-    // Drop 'multicast' bit
-    macAddr[0] &= 0b11111110;
-    // Set 'locally administered' bit
-    macAddr[0] |= 0b10;
-#elif HAL_PLATFORM_RTL872X
-    #define HAL_DEVICE_MAC_ETHERNET         3
-    WiFi.macAddress(macAddr);
-    macAddr[5] += HAL_DEVICE_MAC_ETHERNET;
-#error "Unsupported platform" // temporary, as the P2 support is not currently working
-#else
-#error "Unsupported platform"
-#endif
-
-    appLog.trace("mac %02x:%02x:%02x:%02x:%02x:%02x", macAddr[0], macAddr[1], macAddr[2], macAddr[3], macAddr[4], macAddr[5]);
-
+    std::lock_guard<Mutex> lock(clientPoolsMutex);
+    for (auto pool : clientPools)
+    {
+        if (pool->evictOldest())
+        {
+            appLog.trace("closed idle pool connection to free a socket");
+            return true;
+        }
+    }
+    return false;
 }
 
-
-extern "C" void wizchip_debug(const char *fmt, ...)
+int IsolatedEthernet::socketAllocOnce(SocketOwner owner, const char *service, size_t minTxSize, size_t minRxSize)
 {
-    va_list ap;
-    char fmt2[100];
-    char buf[100];
+    std::lock_guard<Mutex> lock(socketTableMutex);
 
-    const char *src = fmt;
-    char *dst = fmt2;
-    char *dstEnd = &fmt2[sizeof(fmt2) - 1];
-    while (*src && dst < dstEnd)
+    int reservation = -1;
+    if (service)
     {
-        if (*src != '\r' && *src != '\n')
+        for (uint8_t ii = 0; ii < socketReservationCount; ii++)
         {
-            *dst++ = *src++;
+            if (strcmp(socketReservations[ii].service, service) == 0)
+            {
+                reservation = ii;
+                break;
+            }
         }
-        else
+    }
+
+    // Free sockets that must be left for other services' reservations
+    int held = 0;
+    uint8_t inUse[NUM_SOCKETS] = {0};
+    for (uint8_t ii = 0; ii < NUM_SOCKETS; ii++)
+    {
+        if (socketTable[ii].reservation >= 0)
         {
-            src++;
+            inUse[socketTable[ii].reservation]++;
         }
     }
-    *dst = 0;
+    for (uint8_t ii = 0; ii < socketReservationCount; ii++)
+    {
+        if ((int)ii != reservation && socketReservations[ii].count > inUse[ii])
+        {
+            held += socketReservations[ii].count - inUse[ii];
+        }
+    }
+    if (getSocketsFree() <= held)
+    {
+        return -1;
+    }
 
-    va_start(ap, fmt);
-    vsnprintf(buf, sizeof(buf), fmt2, ap);
-    va_end(ap);
+    // socketOrder has the sockets with the smallest buffers first
+    for (uint8_t jj = 0; jj < NUM_SOCKETS; jj++)
+    {
+        uint8_t ii = socketOrder[jj];
+        SocketEntry &entry = socketTable[ii];
+        if ((entry.owner != SocketOwner::FREE && entry.owner != SocketOwner::CLOSING) ||
+            socketTxBufKB[ii] == 0 || socketRxBufKB[ii] == 0 || 
+            getSocketTxBufferSize(ii) < minTxSize || getSocketRxBufferSize(ii) < minRxSize)
+        {
+            continue;
+        }
 
-    IsolatedEthernet::instance().appLog.trace("%s", buf);
-}
+        if (entry.owner == SocketOwner::CLOSING)
+        {
+            // Released while the connection was still closing, only the W5500 knows if it's done yet
+            SocketStatus status;
+            if (!getSocketStatus(ii, status) || status.sr != SOCK_CLOSED)
+            {
+                continue;
+            }
+        }
 
-extern "C" void wizchip_yield()
-{
-    delay(1);
-}
+        entry.owner = owner;
+        entry.reservation = (int8_t)reservation;
 
-//
-// TCPClient
-//
+        // Chosen now because socket() calls wizchip_ephemeral_port() with the bus locked
+        allocEphemeralPortLocked(ii);
+        if (owner == SocketOwner::TCP_CLIENT || owner == SocketOwner::TCP_SERVER || owner == SocketOwner::UDP)
+        {
+            rxRingOpen(ii);
+        }
+        return (int)ii;
+    }
 
-bool IsolatedEthernet::TCPClient::isOpen(sock_handle_t sd)
-{
-    uint8_t status;
-    wiznet::getsockopt((uint8_t)sd, wiznet::SO_STATUS, &status);
-    return status == SOCK_ESTABLISHED;
+    return -1; // No free sockets
 }
 
-IsolatedEthernet::TCPClient::TCPClient() : TCPClient(-1)
+void IsolatedEthernet::socketRelease(int sock, bool closed)
 {
+    if (sock < 0 || sock >= NUM_SOCKETS)
+    {
+        return;
+    }
+    rxRingClose(sock);
+    txQueueClose(sock);
+    connectCancel(sock);
+    peerWatch(sock, false);
+
+    std::lock_guard<Mutex> lock(socketTableMutex);
+    socketTable[sock].owner = closed ? SocketOwner::FREE : SocketOwner::CLOSING;
+    socketTable[sock].reservation = -1;
 }
 
-IsolatedEthernet::TCPClient::TCPClient(sock_handle_t sock) :
-        d_(std::make_shared<Data>(sock))
+void IsolatedEthernet::socketSetOwner(int sock, SocketOwner owner)
 {
-    flush_buffer();
+    if (sock < 0 || sock >= NUM_SOCKETS)
+    {
+        return;
+    }
+    std::lock_guard<Mutex> lock(socketTableMutex);
+    socketTable[sock].owner = owner;
 }
 
-
-// return 0 on error, 1 on success
-int IsolatedEthernet::TCPClient::connect(const char *host, uint16_t port, network_interface_t nif)
+void IsolatedEthernet::rxRingOpen(int sock)
 {
-    stop();
-    if (IsolatedEthernet::instance().ready())
+    if (!rxDrainSize || sock < 0 || sock >= NUM_SOCKETS)
     {
-        HAL_IPAddress halIpAddress;
-        if (IsolatedEthernet::instance().inet_gethostbyname(host, strlen(host), &halIpAddress, 0, NULL) == 0)
-        {
-            IPAddress ip_addr(halIpAddress);
-            return connect(ip_addr, port, nif);
-        }
-        else
+        return;
+    }
+
+    RxRing &ring = rxRings[sock];
+    if (!ring.buf)
+    {
+        ring.buf = new uint8_t[rxDrainSize];
+        if (!ring.buf)
         {
-            IsolatedEthernet::instance().appLog.trace("unable to get IP for hostname");
+            appLog.error("withRxDrain could not allocate %u bytes, socket %d not drained", (unsigned) rxDrainSize, sock);
+            return;
         }
     }
 
-    return 0; // error, could not connect
+    // The worker only touches the ring while holding the bus
+    BusSession session;
+    ring.head = ring.tail = 0;
+    ring.count = 0;
+    rxDrainStalled &= ~(1 << sock);
+    rxDrainMask |= (1 << sock);
 }
 
-// return 0 on error, 1 on success
-int IsolatedEthernet::TCPClient::connect(IPAddress ip, uint16_t port, network_interface_t nif)
+void IsolatedEthernet::rxRingClose(int sock)
 {
-    stop();
+    if (!rxRingActive(sock))
+    {
+        return;
+    }
 
-    IsolatedEthernet::instance().appLog.trace("TCPClient connect(%s %d)", ip.toString().c_str(), (int)port);                
+    BusSession session;
+    rxDrainMask &= ~(1 << sock);
+    rxDrainStalled &= ~(1 << sock);
+    rxRings[sock].count = 0;
+}
 
-    int connected = 0;
-    if (IsolatedEthernet::instance().ready())
+void IsolatedEthernet::rxRingCopy(const RxRing &ring, size_t offset, uint8_t *buffer, size_t size) const
+{
+    offset %= rxDrainSize;
+    size_t first = std::min(size, rxDrainSize - offset);
+    memcpy(buffer, &ring.buf[offset], first);
+    if (size > first)
     {
-        int sock = IsolatedEthernet::instance().socketGetFree();
-        if (sock >= 0) {
-            IsolatedEthernet::instance().appLog.trace("TCPClient using socket=%d", sock);
+        memcpy(buffer + first, ring.buf, size - first);
+    }
+}
 
-            int8_t res = wiznet::socket((uint8_t) sock, Sn_MR_TCP, port, 0);
-            if (res >= 0) {
-                d_->sock = sock;
-                // IsolatedEthernet::instance().appLog.trace("TCPClient socket() success");
+size_t IsolatedEthernet::rxRingRead(int sock, uint8_t *buffer, size_t size)
+{
+    if (!rxRingActive(sock))
+    {
+        return 0;
+    }
+
+    RxRing &ring = rxRings[sock];
+    size_t n = std::min(size, ring.count.load());
+    if (n)
+    {
+        rxRingCopy(ring, ring.tail, buffer, n);
+        ring.tail = (ring.tail + n) % rxDrainSize;
+        ring.count -= n;
+
+        if ((rxDrainStalled & (1 << sock)) && interruptsActive)
+        {
+            // There's data in the W5500 that didn't fit, and there is room for it now
+            uint8_t dummy = 0;
+            os_queue_put(interruptQueue, &dummy, 0, NULL);
+        }
+    }
+    return n;
+}
+
+int IsolatedEthernet::rxRingReadDatagram(int sock, uint8_t *buffer, size_t size, uint8_t *addr, uint16_t *port)
+{
+    if (!rxRingActive(sock))
+    {
+        return -1;
+    }
+
+    RxRing &ring = rxRings[sock];
+    if (ring.count.load() < 8)
+    {
+        return -1;
+    }
+
+    // Same header as the W5500 puts in the socket RX buffer
+    uint8_t head[8];
+    rxRingCopy(ring, ring.tail, head, sizeof(head));
+    memcpy(addr, head, 4);
+    *port = (head[4] << 8) | head[5];
+    size_t len = (head[6] << 8) | head[7];
+
+    size_t n = std::min(size, len);
+    rxRingCopy(ring, ring.tail + 8, buffer, n);
+    ring.tail = (ring.tail + 8 + len) % rxDrainSize;
+    ring.count -= 8 + len;
+
+    if ((rxDrainStalled & (1 << sock)) && interruptsActive)
+    {
+        uint8_t dummy = 0;
+        os_queue_put(interruptQueue, &dummy, 0, NULL);
+    }
+    return (int)n;
+}
+
+void IsolatedEthernet::rxDrain(uint8_t sockMask)
+{
+    for (int sock = 0; sock < NUM_SOCKETS; sock++)
+    {
+        if (!(sockMask & rxDrainMask & (1 << sock)))
+        {
+            continue;
+        }
+
+        BusSession session;
+        if (!(rxDrainMask & (1 << sock)))
+        {
+            continue; // Closed while waiting for the bus
+        }
+
+        wiz_SockRegs regs;
+        getSn_REGS((uint8_t)sock, &regs);
+        uint16_t rsr = getSn_REGS_RX_RSR(&regs);
+        if (rsr == 0)
+        {
+            rxDrainStalled &= ~(1 << sock);
+            continue;
+        }
+
+        RxRing &ring = rxRings[sock];
+        uint16_t ptr = getSn_REGS_RX_RD(&regs);
+        size_t space = rxDrainSize - ring.count.load();
+        size_t head = ring.head;
+        uint16_t consumed = 0;  // Bytes read from the W5500, including discarded datagrams
+        size_t stored = 0;      // Bytes added to the ring
+        bool full = false;
+
+        // Reads len bytes at ptr in the W5500 into the ring at head, in two parts if it wraps around
+        auto copyIn = [&](uint16_t ptr, size_t len) {
+            size_t first = std::min(len, rxDrainSize - head);
+            wiz_recv_data_at((uint8_t)sock, ptr, &ring.buf[head], (uint16_t)first);
+            if (len > first)
+            {
+                wiz_recv_data_at((uint8_t)sock, (uint16_t)(ptr + first), ring.buf, (uint16_t)(len - first));
+            }
+            head = (head + len) % rxDrainSize;
+        };
+
+        uint8_t mode = getSn_REGS_MR(&regs) & 0x0f;
+        if (mode == Sn_MR_TCP)
+        {
+            uint8_t sr = getSn_REGS_SR(&regs);
+            if (sr == SOCK_ESTABLISHED || sr == SOCK_CLOSE_WAIT)
+            {
+                consumed = (uint16_t)std::min((size_t)rsr, space);
+                copyIn(ptr, consumed);
+                stored = consumed;
+                full = (consumed < rsr);
+            }
+        }
+        else if (mode == Sn_MR_UDP)
+        {
+            // Sn_RX_RSR only counts complete datagrams, each with an 8-byte header
+            while (consumed + 8 <= rsr)
+            {
+                uint8_t udpHead[8];
+                wiz_recv_data_at((uint8_t)sock, (uint16_t)(ptr + consumed), udpHead, sizeof(udpHead));
+                size_t len = (udpHead[6] << 8) | udpHead[7];
+
+                if (8 + len > rxDrainSize)
+                {
+                    appLog.trace("sock %d discarded %u byte datagram larger than withRxDrain", sock, (unsigned) len);
+                    consumed += 8 + len;
+                    continue;
+                }
+                if (8 + len > space)
+                {
+                    full = true;
+                    break;
+                }
+
+                size_t first = std::min((size_t)8, rxDrainSize - head);
+                memcpy(&ring.buf[head], udpHead, first);
+                memcpy(ring.buf, udpHead + first, 8 - first);
+                head = (head + 8) % rxDrainSize;
+                copyIn((uint16_t)(ptr + consumed + 8), len);
+
+                consumed += 8 + len;
+                stored += 8 + len;
+                space -= 8 + len;
+            }
+        }
+
+        if (consumed)
+        {
+            setSn_RX_RD((uint8_t)sock, (uint16_t)(ptr + consumed));
+            setSn_CR((uint8_t)sock, Sn_CR_RECV);
+            while(getSn_CR((uint8_t)sock));
+
+            ring.head = head;
+            ring.count += stored;
+        }
+
+        if (full)
+        {
+            rxDrainStalled |= (1 << sock);
+        }
+        else
+        {
+            rxDrainStalled &= ~(1 << sock);
+        }
+    }
+}
+
+bool IsolatedEthernet::txQueueOpen(int sock, bool udp, size_t size, TxQueuePolicy policy, size_t high, size_t low)
+{
+    if (sock < 0 || sock >= NUM_SOCKETS)
+    {
+        return false;
+    }
+    txQueueClose(sock);
+
+    uint8_t *buf = new uint8_t[size];
+    if (!buf)
+    {
+        appLog.error("withTxQueue could not allocate %u bytes", (unsigned) size);
+        return false;
+    }
+
+    std::lock_guard<Mutex> lock(txQueueMutex);
+    TxQueue &q = txQueues[sock];
+    q = TxQueue();
+    q.buf = buf;
+    q.size = size;
+    q.udp = udp;
+    q.policy = policy;
+    q.high = high ? std::min(high, size) : (size * 3 / 4);
+    q.low = low ? std::min(low, q.high) : (size / 4);
+    txQueueMask |= (1 << sock);
+    return true;
+}
+
+void IsolatedEthernet::txQueueClose(int sock)
+{
+    if (!txQueueActive(sock))
+    {
+        return;
+    }
+
+    // Waits for the worker thread to finish copying from the buffer
+    std::lock_guard<Mutex> sendLock(txQueueSendMutex);
+    std::lock_guard<Mutex> lock(txQueueMutex);
+    txQueueMask &= ~(1 << sock);
+    delete[] txQueues[sock].buf;
+    txQueues[sock] = TxQueue();
+}
+
+size_t IsolatedEthernet::txQueued(int sock)
+{
+    if (!txQueueActive(sock))
+    {
+        return 0;
+    }
+    std::lock_guard<Mutex> lock(txQueueMutex);
+    return txQueues[sock].count + txQueues[sock].sending;
+}
+
+size_t IsolatedEthernet::txQueueSpace(int sock)
+{
+    if (!txQueueActive(sock))
+    {
+        return 0;
+    }
+    std::lock_guard<Mutex> lock(txQueueMutex);
+    const TxQueue &q = txQueues[sock];
+    return q.size - q.count - q.sending;
+}
+
+int IsolatedEthernet::txQueueWrite(int sock, const uint8_t *buffer, size_t size, system_tick_t timeout)
+{
+    size_t written = 0;
+    unsigned long start = millis();
+
+    while(written < size)
+    {
+        TxQueueEvent event = {sock, 0, 0};
+        bool high = false;
+        bool wake = false;
+        {
+            std::lock_guard<Mutex> lock(txQueueMutex);
+            if (!txQueueActive(sock))
+            {
+                break;
+            }
+            TxQueue &q = txQueues[sock];
+            if (q.error)
+            {
+                return q.error;
+            }
+
+            const uint8_t *src = buffer + written;
+            size_t len = size - written;
+            size_t space = q.size - q.count - q.sending;
+            if (len > space)
+            {
+                if (q.policy == TxQueuePolicy::FAIL)
+                {
+                    break;
+                }
+                if (q.policy == TxQueuePolicy::DROP_OLDEST)
+                {
+                    // Keep the newest data: the end of this write, and as much of the queue as fits with it.
+                    // Bytes the worker thread is copying to the W5500 can't be dropped.
+                    size_t avail = q.size - q.sending;
+                    if (len > avail)
+                    {
+                        q.dropped += len - avail;
+                        src += len - avail;
+                        written += len - avail;
+                        len = avail;
+                    }
+                    size_t drop = len - space;
+                    q.tail = (q.tail + drop) % q.size;
+                    q.count -= drop;
+                    q.dropped += drop;
+                }
+                else
+                {
+                    len = space;
+                }
+            }
+
+            if (len)
+            {
+                wake = (q.count == 0);
+                size_t first = std::min(len, q.size - q.head);
+                memcpy(&q.buf[q.head], src, first);
+                memcpy(q.buf, src + first, len - first);
+                q.head = (q.head + len) % q.size;
+                q.count += len;
+                written += len;
+
+                if (!q.aboveHigh && q.count + q.sending >= q.high)
+                {
+                    q.aboveHigh = high = true;
+                    event.queued = q.count + q.sending;
+                    event.dropped = q.dropped;
+                }
+            }
+        }
+
+        if (wake && interruptsActive)
+        {
+            uint8_t dummy = 0;
+            os_queue_put(interruptQueue, &dummy, 0, NULL);
+        }
+        if (high)
+        {
+            txQueueNotify(CallbackType::txQueueHigh, event);
+        }
+
+        if (written < size)
+        {
+            // BLOCK policy and the queue is full
+            unsigned long elapsed = millis() - start;
+            if (elapsed >= timeout)
+            {
+                break;
+            }
+            waitSocketEvent(sock, timeout - elapsed);
+        }
+    }
+    return (int)written;
+}
+
+int IsolatedEthernet::txQueueWriteDatagram(int sock, const uint8_t *buffer, size_t size, const uint8_t *addr, uint16_t port, system_tick_t timeout)
+{
+    unsigned long start = millis();
+
+    while(true)
+    {
+        TxQueueEvent event = {sock, 0, 0};
+        bool high = false;
+        bool wake = false;
+        bool queued = false;
+        {
+            std::lock_guard<Mutex> lock(txQueueMutex);
+            if (!txQueueActive(sock))
+            {
+                return SOCKERR_SOCKNUM;
+            }
+            TxQueue &q = txQueues[sock];
+            size_t need = 8 + size;
+            if (size >= TX_QUEUE_SKIP || need > q.size)
+            {
+                return SOCKERR_DATALEN;
+            }
+
+            if (q.count == 0 && q.sending == 0)
+            {
+                q.head = q.tail = 0;
+            }
+
+            // Datagrams are not split, so space at the end of the buffer may have to be skipped
+            size_t skip = (q.head + need > q.size) ? (q.size - q.head) : 0;
+            while(q.policy == TxQueuePolicy::DROP_OLDEST && q.size - q.count - q.sending < skip + need && q.count)
+            {
+                int len = txQueueNextDatagram(q);
+                if (len >= 0)
+                {
+                    q.tail = (q.tail + 8 + len) % q.size;
+                    q.count -= 8 + len;
+                    q.dropped++;
+                }
+                if (q.count == 0 && q.sending == 0)
+                {
+                    q.head = q.tail = 0;
+                    skip = 0;
+                }
+            }
+
+            if (q.size - q.count - q.sending >= skip + need)
+            {
+                wake = (q.count == 0);
+                if (skip)
+                {
+                    if (skip >= 8)
+                    {
+                        q.buf[q.head + 6] = (uint8_t)(TX_QUEUE_SKIP >> 8);
+                        q.buf[q.head + 7] = (uint8_t)TX_QUEUE_SKIP;
+                    }
+                    q.count += skip;
+                    q.head = 0;
+                }
+
+                uint8_t *rec = &q.buf[q.head];
+                memcpy(rec, addr, 4);
+                rec[4] = (uint8_t)(port >> 8);
+                rec[5] = (uint8_t)port;
+                rec[6] = (uint8_t)(size >> 8);
+                rec[7] = (uint8_t)size;
+                memcpy(rec + 8, buffer, size);
+
+                q.head = (q.head + need) % q.size;
+                q.count += need;
+                queued = true;
+
+                if (!q.aboveHigh && q.count + q.sending >= q.high)
+                {
+                    q.aboveHigh = high = true;
+                    event.queued = q.count + q.sending;
+                    event.dropped = q.dropped;
+                }
+            }
+            else if (q.policy == TxQueuePolicy::FAIL)
+            {
+                return 0;
+            }
+        }
+
+        if (wake && interruptsActive)
+        {
+            uint8_t dummy = 0;
+            os_queue_put(interruptQueue, &dummy, 0, NULL);
+        }
+        if (high)
+        {
+            txQueueNotify(CallbackType::txQueueHigh, event);
+        }
+        if (queued)
+        {
+            return (int)size;
+        }
+
+        // BLOCK policy and the queue is full, or DROP_OLDEST and the rest is being sent
+        unsigned long elapsed = millis() - start;
+        if (elapsed >= timeout)
+        {
+            return 0;
+        }
+        waitSocketEvent(sock, timeout - elapsed);
+    }
+}
+
+int IsolatedEthernet::txQueueNextDatagram(TxQueue &q)
+{
+    while(q.count)
+    {
+        size_t skip = q.size - q.tail;
+        if (skip >= 8)
+        {
+            const uint8_t *rec = &q.buf[q.tail];
+            uint16_t len = (rec[6] << 8) | rec[7];
+            if (len != TX_QUEUE_SKIP)
+            {
+                return len;
+            }
+        }
+        // Skipped space at the end of the buffer, the next datagram is at the start
+        q.count -= skip;
+        q.tail = 0;
+    }
+    return -1;
+}
+
+bool IsolatedEthernet::txQueueFinish(int sock, system_tick_t timeout, bool discard)
+{
+    unsigned long start = millis();
+
+    // The worker thread would be waiting for itself
+    bool canWait = (os_thread_current(NULL) != workerThread);
+
+    while(canWait && txQueued(sock))
+    {
+        SocketStatus status;
+        if (!getSocketStatus(sock, status) || (status.sr != SOCK_ESTABLISHED && status.sr != SOCK_CLOSE_WAIT))
+        {
+            break;
+        }
+        unsigned long elapsed = millis() - start;
+        if (elapsed >= timeout)
+        {
+            break;
+        }
+        waitSocketEvent(sock, timeout - elapsed);
+    }
+
+    if (discard)
+    {
+        txQueueDiscard(sock);
+    }
+    return txQueued(sock) == 0;
+}
+
+void IsolatedEthernet::txQueueDiscard(int sock, int error)
+{
+    if (!txQueueActive(sock))
+    {
+        return;
+    }
+
+    std::lock_guard<Mutex> lock(txQueueMutex);
+    TxQueue &q = txQueues[sock];
+    if (q.count)
+    {
+        appLog.trace("sock %d discarding %u queued bytes", sock, (unsigned) q.count);
+    }
+    q.head = q.tail;
+    q.count = 0;
+    if (error)
+    {
+        q.error = error;
+    }
+    if (q.sending == 0)
+    {
+        q.head = q.tail = 0;
+    }
+}
+
+uint8_t IsolatedEthernet::txQueuePoll()
+{
+    uint8_t progress = 0;
+    TxQueueEvent lowEvents[NUM_SOCKETS];
+    uint8_t lowMask = 0;
+
+    if (!txQueueMask)
+    {
+        return 0;
+    }
+
+    // txQueueMutex is only held for the bookkeeping, so writers don't wait for SPI transfers. The data being
+    // copied is counted in q.sending instead of q.count, so writers don't overwrite or drop it.
+    std::lock_guard<Mutex> sendLock(txQueueSendMutex);
+
+    for (int sock = 0; sock < NUM_SOCKETS; sock++)
+    {
+        TxQueue &q = txQueues[sock];
+        if (!(txQueueMask & (1 << sock)) || q.count == 0 || (connectPending & (1 << sock)))
+        {
+            // Data written while connecting stays queued until connected
+            continue;
+        }
+
+        if (q.udp)
+        {
+            // One datagram at a time, as in UDP::withAsyncSend() mode. udpSendPoll() already ran this pass.
+            while(!(udpSendPending & (1 << sock)))
+            {
+                uint8_t *rec;
+                int len;
+                {
+                    std::lock_guard<Mutex> lock(txQueueMutex);
+                    if ((len = txQueueNextDatagram(q)) < 0)
+                    {
+                        break;
+                    }
+                    rec = &q.buf[q.tail];
+                    q.tail = (q.tail + 8 + len) % q.size;
+                    q.count -= 8 + len;
+                    q.sending = 8 + len;
+                }
+
+                // The previous datagram is done, so the TX buffer is empty and this doesn't return SOCK_BUSY
+                uint16_t port = (rec[4] << 8) | rec[5];
+                int result = wiznet::sendto((uint8_t)sock, rec + 8, (uint16_t)len, rec, port);
+                if (result > 0)
+                {
+                    udpSendBegin(sock);
+                }
+                else
+                {
+                    appLog.trace("sock %d queued datagram sendto failed %d", sock, result);
+                }
+
+                std::lock_guard<Mutex> lock(txQueueMutex);
+                q.sending = 0;
+                progress |= (1 << sock);
+            }
+        }
+        else
+        {
+            BusSession session;
+
+            uint16_t ptr;
+            int32_t space = wiznet::send_reserve((uint8_t)sock, &ptr);
+
+            size_t tail, n = 0;
+            {
+                std::lock_guard<Mutex> lock(txQueueMutex);
+                if (space < 0)
+                {
+                    // The connection is gone; writes return the error from now on
+                    q.error = (int)space;
+                    q.head = q.tail = q.count = 0;
+                }
+                else
+                {
+                    n = std::min(q.count, (size_t)space);
+                    tail = q.tail;
+                    q.tail = (q.tail + n) % q.size;
+                    q.count -= n;
+                    q.sending = n;
+                }
+            }
+            if (n)
+            {
+                size_t first = std::min(n, q.size - tail);
+                wiz_write_tx((uint8_t)sock, ptr, &q.buf[tail], (uint16_t)first);
+                if (n > first)
+                {
+                    wiz_write_tx((uint8_t)sock, (uint16_t)(ptr + first), q.buf, (uint16_t)(n - first));
+                }
+                wiznet::send_commit((uint8_t)sock, ptr, (uint16_t)n);
+
+                // Corked or coalescing: send once there's a full segment, like TCPClient::write()
+                if (wiznet::send_pending((uint8_t)sock) >= 1460)
+                {
+                    wiznet::send_flush((uint8_t)sock);
+                }
+
+                std::lock_guard<Mutex> lock(txQueueMutex);
+                q.sending = 0;
+                progress |= (1 << sock);
+            }
+        }
+
+        if (progress & (1 << sock))
+        {
+            std::lock_guard<Mutex> lock(txQueueMutex);
+            if (q.aboveHigh && q.count <= q.low)
+            {
+                q.aboveHigh = false;
+                lowEvents[sock] = {sock, q.count, q.dropped};
+                lowMask |= (1 << sock);
+            }
+        }
+    }
+
+    for (int sock = 0; lowMask && sock < NUM_SOCKETS; sock++)
+    {
+        if (lowMask & (1 << sock))
+        {
+            txQueueNotify(CallbackType::txQueueLow, lowEvents[sock]);
+        }
+    }
+    return progress;
+}
+
+void IsolatedEthernet::txQueueNotify(CallbackType type, const TxQueueEvent &event)
+{
+    TxQueueEvent copy = event;
+    callCallbacks(type, &copy);
+}
+
+IsolatedEthernet::SpiStats IsolatedEthernet::getSpiStats() const
+{
+    wiz_SpiStats wizStats;
+    wizchip_spi_stats_get(&wizStats);
+
+    auto copy = [](SpiCounters &dst, const wiz_SpiCounters &src) {
+        dst.transactions = src.transactions;
+        dst.headerBytes = src.headerBytes;
+        dst.payloadBytes = src.payloadBytes;
+        dst.csMicros = src.csMicros;
+    };
+
+    SpiStats stats;
+    copy(stats.total, wizStats.total);
+    copy(stats.common, wizStats.common);
+    for (size_t ii = 0; ii < arraySize(stats.socket); ii++)
+    {
+        copy(stats.socket[ii], wizStats.sock[ii]);
+    }
+    copy(stats.statusPoll, wizStats.category[WIZ_SPI_CAT_STATUS]);
+    copy(stats.txData, wizStats.category[WIZ_SPI_CAT_TX_DATA]);
+    copy(stats.rxData, wizStats.category[WIZ_SPI_CAT_RX_DATA]);
+    copy(stats.command, wizStats.category[WIZ_SPI_CAT_COMMAND]);
+    copy(stats.config, wizStats.category[WIZ_SPI_CAT_CONFIG]);
+    return stats;
+}
+
+void IsolatedEthernet::resetSpiStats()
+{
+    wizchip_spi_stats_reset();
+}
+
+bool IsolatedEthernet::getSocketStatus(int sock, SocketStatus &status, bool fresh)
+{
+    if (sock < 0 || sock >= NUM_SOCKETS)
+    {
+        return false;
+    }
+
+    if (!fresh && statusSnapshotIntervalMs)
+    {
+        std::lock_guard<Mutex> lock(statusSnapshotMutex);
+        if ((statusSnapshotValid & (1 << sock)) != 0 && (millis() - statusSnapshot[sock].timestamp) <= statusSnapshotMaxAgeMs())
+        {
+            status = statusSnapshot[sock];
+            return true;
+        }
+    }
+
+    BusSession session;
+    readSocketStatus(sock, getSIR(), status);
+    return true;
+}
+
+void IsolatedEthernet::invalidateSocketStatus(int sock)
+{
+    if (sock < 0 || sock >= NUM_SOCKETS)
+    {
+        return;
+    }
+
+    std::lock_guard<Mutex> lock(statusSnapshotMutex);
+    statusSnapshotValid &= ~(1 << sock);
+    statusSnapshotGen[sock]++;
+}
+
+void IsolatedEthernet::readSocketStatus(int sock, uint8_t sir, SocketStatus &status)
+{
+    uint8_t gen;
+    {
+        std::lock_guard<Mutex> lock(statusSnapshotMutex);
+        gen = statusSnapshotGen[sock];
+    }
+
+    // The snapshot mutex is not held during SPI access; another thread may hold the bus and want the mutex
+    wiz_SockRegs regs;
+    getSn_REGS((uint8_t)sock, &regs);
+
+    status.sr = getSn_REGS_SR(&regs);
+    status.ir = getSn_REGS_IR(&regs);
+    status.rxRsr = getSn_REGS_RX_RSR(&regs);
+    status.txFsr = getSn_REGS_TX_FSR(&regs);
+    status.sir = sir;
+    status.timestamp = millis();
+
+    std::lock_guard<Mutex> lock(statusSnapshotMutex);
+    if (gen == statusSnapshotGen[sock])
+    {
+        statusSnapshot[sock] = status;
+        statusSnapshotValid |= (1 << sock);
+    }
+}
+
+void IsolatedEthernet::takeStatusSnapshot()
+{
+    BusSession session;
+
+    uint8_t sir = getSIR();
+    bool readClosed = (statusSnapshotCount++ % STATUS_SNAPSHOT_CLOSED_EVERY) == 0;
+
+    for (int sock = 0; sock < NUM_SOCKETS; sock++)
+    {
+        {
+            std::lock_guard<Mutex> lock(statusSnapshotMutex);
+            if (!readClosed && (statusSnapshotValid & (1 << sock)) != 0 && statusSnapshot[sock].sr == SOCK_CLOSED)
+            {
+                // Still closed as far as we know, keep the entry current without reading it
+                statusSnapshot[sock].sir = sir;
+                statusSnapshot[sock].timestamp = millis();
+                continue;
+            }
+        }
+
+        SocketStatus status;
+        readSocketStatus(sock, sir, status);
+    }
+}
+
+void IsolatedEthernet::coalesceSet(int sock, uint16_t idleMs)
+{
+    if (sock < 0 || sock >= NUM_SOCKETS)
+    {
+        return;
+    }
+
+    std::lock_guard<Mutex> lock(coalesceMutex);
+    coalesceIdleMs[sock] = idleMs;
+    coalesceLastWrite[sock] = millis();
+    if (idleMs)
+    {
+        if (!coalesceMask && interruptsActive)
+        {
+            // The worker may be waiting up to INTERRUPT_POLL_MS; it needs to check the idle time every millisecond now
+            uint8_t dummy = 0;
+            os_queue_put(interruptQueue, &dummy, 0, NULL);
+        }
+        coalesceMask |= (1 << sock);
+    }
+    else
+    {
+        coalesceMask &= ~(1 << sock);
+    }
+}
+
+void IsolatedEthernet::coalesceTouch(int sock)
+{
+    if (sock < 0 || sock >= NUM_SOCKETS)
+    {
+        return;
+    }
+
+    std::lock_guard<Mutex> lock(coalesceMutex);
+    coalesceLastWrite[sock] = millis();
+}
+
+void IsolatedEthernet::coalesceCheck()
+{
+    uint8_t idle = 0;
+    {
+        std::lock_guard<Mutex> lock(coalesceMutex);
+        for (int sock = 0; coalesceMask && sock < NUM_SOCKETS; sock++)
+        {
+            if ((coalesceMask & (1 << sock)) && millis() - coalesceLastWrite[sock] >= coalesceIdleMs[sock])
+            {
+                idle |= (1 << sock);
+            }
+        }
+    }
+
+    for (int sock = 0; idle && sock < NUM_SOCKETS; sock++)
+    {
+        if ((idle & (1 << sock)) && wiznet::send_pending(sock))
+        {
+            wiznet::send_flush(sock);
+        }
+    }
+}
+
+void IsolatedEthernet::udpSendBegin(int sock)
+{
+    if (sock < 0 || sock >= NUM_SOCKETS)
+    {
+        return;
+    }
+
+    std::lock_guard<Mutex> lock(udpSendMutex);
+    udpSendPending |= (1 << sock);
+    udpSendError[sock] = 0;
+}
+
+void IsolatedEthernet::udpSendCancel(int sock)
+{
+    if (sock < 0 || sock >= NUM_SOCKETS)
+    {
+        return;
+    }
+
+    std::lock_guard<Mutex> lock(udpSendMutex);
+    udpSendPending &= ~(1 << sock);
+    udpSendError[sock] = 0;
+}
+
+int IsolatedEthernet::udpSendPoll(int sock)
+{
+    if (sock < 0 || sock >= NUM_SOCKETS)
+    {
+        return SOCKERR_SOCKNUM;
+    }
+
+    UdpSendResult data;
+    {
+        std::lock_guard<Mutex> lock(udpSendMutex);
+        if ((udpSendPending & (1 << sock)) == 0)
+        {
+            return udpSendError[sock] ? udpSendError[sock] : SOCK_OK;
+        }
+
+        int res = wiznet::sendto_status((uint8_t)sock);
+        if (res == SOCK_BUSY)
+        {
+            return SOCK_BUSY;
+        }
+        udpSendPending &= ~(1 << sock);
+        udpSendError[sock] = (res == SOCK_OK) ? 0 : (int8_t)res;
+
+        data.sock = sock;
+        data.result = res;
+    }
+
+    // Not holding udpSendMutex so the callback can send the next datagram
+    callCallbacks(CallbackType::udpSendComplete, &data);
+    return data.result;
+}
+
+void IsolatedEthernet::connectBegin(int sock)
+{
+    if (sock < 0 || sock >= NUM_SOCKETS)
+    {
+        return;
+    }
+
+    std::lock_guard<Mutex> lock(connectMutex);
+    connectPending |= (1 << sock);
+    connectError[sock] = 0;
+}
+
+bool IsolatedEthernet::connectCancel(int sock)
+{
+    if (sock < 0 || sock >= NUM_SOCKETS)
+    {
+        return false;
+    }
+
+    std::lock_guard<Mutex> lock(connectMutex);
+    bool pending = (connectPending & (1 << sock)) != 0;
+    connectPending &= ~(1 << sock);
+    connectError[sock] = 0;
+    return pending;
+}
+
+int IsolatedEthernet::connectPoll(int sock)
+{
+    if (sock < 0 || sock >= NUM_SOCKETS)
+    {
+        return SOCKERR_SOCKNUM;
+    }
+
+    TcpConnectResult data;
+    {
+        std::lock_guard<Mutex> lock(connectMutex);
+        if ((connectPending & (1 << sock)) == 0)
+        {
+            return connectError[sock] ? connectError[sock] : SOCK_OK;
+        }
+
+        // Same checks as the blocking loop in wiznet::connect()
+        SocketStatus status;
+        if (!getSocketStatus(sock, status, true))
+        {
+            return SOCK_BUSY;
+        }
+
+        int res;
+        if (status.sr == SOCK_ESTABLISHED || status.sr == SOCK_CLOSE_WAIT)
+        {
+            res = SOCK_OK;
+        }
+        else if (status.ir & Sn_IR_TIMEOUT)
+        {
+            BusSession session;
+            setSn_IR(sock, Sn_IR_TIMEOUT);
+            res = SOCKERR_TIMEOUT;
+        }
+        else if (status.sr == SOCK_CLOSED)
+        {
+            res = SOCKERR_SOCKCLOSED;
+        }
+        else
+        {
+            return SOCK_BUSY;
+        }
+        invalidateSocketStatus(sock);
+
+        connectPending &= ~(1 << sock);
+        connectError[sock] = (res == SOCK_OK) ? 0 : (int8_t)res;
+        if (res != SOCK_OK)
+        {
+            // Reported as tcpConnectComplete, not tcpPeerLost
+            peerWatch(sock, false);
+        }
+
+        data.sock = sock;
+        data.result = res;
+    }
+
+    if (data.result != SOCK_OK)
+    {
+        // Data written while connecting can't be sent, so the callback can stop() without waiting for it
+        txQueueDiscard(sock, data.result);
+    }
+
+    // Not holding connectMutex so the callback can start another connection
+    callCallbacks(CallbackType::tcpConnectComplete, &data);
+    return data.result;
+}
+
+IsolatedEthernet &IsolatedEthernet::withRetransmission(unsigned timeMs, uint8_t count)
+{
+    // RTR is in units of 100 us
+    unsigned long time100us = (unsigned long)timeMs * 10;
+    if (time100us < 1)
+    {
+        time100us = 1;
+    }
+    if (time100us > 0xffff)
+    {
+        time100us = 0xffff;
+    }
+    retransmissionTime100us = (uint16_t) time100us;
+    retransmissionCount = count;
+
+    if (setupDone)
+    {
+        applyRetransmission();
+    }
+    return *this;
+}
+
+unsigned long IsolatedEthernet::getTcpTimeoutMs() const
+{
+    // W5500 datasheet, Sn_IR TIMEOUT: the retransmission time doubles each time, but stops at 0xffff
+    unsigned long total100us = 0;
+    unsigned long rtr = retransmissionTime100us;
+    for (int ii = 0; ii <= retransmissionCount; ii++)
+    {
+        total100us += rtr;
+        rtr = std::min(rtr * 2, (unsigned long) 0xffff);
+    }
+    return total100us / 10;
+}
+
+void IsolatedEthernet::applyRetransmission()
+{
+    wiz_NetTimeout timeout;
+    timeout.retry_cnt = retransmissionCount;
+    timeout.time_100us = retransmissionTime100us;
+
+    BusSession session;
+    wizchip_settimeout(&timeout);
+}
+
+void IsolatedEthernet::applySocketOptions(int sock, const SocketOptions &options)
+{
+    if (sock < 0 || sock >= NUM_SOCKETS)
+    {
+        return;
+    }
+
+    // The registers keep their values when the socket is closed, so only write the ones that change
+    SocketOptions &applied = socketOptionsApplied[sock];
+
+    BusSession session;
+    if (applied.mss != options.mss)
+    {
+        setSn_MSSR(sock, options.mss);
+    }
+    if (applied.ttl != options.ttl)
+    {
+        setSn_TTL(sock, options.ttl);
+    }
+    if (applied.tos != options.tos)
+    {
+        setSn_TOS(sock, options.tos);
+    }
+    applied = options;
+}
+
+void IsolatedEthernet::peerWatch(int sock, bool watch)
+{
+    if (sock < 0 || sock >= NUM_SOCKETS)
+    {
+        return;
+    }
+
+    std::lock_guard<Mutex> lock(peerWatchMutex);
+    if (watch)
+    {
+        peerWatchMask |= (1 << sock);
+    }
+    else
+    {
+        peerWatchMask &= ~(1 << sock);
+    }
+}
+
+uint8_t IsolatedEthernet::peerWatchPoll(uint8_t mask)
+{
+    TcpPeerLost lost[NUM_SOCKETS];
+    int numLost = 0;
+    uint8_t lostMask = 0;
+    {
+        std::lock_guard<Mutex> lock(peerWatchMutex);
+
+        // A connect that fails is reported by connectPoll()
+        mask &= peerWatchMask & ~connectPending;
+        if (!mask)
+        {
+            return 0;
+        }
+
+        BusSession session;
+        for (int sock = 0; sock < NUM_SOCKETS; sock++)
+        {
+            if (!(mask & (1 << sock)) || getSn_SR(sock) != SOCK_CLOSED)
+            {
+                continue;
+            }
+            // Sn_IR is not cleared; the TCPClient calls check TIMEOUT themselves
+            lost[numLost].sock = sock;
+            lost[numLost].result = (getSn_IR(sock) & Sn_IR_TIMEOUT) ? SOCKERR_TIMEOUT : SOCKERR_SOCKCLOSED;
+            numLost++;
+            lostMask |= (1 << sock);
+        }
+        peerWatchMask &= ~lostMask;
+    }
+
+    // Not holding peerWatchMutex so the callback can stop() the TCPClient
+    for (int ii = 0; ii < numLost; ii++)
+    {
+        invalidateSocketStatus(lost[ii].sock);
+        appLog.trace("sock %d peer lost %d", lost[ii].sock, lost[ii].result);
+        callCallbacks(CallbackType::tcpPeerLost, &lost[ii]);
+    }
+    return lostMask;
+}
+
+void IsolatedEthernet::spiCalibrate()
+{
+    static const unsigned rates[] = { 50*MHZ, 40*MHZ, 32*MHZ, 25*MHZ, 20*MHZ, 16*MHZ, 10*MHZ, 8*MHZ, 4*MHZ };
+
+    SPISettings origSettings = spiSettings;
+    bool fasterFailed = false;
+    unsigned tested = 0;
+    unsigned chosen = 0;
+
+    for (size_t ii = 0; ii < arraySize(rates); ii++)
+    {
+        if (rates[ii] > spiCalibrationMaxClock)
+        {
+            continue;
+        }
+
+        // Rates that end up as the same clock on this MCU are only tested once, so stepping down one
+        // rate for margin is a real step
+        unsigned clock = spiEffectiveClock(rates[ii]);
+        if (clock == tested)
+        {
+            continue;
+        }
+        tested = clock;
+
+        spiSettings = SPISettings(clock, MSBFIRST, spiCalibrationDataMode);
+
+        bool pass = true;
+        for (int round = 0; round < SPI_CALIBRATION_ROUNDS && pass; round++)
+        {
+            pass = spiCalibrationTest();
+        }
+        appLog.trace("SPI calibration %u MHz %s", clock / MHZ, pass ? "passed" : "failed");
+
+        if (!pass)
+        {
+            fasterFailed = true;
+            continue;
+        }
+
+        if (!chosen)
+        {
+            chosen = clock;
+            if (!fasterFailed)
+            {
+                // The fastest rate allowed by maxClock, with no evidence that it's marginal
+                break;
+            }
+            // Keep going to also check the next slower clock for margin
+            continue;
+        }
+
+        // Step down one clock from the fastest passing clock
+        chosen = clock;
+        break;
+    }
+
+    if (chosen)
+    {
+        spiClock = chosen;
+        spiSettings = SPISettings(spiClock, MSBFIRST, spiCalibrationDataMode);
+        appLog.info("SPI calibration selected %u MHz", spiClock / MHZ);
+    }
+    else
+    {
+        spiClock = 0;
+        spiSettings = origSettings;
+        appLog.error("SPI calibration failed at all rates, connection to W5500 is probably not working");
+    }
+}
+
+// [static]
+unsigned IsolatedEthernet::spiEffectiveClock(unsigned clock)
+{
+#if HAL_PLATFORM_NRF52840
+    // Device OS divides the 64 MHz clock by a power of 2 (32 MHz maximum), rounding down
+    unsigned effective = 32*MHZ;
+    while(effective > clock && effective > 125000)
+    {
+        effective /= 2;
+    }
+    return effective;
+#else
+    return clock;
+#endif
+}
+
+bool IsolatedEthernet::spiCalibrationTest()
+{
+    // Socket 0 TX buffer, which is not in use during setup
+    const uint32_t addrSel = (0x0000 << 8) + (WIZCHIP_TXBUF_BLOCK(0) << 3);
+    const size_t patternLen = 128;
+    uint8_t txBuf[patternLen];
+    uint8_t rxBuf[patternLen];
+
+    // Short transactions use different code paths than bursts, so check one of them too
+    if (getVERSIONR() != 0x04)
+    {
+        return false;
+    }
+
+    for (int pattern = 0; pattern < 5; pattern++)
+    {
+        uint32_t lfsr = 0xace1u;
+
+        for (size_t ii = 0; ii < patternLen; ii++)
+        {
+            switch(pattern)
+            {
+                case 0: 
+                    txBuf[ii] = 0x00; 
+                    break;
+                case 1: 
+                    txBuf[ii] = 0xff; 
+                    break;
+                case 2: 
+                    txBuf[ii] = (ii & 1) ? 0x55 : 0xaa; 
+                    break;
+                case 3: 
+                    txBuf[ii] = (uint8_t)(1 << (ii % 8)); 
+                    break;
+                default:
+                    // Pseudo-random
+                    lfsr = (lfsr >> 1) ^ (-(lfsr & 1u) & 0xb400u);
+                    txBuf[ii] = (uint8_t)lfsr;
+                    break;
+            }
+        }
+
+        memset(rxBuf, 0, sizeof(rxBuf));
+        WIZCHIP_WRITE_BUF(addrSel, txBuf, patternLen);
+        WIZCHIP_READ_BUF(addrSel, rxBuf, patternLen);
+        if (memcmp(txBuf, rxBuf, patternLen) != 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void IsolatedEthernet::beginTransaction()
+{
+    spi->beginTransaction(spiSettings);
+    if (pinCS != PIN_INVALID)
+    {
+        pinResetFast(pinCS);
+    }
+}
+
+void IsolatedEthernet::endTransaction()
+{
+    if (pinCS != PIN_INVALID)
+    {
+        pinSetFast(pinCS);
+    }
+    spi->endTransaction();
+}
+
+void IsolatedEthernet::wizchip_cris_enter(void)
+{
+    os_thread_t current = os_thread_current(NULL);
+
+    // Only this thread can set busOwner to this thread, so this is safe to check without a lock
+    if (busOwner == current)
+    {
+        busDepth++;
+        busSessionStats.nestedCount++;
+        return;
+    }
+
+    spi->beginTransaction(spiSettings);
+    busOwner = current;
+    busDepth = 1;
+    busLockMicros = micros();
+    busSessionStats.lockCount++;
+}
+
+void IsolatedEthernet::wizchip_cris_exit(void)
+{
+    if (--busDepth == 0)
+    {
+        uint32_t held = micros() - busLockMicros;
+        busSessionStats.holdMicros += held;
+        if (held > busSessionStats.maxHoldMicros)
+        {
+            busSessionStats.maxHoldMicros = held;
+        }
+        busOwner = NULL;
+        spi->endTransaction();
+    }
+}
+
+void IsolatedEthernet::wizchip_cs_select(void)
+{
+    if (pinCS != PIN_INVALID)
+    {
+        pinResetFast(pinCS);
+    }
+}
+
+void IsolatedEthernet::wizchip_cs_deselect(void)
+{
+    if (pinCS != PIN_INVALID)
+    {
+        pinSetFast(pinCS);
+    }
+}
+
+uint8_t IsolatedEthernet::wizchip_spi_readbyte(void)
+{
+    return spi->transfer(0xff);
+}
+
+void IsolatedEthernet::wizchip_spi_writebyte(uint8_t wb)
+{
+    spi->transfer(wb);
+}
+
+void IsolatedEthernet::wizchip_spi_readburst(uint8_t *pBuf, uint16_t len)
+{
+    spiBurstTransfer(NULL, pBuf, len);
+}
+
+void IsolatedEthernet::wizchip_spi_writeburst(uint8_t *pBuf, uint16_t len)
+{
+    spiBurstTransfer(pBuf, NULL, len);
+}
+
+int IsolatedEthernet::wizchip_spi_readburst_sg(uint8_t *pHdr, uint16_t hdrLen, uint8_t *pBuf, uint16_t len)
+{
+    if (hdrLen > 3 || len > spiSgMaxLength)
+    {
+        return -1;
+    }
+
+    // The bytes clocked out after the address phase are ignored by the W5500 during a read,
+    // and the bytes clocked in during the address phase are discarded
+    memcpy(spiSgTxBuf, pHdr, hdrLen);
+    spiBurstTransfer(spiSgTxBuf, spiSgRxBuf, hdrLen + len);
+    memcpy(pBuf, &spiSgRxBuf[hdrLen], len);
+    return 0;
+}
+
+int IsolatedEthernet::wizchip_spi_writeburst_sg(uint8_t *pHdr, uint16_t hdrLen, uint8_t *pBuf, uint16_t len)
+{
+    if (hdrLen > 3 || len > spiSgMaxLength)
+    {
+        return -1;
+    }
+
+    memcpy(spiSgTxBuf, pHdr, hdrLen);
+    memcpy(&spiSgTxBuf[hdrLen], pBuf, len);
+    spiBurstTransfer(spiSgTxBuf, NULL, hdrLen + len);
+    return 0;
+}
+
+void IsolatedEthernet::spiBurstTransfer(uint8_t *txBuf, uint8_t *rxBuf, uint16_t len)
+{
+    // After a timeout, a late completion callback could end a later transfer early, so DMA isn't used anymore
+    if (spiAsyncDmaQueue && !spiFault && len >= spiAsyncDmaMinLength)
+    {
+        spiAsyncTransfer(txBuf, rxBuf, len);
+        return;
+    }
+    spi->transfer(txBuf, rxBuf, len, NULL);
+}
+
+bool IsolatedEthernet::spiAsyncTransfer(uint8_t *txBuf, uint8_t *rxBuf, uint16_t len)
+{
+    // The completion callback posts to the queue, and this thread sleeps until then instead
+    // of busy-waiting. 2048 bytes at 4 MHz is about 4 ms, so 100 ms means the DMA is stuck.
+    uint8_t dummy;
+    spi->transfer(txBuf, rxBuf, len, spiAsyncTransferDoneStatic);
+    if (os_queue_take(spiAsyncDmaQueue, &dummy, 100, NULL) == 0)
+    {
+        return true;
+    }
+
+    spi->transferCancel();
+    if (rxBuf)
+    {
+        // Don't return a partly filled buffer as data
+        memset(rxBuf, 0, len);
+    }
+    appLog.error("SPI DMA transfer timed out len=%u, W5500 needs a reset", (unsigned int)len);
+    spiFault = true;
+    return false;
+}
+
+// [static]
+void IsolatedEthernet::spiAsyncTransferDoneStatic(void)
+{
+    uint8_t dummy = 0;
+
+    // Called from the DMA interrupt, os_queue_put with a timeout of 0 is ISR-safe
+    os_queue_put(instance().spiAsyncDmaQueue, &dummy, 0, NULL);
+}
+
+os_thread_return_t IsolatedEthernet::threadFunction()
+{
+    workerThread = os_thread_current(NULL);
+
+    while (true)
+    {
+        if (setupDone) {
+            uint8_t events = 0;
+            if (interruptsActive) {
+                // Also checks the level in case an edge was missed; INT stays low until the bits are cleared
+                for (int tries = 0; tries < 4 && digitalRead(pinINT) == LOW; tries++) {
+                    events |= serviceInterrupts();
+                }
+            }
+
+            bool pollAll = (!interruptsActive || workerWaitMs() <= 1 || millis() - stateMachineLast >= INTERRUPT_POLL_MS);
+            if (pollAll) {
+                stateMachineLast = millis();
+                stateMachine();
+            }
+
+            // Move received data into the RAM ring buffers. With interrupts, only sockets that had an
+            // interrupt or were waiting for ring buffer space, except on the periodic check.
+            if (rxDrainMask) {
+                rxDrain((interruptsActive && !pollAll) ? (events | rxDrainStalled) : 0xff);
+            }
+
+            if (statusSnapshotIntervalMs && millis() - statusSnapshotLast >= statusSnapshotMaxAgeMs() / 2) {
+                statusSnapshotLast = millis();
+                takeStatusSnapshot();
+            }
+
+            // Issue the SEND for TCP data appended while a previous SEND was in flight. No SPI access unless there is some.
+            coalesceCheck();
+            for (int sock = 0; sock < NUM_SOCKETS; sock++) {
+                wiznet::send_poll(sock);
+            }
+
+            for (int sock = 0; udpSendPending && sock < NUM_SOCKETS; sock++) {
+                if (udpSendPending & (1 << sock)) {
+                    udpSendPoll(sock);
+                }
+            }
+
+            // Finish TCPClient::connectAsync() connections, so queued data can be sent on this pass
+            for (int sock = 0; connectPending && sock < NUM_SOCKETS; sock++) {
+                if ((connectPending & (1 << sock)) && connectPoll(sock) != SOCK_BUSY && interruptsActive) {
+                    events |= (1 << sock);
+                }
+            }
+
+            // Report TCP connections the W5500 closed because the peer stopped responding
+            if (peerWatchMask) {
+                bool due = (millis() - peerWatchLast >= PEER_WATCH_INTERVAL_MS);
+                if (due) {
+                    peerWatchLast = millis();
+                }
+                uint8_t lost = peerWatchPoll(due ? 0xff : (interruptsActive ? events : 0));
+                if (interruptsActive) {
+                    events |= lost;
+                }
+            }
+
+            // Move withTxQueue() data into the TX buffers, and wake writers waiting for queue space
+            uint8_t progress = txQueuePoll();
+            if (interruptsActive) {
+                events |= progress;
+            }
+
+            // Wake calls waiting for these sockets, after the SEND and UDP send state above was updated
+            if (events) {
+                uint8_t dummy = 0;
+                for (int sock = 0; sock < NUM_SOCKETS; sock++) {
+                    if (events & (1 << sock)) {
+                        os_queue_put(socketEventQueue[sock], &dummy, 0, NULL);
+                    }
+                }
+                os_queue_put(anyEventQueue, &dummy, 0, NULL);
+            }
+        }
+
+        if (interruptsActive && setupDone) {
+            uint8_t dummy;
+            os_queue_take(interruptQueue, &dummy, workerWaitMs(), NULL);
+        }
+        else {
+            delay(1);
+        }
+    }
+}
+
+// [static]
+void IsolatedEthernet::interruptHandlerStatic(void)
+{
+    uint8_t dummy = 0;
+
+    // os_queue_put with a timeout of 0 is ISR-safe. If the queue is full, the worker is already going to run.
+    os_queue_put(instance().interruptQueue, &dummy, 0, NULL);
+}
+
+uint8_t IsolatedEthernet::serviceInterrupts()
+{
+    uint8_t events = 0;
+    {
+        BusSession session;
+
+        uint8_t sir = getSIR();
+        for (int sock = 0; sock < NUM_SOCKETS; sock++) {
+            if ((sir & (1 << sock)) && wiz_latch_sn_ir((uint8_t)sock)) {
+                events |= (1 << sock);
+            }
+        }
+
+        // Interrupts mean the state changed (RECV, SENDOK, CON, DISCON, TIMEOUT), so refresh the snapshot now
+        for (int sock = 0; statusSnapshotIntervalMs && sock < NUM_SOCKETS; sock++) {
+            if (events & (1 << sock)) {
+                SocketStatus status;
+                readSocketStatus(sock, sir, status);
+            }
+        }
+    }
+    return events;
+}
+
+void IsolatedEthernet::waitSocketEvent(int sock, system_tick_t timeoutMs)
+{
+    if (!interruptsActive || sock < 0 || sock >= NUM_SOCKETS) {
+        delay(1);
+        return;
+    }
+
+    // An interrupt that was missed is picked up by the worker within INTERRUPT_POLL_MS
+    uint8_t dummy;
+    os_queue_take(socketEventQueue[sock], &dummy, std::min(timeoutMs, INTERRUPT_POLL_MS), NULL);
+}
+
+void IsolatedEthernet::waitAnyEvent()
+{
+    if (!interruptsActive) {
+        delay(1);
+        return;
+    }
+
+    uint8_t dummy;
+    os_queue_take(anyEventQueue, &dummy, 1, NULL);
+}
+
+system_tick_t IsolatedEthernet::workerWaitMs()
+{
+    // Things that are timed instead of interrupt driven: link detection, DHCP, and coalescing idle time
+    bool dhcpBusy = (dhcpState != DhcpState::DONE && dhcpState != DhcpState::NOT_USED);
+    if (!phyLink || dhcpBusy || coalesceMask) {
+        return 1;
+    }
+    return INTERRUPT_POLL_MS;
+}
+
+unsigned long IsolatedEthernet::statusSnapshotMaxAgeMs() const
+{
+    // Interrupts refresh the entry of a socket whenever its state changes, so the periodic snapshot is only a safety net
+    if (interruptsActive) {
+        return 2 * std::max(statusSnapshotIntervalMs, (unsigned long)INTERRUPT_POLL_MS);
+    }
+    return 2 * statusSnapshotIntervalMs;
+}
+
+// [static]
+os_thread_return_t IsolatedEthernet::threadFunctionStatic(void *param)
+{
+    ((IsolatedEthernet *)param)->threadFunction();
+}
+
+
+void IsolatedEthernet::setMacAddress() 
+{
+#if HAL_PLATFORM_NRF52840
+    const uint32_t lsb = __builtin_bswap32(NRF_FICR->DEVICEADDR[0]);
+    const uint32_t msb = NRF_FICR->DEVICEADDR[1] & 0xffff;
+    memcpy(macAddr + 2, &lsb, sizeof(lsb));
+    macAddr[0] = msb >> 8;
+    macAddr[1] = msb;
+    // Drop 'multicast' bit
+    macAddr[0] &= 0b11111110;
+    // Set 'locally administered' bit
+    macAddr[0] |= 0b10;
+#elif HAL_PLATFORM_RTL872X
+    #define HAL_DEVICE_MAC_ETHERNET         3
+    WiFi.macAddress(macAddr);
+    macAddr[5] += HAL_DEVICE_MAC_ETHERNET;
+#error "Unsupported platform" // temporary, as the P2 support is not currently working
+#else
+#error "Unsupported platform"
+#endif
+
+    appLog.trace("mac %02x:%02x:%02x:%02x:%02x:%02x", macAddr[0], macAddr[1], macAddr[2], macAddr[3], macAddr[4], macAddr[5]);
+
+}
+
+
+extern "C" void wizchip_debug(const char *fmt, ...)
+{
+    va_list ap;
+    char fmt2[100];
+    char buf[100];
+
+    const char *src = fmt;
+    char *dst = fmt2;
+    char *dstEnd = &fmt2[sizeof(fmt2) - 1];
+    while (*src && dst < dstEnd)
+    {
+        if (*src != '\r' && *src != '\n')
+        {
+            *dst++ = *src++;
+        }
+        else
+        {
+            src++;
+        }
+    }
+    *dst = 0;
+
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt2, ap);
+    va_end(ap);
+
+    IsolatedEthernet::instance().appLog.trace("%s", buf);
+}
+
+extern "C" void wizchip_yield()
+{
+    IsolatedEthernet::instance().waitAnyEvent();
+}
+
+extern "C" uint16_t wizchip_ephemeral_port(uint8_t sn)
+{
+    return IsolatedEthernet::instance().getEphemeralPort(sn);
+}
+
+//
+// TCPClient
+//
+
+bool IsolatedEthernet::TCPClient::isOpen(sock_handle_t sd)
+{
+    SocketStatus status;
+    return IsolatedEthernet::instance().getSocketStatus(sd, status) && status.sr == SOCK_ESTABLISHED;
+}
+
+IsolatedEthernet::TCPClient::TCPClient() : TCPClient(-1)
+{
+}
+
+IsolatedEthernet::TCPClient::TCPClient(sock_handle_t sock) :
+        d_(std::make_shared<Data>(sock))
+{
+    flush_buffer();
+}
+
+
+// return 0 on error, 1 on success
+int IsolatedEthernet::TCPClient::connect(const char *host, uint16_t port, network_interface_t nif)
+{
+    stop();
+    if (IsolatedEthernet::instance().ready())
+    {
+        HAL_IPAddress halIpAddress;
+        if (IsolatedEthernet::instance().inet_gethostbyname(host, strlen(host), &halIpAddress, 0, NULL) == 0)
+        {
+            IPAddress ip_addr(halIpAddress);
+            return connect(ip_addr, port, nif);
+        }
+        else
+        {
+            IsolatedEthernet::instance().appLog.trace("unable to get IP for hostname");
+        }
+    }
+
+    return 0; // error, could not connect
+}
+
+// return 0 on error, 1 on success
+int IsolatedEthernet::TCPClient::connect(IPAddress ip, uint16_t port, network_interface_t nif)
+{
+    int connected = 0;
+    if (connectAsync(ip, port))
+    {
+        nif_ = nif;
+
+        // The worker thread also checks the connection, and wakes this thread with the W5500 interrupt
+        int res;
+        while((res = connectStatus()) == CONNECT_STATUS_BUSY)
+        {
+            IsolatedEthernet::instance().waitSocketEvent(sock_handle(), 1000);
+        }
+        if (res == CONNECT_STATUS_OK) {
+            // IsolatedEthernet::instance().appLog.trace("TCPClient connect() success");                
+            connected = true;
+        }
+        else {
+            IsolatedEthernet::instance().appLog.trace("TCPClient connect() res=%d", res);
+        }
+    }
+    return connected;
+}
+
+// return 0 on error, 1 on success
+int IsolatedEthernet::TCPClient::connectAsync(const char *host, uint16_t port)
+{
+    stop();
+    if (IsolatedEthernet::instance().ready())
+    {
+        HAL_IPAddress halIpAddress;
+        if (IsolatedEthernet::instance().inet_gethostbyname(host, strlen(host), &halIpAddress, 0, NULL) == 0)
+        {
+            IPAddress ip_addr(halIpAddress);
+            return connectAsync(ip_addr, port);
+        }
+        else
+        {
+            IsolatedEthernet::instance().appLog.trace("unable to get IP for hostname");
+        }
+    }
+
+    return 0; // error, could not start connecting
+}
+
+// return 0 on error, 1 if the connection was started
+int IsolatedEthernet::TCPClient::connectAsync(IPAddress ip, uint16_t port)
+{
+    stop();
+
+    IsolatedEthernet::instance().appLog.trace("TCPClient connect(%s %d)", ip.toString().c_str(), (int)port);                
+
+    int started = 0;
+    if (IsolatedEthernet::instance().ready())
+    {
+        int sock = IsolatedEthernet::instance().socketAlloc(SocketOwner::TCP_CLIENT, d_->service, d_->minTxSize, d_->minRxSize);
+        if (sock >= 0) {
+            IsolatedEthernet::instance().appLog.trace("TCPClient using socket=%d", sock);
+
+            IsolatedEthernet::instance().applySocketOptions(sock, d_->socketOptions);
+
+            // Local port 0 is a withEphemeralPortRange() port, so reconnects don't reuse the server's TIME_WAIT 4-tuple
+            int8_t res = wiznet::socket((uint8_t) sock, Sn_MR_TCP, 0, 0);
+            IsolatedEthernet::instance().invalidateSocketStatus(sock);
+            if (res >= 0) {
+                d_->sock = sock;
+                // IsolatedEthernet::instance().appLog.trace("TCPClient socket() success");
             }
             else {
                 IsolatedEthernet::instance().appLog.trace("TCPClient socket error %d", (int) res);
+                IsolatedEthernet::instance().socketRelease(sock, true);
             }
         }
         else {
@@ -781,25 +2767,30 @@ int IsolatedEthernet::TCPClient::connect(IPAddress ip, uint16_t port, network_in
             uint8_t addr[4];
             IsolatedEthernet::ipAddressToArray(ip, addr);
 
+            // Non-blocking I/O mode, so connect() returns SOCK_BUSY once the SYN is on its way.
+            // socket() resets the I/O mode.
+            uint8_t mode = SOCK_IO_NONBLOCK;
+            wiznet::ctlsocket(sock_handle(), wiznet::CS_SET_IOMODE, &mode);
+
             int8_t res = wiznet::connect(sock_handle(), addr, port);
-            if (res == SOCK_OK) {
-                // IsolatedEthernet::instance().appLog.trace("TCPClient connect() success");                
-                connected = true;
+            IsolatedEthernet::instance().invalidateSocketStatus(sock_handle());
+            if (res == SOCK_BUSY) {
+                IsolatedEthernet::instance().connectBegin(sock_handle());
+                started = true;
+
+                // socket() clears the cork, connect() always starts uncorked
+                d_->corked = false;
+                applyCoalescing();
+                applyTxQueue();
+                applyKeepAlive();
+
+                d_->remoteIP = ip;
+                d_->remotePort = port;
             }
             else {
                 IsolatedEthernet::instance().appLog.trace("TCPClient connect() res=%d", res);
-                connected = false;
-            }
-
-            // Once connected, switch to non-blocking I/O mode
-            uint8_t mode = SOCK_IO_NONBLOCK;
-            wiznet::ctlsocket(sock_handle(), wiznet::CS_SET_IOMODE, &mode);
-
-            d_->remoteIP = ip;
-            nif_ = nif;
-            if (!connected)
-            {
                 stop();
+                d_->connectResult = res;
             }
         }
         else {
@@ -807,7 +2798,22 @@ int IsolatedEthernet::TCPClient::connect(IPAddress ip, uint16_t port, network_in
 
         }
     }
-    return connected;
+    return started;
+}
+
+int IsolatedEthernet::TCPClient::connectStatus()
+{
+    if (sock_handle() < 0) {
+        return d_->connectResult;
+    }
+
+    int res = IsolatedEthernet::instance().connectPoll(sock_handle());
+    if (res < 0) {
+        // Release the socket so it can be used for another connection
+        stop();
+        d_->connectResult = res;
+    }
+    return res;
 }
 
 size_t IsolatedEthernet::TCPClient::write(uint8_t b)
@@ -829,6 +2835,15 @@ size_t IsolatedEthernet::TCPClient::write(const uint8_t *buffer, size_t size, sy
 {
     clearWriteError();
 
+    if (IsolatedEthernet::instance().txQueueActive(sock_handle())) {
+        // The worker thread moves the data into the TX buffer; timeout only matters with TxQueuePolicy::BLOCK
+        int ret = IsolatedEthernet::instance().txQueueWrite(sock_handle(), buffer, size, timeout);
+        if (ret < 0) {
+            setWriteError(ret);
+        }
+        return ret;
+    }
+
     int ret = -1;
     unsigned long start = millis();
     size_t offset = 0;
@@ -836,6 +2851,7 @@ size_t IsolatedEthernet::TCPClient::write(const uint8_t *buffer, size_t size, sy
     do {
         ret = wiznet::send(sock_handle(), const_cast<uint8_t *>(buffer + offset), size - offset);
         if (ret > 0) {
+            coalesceAfterWrite();
             offset += ret;
             if (offset == size) {
                 ret = size;
@@ -848,13 +2864,98 @@ size_t IsolatedEthernet::TCPClient::write(const uint8_t *buffer, size_t size, sy
          
             break;
         }
-        delay(1);
-    } while(timeout != 0 && millis() - start < timeout);
+        else {
+            // Only wait when the TX buffer is full. send() does not wait for the previous SEND to finish.
+            // A timeout of 0 (SOCKET_WAIT_FOREVER) waits until there's space or the connection fails.
+            unsigned long elapsed = millis() - start;
+            IsolatedEthernet::instance().waitSocketEvent(sock_handle(), (timeout == 0) ? 1000 : (elapsed < timeout) ? timeout - elapsed : 0);
+        }
+    } while(timeout == 0 || millis() - start < timeout);
+
+    /*
+     * FIXME: We should not be returning negative numbers here
+     */
+    return ret;
+}
+
+int IsolatedEthernet::TCPClient::availableForWrite()
+{
+    uint16_t ptr;
+
+    if (!socket_handle_valid(sock_handle())) {
+        return 0;
+    }
+    if (IsolatedEthernet::instance().txQueueActive(sock_handle())) {
+        return (int)IsolatedEthernet::instance().txQueueSpace(sock_handle());
+    }
+    int ret = wiznet::send_reserve(sock_handle(), &ptr);
+    return (ret > 0) ? ret : 0;
+}
+
+int IsolatedEthernet::TCPClient::writeFrom(std::function<void(TxWriter &writer)> producer)
+{
+    uint16_t ptr;
+
+    clearWriteError();
+
+    if (!socket_handle_valid(sock_handle())) {
+        return SOCKERR_SOCKNUM;
+    }
+    if (IsolatedEthernet::instance().txQueued(sock_handle())) {
+        // Writing directly to the TX buffer would go ahead of the queued data
+        return 0;
+    }
+
+    int ret = wiznet::send_reserve(sock_handle(), &ptr);
+    if (ret <= 0) {
+        if (ret < 0) {
+            setWriteError(ret);
+        }
+        return ret;
+    }
+
+    // The bus is not held while the producer runs; only this connection writes at ptr
+    TxWriter writer(sock_handle(), ptr, (size_t)ret);
+    producer(writer);
+
+    if (writer.written() == 0) {
+        return 0;
+    }
+
+    ret = wiznet::send_commit(sock_handle(), ptr, (uint16_t)writer.written());
+    if (ret > 0) {
+        coalesceAfterWrite();
+    }
+    else {
+        setWriteError(ret);
+    }
+    return ret;
+}
+
+size_t IsolatedEthernet::TCPClient::TxWriter::write(uint8_t b)
+{
+    return write(&b, 1);
+}
+
+size_t IsolatedEthernet::TCPClient::TxWriter::write(const uint8_t *buffer, size_t size)
+{
+    size = std::min(size, available());
+    if (size) {
+        wiz_write_tx((uint8_t)sock, (uint16_t)(ptr + offset), const_cast<uint8_t *>(buffer), (uint16_t)size);
+        offset += size;
+    }
+    return size;
+}
 
-    /*
-     * FIXME: We should not be returning negative numbers here
-     */
-    return ret;
+void IsolatedEthernet::TCPClient::coalesceAfterWrite()
+{
+    if (d_->corked || d_->coalesceSize) {
+        // Held in the TX buffer, send once there's a full segment
+        IsolatedEthernet::instance().coalesceTouch(sock_handle());
+        if (wiznet::send_pending(sock_handle()) >= (d_->coalesceSize ? d_->coalesceSize : 1460)) {
+            wiznet::send_flush(sock_handle());
+        }
+    }
 }
 
 int IsolatedEthernet::TCPClient::bufferCount()
@@ -872,13 +2973,34 @@ int IsolatedEthernet::TCPClient::available()
         flush_buffer();
     }
 
-    if (IsolatedEthernet::instance().ready() && isOpen(sock_handle()))
+    if (IsolatedEthernet::instance().rxRingActive(sock_handle()))
     {
-        // Have room
+        // The worker thread has already moved the received data into RAM
         if (d_->total < arraySize(d_->buffer))
+        {
+            int ret = (int)IsolatedEthernet::instance().rxRingRead(sock_handle(), d_->buffer + d_->total, arraySize(d_->buffer) - d_->total);
+            if (ret > 0)
+            {
+                if (d_->total == 0)
+                    d_->offset = 0;
+                d_->total += ret;
+            }
+        }
+    }
+    else if (IsolatedEthernet::instance().ready() && socket_handle_valid(sock_handle()))
+    {
+        IsolatedEthernet::BusSession session;
+
+        // One burst read of the socket register window gives both the status and the
+        // received size, so an idle poll costs a single SPI transaction
+        wiz_SockRegs regs;
+        getSn_REGS((uint8_t)sock_handle(), &regs);
+
+        // Have room
+        if (getSn_REGS_SR(&regs) == SOCK_ESTABLISHED && getSn_REGS_RX_RSR(&regs) != 0 && d_->total < arraySize(d_->buffer))
         {
             // int ret = socket_receive(sock_handle(), d_->buffer + d_->total, arraySize(d_->buffer) - d_->total, 0);
-            int ret = wiznet::recv(sock_handle(), d_->buffer + d_->total, arraySize(d_->buffer) - d_->total);
+            int ret = wiznet::recv_regs(sock_handle(), d_->buffer + d_->total, arraySize(d_->buffer) - d_->total, &regs);
             if (ret > 0)
             {
                 DEBUG("recv(=%d)", ret);
@@ -900,6 +3022,26 @@ int IsolatedEthernet::TCPClient::read()
 int IsolatedEthernet::TCPClient::read(uint8_t *buffer, size_t size)
 {
     int read = -1;
+    if (size >= arraySize(d_->buffer))
+    {
+        // Large read: drain the internal buffer, then receive directly into the caller's buffer
+        read = std::min((size_t)bufferCount(), size);
+        if (read)
+        {
+            memcpy(buffer, &d_->buffer[d_->offset], read);
+            d_->offset += read;
+        }
+        if ((size_t)read < size)
+        {
+            int ret = readDirect(buffer + read, size - read);
+            if (ret > 0)
+            {
+                read += ret;
+            }
+        }
+        return read ? read : -1;
+    }
+
     if (bufferCount() || available())
     {
         read = (size > (size_t)bufferCount()) ? bufferCount() : size;
@@ -909,6 +3051,37 @@ int IsolatedEthernet::TCPClient::read(uint8_t *buffer, size_t size)
     return read;
 }
 
+int IsolatedEthernet::TCPClient::readDirect(uint8_t *buffer, size_t size)
+{
+    if (IsolatedEthernet::instance().rxRingActive(sock_handle()))
+    {
+        return (int)IsolatedEthernet::instance().rxRingRead(sock_handle(), buffer, size);
+    }
+
+    if (!IsolatedEthernet::instance().ready() || !socket_handle_valid(sock_handle()))
+    {
+        return 0;
+    }
+
+    IsolatedEthernet::BusSession session;
+
+    wiz_SockRegs regs;
+    getSn_REGS((uint8_t)sock_handle(), &regs);
+    if (getSn_REGS_SR(&regs) != SOCK_ESTABLISHED || getSn_REGS_RX_RSR(&regs) == 0)
+    {
+        return 0;
+    }
+
+    // recv() copies min(size, Sn_RX_RSR) with a single Sn_CR_RECV. The bus is still held, so the
+    // registers just read are current and recv() doesn't need to read them again.
+    int ret = wiznet::recv_regs(sock_handle(), buffer, (uint16_t)std::min(size, (size_t)0xffff), &regs);
+    if (ret > 0)
+    {
+        DEBUG("recv(=%d)", ret);
+    }
+    return ret;
+}
+
 int IsolatedEthernet::TCPClient::peek()
 {
     return (bufferCount() || available()) ? d_->buffer[d_->offset] : -1;
@@ -922,38 +3095,198 @@ void IsolatedEthernet::TCPClient::flush_buffer()
 
 void IsolatedEthernet::TCPClient::flush()
 {
+    IsolatedEthernet::instance().txQueueFinish(sock_handle(), SPARK_WIRING_TCPCLIENT_DEFAULT_SEND_TIMEOUT, false);
+
     uint16_t bufSize = getSn_TxMAX(sock_handle());
     uint16_t freeSize = getSn_TX_FSR(sock_handle());
 
-    while(freeSize < bufSize) {
-        delay(1);
+    while(freeSize < bufSize || wiznet::send_pending(sock_handle())) {
+        if (wiznet::send_flush(sock_handle()) < 0) {
+            break;
+        }
+        IsolatedEthernet::instance().waitSocketEvent(sock_handle(), 1000);
         freeSize = getSn_TX_FSR(sock_handle());
     }
 }
 
+void IsolatedEthernet::TCPClient::cork()
+{
+    d_->corked = true;
+    applyCoalescing();
+}
+
+void IsolatedEthernet::TCPClient::uncork()
+{
+    d_->corked = false;
+    applyCoalescing();
+    if (socket_handle_valid(sock_handle())) {
+        wiznet::send_flush(sock_handle());
+    }
+}
+
+IsolatedEthernet::TCPClient &IsolatedEthernet::TCPClient::withCoalescing(size_t flushSize, system_tick_t flushIdleMs)
+{
+    d_->coalesceSize = (uint16_t) std::min(flushSize, (size_t)0xffff);
+    d_->coalesceIdleMs = (uint16_t) std::min(flushIdleMs, (system_tick_t)0xffff);
+    applyCoalescing();
+    return *this;
+}
+
+IsolatedEthernet::TCPClient &IsolatedEthernet::TCPClient::withSocketBufferSize(size_t txSize, size_t rxSize)
+{
+    d_->minTxSize = txSize;
+    d_->minRxSize = rxSize;
+    return *this;
+}
+
+IsolatedEthernet::TCPClient &IsolatedEthernet::TCPClient::withSocketService(const char *service)
+{
+    d_->service = service;
+    return *this;
+}
+
+IsolatedEthernet::TCPClient &IsolatedEthernet::TCPClient::withTxQueue(size_t queueSize, TxQueuePolicy policy, size_t highWatermark, size_t lowWatermark)
+{
+    d_->txQueueSize = queueSize;
+    d_->txQueuePolicy = policy;
+    d_->txQueueHigh = highWatermark;
+    d_->txQueueLow = lowWatermark;
+    applyTxQueue();
+    return *this;
+}
+
+size_t IsolatedEthernet::TCPClient::txQueued()
+{
+    return IsolatedEthernet::instance().txQueued(sock_handle());
+}
+
+void IsolatedEthernet::TCPClient::applyTxQueue()
+{
+    if (!socket_handle_valid(sock_handle())) {
+        return;
+    }
+    if (d_->txQueueSize) {
+        IsolatedEthernet::instance().txQueueOpen(sock_handle(), false, d_->txQueueSize, d_->txQueuePolicy, d_->txQueueHigh, d_->txQueueLow);
+    }
+    else {
+        IsolatedEthernet::instance().txQueueClose(sock_handle());
+    }
+}
+
+// withKeepAlive() seconds to Sn_KPALVTR, which is in units of 5 seconds
+static uint8_t keepAliveUnits(unsigned seconds)
+{
+    return (uint8_t)std::min<unsigned>((seconds + 4) / 5, 255);
+}
+
+IsolatedEthernet::TCPClient &IsolatedEthernet::TCPClient::withKeepAlive(unsigned seconds)
+{
+    d_->keepAlive = keepAliveUnits(seconds);
+    applyKeepAlive();
+    return *this;
+}
+
+void IsolatedEthernet::TCPClient::applyKeepAlive()
+{
+    if (!socket_handle_valid(sock_handle())) {
+        return;
+    }
+    // Always written, as the register keeps the value from the last connection on this socket
+    uint8_t units = d_->keepAlive;
+    wiznet::setsockopt(sock_handle(), wiznet::SO_KEEPALIVEAUTO, &units);
+    IsolatedEthernet::instance().peerWatch(sock_handle(), units != 0);
+}
+
+int IsolatedEthernet::TCPClient::sendKeepAlive()
+{
+    if (!socket_handle_valid(sock_handle())) {
+        return SOCKERR_SOCKNUM;
+    }
+    int8_t res = wiznet::setsockopt(sock_handle(), wiznet::SO_KEEPALIVESEND, NULL);
+    IsolatedEthernet::instance().invalidateSocketStatus(sock_handle());
+    if (res == SOCK_OK) {
+        IsolatedEthernet::instance().peerWatch(sock_handle(), true);
+    }
+    return res;
+}
+
+void IsolatedEthernet::TCPClient::applyCoalescing()
+{
+    if (!socket_handle_valid(sock_handle())) {
+        return;
+    }
+    wiznet::send_cork(sock_handle(), (d_->corked || d_->coalesceSize) ? 1 : 0);
+    IsolatedEthernet::instance().coalesceSet(sock_handle(), (d_->coalesceSize && !d_->corked) ? d_->coalesceIdleMs : 0);
+}
+
 void IsolatedEthernet::TCPClient::stop()
 {
     if (sock_handle() < 0) {
         return;
     }
 
+    IsolatedEthernet::instance().peerWatch(sock_handle(), false);
+    IsolatedEthernet::instance().coalesceSet(sock_handle(), 0);
+
+    if (IsolatedEthernet::instance().connectCancel(sock_handle())) {
+        // Still connecting, so there's nothing to send. Abandon the connection.
+        IsolatedEthernet::instance().appLog.trace("sock %d close while connecting", sock_handle());
+        wiznet::close(sock_handle());
+        IsolatedEthernet::instance().invalidateSocketStatus(sock_handle());
+        IsolatedEthernet::instance().socketRelease(sock_handle(), true);
+        d_->sock = -1;
+        d_->remoteIP.clear();
+        d_->remotePort = 0;
+        d_->connectResult = CONNECT_STATUS_CLOSED;
+        flush_buffer();
+        return;
+    }
+
+    // disconnect() sends what's in the TX buffer, but the queue has to get there first. What can't be
+    // sent in time, or at all because the connection is gone, is discarded.
+    unsigned long start = millis();
+    IsolatedEthernet::instance().txQueueFinish(sock_handle(), IsolatedEthernet::TX_QUEUE_STOP_TIMEOUT_MS, true);
+
+    // Data held back by send() waits for the SEND in flight, which can take the whole retransmission timeout
+    // on a dead peer. Wait within the same limit, but not on the worker thread, then close without it.
+    bool canWait = (os_thread_current(NULL) != IsolatedEthernet::instance().workerThread);
+    int8_t res;
+    while ((res = wiznet::send_flush(sock_handle())) == SOCK_BUSY && canWait) {
+        unsigned long elapsed = millis() - start;
+        if (elapsed >= IsolatedEthernet::TX_QUEUE_STOP_TIMEOUT_MS) {
+            break;
+        }
+        IsolatedEthernet::instance().waitSocketEvent(sock_handle(), IsolatedEthernet::TX_QUEUE_STOP_TIMEOUT_MS - elapsed);
+    }
+
     // This log line pollutes the log too much
     IsolatedEthernet::instance().appLog.trace("sock %d closesocket", sock_handle());
 
-    // if (isOpen(sock_handle()))
-    int8_t res = wiznet::disconnect(sock_handle());
+    if (res == SOCK_BUSY) {
+        IsolatedEthernet::instance().appLog.trace("sock %d close discarding %u bytes", sock_handle(), (unsigned) wiznet::send_pending(sock_handle()));
+        wiznet::close(sock_handle());
+        res = SOCK_OK;
+    }
+    else {
+        // if (isOpen(sock_handle()))
+        res = wiznet::disconnect(sock_handle());
+    }
+    IsolatedEthernet::instance().invalidateSocketStatus(sock_handle());
     if (res != SOCK_OK) {
         IsolatedEthernet::instance().appLog.trace("sock %d disconnect failed %d", sock_handle(), (int) res);
     }
+    IsolatedEthernet::instance().socketRelease(sock_handle(), false);
     d_->sock = -1;
     d_->remoteIP.clear();
+    d_->remotePort = 0;
+    d_->connectResult = CONNECT_STATUS_CLOSED;
     flush_buffer();
 }
 
 uint8_t IsolatedEthernet::TCPClient::connected()
 {
     // Wlan up, open and not in CLOSE_WAIT or data still in the local buffer
-    bool rv = (status() || bufferCount());
+    bool rv = (status() || bufferCount() || IsolatedEthernet::instance().rxRingAvailable(sock_handle()));
     // no data in the local buffer, Socket open but my be in CLOSE_WAIT yet the CC3000 may have data in its buffer
     if (!rv && isOpen(sock_handle()))
     {
@@ -964,6 +3297,14 @@ uint8_t IsolatedEthernet::TCPClient::connected()
             stop(); // Close our side
         }
     }
+    // The W5500 closed the socket (keep-alive or retransmission timeout, or reset), so release it for other connections
+    SocketStatus status;
+    if (!rv && socket_handle_valid(sock_handle()) && !(IsolatedEthernet::instance().connectPending & (1 << sock_handle())) &&
+        IsolatedEthernet::instance().getSocketStatus(sock_handle(), status) && status.sr == SOCK_CLOSED)
+    {
+        IsolatedEthernet::instance().appLog.trace("calling .stop(), socket closed");
+        stop();
+    }
     return rv;
 }
 
@@ -994,7 +3335,10 @@ IsolatedEthernet::TCPClient::Data::~Data()
 {
     if (socket_handle_valid(sock))
     {
+        IsolatedEthernet::instance().peerWatch(sock, false);
         wiznet::close(sock);
+        IsolatedEthernet::instance().invalidateSocketStatus(sock);
+        IsolatedEthernet::instance().socketRelease(sock, true);
     }
 }
 
@@ -1069,28 +3413,44 @@ IsolatedEthernet::TCPServer::TCPServer(uint16_t port, network_interface_t nif)
     }
 }
 
+IsolatedEthernet::TCPServer &IsolatedEthernet::TCPServer::withKeepAlive(unsigned seconds) {
+    _keepAlive = keepAliveUnits(seconds);
+    return *this;
+}
+
 bool IsolatedEthernet::TCPServer::startListener() {
     bool result = false;
 
-    int sock = IsolatedEthernet::instance().socketGetFree();
+    int sock = IsolatedEthernet::instance().socketAlloc(SocketOwner::TCP_SERVER, _service, _minTxSize, _minRxSize);
     if (sock >= 0) {
         IsolatedEthernet::instance().appLog.trace("TCPServer using socket=%d", sock);
 
+        IsolatedEthernet::instance().applySocketOptions(sock, _socketOptions);
         int8_t res = wiznet::socket((uint8_t) sock, Sn_MR_TCP, _port, 0);
+        IsolatedEthernet::instance().invalidateSocketStatus(sock);
         if (res >= 0) {
             _sock = sock;
+
+            // Carries over to the accepted connection. Always written, as the register keeps its value.
+            wiznet::setsockopt(_sock, wiznet::SO_KEEPALIVEAUTO, &_keepAlive);
             // IsolatedEthernet::instance().appLog.trace("TCPServer socket() success");
 
             int8_t res = wiznet::listen(_sock);
+            IsolatedEthernet::instance().invalidateSocketStatus(_sock);
             if (res == SOCK_OK) {
                 result = true;
             }
             else {
                 IsolatedEthernet::instance().appLog.trace("TCPServer listen error=%d sock=%d", (int) res, (int)_sock);
+                wiznet::close(_sock);
+                IsolatedEthernet::instance().invalidateSocketStatus(_sock);
+                IsolatedEthernet::instance().socketRelease(_sock, true);
+                _sock = -1;
             }
         }
         else {
             IsolatedEthernet::instance().appLog.trace("TCPServer socket error %d", (int) res);
+            IsolatedEthernet::instance().socketRelease(sock, true);
         }
     }
     else {
@@ -1121,9 +3481,11 @@ void IsolatedEthernet::TCPServer::stop() {
     _client.stop();
     if (_sock >= 0) {
         int8_t res = wiznet::disconnect(_sock);
+        IsolatedEthernet::instance().invalidateSocketStatus(_sock);
         if (res != SOCK_OK) {
             IsolatedEthernet::instance().appLog.trace("sock %d disconnect failed %d", _sock, (int) res);
         }
+        IsolatedEthernet::instance().socketRelease(_sock, false);
     }
     _sock = -1;
 }
@@ -1135,16 +3497,22 @@ IsolatedEthernet::TCPClient IsolatedEthernet::TCPServer::available() {
         begin();
     }
 
-    uint8_t status;
-    wiznet::getsockopt(_sock, wiznet::SO_STATUS, &status);
-    if (status != SOCK_ESTABLISHED) {
+    SocketStatus status;
+    if (!IsolatedEthernet::instance().getSocketStatus(_sock, status) || status.sr != SOCK_ESTABLISHED) {
         _client = *s_invalid_client;
         return _client;
     }
 
+    // The listener socket becomes the client socket
+    IsolatedEthernet::instance().socketSetOwner(_sock, SocketOwner::TCP_CLIENT);
     TCPServerClient client = TCPServerClient(_sock);
     client.d_->remoteIP = client.remoteIP(); // fetch the peer IP ready for the copy operator
+    client.d_->keepAlive = _keepAlive;
+    if (_keepAlive) {
+        IsolatedEthernet::instance().peerWatch(_sock, true);
+    }
     _client = client;
+    _sock = -1;
 
     // Start a new listener
     startListener();
@@ -1171,6 +3539,204 @@ size_t IsolatedEthernet::TCPServer::write(const uint8_t *buffer, size_t size) {
     return write(buffer, size, SOCKET_WAIT_FOREVER);
 }
 
+//
+// IsolatedEthernet::TCPClientPool
+//
+
+IsolatedEthernet::TCPClientPool::TCPClientPool()
+{
+}
+
+IsolatedEthernet::TCPClientPool::~TCPClientPool()
+{
+    if (registered)
+    {
+        IsolatedEthernet &eth = IsolatedEthernet::instance();
+        std::lock_guard<Mutex> lock(eth.clientPoolsMutex);
+        for (auto it = eth.clientPools.begin(); it != eth.clientPools.end(); it++)
+        {
+            if (*it == this)
+            {
+                eth.clientPools.erase(it);
+                break;
+            }
+        }
+    }
+    closeAll();
+}
+
+IsolatedEthernet::TCPClient IsolatedEthernet::TCPClientPool::lease(IPAddress ip, uint16_t port)
+{
+    registerPool();
+
+    while(true)
+    {
+        TCPClient client;
+        bool found = false;
+        {
+            std::lock_guard<Mutex> lock(mutex);
+            expireLocked();
+
+            // Most recently used first, as it's the least likely to have been closed by the server
+            for (size_t ii = idle.size(); ii-- > 0; )
+            {
+                if (idle[ii].port == port && idle[ii].ip == ip)
+                {
+                    client = idle[ii].client;
+                    idle.erase(idle.begin() + ii);
+                    found = true;
+                    break;
+                }
+            }
+        }
+        if (!found)
+        {
+            break;
+        }
+
+        if (isReusable(client))
+        {
+            std::lock_guard<Mutex> lock(mutex);
+            stats.leases++;
+            stats.reused++;
+            return client;
+        }
+
+        IsolatedEthernet::instance().appLog.trace("pool sock %d not reusable, closing", client.sock_handle());
+        client.stop();
+        std::lock_guard<Mutex> lock(mutex);
+        stats.discarded++;
+    }
+
+    // Not holding the mutex while connecting, as socketAlloc() may call evictOldest()
+    TCPClient client;
+    if (client.connect(ip, port))
+    {
+        std::lock_guard<Mutex> lock(mutex);
+        stats.leases++;
+    }
+    return client;
+}
+
+void IsolatedEthernet::TCPClientPool::release(TCPClient &client)
+{
+    if (client.sock_handle() < 0)
+    {
+        return;
+    }
+    registerPool();
+
+    TCPClient pooled = client;
+    client = TCPClient();
+
+    if (!maxIdle || pooled.d_->remotePort == 0 || !isReusable(pooled))
+    {
+        pooled.stop();
+        return;
+    }
+
+    std::lock_guard<Mutex> lock(mutex);
+    expireLocked();
+    while(idle.size() >= maxIdle && evictOldestLocked())
+    {
+    }
+
+    Entry entry;
+    entry.client = pooled;
+    entry.ip = pooled.remoteIP();
+    entry.port = pooled.d_->remotePort;
+    entry.releasedMs = millis();
+    idle.push_back(entry);
+}
+
+void IsolatedEthernet::TCPClientPool::expire()
+{
+    std::lock_guard<Mutex> lock(mutex);
+    expireLocked();
+}
+
+void IsolatedEthernet::TCPClientPool::closeAll()
+{
+    std::lock_guard<Mutex> lock(mutex);
+    for (auto &entry : idle)
+    {
+        entry.client.stop();
+    }
+    idle.clear();
+}
+
+size_t IsolatedEthernet::TCPClientPool::idleCount()
+{
+    std::lock_guard<Mutex> lock(mutex);
+    return idle.size();
+}
+
+IsolatedEthernet::TCPClientPool::Stats IsolatedEthernet::TCPClientPool::getStats()
+{
+    std::lock_guard<Mutex> lock(mutex);
+    return stats;
+}
+
+bool IsolatedEthernet::TCPClientPool::isReusable(TCPClient &client)
+{
+    int sock = client.sock_handle();
+    if (sock < 0 || client.bufferCount() || client.txQueued())
+    {
+        return false;
+    }
+
+    // A connection the server closed is CLOSE_WAIT or CLOSED, and unread data is left over from an earlier response
+    SocketStatus status;
+    return IsolatedEthernet::instance().getSocketStatus(sock, status, true) &&
+        status.sr == SOCK_ESTABLISHED && status.rxRsr == 0 &&
+        IsolatedEthernet::instance().rxRingAvailable(sock) == 0;
+}
+
+bool IsolatedEthernet::TCPClientPool::evictOldestLocked()
+{
+    if (idle.empty())
+    {
+        return false;
+    }
+    idle.front().client.stop();
+    idle.erase(idle.begin());
+    stats.evicted++;
+    return true;
+}
+
+bool IsolatedEthernet::TCPClientPool::evictOldest()
+{
+    std::lock_guard<Mutex> lock(mutex);
+    return evictOldestLocked();
+}
+
+void IsolatedEthernet::TCPClientPool::expireLocked()
+{
+    while(!idle.empty() && millis() - idle.front().releasedMs >= maxIdleMs)
+    {
+        idle.front().client.stop();
+        idle.erase(idle.begin());
+        stats.expired++;
+    }
+}
+
+void IsolatedEthernet::TCPClientPool::registerPool()
+{
+    {
+        std::lock_guard<Mutex> lock(mutex);
+        if (registered)
+        {
+            return;
+        }
+        registered = true;
+    }
+
+    // Not done in the constructor, so global pools don't depend on construction order
+    IsolatedEthernet &eth = IsolatedEthernet::instance();
+    std::lock_guard<Mutex> lock(eth.clientPoolsMutex);
+    eth.clientPools.push_back(this);
+}
+
 //
 // UDP
 //
@@ -1216,20 +3782,27 @@ uint8_t IsolatedEthernet::UDP::begin(uint16_t port, network_interface_t nif) {
     stop();
 
     bool result = false;
-    int sock = IsolatedEthernet::instance().socketGetFree();
+    int sock = IsolatedEthernet::instance().socketAlloc(SocketOwner::UDP, _service, _minTxSize, _minRxSize);
     if (sock >= 0) {
         IsolatedEthernet::instance().appLog.trace("UDP using socket=%d", (int)sock);
 
-        int8_t res = wiznet::socket((uint8_t) sock, Sn_MR_UDP, port, 0x00);
+        IsolatedEthernet::instance().applySocketOptions(sock, _socketOptions);
+        int8_t res = wiznet::socket((uint8_t) sock, Sn_MR_UDP, port, (_asyncSend || _txQueueSize) ? SF_IO_NONBLOCK : 0x00);
+        IsolatedEthernet::instance().invalidateSocketStatus(sock);
+        IsolatedEthernet::instance().udpSendCancel(sock);
         if (res >= 0) {
             _sock = sock;
             _port = port;
+            if (_txQueueSize) {
+                IsolatedEthernet::instance().txQueueOpen(sock, true, _txQueueSize, _txQueuePolicy, _txQueueHigh, _txQueueLow);
+            }
             // IsolatedEthernet::instance().appLog.trace("UDP socket() success");
 
             result = true;
         }
         else {
             IsolatedEthernet::instance().appLog.trace("UDP socket error %d", (int) res);
+            IsolatedEthernet::instance().socketRelease(sock, true);
         }
     }
     else {
@@ -1245,10 +3818,13 @@ int IsolatedEthernet::UDP::available() {
 void IsolatedEthernet::UDP::stop() {
     if (isOpen(_sock)) {
         int8_t res = wiznet::close(_sock);
+        IsolatedEthernet::instance().invalidateSocketStatus(_sock);
+        IsolatedEthernet::instance().udpSendCancel(_sock);
         if (res != SOCK_OK) {
             IsolatedEthernet::instance().appLog.trace("sock %d disconnect failed %d", _sock, (int) res);
         }
     }
+    IsolatedEthernet::instance().socketRelease(_sock, true);
 
     _sock = -1;
 
@@ -1284,7 +3860,9 @@ int IsolatedEthernet::UDP::beginPacket(IPAddress ip, uint16_t port) {
 
 int IsolatedEthernet::UDP::endPacket() {
     int result = sendPacket(_buffer, _offset, _remoteIP, _remotePort);
-    flush(); // wait for send to complete
+    if (!_asyncSend && !_txQueueSize) {
+        flush(); // wait for send to complete
+    }
     return result;
 }
 
@@ -1294,7 +3872,67 @@ int IsolatedEthernet::UDP::sendPacket(const uint8_t* buffer, size_t buffer_size,
     uint8_t addr[4];
     IsolatedEthernet::ipAddressToArray(remoteIP, addr);
 
-    return wiznet::sendto(_sock, const_cast<uint8_t *>(buffer), buffer_size, addr, port);
+    if (IsolatedEthernet::instance().txQueueActive(_sock)) {
+        // The worker thread sends it; the timeout only matters with TxQueuePolicy::BLOCK
+        return IsolatedEthernet::instance().txQueueWriteDatagram(_sock, buffer, buffer_size, addr, port, 1000);
+    }
+
+    if (_asyncSend && sendStatus() == SOCK_BUSY) {
+        return SOCK_BUSY;
+    }
+
+    int result = wiznet::sendto(_sock, const_cast<uint8_t *>(buffer), buffer_size, addr, port);
+    if (_asyncSend && result > 0) {
+        IsolatedEthernet::instance().udpSendBegin(_sock);
+    }
+    return result;
+}
+
+IsolatedEthernet::UDP &IsolatedEthernet::UDP::withAsyncSend(bool async) {
+    _asyncSend = async;
+    if (isOpen(_sock)) {
+        uint8_t mode = (async || _txQueueSize) ? SOCK_IO_NONBLOCK : SOCK_IO_BLOCK;
+        wiznet::ctlsocket(_sock, wiznet::CS_SET_IOMODE, &mode);
+    }
+    return *this;
+}
+
+static_assert(IsolatedEthernet::UDP::SEND_STATUS_OK == SOCK_OK, "SEND_STATUS_OK must match socket.h");
+static_assert(IsolatedEthernet::UDP::SEND_STATUS_BUSY == SOCK_BUSY, "SEND_STATUS_BUSY must match socket.h");
+static_assert(IsolatedEthernet::UDP::SEND_STATUS_TIMEOUT == SOCKERR_TIMEOUT, "SEND_STATUS_TIMEOUT must match socket.h");
+static_assert(IsolatedEthernet::TCPClient::CONNECT_STATUS_OK == SOCK_OK, "CONNECT_STATUS_OK must match socket.h");
+static_assert(IsolatedEthernet::TCPClient::CONNECT_STATUS_BUSY == SOCK_BUSY, "CONNECT_STATUS_BUSY must match socket.h");
+static_assert(IsolatedEthernet::TCPClient::CONNECT_STATUS_CLOSED == SOCKERR_SOCKCLOSED, "CONNECT_STATUS_CLOSED must match socket.h");
+static_assert(IsolatedEthernet::TCPClient::CONNECT_STATUS_TIMEOUT == SOCKERR_TIMEOUT, "CONNECT_STATUS_TIMEOUT must match socket.h");
+
+int IsolatedEthernet::UDP::sendStatus() {
+    if (IsolatedEthernet::instance().txQueued(_sock)) {
+        return SOCK_BUSY;
+    }
+    return IsolatedEthernet::instance().udpSendPoll(_sock);
+}
+
+IsolatedEthernet::UDP &IsolatedEthernet::UDP::withTxQueue(size_t queueSize, TxQueuePolicy policy, size_t highWatermark, size_t lowWatermark) {
+    _txQueueSize = queueSize;
+    _txQueuePolicy = policy;
+    _txQueueHigh = highWatermark;
+    _txQueueLow = lowWatermark;
+    if (isOpen(_sock)) {
+        if (_txQueueSize) {
+            // The worker thread must not wait for each datagram
+            uint8_t mode = SOCK_IO_NONBLOCK;
+            wiznet::ctlsocket(_sock, wiznet::CS_SET_IOMODE, &mode);
+            IsolatedEthernet::instance().txQueueOpen(_sock, true, _txQueueSize, _txQueuePolicy, _txQueueHigh, _txQueueLow);
+        }
+        else {
+            IsolatedEthernet::instance().txQueueClose(_sock);
+        }
+    }
+    return *this;
+}
+
+size_t IsolatedEthernet::UDP::txQueued() {
+    return IsolatedEthernet::instance().txQueued(_sock);
 }
 
 size_t IsolatedEthernet::UDP::write(uint8_t byte) {
@@ -1334,14 +3972,23 @@ int IsolatedEthernet::UDP::receivePacket(uint8_t* buffer, size_t size, system_ti
         unsigned long start = millis();
 
         do {
-            if (getSn_RX_RSR(_sock) > 0) {
+            if (IsolatedEthernet::instance().rxRingActive(_sock)) {
+                // The worker thread has already moved received datagrams into RAM
+                ret = IsolatedEthernet::instance().rxRingReadDatagram(_sock, buffer, size, addr, &_remotePort);
+                if (ret >= 0) {
+                    _remoteIP = IPAddress(addr);
+                    return ret;
+                }
+            }
+            else if (getSn_RX_RSR(_sock) > 0) {
                 ret = wiznet::recvfrom(_sock, buffer, size, addr, &_remotePort);
 
                 _remoteIP = IPAddress(addr);
                 return ret;
                 // LOG_DEBUG(TRACE, "received %d bytes from %s#%d", ret, _remoteIP.toString().c_str(), _remotePort);
             }    
-            delay(1);
+            unsigned long elapsed = millis() - start;
+            IsolatedEthernet::instance().waitSocketEvent(_sock, (elapsed < timeout) ? timeout - elapsed : 0);
             ret = 0;
         } while((timeout != 0) && ((millis() - start) < timeout));
     }
@@ -1367,6 +4014,9 @@ int IsolatedEthernet::UDP::peek() {
 }
 
 void IsolatedEthernet::UDP::flush() {
+    while((_asyncSend || _txQueueSize) && isOpen(_sock) && sendStatus() == SOCK_BUSY) {
+        IsolatedEthernet::instance().waitSocketEvent(_sock, 1000);
+    }
 }
 
 void IsolatedEthernet::UDP::flush_buffer() {
@@ -1390,14 +4040,16 @@ int IsolatedEthernet::UDP::joinMulticast(const IPAddress& ip) {
     IsolatedEthernet::ipAddressToArray(ip, addr);
 
     bool result = false;
-    int sock = IsolatedEthernet::instance().socketGetFree();
+    int sock = IsolatedEthernet::instance().socketAlloc(SocketOwner::UDP, _service, _minTxSize, _minRxSize);
     if (sock >= 0) {
         IsolatedEthernet::instance().appLog.trace("UDP multicast using socket=%d", (int)sock);
 
         setSn_DIPR(sock, addr);
         setSn_DPORT(sock, _port);
 
+        IsolatedEthernet::instance().applySocketOptions(sock, _socketOptions);
         int8_t res = wiznet::socket((uint8_t) sock, Sn_MR_UDP, _port, Sn_MR_MULTI);
+        IsolatedEthernet::instance().invalidateSocketStatus(sock);
         if (res >= 0) {
             _sock = sock;
             // IsolatedEthernet::instance().appLog.trace("UDP multicast socket() success");
@@ -1406,6 +4058,7 @@ int IsolatedEthernet::UDP::joinMulticast(const IPAddress& ip) {
         }
         else {
             IsolatedEthernet::instance().appLog.trace("UDP multicast socket error %d", (int) res);
+            IsolatedEthernet::instance().socketRelease(sock, true);
         }
     }
     else {
@@ -1423,8 +4076,7 @@ int IsolatedEthernet::UDP::leaveMulticast(const IPAddress& ip) {
 }
 
 bool IsolatedEthernet::UDP::isOpen(sock_handle_t sn) {
-    uint8_t status;
-    wiznet::getsockopt((uint8_t)sn, wiznet::SO_STATUS, &status);
-    return status == SOCK_UDP;
+    SocketStatus status;
+    return IsolatedEthernet::instance().getSocketStatus(sn, status) && status.sr == SOCK_UDP;
 }
 
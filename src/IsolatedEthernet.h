@@ -2,6 +2,7 @@
 #define __ISOLATEDETHERNET_H
 
 #include "Particle.h"
+#include <atomic>
 #include <vector>
 
 /**
@@ -25,6 +26,25 @@
 class IsolatedEthernet {
 public:
     class TCPServer; // Forward declaration
+    class TCPClientPool; // Forward declaration
+
+    /**
+     * @brief What a TCPClient or UDP object does when its withTxQueue() queue is full
+     */
+    enum class TxQueuePolicy {
+        BLOCK,          //!< Wait for space, up to the write timeout
+        DROP_OLDEST,    //!< Discard the oldest queued data to make room
+        FAIL,           //!< Return 0 without queueing anything
+    };
+
+    /**
+     * @brief Per-socket IP and TCP settings, set with withMss(), withTtl() and withTos() on TCPClient, TCPServer and UDP
+     */
+    struct SocketOptions {
+        uint16_t mss = 0;           //!< Sn_MSSR, TCP maximum segment size (UDP: largest datagram). 0 = W5500 default, 1460 for TCP.
+        uint8_t ttl = 128;          //!< Sn_TTL, IP time to live (W5500 default 128)
+        uint8_t tos = 0;            //!< Sn_TOS, IP type of service, DSCP in the upper 6 bits (W5500 default 0)
+    };
 
     /**
      * @brief TCPClient class used to access the isolated Ethernet
@@ -83,6 +103,113 @@ public:
          */
         virtual int connect(const char *host, uint16_t port, network_interface_t=0);
 
+        /**
+         * @brief Starts connecting to a host by IP address without waiting for the connection
+         * 
+         * @param ip The IP address to connect to 
+         * @param port The IP port number to connect to
+         * @return int true (1) if the connection was started or false (0) if not, for example no free socket.
+         * 
+         * Check the result later using connectStatus(), or register a CallbackType::tcpConnectComplete callback
+         * using IsolatedEthernet::withCallback(). Each TCPClient uses its own socket, so several connections can 
+         * be in progress at the same time. How long the W5500 tries before giving up is set by 
+         * IsolatedEthernet::withRetransmission(), about 32 seconds by default.
+         * 
+         * With withTxQueue(), data written while connecting is queued and sent once connected. Without it, wait
+         * for CONNECT_STATUS_OK before writing. stop() abandons a connection in progress.
+         */
+        int connectAsync(IPAddress ip, uint16_t port);
+
+        /**
+         * @brief Starts connecting to a host by its DNS hostname without waiting for the connection
+         * 
+         * @param host the hostname to connect to
+         * @param port The IP port number to connect to
+         * @return int true (1) if the connection was started or false (0) if not.
+         * 
+         * The DNS lookup blocks; only the TCP connection is made in the background. Use the IPAddress
+         * overload if you already know the address.
+         */
+        int connectAsync(const char *host, uint16_t port);
+
+        static const int CONNECT_STATUS_OK = 1;         //!< connectStatus() connected (SOCK_OK)
+        static const int CONNECT_STATUS_BUSY = 0;       //!< connectStatus() connection in progress (SOCK_BUSY)
+        static const int CONNECT_STATUS_CLOSED = -4;    //!< connectStatus() refused, reset, not connected, or stopped (SOCKERR_SOCKCLOSED)
+        static const int CONNECT_STATUS_TIMEOUT = -13;  //!< connectStatus() the remote host did not respond (SOCKERR_TIMEOUT)
+
+        /**
+         * @brief Gets the progress of the connection started by connectAsync() or connect()
+         * 
+         * @return CONNECT_STATUS_OK if connected, CONNECT_STATUS_BUSY if still connecting, or CONNECT_STATUS_TIMEOUT
+         * or CONNECT_STATUS_CLOSED if it failed. 
+         * 
+         * When the connection fails, the socket is released as if stop() had been called. This also calls the
+         * CallbackType::tcpConnectComplete callbacks if the connection finished since it was last checked. 
+         * The worker thread checks every millisecond (or on the W5500 interrupt) as well, so you can use the 
+         * callback instead of polling.
+         */
+        int connectStatus();
+
+        /**
+         * @brief Sends TCP keep-alive packets while the connection is idle, to detect a peer that has gone away
+         * 
+         * @param seconds Idle time between keep-alive packets, rounded up to a multiple of 5 seconds, up to 
+         * 1275. 0 (the default) turns keep-alive off.
+         * 
+         * @return TCPClient& Reference to this object so you can chain options, fluent-style.
+         * 
+         * The W5500 sends the keep-alive packets itself (Sn_KPALVTR), starting after the first data has been
+         * sent or received. If the peer doesn't respond within the retransmission timeout, the W5500 closes 
+         * the socket. The CallbackType::tcpPeerLost callbacks are called, connected() returns false and the
+         * socket is released for other connections. Without keep-alive, a connection to a peer that lost 
+         * power or its network stays open until you write to it.
+         * 
+         * Can be set before or after connect().
+         */
+        TCPClient &withKeepAlive(unsigned seconds);
+
+        /**
+         * @brief Sets the TCP maximum segment size for this connection (Sn_MSSR)
+         * 
+         * @param mss Maximum segment size in bytes, 0 (default) for the W5500 default of 1460, a full 1500 byte 
+         * Ethernet frame. Use a smaller value if there is a tunnel or VPN with a smaller MTU on the path.
+         * 
+         * @return TCPClient& Reference to this object so you can chain options, fluent-style.
+         * 
+         * Takes effect on the next connect(). withMss(), withTtl() and withTos() are only written to the W5500
+         * when they differ from the previous use of the socket.
+         */
+        TCPClient &withMss(uint16_t mss) { d_->socketOptions.mss = mss; return *this; };
+
+        /**
+         * @brief Sets the IP time to live for this connection (Sn_TTL, default 128). Takes effect on the next connect().
+         */
+        TCPClient &withTtl(uint8_t ttl) { d_->socketOptions.ttl = ttl; return *this; };
+
+        /**
+         * @brief Sets the IP type of service for this connection (Sn_TOS, default 0). Takes effect on the next connect().
+         * 
+         * The upper 6 bits are the DSCP, for example 0xb8 for Expedited Forwarding (DSCP 46).
+         */
+        TCPClient &withTos(uint8_t tos) { d_->socketOptions.tos = tos; return *this; };
+
+        /**
+         * @brief Sends one keep-alive packet now
+         * 
+         * @return int 1 (SOCK_OK) if sent, or a negative error code. Not allowed while withKeepAlive() is on.
+         * 
+         * Like withKeepAlive(), this only works after data has been sent or received. If the peer doesn't 
+         * respond, the socket is closed and the CallbackType::tcpPeerLost callbacks are called.
+         */
+        int sendKeepAlive();
+
+        /**
+         * @brief Returns the W5500 socket number of this connection, or -1 if not connected
+         * 
+         * This is the sock member of the callback data, for example TcpPeerLost.
+         */
+        sock_handle_t socket() { return sock_handle(); }
+
         /**
          * @brief Writes a single byte to the remote host
          * 
@@ -111,8 +238,9 @@ public:
          * 
          * @return size_t The number of bytes written, typically 1.
          * 
-         * Internally, the W5500 can't buffer more than 2048 bytes of data, however this library
-         * will break up your send into chunks to fit in the available buffer space.
+         * Internally, the W5500 can't buffer more than the socket TX buffer size (2048 bytes by default, see
+         * withSocketBufferSizes()), however this library will break up your send into chunks to fit in the
+         * available buffer space.
          * 
          * This overload does not take a timeout and uses the default timeout of 30 seconds.
          * The timeout is for the whole send, not individual chunks. If the timeout is 
@@ -153,8 +281,9 @@ public:
          * 
          * @return size_t The number of bytes written, typically 1.
          * 
-         * Internally, the W5500 can't buffer more than 2048 bytes of data, however this library
-         * will break up your send into chunks to fit in the available buffer space.
+         * Internally, the W5500 can't buffer more than the socket TX buffer size (2048 bytes by default, see
+         * withSocketBufferSizes()), however this library will break up your send into chunks to fit in the
+         * available buffer space.
          * 
          * The timeout is for the whole send, not individual chunks. If the timeout is 
          * exceeded there is no guarantee of how many bytes were actually sent.
@@ -165,12 +294,72 @@ public:
          */                
         virtual size_t write(const uint8_t *buffer, size_t size, system_tick_t timeout);
 
+        /**
+         * @brief Writes directly into the W5500 TX buffer during writeFrom()
+         *
+         * Data is copied straight to the W5500 over SPI; there is no intermediate buffer. Writes past
+         * available() are truncated. Use write(buf, len), print(), or printf() rather than writing single
+         * bytes, as each write is a separate SPI transaction.
+         */
+        class TxWriter : public Print {
+        public:
+            /**
+             * @brief Number of bytes that can still be written
+             */
+            size_t available() const { return limit - offset; }
+
+            /**
+             * @brief Number of bytes written so far
+             */
+            size_t written() const { return offset; }
+
+            virtual size_t write(uint8_t b);
+            virtual size_t write(const uint8_t *buffer, size_t size);
+
+            using Print::write;
+
+        private:
+            TxWriter(sock_handle_t sock, uint16_t ptr, size_t limit) : sock(sock), ptr(ptr), limit(limit) {};
+
+            sock_handle_t sock;
+            uint16_t ptr;           //!< Sn_TX_WR at the start of the reservation
+            size_t limit;           //!< Free space in the TX buffer
+            size_t offset = 0;      //!< Bytes written
+
+            friend class TCPClient;
+        };
+
+        /**
+         * @brief Returns the number of bytes that can be written without waiting
+         *
+         * @return int Free space in the W5500 TX buffer, or 0 if not connected
+         */
+        virtual int availableForWrite();
+
+        /**
+         * @brief Zero-copy write: a producer function writes directly into the W5500 TX buffer
+         *
+         * @param producer Called once with a TxWriter. TxWriter::available() is the free space in the TX
+         * buffer; write up to that many bytes. Writing nothing is allowed.
+         *
+         * @return int Number of bytes written and queued to send, 0 if the TX buffer is full or the producer
+         * wrote nothing, or a negative error code.
+         *
+         * Avoids copying the data into a RAM buffer first when the data is generated on the fly (formatting,
+         * sensor data, reading from a file). The data is sent with a single Sn_TX_WR update and SEND, subject
+         * to cork() and withCoalescing(). Wrap in the TX ring buffer is handled for you.
+         *
+         * Do not call other write functions on this connection from the producer.
+         */
+        int writeFrom(std::function<void(TxWriter &writer)> producer);
+
         /**
          * @brief Returns the number of bytes available to read
          * 
          * @return int number of bytes
          * 
-         * Note that the receive buffer is only 2048 bytes on the W5500. Thus the other side of
+         * Note that the receive buffer is only 2048 bytes on the W5500 by default (see
+         * IsolatedEthernet::withSocketBufferSizes()). Thus the other side of
          * the connection may be holding more data that has not been received by the W5500
          * yet. 
          * 
@@ -203,8 +392,12 @@ public:
          * size requested; if any bytes are available they will be copied to buffer and the result
          * will be the number of bytes actually read.
          * 
-         * The optimize request size is 2048 bytes, which is the size of the incoming data
-         * buffer. Making it larger will have no effect since there will never be more bytes
+         * Reads of TCPCLIENT_BUF_MAX_SIZE bytes or more copy any bytes already in the internal buffer,
+         * then receive directly from the W5500 into buffer with a single RECV command, without going
+         * through the internal buffer. This is much faster for large downloads.
+         * 
+         * The optimize request size is the socket RX buffer size, 2048 bytes by default, which is the
+         * size of the incoming data buffer. Making it larger will have no effect since there will never be more bytes
          * in the buffer.
          */
         virtual int read(uint8_t *buffer, size_t size);
@@ -218,9 +411,113 @@ public:
 
         /**
          * @brief Blocks until all data waiting to be sent in the W5500 send buffer has been sent
+         *
+         * This also sends data held by cork() or withCoalescing(), and waits for the withTxQueue() queue
+         * to empty first.
          */
         virtual void flush();
 
+        /**
+         * @brief Holds written data in the W5500 TX buffer until uncork() instead of sending each write
+         *
+         * Each write(), print(), or printf() normally results in a SEND command and a TCP segment, so a println()
+         * costs two segments. While corked, writes are appended to the TX buffer and go out together. A full
+         * segment (withCoalescing() flushSize, default 1460 bytes) is still sent as soon as it's available, and
+         * flush(), uncork() and stop() send the rest.
+         *
+         * Only has an effect while connected. connect() starts out uncorked.
+         */
+        void cork();
+
+        /**
+         * @brief Ends cork() and sends the held data
+         *
+         * If withCoalescing() is enabled, writes continue to be coalesced using its idle time.
+         */
+        void uncork();
+
+        /**
+         * @brief Coalesce small writes into larger segments automatically
+         *
+         * @param flushSize Send as soon as this many bytes are waiting. Default is 1460, the Ethernet TCP MSS.
+         * 0 turns coalescing off.
+         *
+         * @param flushIdleMs Send what's waiting when there have been no writes for this many milliseconds.
+         * The worker thread checks every millisecond. Default is 2.
+         *
+         * @return TCPClient& Reference to this object so you can chain options, fluent-style.
+         *
+         * This is like cork() with a timer, and is well suited to line-oriented protocols that write using
+         * print() and println(). It can be set before or after connect(). Latency of a single small write
+         * increases by up to flushIdleMs; call flush() to send immediately.
+         */
+        TCPClient &withCoalescing(size_t flushSize = 1460, system_tick_t flushIdleMs = 2);
+
+        /**
+         * @brief Only connect using a socket with at least this much W5500 buffer space
+         *
+         * @param txSize Minimum TX buffer size in bytes, or 0 for any size
+         *
+         * @param rxSize Minimum RX buffer size in bytes, or 0 for any size
+         *
+         * @return TCPClient& Reference to this object so you can chain options, fluent-style.
+         *
+         * Use with IsolatedEthernet::withSocketBufferSizes() so a bulk transfer connection gets the large
+         * buffers. If no free socket is large enough, connect() fails. Takes effect on the next connect().
+         */
+        TCPClient &withSocketBufferSize(size_t txSize, size_t rxSize);
+
+        /**
+         * @brief Sets the service name for IsolatedEthernet::withSocketReservation()
+         *
+         * @param service Service name. Only the pointer is stored, so this is typically a string literal.
+         *
+         * @return TCPClient& Reference to this object so you can chain options, fluent-style.
+         *
+         * The connection can use the sockets reserved for this service. Takes effect on the next connect().
+         */
+        TCPClient &withSocketService(const char *service);
+
+        /**
+         * @brief Queue writes in RAM and send them from the worker thread
+         *
+         * @param queueSize Size of the queue in bytes, allocated from the heap while connected. 0 turns 
+         * the queue off.
+         *
+         * @param policy What write() does when the queue does not have room for all of the data:
+         * TxQueuePolicy::FAIL returns 0 without queueing anything, TxQueuePolicy::DROP_OLDEST discards the
+         * oldest queued bytes that have not been sent yet, and TxQueuePolicy::BLOCK waits for space like 
+         * write() without a queue. Default is FAIL.
+         *
+         * @param highWatermark Calls the CallbackType::txQueueHigh callbacks when this many bytes are 
+         * queued. Default (0) is 3/4 of queueSize.
+         *
+         * @param lowWatermark After txQueueHigh, calls the CallbackType::txQueueLow callbacks when the
+         * queue drops to this many bytes. Default (0) is 1/4 of queueSize.
+         *
+         * @return TCPClient& Reference to this object so you can chain options, fluent-style.
+         *
+         * Without a queue, write() waits when the W5500 TX buffer is full, up to 
+         * SPARK_WIRING_TCPCLIENT_DEFAULT_SEND_TIMEOUT. With a queue, write() copies the data into the queue
+         * and returns, and the worker thread moves it into the TX buffer as space frees up. Since TCP is 
+         * a byte stream, DROP_OLDEST can discard part of an earlier write; use it when the receiver can
+         * resynchronize, for example with line-oriented data.
+         *
+         * The txQueueHigh callback is called from the thread that called write() and txQueueLow from the 
+         * worker thread, so keep them short. availableForWrite() returns the free space in the queue, 
+         * writeFrom() only writes when the queue is empty, and stop() waits up to 5 seconds for the queue
+         * to be sent and discards the rest. When called from a callback (on the worker thread) or after the
+         * connection is lost, stop() discards the queue without waiting.
+         *
+         * Can be set before or after connect().
+         */
+        TCPClient &withTxQueue(size_t queueSize, TxQueuePolicy policy = TxQueuePolicy::FAIL, size_t highWatermark = 0, size_t lowWatermark = 0);
+
+        /**
+         * @brief Returns the number of bytes in the withTxQueue() queue that have not been moved to the W5500 yet
+         */
+        size_t txQueued();
+
         /**
          * @brief Discards data waiting to be read from the internal buffer
          * 
@@ -265,6 +562,7 @@ public:
 
 
         friend class IsolatedEthernet::TCPServer;
+        friend class IsolatedEthernet::TCPClientPool;
 
         using Print::write;
     protected:
@@ -283,6 +581,33 @@ public:
          */
         inline sock_handle_t sock_handle() { return d_->sock; }
 
+        /**
+         * @brief Applies the cork() and withCoalescing() settings to the open socket
+         */
+        void applyCoalescing();
+
+        /**
+         * @brief Opens the withTxQueue() queue for the open socket
+         */
+        void applyTxQueue();
+
+        /**
+         * @brief Applies the withKeepAlive() setting to the open socket
+         */
+        void applyKeepAlive();
+
+        /**
+         * @brief Sends data held by cork() or withCoalescing() once there's a full segment. Used internally after writing.
+         */
+        void coalesceAfterWrite();
+
+        /**
+         * @brief Receives up to size bytes from the W5500 directly into buffer, bypassing the internal buffer. Used internally.
+         *
+         * @return int Number of bytes read, 0 if none are available, or a negative error code
+         */
+        int readDirect(uint8_t *buffer, size_t size);
+
     private:
         struct Data {
             sock_handle_t sock;
@@ -290,6 +615,20 @@ public:
             uint16_t offset;
             uint16_t total;
             IPAddress remoteIP;
+            uint16_t remotePort = 0;        //!< Port passed to connect(), 0 for TCPServer connections
+            bool corked = false;            //!< cork() was called
+            uint16_t coalesceSize = 0;      //!< withCoalescing() flushSize, 0 = off
+            uint16_t coalesceIdleMs = 0;    //!< withCoalescing() flushIdleMs
+            size_t minTxSize = 0;           //!< withSocketBufferSize() txSize
+            size_t minRxSize = 0;           //!< withSocketBufferSize() rxSize
+            const char *service = NULL;     //!< withSocketService()
+            size_t txQueueSize = 0;         //!< withTxQueue() queueSize, 0 = off
+            TxQueuePolicy txQueuePolicy = TxQueuePolicy::FAIL; //!< withTxQueue() policy
+            size_t txQueueHigh = 0;         //!< withTxQueue() highWatermark
+            size_t txQueueLow = 0;          //!< withTxQueue() lowWatermark
+            int connectResult = CONNECT_STATUS_CLOSED; //!< connectStatus() after a failed connect or stop()
+            uint8_t keepAlive = 0;          //!< withKeepAlive() in Sn_KPALVTR units of 5 seconds, 0 = off
+            SocketOptions socketOptions;    //!< withMss(), withTtl(), withTos()
 
             explicit Data(sock_handle_t sock);
             ~Data();
@@ -438,6 +777,57 @@ public:
          */
         void stop();
 
+        /**
+         * @brief Only listen using a socket with at least this much W5500 buffer space
+         *
+         * @param txSize Minimum TX buffer size in bytes, or 0 for any size
+         *
+         * @param rxSize Minimum RX buffer size in bytes, or 0 for any size
+         *
+         * @return TCPServer& Reference to this object so you can chain options, fluent-style.
+         *
+         * On the W5500, the listener socket becomes the client socket when a connection is accepted, so
+         * this sets the buffer size for the connections returned by available(). Call before begin().
+         */
+        TCPServer &withSocketBufferSize(size_t txSize, size_t rxSize) { _minTxSize = txSize; _minRxSize = rxSize; return *this; };
+
+        /**
+         * @brief Sets the service name for IsolatedEthernet::withSocketReservation()
+         *
+         * @param service Service name. Only the pointer is stored, so this is typically a string literal.
+         *
+         * @return TCPServer& Reference to this object so you can chain options, fluent-style.
+         *
+         * The listener can use the sockets reserved for this service. Call before begin().
+         */
+        TCPServer &withSocketService(const char *service) { _service = service; return *this; };
+
+        /**
+         * @brief Turns on TCP keep-alive for the connections returned by available()
+         *
+         * @param seconds Idle time between keep-alive packets, rounded up to a multiple of 5 seconds. 0 = off.
+         *
+         * @return TCPServer& Reference to this object so you can chain options, fluent-style.
+         *
+         * See TCPClient::withKeepAlive(). Call before begin().
+         */
+        TCPServer &withKeepAlive(unsigned seconds);
+
+        /**
+         * @brief Sets the TCP maximum segment size for the connections returned by available(). See TCPClient::withMss(). Call before begin().
+         */
+        TCPServer &withMss(uint16_t mss) { _socketOptions.mss = mss; return *this; };
+
+        /**
+         * @brief Sets the IP time to live for the connections returned by available(). Call before begin().
+         */
+        TCPServer &withTtl(uint8_t ttl) { _socketOptions.ttl = ttl; return *this; };
+
+        /**
+         * @brief Sets the IP type of service for the connections returned by available(). Call before begin().
+         */
+        TCPServer &withTos(uint8_t tos) { _socketOptions.tos = tos; return *this; };
+
     private:
         /**
          * @brief Used internally to start a new listener
@@ -454,10 +844,174 @@ public:
         network_interface_t _nif;
         sock_handle_t _sock;
         IsolatedEthernet::TCPClient _client;
+        size_t _minTxSize = 0;
+        size_t _minRxSize = 0;
+        const char *_service = NULL;
+        uint8_t _keepAlive = 0;
+        SocketOptions _socketOptions;
 
         using Print::write;
     };
 
+    /**
+     * @brief Keeps TCPClient connections open between transactions so they can be used again
+     * 
+     * Opening a connection for each request costs a socket allocation, the 3-way handshake, and a disconnect.
+     * For request/response protocols where the server keeps the connection open, lease a connection from
+     * the pool instead, and release it when the response has been read:
+     * 
+     *   IsolatedEthernet::TCPClient client = pool.lease(addr, port);
+     *   if (client.status()) {
+     *       // Send the request and read the response
+     *       pool.release(client);
+     *   }
+     * 
+     * Idle connections are kept per ip:port. Before one is handed out again, the W5500 socket status
+     * registers are checked: it must still be ESTABLISHED, and there must not be any unread data, which
+     * would be left over from an earlier response. Otherwise it's closed and another one is tried.
+     * 
+     * When a TCPClient, TCPServer, or UDP needs a socket and none are free, the oldest idle connection
+     * is closed to make room, so the pool never keeps other code from getting a socket.
+     * 
+     * This is safe as a globally constructed object. All methods can be called from any thread.
+     */
+    class TCPClientPool {
+    public:
+        /**
+         * @brief Counters returned by getStats()
+         */
+        struct Stats {
+            uint32_t leases;        //!< Number of lease() calls that returned a connection
+            uint32_t reused;        //!< Leases that used an idle connection instead of connecting
+            uint32_t discarded;     //!< Idle connections closed because the status check failed
+            uint32_t expired;       //!< Idle connections closed after withMaxIdleTime()
+            uint32_t evicted;       //!< Idle connections closed for withMaxIdleConnections() or to free a socket
+        };
+
+        /**
+         * @brief Construct a new TCPClientPool object
+         */
+        TCPClientPool();
+
+        /**
+         * @brief Destroy the TCPClientPool object, closing its idle connections
+         */
+        ~TCPClientPool();
+
+        /**
+         * @brief How long a connection can be idle before it's closed
+         * 
+         * @param ms Milliseconds (default: 30000). Use a value less than the server's idle timeout.
+         * 
+         * @return TCPClientPool& Reference to this object so you can chain options, fluent-style.
+         */
+        TCPClientPool &withMaxIdleTime(unsigned long ms) { maxIdleMs = ms; return *this; };
+
+        /**
+         * @brief Maximum number of idle connections, for all endpoints combined
+         * 
+         * @param count Number of connections (default: 2). When full, release() closes the oldest idle connection.
+         * 
+         * @return TCPClientPool& Reference to this object so you can chain options, fluent-style.
+         */
+        TCPClientPool &withMaxIdleConnections(size_t count) { maxIdle = count; return *this; };
+
+        /**
+         * @brief Gets a connection to ip:port, reusing an idle one if possible
+         * 
+         * @param ip The IP address to connect to 
+         * @param port The IP port number to connect to
+         * 
+         * @return TCPClient The connection. If a connection could not be made, status() is 0.
+         * 
+         * If there isn't a usable idle connection, this blocks while connecting, like TCPClient::connect().
+         */
+        TCPClient lease(IPAddress ip, uint16_t port);
+
+        /**
+         * @brief Returns a connection from lease() to the pool
+         * 
+         * @param client The connection. It's replaced with an unconnected TCPClient, so the connection can't
+         * be used by mistake after it has been released.
+         * 
+         * Read the whole response before releasing. A connection that is not ESTABLISHED, has unread data, 
+         * or was not made using connect() is closed instead.
+         */
+        void release(TCPClient &client);
+
+        /**
+         * @brief Closes idle connections that are older than withMaxIdleTime()
+         * 
+         * This is done by lease() and release() as well. Call it from loop() if you want idle connections
+         * closed promptly when the pool is not being used.
+         */
+        void expire();
+
+        /**
+         * @brief Closes all idle connections
+         */
+        void closeAll();
+
+        /**
+         * @brief Returns the number of idle connections
+         */
+        size_t idleCount();
+
+        /**
+         * @brief Gets a copy of the counters
+         */
+        Stats getStats();
+
+    protected:
+        /**
+         * @brief An idle connection
+         */
+        struct Entry {
+            TCPClient client;
+            IPAddress ip;
+            uint16_t port;
+            unsigned long releasedMs;
+        };
+
+        /**
+         * @brief Returns true if an idle connection can be used again. Checks the W5500 status registers.
+         */
+        bool isReusable(TCPClient &client);
+
+        /**
+         * @brief Closes the oldest idle connection. mutex must be locked.
+         * 
+         * @return true if there was one to close
+         */
+        bool evictOldestLocked();
+
+        /**
+         * @brief Closes the oldest idle connection. Called by IsolatedEthernet when there are no free sockets.
+         * 
+         * @return true if there was one to close
+         */
+        bool evictOldest();
+
+        /**
+         * @brief Closes idle connections older than maxIdleMs. mutex must be locked.
+         */
+        void expireLocked();
+
+        /**
+         * @brief Adds this pool to the list IsolatedEthernet evicts from, on first use
+         */
+        void registerPool();
+
+        unsigned long maxIdleMs = 30000;
+        size_t maxIdle = 2;
+        bool registered = false;
+        std::vector<Entry> idle;    //!< Idle connections, oldest first
+        Stats stats = {0};
+        Mutex mutex;                //!< Protects idle, stats, and registered
+
+        friend class IsolatedEthernet;
+    };
+
     /**
      * @brief Replacement for UDP class to use Ethernet
      * 
@@ -520,17 +1074,41 @@ public:
          */
         bool _buffer_allocated;
 
-
-
-    public:
         /**
-         * @brief Construct a new UDP object. This is safe as a globally constructed object.
-         * 
+         * Set by withAsyncSend()
          */
-        UDP();
+        bool _asyncSend = false;
 
         /**
-         * @brief Destroy the UDP object. This releases the socket (it allocated) and any buffers.
+         * Set by withSocketBufferSize() and withSocketService()
+         */
+        size_t _minTxSize = 0;
+        size_t _minRxSize = 0;
+        const char *_service = NULL;
+
+        /**
+         * Set by withTxQueue()
+         */
+        size_t _txQueueSize = 0;
+        TxQueuePolicy _txQueuePolicy = TxQueuePolicy::FAIL;
+        size_t _txQueueHigh = 0;
+        size_t _txQueueLow = 0;
+
+        /**
+         * Set by withMss(), withTtl() and withTos()
+         */
+        SocketOptions _socketOptions;
+
+
+    public:
+        /**
+         * @brief Construct a new UDP object. This is safe as a globally constructed object.
+         * 
+         */
+        UDP();
+
+        /**
+         * @brief Destroy the UDP object. This releases the socket (it allocated) and any buffers.
          */
         virtual ~UDP() { stop(); releaseBuffer(); }
 
@@ -570,6 +1148,115 @@ public:
          */
         virtual void stop();
 
+        /**
+         * @brief Makes sendPacket() and endPacket() return without waiting for the datagram to be sent
+         *
+         * @param async true to enable, false to wait for each datagram (the default)
+         * @return UDP& Reference to this object so you can chain options, fluent-style.
+         *
+         * Sending to a destination not in the W5500 ARP cache waits for ARP resolution, which can take
+         * hundreds of milliseconds, or the ARP timeout if the destination does not exist. In async mode
+         * sendPacket() returns as soon as the datagram is handed to the W5500. Use sendStatus() or the
+         * CallbackType::udpSendComplete callback to find out if it was sent.
+         *
+         * Each UDP object (socket) can only have one datagram in flight. While one is in progress,
+         * sendPacket() returns 0 (SEND_STATUS_BUSY) immediately. To send to several destinations in parallel,
+         * use one UDP object per destination.
+         *
+         * Takes effect on the next begin(), or immediately if already open.
+         */
+        UDP &withAsyncSend(bool async = true);
+
+        /**
+         * @brief Only use a socket with at least this much W5500 buffer space
+         *
+         * @param txSize Minimum TX buffer size in bytes, or 0 for any size
+         *
+         * @param rxSize Minimum RX buffer size in bytes, or 0 for any size
+         *
+         * @return UDP& Reference to this object so you can chain options, fluent-style.
+         *
+         * A larger RX buffer holds more datagrams that have not been read yet. Use with
+         * IsolatedEthernet::withSocketBufferSizes(). Takes effect on the next begin().
+         */
+        UDP &withSocketBufferSize(size_t txSize, size_t rxSize) { _minTxSize = txSize; _minRxSize = rxSize; return *this; };
+
+        /**
+         * @brief Sets the service name for IsolatedEthernet::withSocketReservation()
+         *
+         * @param service Service name. Only the pointer is stored, so this is typically a string literal.
+         *
+         * @return UDP& Reference to this object so you can chain options, fluent-style.
+         *
+         * The UDP object can use the sockets reserved for this service. Takes effect on the next begin().
+         */
+        UDP &withSocketService(const char *service) { _service = service; return *this; };
+
+        /**
+         * @brief Queue datagrams in RAM and send them from the worker thread
+         *
+         * @param queueSize Size of the queue in bytes, allocated from the heap while open. Each datagram
+         * takes 8 bytes more than its length. 0 turns the queue off.
+         *
+         * @param policy What sendPacket() and endPacket() do when the queue does not have room for the 
+         * datagram: TxQueuePolicy::FAIL returns 0 (SEND_STATUS_BUSY), TxQueuePolicy::DROP_OLDEST discards 
+         * the oldest queued datagrams, and TxQueuePolicy::BLOCK waits up to 1 second for space. Default is FAIL.
+         *
+         * @param highWatermark Calls the CallbackType::txQueueHigh callbacks when this many bytes are 
+         * queued. Default (0) is 3/4 of queueSize.
+         *
+         * @param lowWatermark After txQueueHigh, calls the CallbackType::txQueueLow callbacks when the
+         * queue drops to this many bytes. Default (0) is 1/4 of queueSize.
+         *
+         * @return UDP& Reference to this object so you can chain options, fluent-style.
+         *
+         * sendPacket() and endPacket() copy the datagram into the queue and return its length. The worker
+         * thread sends the datagrams in order, one at a time as in withAsyncSend() mode, and calls the 
+         * CallbackType::udpSendComplete callbacks for each one. sendStatus() returns SEND_STATUS_BUSY 
+         * while there are queued datagrams, flush() waits for the queue to be sent, and stop() discards it.
+         *
+         * Takes effect on the next begin(), or immediately if already open.
+         */
+        UDP &withTxQueue(size_t queueSize, TxQueuePolicy policy = TxQueuePolicy::FAIL, size_t highWatermark = 0, size_t lowWatermark = 0);
+
+        /**
+         * @brief Sets the largest datagram for this socket (Sn_MSSR), 0 (default) for the W5500 default of 1472. Takes effect on the next begin().
+         */
+        UDP &withMss(uint16_t mss) { _socketOptions.mss = mss; return *this; };
+
+        /**
+         * @brief Sets the IP time to live (Sn_TTL, default 128). Takes effect on the next begin().
+         * 
+         * For multicast, this limits how many routers the datagrams can cross.
+         */
+        UDP &withTtl(uint8_t ttl) { _socketOptions.ttl = ttl; return *this; };
+
+        /**
+         * @brief Sets the IP type of service (Sn_TOS, default 0). Takes effect on the next begin().
+         */
+        UDP &withTos(uint8_t tos) { _socketOptions.tos = tos; return *this; };
+
+        /**
+         * @brief Returns the number of bytes in the withTxQueue() queue, including the 8 bytes per datagram
+         */
+        size_t txQueued();
+
+        static const int SEND_STATUS_OK = 1;            //!< sendStatus() datagram sent (SOCK_OK)
+        static const int SEND_STATUS_BUSY = 0;          //!< sendStatus() datagram still in progress (SOCK_BUSY)
+        static const int SEND_STATUS_TIMEOUT = -13;     //!< sendStatus() ARP or send timed out (SOCKERR_TIMEOUT)
+
+        /**
+         * @brief Gets the result of the last datagram sent in async mode
+         *
+         * @return SEND_STATUS_OK if sent or no datagram was sent yet, SEND_STATUS_BUSY if still in progress,
+         * or SEND_STATUS_TIMEOUT if ARP or the send timed out.
+         *
+         * This also calls the CallbackType::udpSendComplete callbacks if the send finished since it was
+         * last checked. The worker thread checks every millisecond as well, so you can use the callback
+         * instead of polling.
+         */
+        int sendStatus();
+
         /**
          * @brief Sends an packet directly. You should use this method instead of beginPacket(), write(), and endPacket().
          *
@@ -766,6 +1453,8 @@ public:
 
         /**
          * @brief Blocks until all data has been sent out
+         *
+         * In async mode (withAsyncSend()) this waits for the datagram in flight, if any.
          */
         virtual void flush();
 
@@ -852,6 +1541,88 @@ public:
     };
 
 public:
+    /**
+     * @brief Holds the SPI bus for the W5500 for the lifetime of this object
+     * 
+     * Every W5500 register access is wrapped in an SPI beginTransaction() and endTransaction(), which
+     * locks the SPI bus mutex and reconfigures the SPI peripheral. A single socket operation like send()
+     * can do a dozen or more register accesses. Creating a BusSession on the stack locks the bus once;
+     * register accesses made by the same thread while it exists skip the lock and reconfiguration.
+     * 
+     * The socket functions in the WIZnet driver (send, recv, sendto, recvfrom, socket) already hold a 
+     * session, so you only need this if you are making several calls in a row and want them to be done
+     * as a unit. Sessions can be nested.
+     * 
+     * Do not hold a session while waiting for a long time, as the worker thread and any other devices 
+     * on the same SPI bus will be blocked.
+     */
+    class BusSession {
+    public:
+        /**
+         * @brief Locks the SPI bus, or increments the nesting depth if this thread already holds it
+         */
+        BusSession() { IsolatedEthernet::instance().wizchip_cris_enter(); }
+
+        /**
+         * @brief Decrements the nesting depth, releasing the SPI bus when it reaches 0
+         */
+        ~BusSession() { IsolatedEthernet::instance().wizchip_cris_exit(); }
+
+        BusSession(const BusSession&) = delete;
+        BusSession& operator=(const BusSession&) = delete;
+    };
+
+    /**
+     * @brief Counters for SPI bus locking, returned by getBusSessionStats()
+     */
+    struct BusSessionStats {
+        uint32_t lockCount;         //!< Number of times the SPI bus was actually locked (beginTransaction called)
+        uint32_t nestedCount;       //!< Number of enter calls that were skipped because this thread already held the bus
+        uint32_t holdMicros;        //!< Total time the bus was held in microseconds
+        uint32_t maxHoldMicros;     //!< Longest single time the bus was held in microseconds
+    };
+
+    /**
+     * @brief Counters for one group of W5500 SPI transactions, part of SpiStats
+     */
+    struct SpiCounters {
+        uint32_t transactions;      //!< Number of register or buffer accesses (CS low periods)
+        uint32_t headerBytes;       //!< Address and control phase bytes, 3 per transaction
+        uint32_t payloadBytes;      //!< Data bytes read or written
+        uint32_t csMicros;          //!< Time with CS asserted in microseconds
+    };
+
+    /**
+     * @brief W5500 SPI transaction counters, returned by getSpiStats()
+     * 
+     * Every transaction is counted in total, in either common or socket[n] depending on the register 
+     * block it addresses, and in one of the categories. The category is determined from the address:
+     * register reads are statusPoll, the TX and RX buffers and their pointer updates are txData and 
+     * rxData, writes to Sn_CR and Sn_IR are command, and other register writes are config.
+     */
+    struct SpiStats {
+        SpiCounters total;          //!< All transactions
+        SpiCounters common;         //!< Common register block
+        SpiCounters socket[8];      //!< Socket register, TX buffer, and RX buffer blocks by socket number
+        SpiCounters statusPoll;     //!< Register reads
+        SpiCounters txData;         //!< TX buffer memory and Sn_TX_WR
+        SpiCounters rxData;         //!< RX buffer memory and Sn_RX_RD
+        SpiCounters command;        //!< Sn_CR and Sn_IR writes
+        SpiCounters config;         //!< Other register writes
+    };
+
+    /**
+     * @brief Socket status registers for one socket, returned by getSocketStatus()
+     */
+    struct SocketStatus {
+        uint8_t sr;                 //!< Sn_SR, socket state (SOCK_CLOSED, SOCK_ESTABLISHED, SOCK_UDP, etc.)
+        uint8_t ir;                 //!< Sn_IR, socket interrupt flags (not cleared by reading)
+        uint16_t rxRsr;             //!< Sn_RX_RSR, bytes received and waiting in the socket RX buffer
+        uint16_t txFsr;             //!< Sn_TX_FSR, bytes free in the socket TX buffer
+        uint8_t sir;                //!< SIR, one bit per socket with any Sn_IR flag set, at the time of the snapshot
+        system_tick_t timestamp;    //!< millis() value when the registers were read
+    };
+
     /**
      * @brief Gets the singleton instance of this class, allocating it if necessary
      * 
@@ -982,13 +1753,77 @@ public:
      * 
      * @return IsolatedEthernet& Reference to this object so you can chain options, fluent-style.
      * 
-     * This setting is not actually used. This library currently always runs in polling mode
-     * and does not use the hardware interrupt support, but it could be used in the future.
+     * When set, the W5500 interrupt output wakes the worker thread and calls that wait for socket events, 
+     * instead of checking every millisecond. See withInterrupts().
      * 
      * Must be called before setup()! Changing it later will not work properly.
      */
     IsolatedEthernet &withPinINT(pin_t pinINT) { this->pinINT = pinINT; return *this; };
 
+    /**
+     * @brief Enables or disables use of the INT pin. Default is enabled if there is an INT pin.
+     * 
+     * @param enable true to use the INT pin, false to poll every millisecond even if there is an INT pin
+     * 
+     * @return IsolatedEthernet& Reference to this object so you can chain options, fluent-style.
+     * 
+     * With interrupts, the W5500 interrupts on RECV, SENDOK, CON, DISCON and TIMEOUT for all sockets. The
+     * interrupt wakes the worker thread, which clears the interrupt and wakes the calls waiting for that
+     * socket: TCPClient::write() when the TX buffer is full, TCPClient::flush(), UDP::receivePacket() and
+     * UDP::flush(). Otherwise these check every millisecond.
+     * 
+     * When there's nothing to do, the worker only checks the PHY link and socket status every 50 ms, so
+     * there is much less SPI traffic when idle. As a safety net, a missed interrupt is picked up then too.
+     * 
+     * Disable this if the INT pin is not actually connected to the W5500.
+     * 
+     * Must be called before setup()! Changing it later will not work properly.
+     */
+    IsolatedEthernet &withInterrupts(bool enable = true) { this->interruptsEnabled = enable; return *this; };
+
+    /**
+     * @brief Returns true if the INT pin is being used. Only valid after setup().
+     */
+    bool getInterruptsActive() const { return interruptsActive; };
+
+    /**
+     * @brief Waits for an interrupt on a socket, or timeoutMs
+     * 
+     * @param sock Socket number 0 <= sock < 8
+     * 
+     * @param timeoutMs Maximum time to wait. Without interrupts, this always waits 1 ms.
+     * With interrupts, it waits at most 50 ms, in case an interrupt was missed.
+     * 
+     * Can return early if there was an interrupt since the last call, so always check the condition you
+     * were waiting for again.
+     */
+    void waitSocketEvent(int sock, system_tick_t timeoutMs);
+
+    /**
+     * @brief Waits for an interrupt on any socket, or 1 ms. Used by wizchip_yield().
+     */
+    void waitAnyEvent();
+
+    /**
+     * @brief Chooses a local port from the withEphemeralPortRange() range for a socket
+     * 
+     * @param sock Socket number 0 <= sock < 8 that will use the port
+     * 
+     * @return uint16_t The port number
+     * 
+     * socketAlloc() chooses a port for each socket it allocates, before the SPI bus is locked, and 
+     * wizchip_ephemeral_port() returns it when socket() is called with port 0.
+     */
+    uint16_t allocEphemeralPort(int sock);
+
+    /**
+     * @brief Returns the port allocEphemeralPort() chose for a socket. Used by wizchip_ephemeral_port().
+     * 
+     * Doesn't lock anything, as it's called with the SPI bus locked. The entry only changes when the
+     * socket is allocated again.
+     */
+    uint16_t getEphemeralPort(int sock) const { return (sock >= 0 && sock < NUM_SOCKETS) ? ephemeralPorts[sock] : 0; };
+
     /**
      * @brief Sets the INT pin. Default is PIN_INVALID (not used). 
      * 
@@ -1014,165 +1849,448 @@ public:
     IsolatedEthernet &withSpiSettings(const SPISettings &spiSettings) { this->spiSettings = spiSettings; return *this; };
 
     /**
-     * @brief Sets the IP address when using static IP addressing (instead of DHCP)
+     * @brief Enable automatic SPI clock calibration in setup(). Default is off.
+     * 
+     * @param maxClock The fastest clock to try in Hz. Default is 50 MHz.
+     * 
+     * @param dataMode SPI_MODE0 (default) or SPI_MODE3. The calibrated settings are always MSBFIRST.
      * 
-     * @param ip The IP Address to use. This is often an internal address like 192.168.1.100 or 10.1.2.50. 
      * @return IsolatedEthernet& Reference to this object so you can chain options, fluent-style.
      * 
-     * This method should be called before setup(). If you want to change the IP address later at runtime,
-     * set the IP address, subnet mask, gateway address, then call updateAddressSettings.
+     * The SPI clock that works depends on the board wiring (Ethernet FeatherWing, Mikroe click, M.2 eval board,
+     * or your own board). A clock that is too fast does not cause an obvious failure; it corrupts some of
+     * the data, and the only symptom may be the "phyConf did not set properly" log message.
      * 
-     * This internally calls withStaticIP() and will stop any DHCP that is currently in progress.
+     * With calibration, setup() writes test patterns into a socket TX buffer and reads them back at 
+     * descending clock rates (50, 40, 32, 25, 20, 16, 10, 8, and 4 MHz, skipping those above maxClock). 
+     * Each rate is first converted to the clock the MCU SPI peripheral actually uses, and rates that end
+     * up as the same clock are only tested once. On Gen 3 devices, which divide 64 MHz by a power of 2, 
+     * the clocks tested are 32, 16, 8 and 4 MHz.
      * 
-     * If you use withIPAddress you must also call withSubnetMask, it does not configure a default automatically
-     * based on your address class!
+     * If a faster clock failed, the next slower clock below the fastest passing one is used for margin. 
+     * If the fastest clock allowed by maxClock passes, it's used as-is: nothing failed, so there's no
+     * sign that it's marginal. If you want margin in that case too, pass a lower maxClock. The result is 
+     * logged and available from getSpiClock(), and replaces the clock in withSpiSettings().
+     * 
+     * Must be called before setup()!
      */
-    IsolatedEthernet &withIPAddress(const IPAddress &ip) { withStaticIP(); ipAddressToArray(ip, ipAddr); return *this; };
+    IsolatedEthernet &withSpiCalibration(unsigned maxClock = 50*MHZ, uint8_t dataMode = SPI_MODE0) { this->spiCalibrationMaxClock = maxClock; this->spiCalibrationDataMode = dataMode; return *this; };
 
     /**
-     * @brief Sets the subnet mask when using static IP addressing (instead of DHCP). This is required when using static IP addressing!
+     * @brief Gets the SPI clock chosen by calibration
      * 
-     * @param ip The subnet mask to use, often something like 255.255.255.0 
-     * @return IsolatedEthernet& Reference to this object so you can chain options, fluent-style.
-     * 
-     * This method should be called before setup(). If you want to change the subnet mask later at runtime,
-     * set the IP address, subnet mask, gateway address, then call updateAddressSettings.
+     * @return unsigned Clock in Hz, or 0 if calibration is not enabled or no rate passed
+     */
+    unsigned getSpiClock() const { return spiClock; };
+
+    /**
+     * @brief Returns true if an SPI DMA transfer to the W5500 failed to complete (see withSpiAsyncDma())
      * 
-     * This internally calls withStaticIP() and will stop any DHCP that is currently in progress.
+     * Data read from the W5500 after this can't be trusted, so the link is reported as down.
      */
-    IsolatedEthernet &withSubnetMask(const IPAddress &ip) { withStaticIP(); ipAddressToArray(ip, subnetMaskArray); return *this; };
+    bool hasSpiFault() const { return spiFault; };
 
     /**
-     * @brief Sets the gateway address static IP addressing (instead of DHCP).
+     * @brief Use asynchronous DMA for large SPI burst transfers to and from the W5500. Default is off.
+     * 
+     * @param enable true to enable asynchronous transfers, false to use the default synchronous transfers
+     * 
+     * @param minLength Bursts shorter than this number of bytes are still done synchronously. The 
+     * 3-byte address phase and most register accesses are much shorter than the time it takes to 
+     * set up the DMA completion callback, so it's only worth using for buffer copies. Default is 64.
      * 
-     * @param ip The gateway address to use, often something like 192.168.1.1. This must be in the same subnet as the IP address.
      * @return IsolatedEthernet& Reference to this object so you can chain options, fluent-style.
      * 
-     * This method should be called before setup(). If you want to change the gateway address later at runtime,
-     * set the IP address, subnet mask, gateway address, then call updateAddressSettings.
+     * By default, SPI.transfer() with a NULL callback busy-waits for the DMA transfer to finish. With this 
+     * option, the transfer is started with a completion callback and the calling thread blocks on a queue
+     * until the transfer completes. A 2048 byte buffer copy at 32 MHz takes about 500 microseconds, during 
+     * which other threads (including your application thread preparing the next buffer) can run.
      * 
-     * This internally calls withStaticIP() and will stop any DHCP that is currently in progress.
+     * The W5500 CS line remains asserted and the SPI bus remains locked during the transfer, so other
+     * operations on the W5500 still wait until the transfer is complete.
+     * 
+     * If a transfer does not complete in 100 ms, it is cancelled and the W5500 state is unknown, so 
+     * hasSpiFault() returns true, the linkDown callbacks are called, and ready() returns false until the 
+     * device is reset. Later transfers are synchronous.
+     * 
+     * Must be called before setup()! Changing it later will not work properly.
      */
-    IsolatedEthernet &withGatewayAddress(const IPAddress &ip) { withStaticIP(); ipAddressToArray(ip, gatewayAddr); return *this; };
+    IsolatedEthernet &withSpiAsyncDma(bool enable = true, size_t minLength = 64) { this->spiAsyncDma = enable; this->spiAsyncDmaMinLength = minLength; return *this; };
 
     /**
-     * @brief Sets the DNS server address static IP addressing (instead of DHCP).
+     * @brief Sets the largest buffer copy that is sent as a single SPI transfer with its address phase. Default is 256.
+     * 
+     * @param maxLength Maximum data length in bytes, or 0 to disable single-transfer mode.
      * 
-     * @param ip The DNS server to use. Often the gateway address, it could also be a site DNS or public DNS like 8.8.8.8.
      * @return IsolatedEthernet& Reference to this object so you can chain options, fluent-style.
      * 
-     * This method should be called before setup(). If you want to change the DNS address later at runtime,
-     * set the IP address, subnet mask, gateway address, then call updateAddressSettings.
+     * Every W5500 access starts with a 3-byte address phase. Without this option, buffer reads and writes
+     * do the address phase and the data as two separate SPI transfers, each with its own DMA setup. With this
+     * option, the address and data are copied into a staging buffer and sent as one transfer. This
+     * is a significant saving for small frames like Modbus TCP (up to 260 bytes) but the copy is not worth it
+     * for large buffers, which fall back to two transfers.
      * 
-     * This internally calls withStaticIP() and will stop any DHCP that is currently in progress.
+     * Two staging buffers of maxLength + 3 bytes are allocated on the heap in setup().
      * 
-     * Only one DNS address is supported.
+     * Must be called before setup()! Changing it later will not work properly.
      */
-    IsolatedEthernet &withDNSAddress(const IPAddress &ip) { withStaticIP(); ipAddressToArray(ip, dnsAddr); return *this; };
+    IsolatedEthernet &withSpiScatterGather(size_t maxLength = 256) { this->spiSgMaxLength = maxLength; return *this; };
 
     /**
-     * @brief Enables static IP mode
+     * @brief Sets the W5500 retransmission timing (RTR and RCR), which is shared by all sockets
+     * 
+     * @param timeMs Time before the first retransmission in milliseconds, 1 to 6553 (W5500 default: 200). 
+     * Each retransmission of a TCP segment waits twice as long as the previous one, up to 6553 ms.
+     * 
+     * @param count Number of retransmissions before giving up (W5500 default: 8)
      * 
      * @return IsolatedEthernet& Reference to this object so you can chain options, fluent-style.
      * 
-     * You normally don't need to call this if you are using withIPAddress(), etc.. However, in the case where
-     * you do not want to attempt DHCP but also do not know your IP address yet, you can call this to disable
-     * DHCP.
+     * This sets how long a TCP connect, send, or keep-alive to a host that doesn't respond takes to fail,
+     * and how long ARP for a UDP destination that doesn't exist takes. getTcpTimeoutMs() returns the TCP
+     * time; with the defaults it's 32.3 seconds. On a local LAN with round trip times under a millisecond, 
+     * withRetransmission(25, 5) fails after 1.6 seconds.
+     * 
+     * Can be called before or after setup().
      */
-    IsolatedEthernet &withStaticIP();
+    IsolatedEthernet &withRetransmission(unsigned timeMs, uint8_t count);
 
     /**
-     * @brief Enables DHCP mode
-     * 
-     * @return IsolatedEthernet& Reference to this object so you can chain options, fluent-style.
+     * @brief Returns how long a TCP operation to a host that doesn't respond takes to fail, in milliseconds
      * 
-     * Since the default is DHCP mode you normally don't need to call this, but you can use this to switch
-     * from static to DHCP again.
+     * Calculated from the withRetransmission() settings using the formula in the W5500 datasheet. The 
+     * ARP timeout is timeMs * (count + 1).
      */
-    IsolatedEthernet &withDHCP();
+    unsigned long getTcpTimeoutMs() const;
 
+    /**
+     * @brief Preset socket buffer allocations for withSocketBufferSizes()
+     */
+    enum class SocketBufferPreset {
+        EIGHT_EQUAL,        //!< 2K TX and 2K RX on all 8 sockets (default)
+        FOUR_EQUAL,         //!< 4K TX and 4K RX on sockets 0 - 3, sockets 4 - 7 are not usable
+        ONE_BULK,           //!< 8K TX and 8K RX on socket 0, 1K TX and 1K RX on sockets 1 - 7
+    };
 
     /**
-     * @brief Specifies that the static IP settings will be stored in a file on the flash file system.
+     * @brief Sets the TX and RX buffer size for each socket
+     * 
+     * @param txKB Array of 8 TX buffer sizes in Kbytes, one per socket. Each must be 0, 1, 2, 4, 8, or 16.
+     * 
+     * @param rxKB Array of 8 RX buffer sizes in Kbytes, one per socket. Each must be 0, 1, 2, 4, 8, or 16.
      * 
-     * @param path Path to the file in the POSIX file system. If in a subdirectory, the subdirectory must exist.
      * @return IsolatedEthernet& Reference to this object so you can chain options, fluent-style.
      * 
-     * You must call this before setup(). It's OK to call this before the settings file exists.
+     * The W5500 has 16K of TX buffer and 16K of RX buffer shared by the 8 sockets, so each array must
+     * add up to 16 or less. If not, an error is logged and the default of 2K per socket is used. A socket
+     * with a 0 size TX or RX buffer is never used.
      * 
+     * The RX buffer size is the TCP window, so a larger RX buffer can increase download speed considerably, 
+     * and a larger TX buffer allows more data to be written without waiting.
+     * 
+     * Use withSocketBufferSize() on TCPClient, TCPServer, or UDP to make sure that object gets a socket
+     * with large enough buffers. Objects that don't request a size get the smallest free socket, leaving
+     * the large buffers available.
+     * 
+     * Must be called before setup()! Changing it later will not work properly.
      */
-    IsolatedEthernet &withJsonConfigFile(const char *path) { this->jsonConfigFile = path; return *this; };
+    IsolatedEthernet &withSocketBufferSizes(const uint8_t txKB[8], const uint8_t rxKB[8]);
 
     /**
-     * @brief Loads the configuration file. You normally do not need to do this; it's done automatically if necessary.
+     * @brief Sets the TX and RX buffer size for each socket using a preset
      * 
-     * The configuration file name is specified using withJsonConfigFile(). 
+     * @param preset The preset to use, such as SocketBufferPreset::ONE_BULK
+     * 
+     * @return IsolatedEthernet& Reference to this object so you can chain options, fluent-style.
+     * 
+     * Must be called before setup()! Changing it later will not work properly.
      */
-    void loadConfigFile();
+    IsolatedEthernet &withSocketBufferSizes(SocketBufferPreset preset);
 
     /**
-     * @brief Save the configuration file
+     * @brief Gets the TX buffer size of a socket in bytes
      * 
-     * @return true 
-     * @return false 
+     * @param sock Socket number 0 <= sock < 8
      * 
-     * Saves the current settings for ipAddr, subnetMaskArray, gatewayAddr, dnsAddr to the settings file specified
-     * by withJsonConfigFile. You use this after updating the settings so they will be used the next restart.
+     * @return size_t Size in bytes, 0 if the socket number is invalid
      */
-    bool saveConfigFile();
+    size_t getSocketTxBufferSize(int sock) const;
 
     /**
-     * @brief Loads a JSON configuration from a string 
+     * @brief Gets the RX buffer size of a socket in bytes
      * 
-     * @param str A string containing a JSON settings object.
+     * @param sock Socket number 0 <= sock < 8
      * 
-     * You typically do this if you receive a new configuration, such as from a Particle function.
+     * @return size_t Size in bytes, 0 if the socket number is invalid
      */
-    void loadJsonConfig(const char *str);
+    size_t getSocketRxBufferSize(int sock) const;
 
     /**
-     * @brief Loads a JSON configuration option that has been parsed by the Device OS JSON parser.
+     * @brief What a socket is being used for, from getSocketOwner()
+     */
+    enum class SocketOwner : uint8_t {
+        FREE,               //!< Not in use
+        CLOSING,            //!< Released, but the W5500 may still be closing the connection
+        TCP_CLIENT,         //!< TCPClient, including connections accepted by TCPServer
+        TCP_SERVER,         //!< TCPServer listener
+        UDP,                //!< UDP
+        DHCP,               //!< DHCP client
+        DNS,                //!< DNS lookup
+    };
+
+    static const char * const SOCKET_SERVICE_DHCP;  //!< withSocketReservation() service name for DHCP, "dhcp"
+    static const char * const SOCKET_SERVICE_DNS;   //!< withSocketReservation() service name for DNS, "dns"
+
+    /**
+     * @brief Keeps sockets available for DHCP, DNS, or a named service
      * 
-     * @param configObj 
+     * @param service SOCKET_SERVICE_DHCP, SOCKET_SERVICE_DNS, or a name up to 15 characters set using 
+     * withSocketService() on TCPClient, TCPServer, or UDP objects.
      * 
-     * See also the overload that takes a c-string, which really just calls this function after 
-     * parsing the data.
+     * @param count Number of sockets to keep available. 
+     * 
+     * @return IsolatedEthernet& Reference to this object so you can chain options, fluent-style.
+     * 
+     * There are only 8 sockets on the W5500. Without a reservation, a burst of connections can use all
+     * of them and DNS and DHCP fail with no available sockets. Sockets are not tied to a specific socket
+     * number; connections without the service name can't use the last count free sockets, while the
+     * service can use both its reserved sockets and unreserved ones.
+     * 
+     * DHCP only uses a socket while getting an address and DNS only during a lookup, so 
+     * withSocketReservation(SOCKET_SERVICE_DNS) is usually sufficient.
+     * 
+     * Calling again with the same service replaces the count. Up to 8 services can be reserved.
+     * A name longer than 15 characters is logged as an error and ignored.
      */
-    void loadJsonConfig(const JSONValue &configObj);
+    IsolatedEthernet &withSocketReservation(const char *service, uint8_t count = 1);
 
     /**
-     * @brief Does a hardware reset of the W5500
+     * @brief Sets the range of local ports used for outgoing connections and UDP::begin(0)
      * 
-     * @return true 
-     * @return false 
+     * @param first First port in the range (default: 49152)
      * 
-     * This is only done if pinRESET is defined for the hardware reset pin. If there is no hardware reset
-     * pin connected, a software reset is done over SPI.
+     * @param last Last port in the range, inclusive (default: 65535)
+     * 
+     * @return IsolatedEthernet& Reference to this object so you can chain options, fluent-style.
+     * 
+     * TCPClient connections, DNS queries, and UDP objects opened with port 0 get a local port from this
+     * range. The first port is random, and each following port is a random 1 to EPHEMERAL_PORT_MAX_STEP
+     * ports further on, wrapping around at the end of the range. Rapid reconnects to the same server 
+     * therefore don't reuse a local port the server may still have in TIME_WAIT, and the ports can't
+     * easily be guessed. Ports held by other open sockets are skipped.
      */
-    bool hwReset();
+    IsolatedEthernet &withEphemeralPortRange(uint16_t first, uint16_t last);
+
+    static const uint16_t EPHEMERAL_PORT_MAX_STEP = 16; //!< Largest step between withEphemeralPortRange() ports
 
     /**
-     * @brief Get the local IP address as an IPAddress object. For compatibility with the WiFi class.
+     * @brief Returns what a socket is being used for
      * 
-     * @return IPAddress 
+     * @param sock Socket number 0 <= sock < 8
+     * 
+     * @return SocketOwner The owner, or SocketOwner::FREE if the socket number is invalid
+     * 
+     * This is from the socket table in RAM and does not access the W5500.
      */
-    IPAddress localIP() {
-        return IPAddress(ipAddr);
-    }
+    SocketOwner getSocketOwner(int sock) const;
 
     /**
-     * @brief Get the subnet mask as an IPAddress object. For compatibility with the WiFi class.
+     * @brief Returns the number of sockets that are not in use
      * 
-     * @return IPAddress 
+     * @return int Number of free sockets, including ones held by withSocketReservation() and ones that are
+     * still closing. Sockets with a 0 size buffer are not included.
      */
-    IPAddress subnetMask() {
-        return IPAddress(subnetMaskArray);
-    }
+    int getSocketsFree() const;
 
     /**
-     * @brief Get the gateway IP address as an IPAddress object. For compatibility with the WiFi class.
+     * @brief Moves received data from the W5500 into RAM from the worker thread
      * 
-     * @return IPAddress 
+     * @param ringSize Size in bytes of the RAM buffer for each TCP and UDP socket, or 0 to disable. Default is 0.
+     * 
+     * @return IsolatedEthernet& Reference to this object so you can chain options, fluent-style.
+     * 
+     * If the application thread is busy, the socket RX buffer in the W5500 fills, the TCP window closes, and 
+     * the peer stops sending. UDP datagrams that arrive when the buffer is full are dropped. With this option,
+     * the worker thread reads received data into a RAM ring buffer for each TCPClient, TCPServer and UDP 
+     * socket as soon as it arrives (on the RECV interrupt, or within 1 ms when polling), and 
+     * TCPClient::available(), TCPClient::read(), UDP::parsePacket() and UDP::receivePacket() are served
+     * from the ring buffer without SPI access.
+     * 
+     * A ring buffer smaller than the socket RX buffer in the W5500 (2048 bytes by default, see 
+     * withSocketBufferSizes()) limits the TCP receive rate. The ring buffers are allocated from the heap 
+     * the first time each socket is used and are kept for reuse. A ring buffer for a socket that is in use takes ringSize bytes even if nothing is received.
+     * UDP datagrams take 8 extra bytes in the ring buffer, and a datagram larger than ringSize - 8 is 
+     * discarded. DHCP and DNS sockets are not affected.
+     * 
+     * Must be called before setup()! Changing it later will not work properly.
+     */
+    IsolatedEthernet &withRxDrain(size_t ringSize) { this->rxDrainSize = ringSize; return *this; };
+
+    /**
+     * @brief Returns the ring buffer size set using withRxDrain(), or 0 if not used
+     */
+    size_t getRxDrainSize() const { return rxDrainSize; };
+
+    /**
+     * @brief Sets the IP address when using static IP addressing (instead of DHCP)
+     * 
+     * @param ip The IP Address to use. This is often an internal address like 192.168.1.100 or 10.1.2.50. 
+     * @return IsolatedEthernet& Reference to this object so you can chain options, fluent-style.
+     * 
+     * This method should be called before setup(). If you want to change the IP address later at runtime,
+     * set the IP address, subnet mask, gateway address, then call updateAddressSettings.
+     * 
+     * This internally calls withStaticIP() and will stop any DHCP that is currently in progress.
+     * 
+     * If you use withIPAddress you must also call withSubnetMask, it does not configure a default automatically
+     * based on your address class!
+     */
+    IsolatedEthernet &withIPAddress(const IPAddress &ip) { withStaticIP(); ipAddressToArray(ip, ipAddr); return *this; };
+
+    /**
+     * @brief Sets the subnet mask when using static IP addressing (instead of DHCP). This is required when using static IP addressing!
+     * 
+     * @param ip The subnet mask to use, often something like 255.255.255.0 
+     * @return IsolatedEthernet& Reference to this object so you can chain options, fluent-style.
+     * 
+     * This method should be called before setup(). If you want to change the subnet mask later at runtime,
+     * set the IP address, subnet mask, gateway address, then call updateAddressSettings.
+     * 
+     * This internally calls withStaticIP() and will stop any DHCP that is currently in progress.
+     */
+    IsolatedEthernet &withSubnetMask(const IPAddress &ip) { withStaticIP(); ipAddressToArray(ip, subnetMaskArray); return *this; };
+
+    /**
+     * @brief Sets the gateway address static IP addressing (instead of DHCP).
+     * 
+     * @param ip The gateway address to use, often something like 192.168.1.1. This must be in the same subnet as the IP address.
+     * @return IsolatedEthernet& Reference to this object so you can chain options, fluent-style.
+     * 
+     * This method should be called before setup(). If you want to change the gateway address later at runtime,
+     * set the IP address, subnet mask, gateway address, then call updateAddressSettings.
+     * 
+     * This internally calls withStaticIP() and will stop any DHCP that is currently in progress.
+     */
+    IsolatedEthernet &withGatewayAddress(const IPAddress &ip) { withStaticIP(); ipAddressToArray(ip, gatewayAddr); return *this; };
+
+    /**
+     * @brief Sets the DNS server address static IP addressing (instead of DHCP).
+     * 
+     * @param ip The DNS server to use. Often the gateway address, it could also be a site DNS or public DNS like 8.8.8.8.
+     * @return IsolatedEthernet& Reference to this object so you can chain options, fluent-style.
+     * 
+     * This method should be called before setup(). If you want to change the DNS address later at runtime,
+     * set the IP address, subnet mask, gateway address, then call updateAddressSettings.
+     * 
+     * This internally calls withStaticIP() and will stop any DHCP that is currently in progress.
+     * 
+     * Only one DNS address is supported.
+     */
+    IsolatedEthernet &withDNSAddress(const IPAddress &ip) { withStaticIP(); ipAddressToArray(ip, dnsAddr); return *this; };
+
+    /**
+     * @brief Enables static IP mode
+     * 
+     * @return IsolatedEthernet& Reference to this object so you can chain options, fluent-style.
+     * 
+     * You normally don't need to call this if you are using withIPAddress(), etc.. However, in the case where
+     * you do not want to attempt DHCP but also do not know your IP address yet, you can call this to disable
+     * DHCP.
+     */
+    IsolatedEthernet &withStaticIP();
+
+    /**
+     * @brief Enables DHCP mode
+     * 
+     * @return IsolatedEthernet& Reference to this object so you can chain options, fluent-style.
+     * 
+     * Since the default is DHCP mode you normally don't need to call this, but you can use this to switch
+     * from static to DHCP again.
+     */
+    IsolatedEthernet &withDHCP();
+
+
+    /**
+     * @brief Specifies that the static IP settings will be stored in a file on the flash file system.
+     * 
+     * @param path Path to the file in the POSIX file system. If in a subdirectory, the subdirectory must exist.
+     * @return IsolatedEthernet& Reference to this object so you can chain options, fluent-style.
+     * 
+     * You must call this before setup(). It's OK to call this before the settings file exists.
+     * 
+     */
+    IsolatedEthernet &withJsonConfigFile(const char *path) { this->jsonConfigFile = path; return *this; };
+
+    /**
+     * @brief Loads the configuration file. You normally do not need to do this; it's done automatically if necessary.
+     * 
+     * The configuration file name is specified using withJsonConfigFile(). 
+     */
+    void loadConfigFile();
+
+    /**
+     * @brief Save the configuration file
+     * 
+     * @return true 
+     * @return false 
+     * 
+     * Saves the current settings for ipAddr, subnetMaskArray, gatewayAddr, dnsAddr to the settings file specified
+     * by withJsonConfigFile. You use this after updating the settings so they will be used the next restart.
+     */
+    bool saveConfigFile();
+
+    /**
+     * @brief Loads a JSON configuration from a string 
+     * 
+     * @param str A string containing a JSON settings object.
+     * 
+     * You typically do this if you receive a new configuration, such as from a Particle function.
+     */
+    void loadJsonConfig(const char *str);
+
+    /**
+     * @brief Loads a JSON configuration option that has been parsed by the Device OS JSON parser.
+     * 
+     * @param configObj 
+     * 
+     * See also the overload that takes a c-string, which really just calls this function after 
+     * parsing the data.
+     */
+    void loadJsonConfig(const JSONValue &configObj);
+
+    /**
+     * @brief Does a hardware reset of the W5500
+     * 
+     * @return true 
+     * @return false 
+     * 
+     * This is only done if pinRESET is defined for the hardware reset pin. If there is no hardware reset
+     * pin connected, a software reset is done over SPI.
+     */
+    bool hwReset();
+
+    /**
+     * @brief Get the local IP address as an IPAddress object. For compatibility with the WiFi class.
+     * 
+     * @return IPAddress 
+     */
+    IPAddress localIP() {
+        return IPAddress(ipAddr);
+    }
+
+    /**
+     * @brief Get the subnet mask as an IPAddress object. For compatibility with the WiFi class.
+     * 
+     * @return IPAddress 
+     */
+    IPAddress subnetMask() {
+        return IPAddress(subnetMaskArray);
+    }
+
+    /**
+     * @brief Get the gateway IP address as an IPAddress object. For compatibility with the WiFi class.
+     * 
+     * @return IPAddress 
      */
     IPAddress gatewayIP() {
         return IPAddress(gatewayAddr);
@@ -1255,7 +2373,45 @@ public:
     enum class CallbackType {
         linkUp,         //!< PHY link is up
         linkDown,       //!< PHY link is down
-        gotIpAddress    //!< An IP address has been assigned
+        gotIpAddress,   //!< An IP address has been assigned
+        udpSendComplete, //!< A UDP::withAsyncSend() datagram finished sending, data is a UdpSendResult *
+        txQueueHigh,    //!< A withTxQueue() queue reached its high watermark, data is a TxQueueEvent *
+        txQueueLow,     //!< A withTxQueue() queue dropped to its low watermark, data is a TxQueueEvent *
+        tcpConnectComplete, //!< A TCPClient connection finished or failed, data is a TcpConnectResult *
+        tcpPeerLost     //!< The W5500 closed a TCPClient connection with withKeepAlive() on, data is a TcpPeerLost *
+    };
+
+    /**
+     * @brief Data passed to the callback for CallbackType::udpSendComplete
+     */
+    struct UdpSendResult {
+        int sock;                   //!< Socket number of the UDP object, UDP::socket()
+        int result;                 //!< UDP::SEND_STATUS_OK if sent, or UDP::SEND_STATUS_TIMEOUT if ARP or the send timed out
+    };
+
+    /**
+     * @brief Data passed to the callback for CallbackType::tcpConnectComplete
+     */
+    struct TcpConnectResult {
+        int sock;                   //!< Socket number of the TCPClient
+        int result;                 //!< TCPClient::CONNECT_STATUS_OK, CONNECT_STATUS_TIMEOUT, or CONNECT_STATUS_CLOSED
+    };
+
+    /**
+     * @brief Data passed to the callback for CallbackType::tcpPeerLost
+     */
+    struct TcpPeerLost {
+        int sock;                   //!< Socket number of the TCPClient, TCPClient::socket()
+        int result;                 //!< TCPClient::CONNECT_STATUS_TIMEOUT if the peer stopped responding, or CONNECT_STATUS_CLOSED if it reset the connection
+    };
+
+    /**
+     * @brief Data passed to the callback for CallbackType::txQueueHigh and CallbackType::txQueueLow
+     */
+    struct TxQueueEvent {
+        int sock;                   //!< Socket number of the TCPClient or UDP object
+        size_t queued;              //!< Bytes in the queue
+        uint32_t dropped;           //!< Bytes (TCP) or datagrams (UDP) discarded by TxQueuePolicy::DROP_OLDEST since the queue was opened
     };
 
     /**
@@ -1270,6 +2426,87 @@ public:
      */
     IsolatedEthernet &withCallback(std::function<void(CallbackType,void*)> cb) { callbacks.push_back(cb); return *this; };
 
+    /**
+     * @brief Gets the SPI bus locking counters
+     * 
+     * @return BusSessionStats A copy of the counters
+     * 
+     * Dividing lockCount by the number of socket operations you made gives the average number of 
+     * SPI bus lock and reconfiguration operations per call. A high nestedCount relative to lockCount 
+     * means the bus sessions are saving many of them.
+     */
+    BusSessionStats getBusSessionStats() const { return busSessionStats; };
+
+    /**
+     * @brief Resets the SPI bus locking counters to 0
+     */
+    void resetBusSessionStats() { busSessionStats = {0}; };
+
+    /**
+     * @brief Gets the W5500 SPI transaction counters
+     * 
+     * @return SpiStats A copy of the counters
+     * 
+     * Use this to see where the SPI bandwidth goes. For example, comparing statusPoll.transactions to
+     * txData.payloadBytes + rxData.payloadBytes shows how much of the bus is spent polling registers 
+     * versus moving data. Since each transaction has a fixed overhead on the bus in addition to its
+     * bytes, the transaction count is often more important than the byte count.
+     * 
+     * The counters are 32-bit and wrap around, so reset them before a measurement using resetSpiStats().
+     */
+    SpiStats getSpiStats() const;
+
+    /**
+     * @brief Resets the W5500 SPI transaction counters to 0
+     */
+    void resetSpiStats();
+
+    /**
+     * @brief Sets how often the worker thread takes a snapshot of all socket status registers. Default is 5 ms.
+     * 
+     * @param intervalMs Interval in milliseconds, or 0 to disable the snapshot and always read the registers.
+     * 
+     * @return IsolatedEthernet& Reference to this object so you can chain options, fluent-style.
+     * 
+     * TCPClient::connected(), TCPClient::status(), UDP::isOpen(), TCPServer::available() and finding a free 
+     * socket used to read Sn_SR from the W5500 each time they were called. With several sockets open 
+     * and polled from loop() that adds up to dozens of SPI transactions per loop. With the snapshot, 
+     * the worker thread reads SIR and the status registers of every open socket in one SPI burst per 
+     * socket and those calls use the copy in RAM instead.
+     * 
+     * The values can be up to intervalMs old. The library invalidates a socket's entry whenever it 
+     * opens, connects, or closes the socket, so its own state changes are seen immediately. Use 
+     * getSocketStatus() with fresh = true if you need the current hardware value.
+     */
+    IsolatedEthernet &withStatusSnapshotInterval(unsigned long intervalMs) { this->statusSnapshotIntervalMs = intervalMs; return *this; };
+
+    /**
+     * @brief Gets the status registers for a socket
+     * 
+     * @param sock Socket number 0 <= sock < 8
+     * 
+     * @param status Filled in with the register values
+     * 
+     * @param fresh If true, read the registers from the W5500 now instead of using the worker thread snapshot
+     * 
+     * @return true if sock is valid and status was filled in
+     * 
+     * If the snapshot is disabled, or the entry for this socket has been invalidated or is older than 
+     * twice the snapshot interval, the registers are read from the W5500 even if fresh is false. A fresh
+     * read also updates the snapshot.
+     */
+    bool getSocketStatus(int sock, SocketStatus &status, bool fresh = false);
+
+    /**
+     * @brief Marks the snapshot entry for a socket as stale so the next getSocketStatus() reads the hardware
+     * 
+     * @param sock Socket number 0 <= sock < 8. Invalid values are ignored.
+     * 
+     * The library calls this itself after socket operations that change the state. You only need to 
+     * call it if you use the WIZnet socket functions directly on a socket.
+     */
+    void invalidateSocketStatus(int sock);
+
 
 
     /**
@@ -1424,47 +2661,153 @@ private:
     void wizchip_spi_writeburst(uint8_t *pBuf, uint16_t len);
 
     /**
-     * @brief Thread function. This runs continuously after setup. 
+     * @brief Writes the address phase and reads the data phase in one SPI transfer. Hooks into WIZnet ioDriver library.
      * 
-     * @return os_thread_return_t 
+     * @return 0 if the transfer was done, -1 if the data does not fit in the staging buffer
      */
-    os_thread_return_t threadFunction();
+    int wizchip_spi_readburst_sg(uint8_t *pHdr, uint16_t hdrLen, uint8_t *pBuf, uint16_t len);
 
     /**
-     * @brief Thread function. This is called from the Device OS thread API, as it does not take a std::function.
-     * 
-     * @param param 
-     * @return os_thread_return_t
+     * @brief Writes the address phase and data phase in one SPI transfer. Hooks into WIZnet ioDriver library.
      * 
-     * It just calls threadFunction in the IsolatedEthernet class. 
+     * @return 0 if the transfer was done, -1 if the data does not fit in the staging buffer
      */
-    static os_thread_return_t threadFunctionStatic(void* param);
+    int wizchip_spi_writeburst_sg(uint8_t *pHdr, uint16_t hdrLen, uint8_t *pBuf, uint16_t len);
 
+    /**
+     * @brief Does a burst transfer, either synchronously or using asynchronous DMA depending on settings
+     * 
+     * @param txBuf Buffer to transmit or NULL
+     * 
+     * @param rxBuf Buffer to receive into or NULL
+     * 
+     * @param len Number of bytes to transfer
+     */
+    void spiBurstTransfer(uint8_t *txBuf, uint8_t *rxBuf, uint16_t len);
 
     /**
-     * @brief SPI interface to use, default is SPI, could be SPI1 (or SPI2).
+     * @brief Does a burst transfer in asynchronous DMA mode, blocking the calling thread until complete
+     * 
+     * @param txBuf Buffer to transmit or NULL
+     * 
+     * @param rxBuf Buffer to receive into or NULL
+     * 
+     * @param len Number of bytes to transfer
+     * 
+     * @return true if the transfer completed. If not, rxBuf is zeroed and spiFault is set.
+     * 
+     * Used by wizchip_spi_readburst() and wizchip_spi_writeburst() when withSpiAsyncDma() is enabled, until
+     * spiFault is set. The callback has no context, so a late completion couldn't be told apart from the
+     * next transfer's.
      */
-	SPIClass *spi = &SPI;
+    bool spiAsyncTransfer(uint8_t *txBuf, uint8_t *rxBuf, uint16_t len);
 
     /**
-     * @brief Chip select pin. Default is D5
+     * @brief SPI DMA completion callback. Called at interrupt time. Posts to spiAsyncDmaQueue.
      */
-	pin_t pinCS = D5; 
+    static void spiAsyncTransferDoneStatic(void);
 
     /**
-     * @brief Interrupt pin. Default is PIN_INVALID (not used). 
+     * @brief Interrupt handler for the INT pin, wakes the worker thread
      */
-	pin_t pinINT = PIN_INVALID;
+    static void interruptHandlerStatic(void);
 
     /**
-     * @brief Reset pin. Default is PIN_INVALID (not used).
+     * @brief Clears socket interrupts after the INT pin was asserted. Called from the worker thread.
+     * 
+     * @return Bit mask of sockets that had an interrupt
      * 
+     * The Sn_IR bits are moved to the driver latch (wiz_latch_sn_ir) so the socket functions still see them.
      */
-    pin_t pinRESET = PIN_INVALID;
+    uint8_t serviceInterrupts();
 
+    /**
+     * @brief Returns how long the worker thread can wait for an interrupt before it has work to do
+     */
+    system_tick_t workerWaitMs();
 
     /**
-     * @brief Default SPI settings
+     * @brief Returns the maximum age of a status snapshot entry that getSocketStatus() will use
+     */
+    unsigned long statusSnapshotMaxAgeMs() const;
+
+    /**
+     * @brief Set using withInterrupts()
+     */
+    bool interruptsEnabled = true;
+
+    /**
+     * @brief true if setup() attached the INT pin interrupt
+     */
+    bool interruptsActive = false;
+
+    /**
+     * @brief When using interrupts, the worker checks the PHY link and takes a status snapshot this often
+     */
+    static const system_tick_t INTERRUPT_POLL_MS = 50;
+
+    /**
+     * @brief millis() value when the worker last ran the state machine
+     */
+    system_tick_t stateMachineLast = 0;
+
+    /**
+     * @brief Queue the INT pin interrupt handler uses to wake the worker thread
+     */
+    os_queue_t interruptQueue = 0;
+
+    /**
+     * @brief Queue per socket, the worker puts an item after an interrupt on that socket
+     */
+    os_queue_t socketEventQueue[8] = {0};
+
+    /**
+     * @brief The worker puts an item after an interrupt on any socket
+     */
+    os_queue_t anyEventQueue = 0;
+
+    /**
+     * @brief Thread function. This runs continuously after setup. 
+     * 
+     * @return os_thread_return_t 
+     */
+    os_thread_return_t threadFunction();
+
+    /**
+     * @brief Thread function. This is called from the Device OS thread API, as it does not take a std::function.
+     * 
+     * @param param 
+     * @return os_thread_return_t
+     * 
+     * It just calls threadFunction in the IsolatedEthernet class. 
+     */
+    static os_thread_return_t threadFunctionStatic(void* param);
+
+
+    /**
+     * @brief SPI interface to use, default is SPI, could be SPI1 (or SPI2).
+     */
+	SPIClass *spi = &SPI;
+
+    /**
+     * @brief Chip select pin. Default is D5
+     */
+	pin_t pinCS = D5; 
+
+    /**
+     * @brief Interrupt pin. Default is PIN_INVALID (not used). 
+     */
+	pin_t pinINT = PIN_INVALID;
+
+    /**
+     * @brief Reset pin. Default is PIN_INVALID (not used).
+     * 
+     */
+    pin_t pinRESET = PIN_INVALID;
+
+
+    /**
+     * @brief Default SPI settings
      * 
      * - Speeds up to 80 MHz are theoretically possible on the W5500, but there may be distorted signals because of
      * crosstalk. Maximum guaranteed speed is 33.3 MHz
@@ -1476,6 +2819,97 @@ private:
      */
     SPISettings spiSettings = SPISettings(32*MHZ, MSBFIRST, SPI_MODE0);
 
+    /**
+     * @brief Fastest clock tried by SPI calibration in setup(), or 0 if calibration is disabled
+     */
+    unsigned spiCalibrationMaxClock = 0;
+
+    uint8_t spiCalibrationDataMode = SPI_MODE0;
+
+    /**
+     * @brief SPI clock chosen by calibration, or 0
+     */
+    unsigned spiClock = 0;
+
+    /**
+     * @brief Number of times the test patterns must pass at a clock rate in spiCalibrate()
+     */
+    static const int SPI_CALIBRATION_ROUNDS = 4;
+
+    /**
+     * @brief Tries descending SPI clock rates and sets spiSettings to the fastest reliable one
+     * 
+     * Called from setup() when withSpiCalibration() is used. spiSettings is left unchanged if no rate passes.
+     */
+    void spiCalibrate();
+
+    /**
+     * @brief Writes test patterns to the socket 0 TX buffer and reads them back using the current spiSettings
+     * 
+     * @return true if all of the patterns read back correctly
+     */
+    bool spiCalibrationTest();
+
+    /**
+     * @brief Returns the clock the MCU SPI peripheral actually uses when asked for clock Hz
+     */
+    static unsigned spiEffectiveClock(unsigned clock);
+
+    bool spiAsyncDma = false;
+
+    size_t spiAsyncDmaMinLength = 64;
+
+    /**
+     * @brief Queue used to wait for a DMA completion callback when spiAsyncDma is enabled
+     */
+    os_queue_t spiAsyncDmaQueue = 0;
+
+    /**
+     * @brief Set when an SPI transfer failed, see hasSpiFault()
+     */
+    volatile bool spiFault = false;
+
+    /**
+     * @brief The worker thread, set when threadFunction() starts
+     */
+    volatile os_thread_t workerThread = NULL;
+
+    /**
+     * @brief Thread that currently holds the SPI bus, or NULL
+     */
+    volatile os_thread_t busOwner = NULL;
+
+    /**
+     * @brief Nesting depth of wizchip_cris_enter() calls by busOwner
+     */
+    uint32_t busDepth = 0;
+
+    /**
+     * @brief Value of micros() when the bus was locked
+     */
+    uint32_t busLockMicros = 0;
+
+    BusSessionStats busSessionStats = {0};
+
+    size_t spiSgMaxLength = 256;
+
+    /**
+     * @brief TX buffer size in Kbytes for each socket, set by withSocketBufferSizes()
+     */
+    uint8_t socketTxBufKB[8] = {2, 2, 2, 2, 2, 2, 2, 2};
+
+    /**
+     * @brief RX buffer size in Kbytes for each socket, set by withSocketBufferSizes()
+     */
+    uint8_t socketRxBufKB[8] = {2, 2, 2, 2, 2, 2, 2, 2};
+
+    /**
+     * @brief Staging buffers for single transfer address + data phase, spiSgMaxLength + 3 bytes, or NULL if not used
+     */
+    uint8_t *spiSgTxBuf = NULL;
+
+    uint8_t *spiSgRxBuf = NULL;
+
     /**
      * @brief Ethernet MAC address setting
      * 
@@ -1572,6 +3006,11 @@ private:
      */
     uint8_t *dhcpBuffer = NULL;
 
+    /**
+     * @brief Socket used for DHCP while dhcpState is IN_PROGRESS, or -1
+     */
+    int dhcpSocket = -1;
+
     /**
      * @brief True if DNS is enabled (default)
      */
@@ -1588,11 +3027,579 @@ private:
     static const uint8_t NUM_SOCKETS = 8;
 
     /**
-     * @brief Get a socket that is not currently in use for a new connection or listener
+     * @brief Allocate a socket that is not currently in use for a new connection or listener
+     * 
+     * @param owner What the socket will be used for, stored in the socket table
+     * 
+     * @param service Service name for withSocketReservation(), or NULL
+     * 
+     * @param minTxSize Minimum TX buffer size in bytes, or 0 for any size
+     * 
+     * @param minRxSize Minimum RX buffer size in bytes, or 0 for any size
      * 
      * @return int -1 if there are no sockets available, otherwise 0 <= sock < NUM_SOCKETS.
+     * 
+     * Of the free sockets with large enough buffers, the one with the smallest buffers is returned so
+     * the larger buffers stay available for objects that ask for them. The socket belongs to the caller
+     * until socketRelease() is called, even if the W5500 closes it.
+     * 
+     * If there are no sockets available, idle TCPClientPool connections are closed to make room.
+     */
+    int socketAlloc(SocketOwner owner, const char *service = NULL, size_t minTxSize = 0, size_t minRxSize = 0);
+
+    /**
+     * @brief Return a socket allocated by socketAlloc() to the socket table
+     * 
+     * @param sock Socket number 0 <= sock < NUM_SOCKETS. Invalid socket numbers are ignored.
+     * 
+     * @param closed true if the socket was closed (wiznet::close), false if it may still be closing (wiznet::disconnect
+     * in non-block mode). A closing socket is not reused until Sn_SR is SOCK_CLOSED.
+     */
+    void socketRelease(int sock, bool closed);
+
+    /**
+     * @brief Changes the owner of an allocated socket. Used when a TCPServer listener becomes a TCPClient.
+     */
+    void socketSetOwner(int sock, SocketOwner owner);
+
+    /**
+     * @brief Entry in the socket table
+     */
+    struct SocketEntry {
+        SocketOwner owner = SocketOwner::FREE;  //!< Owner, or FREE or CLOSING
+        int8_t reservation = -1;                //!< Index into socketReservations if allocated for a reserved service
+    };
+
+    /**
+     * @brief Socket table, one entry per hardware socket
+     */
+    SocketEntry socketTable[NUM_SOCKETS];
+
+    /**
+     * @brief Reservation from withSocketReservation()
+     */
+    struct SocketReservation {
+        char service[16];                       //!< Service name
+        uint8_t count;                          //!< Number of sockets to keep available
+    };
+
+    /**
+     * @brief Reservations from withSocketReservation(), socketReservationCount entries are used
+     */
+    SocketReservation socketReservations[NUM_SOCKETS];
+
+    /**
+     * @brief Number of entries in socketReservations
+     */
+    uint8_t socketReservationCount = 0;
+
+    /**
+     * @brief Socket numbers in order of increasing buffer size, the order socketAlloc() tries them
+     */
+    uint8_t socketOrder[NUM_SOCKETS] = {0, 1, 2, 3, 4, 5, 6, 7};
+
+    /**
+     * @brief Protects socketTable and socketReservations. Do not lock while holding the SPI bus.
+     */
+    Mutex socketTableMutex;
+
+    /**
+     * @brief RAM queue for data written to one socket, used with TCPClient::withTxQueue() and UDP::withTxQueue()
+     *
+     * For TCP, this is a ring buffer of bytes. For UDP, each datagram is stored contiguously after an 8-byte
+     * header (address, port, length). If a datagram does not fit before the end of the buffer, the space
+     * at the end is skipped; if it's at least 8 bytes it starts with a header with length TX_QUEUE_SKIP.
+     * Protected by txQueueMutex.
+     */
+    struct TxQueue {
+        uint8_t *buf = nullptr;             //!< Buffer, size bytes
+        size_t size = 0;                    //!< Size of buf
+        size_t head = 0;                    //!< Offset the owner writes to next
+        size_t tail = 0;                    //!< Offset the worker thread sends from next
+        size_t count = 0;                   //!< Number of bytes in use, including skipped space at the end
+        size_t sending = 0;                 //!< Bytes before tail that the worker thread is still copying to the W5500
+        bool udp = false;                   //!< Datagrams instead of a byte stream
+        TxQueuePolicy policy = TxQueuePolicy::FAIL; //!< What to do when full
+        size_t high = 0;                    //!< High watermark in bytes
+        size_t low = 0;                     //!< Low watermark in bytes
+        bool aboveHigh = false;             //!< The txQueueHigh callbacks were called and txQueueLow has not been yet
+        uint32_t dropped = 0;               //!< Bytes or datagrams discarded by DROP_OLDEST
+        int error = 0;                      //!< Error that stopped the worker thread from sending (socket closed), or 0
+    };
+
+    /**
+     * @brief Datagram length in a TxQueue header that marks skipped space at the end of the buffer
+     */
+    static const uint16_t TX_QUEUE_SKIP = 0xffff;
+
+    /**
+     * @brief Allocates the queue for a socket, replacing any existing queue
+     *
+     * @return false if the memory could not be allocated
+     */
+    bool txQueueOpen(int sock, bool udp, size_t size, TxQueuePolicy policy, size_t high, size_t low);
+
+    /**
+     * @brief Discards and frees the queue for a socket, if any. Called from socketRelease().
+     */
+    void txQueueClose(int sock);
+
+    /**
+     * @brief Returns true if the socket has a queue
+     */
+    bool txQueueActive(int sock) const { return sock >= 0 && sock < NUM_SOCKETS && (txQueueMask & (1 << sock)) != 0; };
+
+    /**
+     * @brief Returns the number of bytes in the queue for a socket, 0 if there is no queue
+     */
+    size_t txQueued(int sock);
+
+    /**
+     * @brief Returns the free space in the queue for a TCP socket
+     */
+    size_t txQueueSpace(int sock);
+
+    /**
+     * @brief Adds TCP data to the queue for a socket. Called from TCPClient::write().
+     *
+     * @return Number of bytes accepted, or a negative error code if sending failed
+     */
+    int txQueueWrite(int sock, const uint8_t *buffer, size_t size, system_tick_t timeout);
+
+    /**
+     * @brief Adds a datagram to the queue for a socket. Called from UDP::sendPacket().
+     *
+     * @return size if queued, 0 if the policy is FAIL or BLOCK timed out, or SOCKERR_DATALEN if it will never fit
+     */
+    int txQueueWriteDatagram(int sock, const uint8_t *buffer, size_t size, const uint8_t *addr, uint16_t port, system_tick_t timeout);
+
+    /**
+     * @brief Finds the next datagram in a UDP queue, skipping space at the end of the buffer
+     *
+     * @return Length of the datagram, which starts after the header at q.tail, or -1 if the queue is empty
+     */
+    int txQueueNextDatagram(TxQueue &q);
+
+    /**
+     * @brief Waits for the queue for a TCP socket to be sent, for TCPClient::flush() and stop()
+     *
+     * Returns right away on the worker thread, which is the only thread that sends the queue (for example,
+     * stop() from a tcpPeerLost callback), or when the connection is not ESTABLISHED or CLOSE_WAIT.
+     *
+     * @param discard If true, whatever is still queued afterwards is discarded
+     *
+     * @return true if the queue is empty
+     */
+    bool txQueueFinish(int sock, system_tick_t timeout, bool discard);
+
+    /**
+     * @brief Discards the data in the queue for a socket, except what the worker thread is copying to the W5500
+     *
+     * @param error If not 0, writes return this error from now on, as when the connection is lost while sending
+     */
+    void txQueueDiscard(int sock, int error = 0);
+
+    /**
+     * @brief Maximum time TCPClient::stop() waits for the queue and the data held by send() to be sent, in milliseconds
+     */
+    static const system_tick_t TX_QUEUE_STOP_TIMEOUT_MS = 5000;
+
+    /**
+     * @brief Moves queued data into the W5500 as space is available. Called from the worker thread.
+     *
+     * @return Bit mask of sockets whose queue got smaller
+     */
+    uint8_t txQueuePoll();
+
+    /**
+     * @brief Calls the txQueueHigh or txQueueLow callbacks. Must not be called with txQueueMutex locked.
+     */
+    void txQueueNotify(CallbackType type, const TxQueueEvent &event);
+
+    /**
+     * @brief Bit mask of sockets with a queue
+     */
+    volatile uint8_t txQueueMask = 0;
+
+    /**
+     * @brief Queue for each socket
+     */
+    TxQueue txQueues[NUM_SOCKETS];
+
+    /**
+     * @brief Protects txQueues. Only held for bookkeeping, never while waiting for the SPI bus, so the worker
+     * thread can lock it while holding the bus.
+     */
+    Mutex txQueueMutex;
+
+    /**
+     * @brief Held by the worker thread while it copies from the queues, so txQueueClose() doesn't free a
+     * buffer in use. Lock before txQueueMutex.
+     */
+    Mutex txQueueSendMutex;
+
+    /**
+     * @brief RAM ring buffer for received data on one socket, used with withRxDrain()
+     * 
+     * The worker thread writes and the object that owns the socket reads, so head is only changed by
+     * the worker, tail by the owner, and count by both (atomically). For UDP, each datagram is stored
+     * with the 8-byte header from the W5500 (address, port, length).
+     */
+    struct RxRing {
+        uint8_t *buf = nullptr;             //!< Buffer, rxDrainSize bytes
+        size_t head = 0;                    //!< Offset the worker thread writes to next
+        size_t tail = 0;                    //!< Offset the owner reads from next
+        std::atomic<size_t> count{0};       //!< Number of bytes in the buffer
+    };
+
+    /**
+     * @brief Starts draining a socket into its ring buffer, if withRxDrain() is used. Called from socketAlloc().
+     */
+    void rxRingOpen(int sock);
+
+    /**
+     * @brief Stops draining a socket and discards the data in its ring buffer. Called from socketRelease().
+     */
+    void rxRingClose(int sock);
+
+    /**
+     * @brief Returns true if the worker thread drains this socket into its ring buffer
+     */
+    bool rxRingActive(int sock) const { return sock >= 0 && sock < NUM_SOCKETS && (rxDrainMask & (1 << sock)) != 0; };
+
+    /**
+     * @brief Returns the number of bytes in the ring buffer of a socket, including UDP headers
+     */
+    size_t rxRingAvailable(int sock) const { return rxRingActive(sock) ? rxRings[sock].count.load() : 0; };
+
+    /**
+     * @brief Reads TCP data from the ring buffer of a socket
+     * 
+     * @return Number of bytes copied to buffer, 0 if the ring buffer is empty
+     */
+    size_t rxRingRead(int sock, uint8_t *buffer, size_t size);
+
+    /**
+     * @brief Reads one UDP datagram from the ring buffer of a socket
+     * 
+     * @param addr Filled in with the sender's IP address (4 bytes)
+     * 
+     * @param port Filled in with the sender's port
+     * 
+     * @return Number of bytes copied to buffer, or -1 if the ring buffer is empty. If the datagram is larger 
+     * than size, the rest is discarded.
+     */
+    int rxRingReadDatagram(int sock, uint8_t *buffer, size_t size, uint8_t *addr, uint16_t *port);
+
+    /**
+     * @brief Copies bytes out of a ring buffer starting at an offset, wrapping around, without updating it
+     */
+    void rxRingCopy(const RxRing &ring, size_t offset, uint8_t *buffer, size_t size) const;
+
+    /**
+     * @brief Reads received data from the W5500 into the ring buffers. Called from the worker thread.
+     * 
+     * @param sockMask Bit mask of sockets to check. Sockets not in rxDrainMask are ignored.
+     * 
+     * All of the data that fits is read with one Sn_CR_RECV per socket, including multiple UDP datagrams.
+     */
+    void rxDrain(uint8_t sockMask);
+
+    /**
+     * @brief Ring buffer size set using withRxDrain(), 0 = disabled
+     */
+    size_t rxDrainSize = 0;
+
+    /**
+     * @brief Bit mask of sockets being drained into their ring buffers. Changed while holding the SPI bus.
+     */
+    volatile uint8_t rxDrainMask = 0;
+
+    /**
+     * @brief Bit mask of sockets with data left in the W5500 because their ring buffer was full
+     * 
+     * Reading from the ring buffer of one of these sockets wakes the worker thread.
+     */
+    volatile uint8_t rxDrainStalled = 0;
+
+    /**
+     * @brief Ring buffer for each socket
+     */
+    RxRing rxRings[NUM_SOCKETS];
+
+    /**
+     * @brief Reads the status registers of one socket from the W5500 and updates statusSnapshot
+     * 
+     * @param sock Socket number 0 <= sock < NUM_SOCKETS
+     * 
+     * @param sir Value of SIR to store with the entry
+     * 
+     * @param status Filled in with the register values
+     * 
+     * The snapshot entry is not updated if invalidateSocketStatus() was called for this socket while 
+     * the registers were being read, as the values may predate the state change.
+     */
+    void readSocketStatus(int sock, uint8_t sir, SocketStatus &status);
+
+    /**
+     * @brief Takes a snapshot of SIR and the status registers of all sockets. Called from the worker thread.
+     * 
+     * Sockets that were closed in the last snapshot are only read every STATUS_SNAPSHOT_CLOSED_EVERY 
+     * snapshots, since the library invalidates entries for sockets it opens. This catches sockets opened
+     * directly using the WIZnet socket functions, like DHCP and DNS.
+     */
+    void takeStatusSnapshot();
+
+    /**
+     * @brief How often sockets that are closed are read during takeStatusSnapshot()
+     */
+    static const uint8_t STATUS_SNAPSHOT_CLOSED_EVERY = 20;
+
+    /**
+     * @brief Interval for takeStatusSnapshot() in milliseconds, 0 = disabled. Set using withStatusSnapshotInterval().
+     */
+    unsigned long statusSnapshotIntervalMs = 5;
+
+    /**
+     * @brief millis() value of the last takeStatusSnapshot()
+     */
+    unsigned long statusSnapshotLast = 0;
+
+    /**
+     * @brief Number of snapshots taken, used to occasionally read closed sockets
+     */
+    uint32_t statusSnapshotCount = 0;
+
+    /**
+     * @brief Most recent status registers for each socket
+     */
+    SocketStatus statusSnapshot[NUM_SOCKETS] = {0};
+
+    /**
+     * @brief Bit mask of sockets whose statusSnapshot entry is valid
+     */
+    uint8_t statusSnapshotValid = 0;
+
+    /**
+     * @brief Incremented by invalidateSocketStatus(), used to detect invalidation during readSocketStatus()
+     */
+    uint8_t statusSnapshotGen[NUM_SOCKETS] = {0};
+
+    /**
+     * @brief Protects statusSnapshot and statusSnapshotValid
+     */
+    Mutex statusSnapshotMutex;
+
+    /**
+     * @brief Sets the idle time after which the worker thread sends data held on a coalescing TCP socket
+     *
+     * @param sock Socket number 0 <= sock < NUM_SOCKETS
+     *
+     * @param idleMs Milliseconds since the last write, or 0 to not send on idle (uncoalesced or explicitly corked)
+     */
+    void coalesceSet(int sock, uint16_t idleMs);
+
+    /**
+     * @brief Records a write on a coalescing TCP socket, restarting its idle time
+     */
+    void coalesceTouch(int sock);
+
+    /**
+     * @brief Sends held data on coalescing sockets that have been idle long enough. Called from the worker thread.
+     */
+    void coalesceCheck();
+
+    /**
+     * @brief Bit mask of sockets with a coalesceIdleMs, set using coalesceSet()
+     */
+    uint8_t coalesceMask = 0;
+
+    /**
+     * @brief Idle time before sending held data, per socket
+     */
+    uint16_t coalesceIdleMs[NUM_SOCKETS] = {0};
+
+    /**
+     * @brief millis() value of the last write, per socket
+     */
+    system_tick_t coalesceLastWrite[NUM_SOCKETS] = {0};
+
+    /**
+     * @brief Protects coalesceMask, coalesceIdleMs and coalesceLastWrite
+     */
+    Mutex coalesceMutex;
+
+    /**
+     * @brief Marks an async UDP send as in progress on a socket. Called from UDP::sendPacket().
+     */
+    void udpSendBegin(int sock);
+
+    /**
+     * @brief Forgets the async UDP send state of a socket, if any. Called when a UDP socket is opened or closed.
+     */
+    void udpSendCancel(int sock);
+
+    /**
+     * @brief Checks an async UDP send on a socket and calls the udpSendComplete callbacks when it finishes
+     *
+     * @param sock Socket number 0 <= sock < NUM_SOCKETS
+     *
+     * @return SOCK_BUSY while in progress, otherwise the result of the last send (SOCK_OK or SOCKERR_TIMEOUT)
+     *
+     * Called from UDP::sendStatus(), UDP::sendPacket() and the worker thread.
+     */
+    int udpSendPoll(int sock);
+
+    /**
+     * @brief Bit mask of sockets with an async UDP send in progress
+     */
+    uint8_t udpSendPending = 0;
+
+    /**
+     * @brief Error from the last async UDP send on each socket (SOCKERR_TIMEOUT), or 0 if it was sent
+     */
+    int8_t udpSendError[NUM_SOCKETS] = {0};
+
+    /**
+     * @brief Protects udpSendPending and udpSendError. The SPI bus may be locked while holding this, but not the reverse.
+     */
+    Mutex udpSendMutex;
+
+    /**
+     * @brief Marks a TCP connect as in progress on a socket. Called from TCPClient::connectAsync().
+     */
+    void connectBegin(int sock);
+
+    /**
+     * @brief Forgets the TCP connect state of a socket, if any
+     * 
+     * @return true if a connect was in progress
+     */
+    bool connectCancel(int sock);
+
+    /**
+     * @brief Checks a TCP connect on a socket and calls the tcpConnectComplete callbacks when it finishes
+     *
+     * @param sock Socket number 0 <= sock < NUM_SOCKETS
+     *
+     * @return SOCK_BUSY while in progress, otherwise the result (SOCK_OK, SOCKERR_TIMEOUT or SOCKERR_SOCKCLOSED)
+     *
+     * Called from TCPClient::connectStatus() and the worker thread.
+     */
+    int connectPoll(int sock);
+
+    /**
+     * @brief Bit mask of sockets with a TCP connect in progress
+     */
+    volatile uint8_t connectPending = 0;
+
+    /**
+     * @brief Error from the last TCP connect on each socket, or 0 if it connected
+     */
+    int8_t connectError[NUM_SOCKETS] = {0};
+
+    /**
+     * @brief Protects connectPending and connectError. The SPI bus may be locked while holding this, but not the reverse.
+     */
+    Mutex connectMutex;
+
+    uint16_t ephemeralPortFirst = 49152;    //!< withEphemeralPortRange() first
+    uint16_t ephemeralPortLast = 65535;     //!< withEphemeralPortRange() last
+    uint16_t ephemeralPortPrev = 0;         //!< Last port returned by allocEphemeralPort(), 0 before the first one
+    uint16_t ephemeralPorts[NUM_SOCKETS] = {0}; //!< Port returned by allocEphemeralPort() for each socket
+
+    /**
+     * @brief Protects the ephemeralPort members. Locked while holding socketTableMutex, but not the reverse.
+     * Do not lock while holding the SPI bus.
+     */
+    Mutex ephemeralPortMutex;
+
+    /**
+     * @brief allocEphemeralPort() with socketTableMutex already locked by the caller
+     */
+    uint16_t allocEphemeralPortLocked(int sock);
+
+    /**
+     * @brief Writes withMss(), withTtl() and withTos() to a socket before it's opened
+     * 
+     * Only the registers that differ from the last values written to this socket are written.
+     */
+    void applySocketOptions(int sock, const SocketOptions &options);
+
+    /**
+     * @brief Writes the withRetransmission() settings to the W5500. The bus must not be locked by the caller.
+     */
+    void applyRetransmission();
+
+    uint16_t retransmissionTime100us = 2000;    //!< withRetransmission() timeMs in the RTR unit of 100 us
+    uint8_t retransmissionCount = 8;            //!< withRetransmission() count (RCR)
+
+    /**
+     * @brief SocketOptions in the W5500 registers of each socket. Set back to the defaults when the W5500 is reset.
+     */
+    SocketOptions socketOptionsApplied[NUM_SOCKETS];
+
+    /**
+     * @brief Starts or stops watching a TCP connection for the tcpPeerLost callback
+     * 
+     * Watching stops before the socket is closed locally, so the callback is only for connections the W5500 closed.
+     */
+    void peerWatch(int sock, bool watch);
+
+    /**
+     * @brief Checks the watched sockets in mask and calls the tcpPeerLost callbacks for the ones that were closed
+     * 
+     * @return uint8_t Mask of the sockets that were closed
+     * 
+     * Called from the worker thread every PEER_WATCH_INTERVAL_MS, and with interrupts, for sockets that had one.
+     */
+    uint8_t peerWatchPoll(uint8_t mask);
+
+    /**
+     * @brief Bit mask of the TCP sockets with withKeepAlive() on
+     */
+    volatile uint8_t peerWatchMask = 0;
+
+    /**
+     * @brief millis() of the last periodic peerWatchPoll()
+     */
+    unsigned long peerWatchLast = 0;
+
+    /**
+     * @brief How often the worker thread reads Sn_SR of the watched sockets
+     * 
+     * One byte per socket. With interrupts, the TIMEOUT interrupt is handled right away as well.
+     */
+    static const unsigned long PEER_WATCH_INTERVAL_MS = 100;
+
+    /**
+     * @brief Protects peerWatchMask. The SPI bus may be locked while holding this, but not the reverse.
+     */
+    Mutex peerWatchMutex;
+
+    /**
+     * @brief Allocates a socket from the socket table, without closing idle TCPClientPool connections
+     * 
+     * Same parameters and return value as socketAlloc(), which calls this.
+     */
+    int socketAllocOnce(SocketOwner owner, const char *service, size_t minTxSize, size_t minRxSize);
+
+    /**
+     * @brief Closes the oldest idle connection from the TCPClientPool objects
+     * 
+     * @return true if a connection was closed
+     */
+    bool clientPoolEvict();
+
+    /**
+     * @brief TCPClientPool objects that have been used, so clientPoolEvict() can close their idle connections
+     */
+    std::vector<TCPClientPool *> clientPools;
+
+    /**
+     * @brief Protects clientPools. A TCPClientPool mutex may be locked while holding this, but not the reverse.
      */
-    int socketGetFree();
+    Mutex clientPoolsMutex;
 
     /**
      * @brief Callbacks registered using withCallback
@@ -52,6 +52,7 @@
 //
 //*****************************************************************************
 //#include <stdio.h>
+#include <string.h> // Added for IsolatedEthernet
 #include "w5500.h"
 
 #define _W5500_SPI_VDM_OP_          0x00
@@ -62,13 +63,91 @@
 #if   (_WIZCHIP_ == 5500)
 ////////////////////////////////////////////////////
 
+// Added for IsolatedEthernet
+// SPI transaction accounting. Updated while WIZCHIP_CRITICAL_ENTER is held.
+static wiz_SpiStats WIZCHIP_SPI_STATS;
+static uint32_t (*WIZCHIP_CLOCK_US)(void) = 0;
+
+void reg_wizchip_clock_cbfunc(uint32_t (*clock_us)(void))
+{
+   WIZCHIP_CLOCK_US = clock_us;
+}
+
+void wizchip_spi_stats_get(wiz_SpiStats *stats)
+{
+   WIZCHIP_CRITICAL_ENTER();
+   memcpy(stats, &WIZCHIP_SPI_STATS, sizeof(WIZCHIP_SPI_STATS));
+   WIZCHIP_CRITICAL_EXIT();
+}
+
+void wizchip_spi_stats_reset(void)
+{
+   WIZCHIP_CRITICAL_ENTER();
+   memset(&WIZCHIP_SPI_STATS, 0, sizeof(WIZCHIP_SPI_STATS));
+   WIZCHIP_CRITICAL_EXIT();
+}
+
+static inline uint32_t wiz_spi_clock(void)
+{
+   return WIZCHIP_CLOCK_US ? WIZCHIP_CLOCK_US() : 0;
+}
+
+static inline void wiz_spi_count(wiz_SpiCounters *c, uint16_t len, uint32_t us)
+{
+   c->transactions++;
+   c->headerBytes += 3;
+   c->payloadBytes += len;
+   c->csMicros += us;
+}
+
+// Call after CS is deselected with the value of wiz_spi_clock() when it was selected
+static void wiz_spi_account(uint32_t AddrSel, uint16_t len, uint32_t start)
+{
+   uint8_t  block = (AddrSel >> 3) & 0x1F;
+   uint16_t offset = (AddrSel >> 8) & 0xFFFF;
+   uint8_t  write = (AddrSel & _W5500_SPI_WRITE_) != 0;
+   uint32_t us = WIZCHIP_CLOCK_US ? (WIZCHIP_CLOCK_US() - start) : 0;
+   wiz_SpiCategory cat;
+
+   wiz_spi_count(&WIZCHIP_SPI_STATS.total, len, us);
+
+   if(block == 0)
+   {
+      wiz_spi_count(&WIZCHIP_SPI_STATS.common, len, us);
+      cat = write ? WIZ_SPI_CAT_CONFIG : WIZ_SPI_CAT_STATUS;
+   }
+   else
+   {
+      wiz_spi_count(&WIZCHIP_SPI_STATS.sock[((block - 1) >> 2) & 0x07], len, us);
+      switch(block & 0x03)
+      {
+         case 0x02:
+            cat = WIZ_SPI_CAT_TX_DATA;
+            break;
+         case 0x03:
+            cat = WIZ_SPI_CAT_RX_DATA;
+            break;
+         default:
+            if(!write)                                               cat = WIZ_SPI_CAT_STATUS;
+            else if(offset == (Sn_CR(0) >> 8) || offset == (Sn_IR(0) >> 8)) cat = WIZ_SPI_CAT_COMMAND;
+            else if(offset == (Sn_TX_WR(0) >> 8))                    cat = WIZ_SPI_CAT_TX_DATA;
+            else if(offset == (Sn_RX_RD(0) >> 8))                    cat = WIZ_SPI_CAT_RX_DATA;
+            else                                                     cat = WIZ_SPI_CAT_CONFIG;
+            break;
+      }
+   }
+   wiz_spi_count(&WIZCHIP_SPI_STATS.category[cat], len, us);
+}
+
 uint8_t  WIZCHIP_READ(uint32_t AddrSel)
 {
    uint8_t ret;
    uint8_t spi_data[3];
+   uint32_t start;
 
    WIZCHIP_CRITICAL_ENTER();
    WIZCHIP.CS._select();
+   start = wiz_spi_clock(); // IsolatedEthernet
 
    AddrSel |= (_W5500_SPI_READ_ | _W5500_SPI_VDM_OP_);
 
@@ -83,11 +162,20 @@ uint8_t  WIZCHIP_READ(uint32_t AddrSel)
 		spi_data[0] = (AddrSel & 0x00FF0000) >> 16;
 		spi_data[1] = (AddrSel & 0x0000FF00) >> 8;
 		spi_data[2] = (AddrSel & 0x000000FF) >> 0;
+		// IsolatedEthernet - address and data phase in one transfer if the scatter-gather callback is registered
+		if(WIZCHIP.IF.SPI._read_burst_sg && WIZCHIP.IF.SPI._read_burst_sg(spi_data, 3, &ret, 1) == 0)
+		{
+			WIZCHIP.CS._deselect();
+			wiz_spi_account(AddrSel, 1, start);
+			WIZCHIP_CRITICAL_EXIT();
+			return ret;
+		}
 		WIZCHIP.IF.SPI._write_burst(spi_data, 3);
    }
    ret = WIZCHIP.IF.SPI._read_byte();
 
    WIZCHIP.CS._deselect();
+   wiz_spi_account(AddrSel, 1, start); // IsolatedEthernet
    WIZCHIP_CRITICAL_EXIT();
    return ret;
 }
@@ -95,9 +183,11 @@ uint8_t  WIZCHIP_READ(uint32_t AddrSel)
 void     WIZCHIP_WRITE(uint32_t AddrSel, uint8_t wb )
 {
    uint8_t spi_data[4];
+   uint32_t start;
 
    WIZCHIP_CRITICAL_ENTER();
    WIZCHIP.CS._select();
+   start = wiz_spi_clock(); // IsolatedEthernet
 
    AddrSel |= (_W5500_SPI_WRITE_ | _W5500_SPI_VDM_OP_);
 
@@ -119,6 +209,7 @@ void     WIZCHIP_WRITE(uint32_t AddrSel, uint8_t wb )
    }
 
    WIZCHIP.CS._deselect();
+   wiz_spi_account(AddrSel, 1, start); // IsolatedEthernet
    WIZCHIP_CRITICAL_EXIT();
 }
          
@@ -126,9 +217,11 @@ void     WIZCHIP_READ_BUF (uint32_t AddrSel, uint8_t* pBuf, uint16_t len)
 {
    uint8_t spi_data[3];
    uint16_t i;
+   uint32_t start;
 
    WIZCHIP_CRITICAL_ENTER();
    WIZCHIP.CS._select();
+   start = wiz_spi_clock(); // IsolatedEthernet
 
    AddrSel |= (_W5500_SPI_READ_ | _W5500_SPI_VDM_OP_);
 
@@ -145,11 +238,16 @@ void     WIZCHIP_READ_BUF (uint32_t AddrSel, uint8_t* pBuf, uint16_t len)
 		spi_data[0] = (AddrSel & 0x00FF0000) >> 16;
 		spi_data[1] = (AddrSel & 0x0000FF00) >> 8;
 		spi_data[2] = (AddrSel & 0x000000FF) >> 0;
-		WIZCHIP.IF.SPI._write_burst(spi_data, 3);
-		WIZCHIP.IF.SPI._read_burst(pBuf, len);
+		// IsolatedEthernet - address and data phase in one transfer if the scatter-gather callback can handle it
+		if(!WIZCHIP.IF.SPI._read_burst_sg || WIZCHIP.IF.SPI._read_burst_sg(spi_data, 3, pBuf, len) != 0)
+		{
+			WIZCHIP.IF.SPI._write_burst(spi_data, 3);
+			WIZCHIP.IF.SPI._read_burst(pBuf, len);
+		}
    }
 
    WIZCHIP.CS._deselect();
+   wiz_spi_account(AddrSel, len, start); // IsolatedEthernet
    WIZCHIP_CRITICAL_EXIT();
 }
 
@@ -157,9 +255,11 @@ void     WIZCHIP_WRITE_BUF(uint32_t AddrSel, uint8_t* pBuf, uint16_t len)
 {
    uint8_t spi_data[3];
    uint16_t i;
+   uint32_t start;
 
    WIZCHIP_CRITICAL_ENTER();
    WIZCHIP.CS._select();
+   start = wiz_spi_clock(); // IsolatedEthernet
 
    AddrSel |= (_W5500_SPI_WRITE_ | _W5500_SPI_VDM_OP_);
 
@@ -176,74 +276,341 @@ void     WIZCHIP_WRITE_BUF(uint32_t AddrSel, uint8_t* pBuf, uint16_t len)
 		spi_data[0] = (AddrSel & 0x00FF0000) >> 16;
 		spi_data[1] = (AddrSel & 0x0000FF00) >> 8;
 		spi_data[2] = (AddrSel & 0x000000FF) >> 0;
-		WIZCHIP.IF.SPI._write_burst(spi_data, 3);
-		WIZCHIP.IF.SPI._write_burst(pBuf, len);
+		// IsolatedEthernet - address and data phase in one transfer if the scatter-gather callback can handle it
+		if(!WIZCHIP.IF.SPI._write_burst_sg || WIZCHIP.IF.SPI._write_burst_sg(spi_data, 3, pBuf, len) != 0)
+		{
+			WIZCHIP.IF.SPI._write_burst(spi_data, 3);
+			WIZCHIP.IF.SPI._write_burst(pBuf, len);
+		}
    }
 
    WIZCHIP.CS._deselect();
+   wiz_spi_account(AddrSel, len, start); // IsolatedEthernet
    WIZCHIP_CRITICAL_EXIT();
 }
 
+// Added for IsolatedEthernet
+uint16_t WIZCHIP_READ_16(uint32_t AddrSel)
+{
+   uint8_t data[2];
 
-uint16_t getSn_TX_FSR(uint8_t sn)
+   WIZCHIP_READ_BUF(AddrSel, data, 2);
+   return (((uint16_t)data[0]) << 8) + data[1];
+}
+
+// Added for IsolatedEthernet
+uint16_t WIZCHIP_READ_16_STABLE(uint32_t AddrSel)
 {
-   uint16_t val=0,val1=0;
+   uint16_t val, prev;
+   uint8_t  tries;
 
-   do
+   val = WIZCHIP_READ_16(AddrSel);
+   for(tries = 0; val != 0 && tries < 4; tries++)
    {
-      val1 = WIZCHIP_READ(Sn_TX_FSR(sn));
-      val1 = (val1 << 8) + WIZCHIP_READ(WIZCHIP_OFFSET_INC(Sn_TX_FSR(sn),1));
-      if (val1 != 0)
+      prev = val;
+      val = WIZCHIP_READ_16(AddrSel);
+      if(val == prev) break;
+   }
+   return val;
+}
+
+// Added for IsolatedEthernet
+// Driver-side copy of registers that only change when the host writes them. See wizchip_shadow_invalidate().
+typedef struct wiz_Shadow_t
+{
+   uint8_t  valid;                         ///< Bit mask of valid common registers (_W5500_SHADOW_xxx_)
+   uint8_t  shar[6];                       ///< @ref SHAR
+   uint8_t  sipr[4];                       ///< @ref SIPR
+   uint8_t  gar[4];                        ///< @ref GAR
+   uint8_t  subr[4];                       ///< @ref SUBR
+   uint8_t  sn_valid[_WIZCHIP_SOCK_NUM_];  ///< Bit mask of valid socket registers (_W5500_SHADOW_Sn_xxx_)
+   uint8_t  sn_mr[_WIZCHIP_SOCK_NUM_];     ///< @ref Sn_MR
+   uint16_t sn_port[_WIZCHIP_SOCK_NUM_];   ///< @ref Sn_PORT
+   uint8_t  sn_txbuf[_WIZCHIP_SOCK_NUM_];  ///< @ref Sn_TXBUF_SIZE
+   uint8_t  sn_rxbuf[_WIZCHIP_SOCK_NUM_];  ///< @ref Sn_RXBUF_SIZE
+} wiz_Shadow;
+
+#define _W5500_SHADOW_SHAR_         0x01
+#define _W5500_SHADOW_SIPR_         0x02
+#define _W5500_SHADOW_GAR_          0x04
+#define _W5500_SHADOW_SUBR_         0x08
+
+#define _W5500_SHADOW_Sn_MR_        0x01
+#define _W5500_SHADOW_Sn_PORT_      0x02
+#define _W5500_SHADOW_Sn_TXBUF_     0x04
+#define _W5500_SHADOW_Sn_RXBUF_     0x08
+
+static wiz_Shadow WIZCHIP_SHADOW;
+
+// Added for IsolatedEthernet
+// Sn_IR bits cleared in the chip by wiz_latch_sn_ir() that the socket functions have not handled yet
+static uint8_t WIZCHIP_SN_IR_LATCH[_WIZCHIP_SOCK_NUM_];
+
+void wizchip_shadow_invalidate(void)
+{
+   memset(&WIZCHIP_SHADOW, 0, sizeof(WIZCHIP_SHADOW));
+   memset(WIZCHIP_SN_IR_LATCH, 0, sizeof(WIZCHIP_SN_IR_LATCH));
+}
+
+// Added for IsolatedEthernet
+// The latch is only read or changed with the bus locked, together with the chip access. The socket functions
+// don't all hold the lock, and the worker thread latches bits at any time.
+uint8_t wiz_latch_sn_ir(uint8_t sn)
+{
+   uint8_t ir;
+
+   WIZCHIP_CRITICAL_ENTER();
+   ir = WIZCHIP_READ(Sn_IR(sn)) & 0x1F;
+   if(ir)
+   {
+      WIZCHIP_WRITE(Sn_IR(sn), ir);
+      WIZCHIP_SN_IR_LATCH[sn] |= ir;
+   }
+   WIZCHIP_CRITICAL_EXIT();
+   return ir;
+}
+
+// Added for IsolatedEthernet
+uint8_t wiz_get_sn_ir(uint8_t sn)
+{
+   uint8_t ir;
+
+   WIZCHIP_CRITICAL_ENTER();
+   ir = WIZCHIP_READ(Sn_IR(sn)) | WIZCHIP_SN_IR_LATCH[sn];
+   WIZCHIP_CRITICAL_EXIT();
+   return ir;
+}
+
+// Added for IsolatedEthernet
+void wiz_set_sn_ir(uint8_t sn, uint8_t ir)
+{
+   WIZCHIP_CRITICAL_ENTER();
+   WIZCHIP_SN_IR_LATCH[sn] &= ~ir;
+   WIZCHIP_WRITE(Sn_IR(sn), ir);
+   WIZCHIP_CRITICAL_EXIT();
+}
+
+// Returns the shadow copy and valid bit for a common register block, or NULL if it's not shadowed
+static uint8_t* wiz_shadow_common(uint32_t AddrSel, uint8_t *bit)
+{
+   switch(AddrSel)
+   {
+      case SHAR: *bit = _W5500_SHADOW_SHAR_; return WIZCHIP_SHADOW.shar;
+      case SIPR: *bit = _W5500_SHADOW_SIPR_; return WIZCHIP_SHADOW.sipr;
+      case GAR:  *bit = _W5500_SHADOW_GAR_;  return WIZCHIP_SHADOW.gar;
+      case SUBR: *bit = _W5500_SHADOW_SUBR_; return WIZCHIP_SHADOW.subr;
+      default:   return 0;
+   }
+}
+
+// Returns the shadow copy and valid bit for an 8-bit socket register, or NULL if it's not shadowed
+static uint8_t* wiz_shadow_socket(uint32_t AddrSel, uint8_t *sn, uint8_t *bit)
+{
+   uint8_t block = (AddrSel >> 3) & 0x1F;
+   uint16_t offset = (AddrSel >> 8) & 0xFFFF;
+
+   if((block & 0x03) != 0x01) return 0;
+   *sn = (block - 1) >> 2;
+   if(*sn >= _WIZCHIP_SOCK_NUM_) return 0;
+
+   switch(offset)
+   {
+      case 0x0000: *bit = _W5500_SHADOW_Sn_MR_;    return &WIZCHIP_SHADOW.sn_mr[*sn];
+      case 0x001E: *bit = _W5500_SHADOW_Sn_RXBUF_; return &WIZCHIP_SHADOW.sn_rxbuf[*sn];
+      case 0x001F: *bit = _W5500_SHADOW_Sn_TXBUF_; return &WIZCHIP_SHADOW.sn_txbuf[*sn];
+      default:     return 0;
+   }
+}
+
+void wiz_shadow_write_buf(uint32_t AddrSel, uint8_t* pBuf, uint16_t len)
+{
+   uint8_t bit = 0;
+   uint8_t *copy = wiz_shadow_common(AddrSel, &bit);
+
+   WIZCHIP_CRITICAL_ENTER();
+   WIZCHIP_WRITE_BUF(AddrSel, pBuf, len);
+   if(copy)
+   {
+      memcpy(copy, pBuf, len);
+      WIZCHIP_SHADOW.valid |= bit;
+   }
+   WIZCHIP_CRITICAL_EXIT();
+}
+
+void wiz_shadow_read_buf(uint32_t AddrSel, uint8_t* pBuf, uint16_t len)
+{
+   uint8_t bit = 0;
+   uint8_t *copy = wiz_shadow_common(AddrSel, &bit);
+
+   WIZCHIP_CRITICAL_ENTER();
+   if(copy && (WIZCHIP_SHADOW.valid & bit))
+   {
+      memcpy(pBuf, copy, len);
+   }
+   else
+   {
+      WIZCHIP_READ_BUF(AddrSel, pBuf, len);
+      if(copy)
       {
-        val = WIZCHIP_READ(Sn_TX_FSR(sn));
-        val = (val << 8) + WIZCHIP_READ(WIZCHIP_OFFSET_INC(Sn_TX_FSR(sn),1));
+         memcpy(copy, pBuf, len);
+         WIZCHIP_SHADOW.valid |= bit;
       }
-   }while (val != val1);
-   return val;
+   }
+   WIZCHIP_CRITICAL_EXIT();
 }
 
+void wiz_shadow_write(uint32_t AddrSel, uint8_t wb)
+{
+   uint8_t sn = 0, bit = 0;
+   uint8_t *copy = wiz_shadow_socket(AddrSel, &sn, &bit);
 
-uint16_t getSn_RX_RSR(uint8_t sn)
+   WIZCHIP_CRITICAL_ENTER();
+   WIZCHIP_WRITE(AddrSel, wb);
+   if(copy)
+   {
+      *copy = wb;
+      WIZCHIP_SHADOW.sn_valid[sn] |= bit;
+   }
+   WIZCHIP_CRITICAL_EXIT();
+}
+
+uint8_t wiz_shadow_read(uint32_t AddrSel)
 {
-   uint16_t val=0,val1=0;
+   uint8_t sn = 0, bit = 0, ret;
+   uint8_t *copy = wiz_shadow_socket(AddrSel, &sn, &bit);
 
-   do
+   WIZCHIP_CRITICAL_ENTER();
+   if(copy && (WIZCHIP_SHADOW.sn_valid[sn] & bit))
+   {
+      ret = *copy;
+   }
+   else
    {
-      val1 = WIZCHIP_READ(Sn_RX_RSR(sn));
-      val1 = (val1 << 8) + WIZCHIP_READ(WIZCHIP_OFFSET_INC(Sn_RX_RSR(sn),1));
-      if (val1 != 0)
+      ret = WIZCHIP_READ(AddrSel);
+      if(copy)
       {
-        val = WIZCHIP_READ(Sn_RX_RSR(sn));
-        val = (val << 8) + WIZCHIP_READ(WIZCHIP_OFFSET_INC(Sn_RX_RSR(sn),1));
+         *copy = ret;
+         WIZCHIP_SHADOW.sn_valid[sn] |= bit;
       }
-   }while (val != val1);
-   return val;
+   }
+   WIZCHIP_CRITICAL_EXIT();
+   return ret;
+}
+
+void wiz_shadow_setSn_PORT(uint8_t sn, uint16_t port)
+{
+   uint8_t data[2];
+
+   data[0] = (uint8_t)(port >> 8);
+   data[1] = (uint8_t)port;
+
+   WIZCHIP_CRITICAL_ENTER();
+   WIZCHIP_WRITE_BUF(Sn_PORT(sn), data, 2);
+   WIZCHIP_SHADOW.sn_port[sn] = port;
+   WIZCHIP_SHADOW.sn_valid[sn] |= _W5500_SHADOW_Sn_PORT_;
+   WIZCHIP_CRITICAL_EXIT();
+}
+
+uint16_t wiz_shadow_getSn_PORT(uint8_t sn)
+{
+   uint8_t data[2];
+   uint16_t port;
+
+   WIZCHIP_CRITICAL_ENTER();
+   if(WIZCHIP_SHADOW.sn_valid[sn] & _W5500_SHADOW_Sn_PORT_)
+   {
+      port = WIZCHIP_SHADOW.sn_port[sn];
+   }
+   else
+   {
+      WIZCHIP_READ_BUF(Sn_PORT(sn), data, 2);
+      port = (((uint16_t)data[0]) << 8) + data[1];
+      WIZCHIP_SHADOW.sn_port[sn] = port;
+      WIZCHIP_SHADOW.sn_valid[sn] |= _W5500_SHADOW_Sn_PORT_;
+   }
+   WIZCHIP_CRITICAL_EXIT();
+   return port;
+}
+
+// IsolatedEthernet - each sample is one 2-byte burst instead of two single-byte reads, and the
+// number of samples is bounded. See WIZCHIP_READ_16_STABLE().
+uint16_t getSn_TX_FSR(uint8_t sn)
+{
+   return WIZCHIP_READ_16_STABLE(Sn_TX_FSR(sn));
+}
+
+
+uint16_t getSn_RX_RSR(uint8_t sn)
+{
+   return WIZCHIP_READ_16_STABLE(Sn_RX_RSR(sn));
+}
+
+// Added for IsolatedEthernet
+void getSn_REGS(uint8_t sn, wiz_SockRegs *regs)
+{
+   uint8_t  sample[8];
+   uint8_t  tries;
+
+   WIZCHIP_CRITICAL_ENTER();
+   WIZCHIP_READ_BUF(Sn_MR(sn), regs->raw, _W5500_SN_REGS_LEN_);
+   regs->raw[0x02] |= WIZCHIP_SN_IR_LATCH[sn]; // Sn_IR, see wiz_latch_sn_ir()
+   WIZCHIP_CRITICAL_EXIT();
+
+   // Sn_TX_FSR (0x20) and Sn_RX_RSR (0x26) are live counters. Confirm them with a
+   // short burst covering 0x20-0x27 and take the newest sample once two agree.
+   for(tries = 0; tries < 4; tries++)
+   {
+      WIZCHIP_READ_BUF(Sn_TX_FSR(sn), sample, sizeof(sample));
+      if(sample[0] == regs->raw[0x20] && sample[1] == regs->raw[0x21] &&
+         sample[6] == regs->raw[0x26] && sample[7] == regs->raw[0x27]) break;
+      regs->raw[0x20] = sample[0];
+      regs->raw[0x21] = sample[1];
+      regs->raw[0x26] = sample[6];
+      regs->raw[0x27] = sample[7];
+   }
 }
 
 void wiz_send_data(uint8_t sn, uint8_t *wizdata, uint16_t len)
 {
-   uint16_t ptr = 0;
+   if(len == 0)  return;
+   wiz_send_data_at(sn, getSn_TX_WR(sn), wizdata, len);
+}
+
+// IsolatedEthernet - split out of wiz_send_data so callers holding a getSn_REGS() snapshot can skip re-reading Sn_TX_WR
+void wiz_send_data_at(uint8_t sn, uint16_t ptr, uint8_t *wizdata, uint16_t len)
+{
+   if(len == 0)  return;
+   wiz_write_tx(sn, ptr, wizdata, len);
+   
+   ptr += len;
+   setSn_TX_WR(sn,ptr);
+}
+
+// Added for IsolatedEthernet
+void wiz_write_tx(uint8_t sn, uint16_t ptr, uint8_t *wizdata, uint16_t len)
+{
    uint32_t addrsel = 0;
 
    if(len == 0)  return;
-   ptr = getSn_TX_WR(sn);
    //M20140501 : implict type casting -> explict type casting
    //addrsel = (ptr << 8) + (WIZCHIP_TXBUF_BLOCK(sn) << 3);
    addrsel = ((uint32_t)ptr << 8) + (WIZCHIP_TXBUF_BLOCK(sn) << 3);
    //
    WIZCHIP_WRITE_BUF(addrsel,wizdata, len);
-   
-   ptr += len;
-   setSn_TX_WR(sn,ptr);
 }
 
 void wiz_recv_data(uint8_t sn, uint8_t *wizdata, uint16_t len)
 {
-   uint16_t ptr = 0;
+   if(len == 0) return;
+   wiz_recv_data_at(sn, getSn_RX_RD(sn), wizdata, len);
+}
+
+// IsolatedEthernet - split out of wiz_recv_data so callers holding a getSn_REGS() snapshot can skip re-reading Sn_RX_RD
+uint16_t wiz_recv_data_at(uint8_t sn, uint16_t ptr, uint8_t *wizdata, uint16_t len)
+{
    uint32_t addrsel = 0;
    
-   if(len == 0) return;
-   ptr = getSn_RX_RD(sn);
+   if(len == 0) return ptr;
    //M20140501 : implict type casting -> explict type casting
    //addrsel = ((ptr << 8) + (WIZCHIP_RXBUF_BLOCK(sn) << 3);
    addrsel = ((uint32_t)ptr << 8) + (WIZCHIP_RXBUF_BLOCK(sn) << 3);
@@ -252,6 +619,7 @@ void wiz_recv_data(uint8_t sn, uint8_t *wizdata, uint16_t len)
    ptr += len;
    
    setSn_RX_RD(sn,ptr);
+   return ptr;
 }
 
 
@@ -1239,6 +1239,198 @@ void     WIZCHIP_READ_BUF (uint32_t AddrSel, uint8_t* pBuf, uint16_t len);
  */
 void     WIZCHIP_WRITE_BUF(uint32_t AddrSel, uint8_t* pBuf, uint16_t len);
 
+/**
+ * @ingroup Basic_IO_function
+ * @brief It reads a 16-bit big-endian register in one 2-byte SPI transaction.
+ * @details Added for IsolatedEthernet. Use this for registers only the host writes, such as
+ * @ref Sn_TX_WR and @ref Sn_RX_RD.
+ * @param AddrSel Register address of the high byte
+ * @return Value of the register
+ */
+uint16_t WIZCHIP_READ_16(uint32_t AddrSel);
+
+/**
+ * @ingroup Basic_IO_function
+ * @brief It reads a 16-bit register the W5500 updates on its own, such as @ref Sn_TX_FSR or @ref Sn_RX_RSR.
+ * @details Added for IsolatedEthernet. The W5500 can change the register between the two bytes,
+ * so samples are taken with WIZCHIP_READ_16() until two in a row agree. A 0 sample is returned
+ * immediately, which makes an idle poll a single transaction. The number of samples is bounded;
+ * if the register never settles the newest sample is returned.
+ * @param AddrSel Register address of the high byte
+ * @return Value of the register
+ */
+uint16_t WIZCHIP_READ_16_STABLE(uint32_t AddrSel);
+
+//////////////////////////////////////////////
+// Shadow register cache                    //
+// Added for IsolatedEthernet               //
+//////////////////////////////////////////////
+
+/**
+ * @ingroup Basic_IO_function
+ * @brief Discards all shadowed register values so they are read from the chip on next access
+ *
+ * @details @ref SHAR, @ref SIPR, @ref GAR, @ref SUBR, @ref Sn_MR, @ref Sn_PORT, @ref Sn_TXBUF_SIZE
+ * and @ref Sn_RXBUF_SIZE are never changed by the W5500 itself, so once written or read they can
+ * be returned from RAM instead of over SPI. The setXXX() macros for these registers write through
+ * to the chip and update the copy, and the getXXX() macros only read the chip on a miss.
+ *
+ * The copy must be invalidated whenever the chip is reset. Call this after a hardware reset of the
+ * W5500. wizchip_sw_reset() calls it after @ref MR_RST.
+ */
+void     wizchip_shadow_invalidate(void);
+
+/**
+ * @ingroup Basic_IO_function
+ * @brief Writes a common register block (SHAR, SIPR, GAR, SUBR) and updates its shadow copy
+ * @param AddrSel Register address
+ * @param pBuf Data to write
+ * @param len Data length
+ */
+void     wiz_shadow_write_buf(uint32_t AddrSel, uint8_t* pBuf, uint16_t len);
+
+/**
+ * @ingroup Basic_IO_function
+ * @brief Reads a common register block (SHAR, SIPR, GAR, SUBR) from its shadow copy, or the chip on a miss
+ * @param AddrSel Register address
+ * @param pBuf Buffer to read into
+ * @param len Data length
+ */
+void     wiz_shadow_read_buf(uint32_t AddrSel, uint8_t* pBuf, uint16_t len);
+
+/**
+ * @ingroup Basic_IO_function
+ * @brief Writes a shadowed 8-bit socket register (Sn_MR, Sn_TXBUF_SIZE, Sn_RXBUF_SIZE) and updates its copy
+ * @param AddrSel Register address
+ * @param wb Value to write
+ */
+void     wiz_shadow_write(uint32_t AddrSel, uint8_t wb);
+
+/**
+ * @ingroup Basic_IO_function
+ * @brief Reads a shadowed 8-bit socket register (Sn_MR, Sn_TXBUF_SIZE, Sn_RXBUF_SIZE), or the chip on a miss
+ * @param AddrSel Register address
+ * @return Register value
+ */
+uint8_t  wiz_shadow_read(uint32_t AddrSel);
+
+/**
+ * @ingroup Socket_register_access_function
+ * @brief Writes @ref Sn_PORT and updates its shadow copy
+ */
+void     wiz_shadow_setSn_PORT(uint8_t sn, uint16_t port);
+
+/**
+ * @ingroup Socket_register_access_function
+ * @brief Reads @ref Sn_PORT from its shadow copy, or the chip on a miss
+ */
+uint16_t wiz_shadow_getSn_PORT(uint8_t sn);
+
+/**
+ * @ingroup Socket_register_access_function
+ * @brief Moves the set bits of @ref Sn_IR into a driver-side latch and clears them in the chip
+ *
+ * @details Added for IsolatedEthernet. INTn stays asserted while any unmasked @ref Sn_IR bit is set, so an
+ * interrupt handler has to clear the bits before the next event can cause an edge. The socket functions
+ * check @ref Sn_IR for SENDOK, TIMEOUT, etc. and clear the bits they handle, so getSn_IR() and
+ * getSn_REGS() return the chip value ORed with the latch, and setSn_IR() clears both.
+ * wizchip_shadow_invalidate() clears the latch.
+ *
+ * @param sn Socket number. It should be <b>0 ~ 7</b>.
+ * @return The bits that were set in the chip
+ */
+uint8_t  wiz_latch_sn_ir(uint8_t sn);
+
+/**
+ * @ingroup Socket_register_access_function
+ * @brief Reads @ref Sn_IR including bits moved to the latch by wiz_latch_sn_ir()
+ */
+uint8_t  wiz_get_sn_ir(uint8_t sn);
+
+/**
+ * @ingroup Socket_register_access_function
+ * @brief Clears @ref Sn_IR bits in the chip and in the wiz_latch_sn_ir() latch
+ */
+void     wiz_set_sn_ir(uint8_t sn, uint8_t ir);
+
+//////////////////////////////////////////////
+// SPI transaction accounting               //
+// Added for IsolatedEthernet               //
+//////////////////////////////////////////////
+
+/**
+ * @ingroup DATA_TYPE
+ * @brief Categories used to break down SPI traffic in wiz_SpiStats
+ *
+ * @details The category is determined from the register address of each transaction:
+ * - Reads of the common and socket registers are status polls.
+ * - The socket TX buffer and writes to @ref Sn_TX_WR are TX data.
+ * - The socket RX buffer and writes to @ref Sn_RX_RD are RX data.
+ * - Writes to @ref Sn_CR and @ref Sn_IR are commands.
+ * - Other register writes are configuration.
+ */
+typedef enum
+{
+   WIZ_SPI_CAT_STATUS = 0,    ///< Register reads
+   WIZ_SPI_CAT_TX_DATA,       ///< TX buffer memory and TX write pointer
+   WIZ_SPI_CAT_RX_DATA,       ///< RX buffer memory and RX read pointer
+   WIZ_SPI_CAT_COMMAND,       ///< Socket command and interrupt clear
+   WIZ_SPI_CAT_CONFIG,        ///< Other register writes
+   WIZ_SPI_CAT_NUM
+} wiz_SpiCategory;
+
+/**
+ * @ingroup DATA_TYPE
+ * @brief Counters for one group of SPI transactions
+ */
+typedef struct wiz_SpiCounters_t
+{
+   uint32_t transactions;     ///< Number of CS low periods (WIZCHIP_READ, WIZCHIP_WRITE, WIZCHIP_READ_BUF, WIZCHIP_WRITE_BUF calls)
+   uint32_t headerBytes;      ///< Address and control phase bytes, 3 per transaction
+   uint32_t payloadBytes;     ///< Data phase bytes
+   uint32_t csMicros;         ///< Time with CS asserted in microseconds, 0 if no clock is registered
+} wiz_SpiCounters;
+
+/**
+ * @brief Number of socket blocks in wiz_SpiStats. Same as _WIZCHIP_SOCK_NUM_ for the W5500.
+ */
+#define _W5500_SPI_STATS_SOCK_NUM_  8
+
+/**
+ * @ingroup DATA_TYPE
+ * @brief SPI transaction counters, returned by wizchip_spi_stats_get()
+ *
+ * @details Every transaction is counted in total, in either common or the socket it addresses
+ * (register, TX buffer, or RX buffer block), and in one category.
+ */
+typedef struct wiz_SpiStats_t
+{
+   wiz_SpiCounters total;                                   ///< All transactions
+   wiz_SpiCounters common;                                  ///< Common register block
+   wiz_SpiCounters sock[_W5500_SPI_STATS_SOCK_NUM_];        ///< Socket register, TX buffer, and RX buffer blocks by socket
+   wiz_SpiCounters category[WIZ_SPI_CAT_NUM];               ///< By wiz_SpiCategory
+} wiz_SpiStats;
+
+/**
+ * @ingroup Basic_IO_function
+ * @brief Registers a microsecond clock used to measure time with CS asserted
+ * @param clock_us Function returning a free-running microsecond counter, or NULL to not measure time
+ */
+void     reg_wizchip_clock_cbfunc(uint32_t (*clock_us)(void));
+
+/**
+ * @ingroup Basic_IO_function
+ * @brief Copies the SPI transaction counters
+ * @param stats Filled in with the counters
+ */
+void     wizchip_spi_stats_get(wiz_SpiStats *stats);
+
+/**
+ * @ingroup Basic_IO_function
+ * @brief Resets the SPI transaction counters to 0
+ */
+void     wizchip_spi_stats_reset(void);
+
 /////////////////////////////////
 // Common Register I/O function //
 /////////////////////////////////
@@ -1268,7 +1460,7 @@ void     WIZCHIP_WRITE_BUF(uint32_t AddrSel, uint8_t* pBuf, uint16_t len);
  * @sa getGAR()
  */
 #define setGAR(gar) \
-		WIZCHIP_WRITE_BUF(GAR,gar,4)
+		wiz_shadow_write_buf(GAR,gar,4)
 
 /**
  * @ingroup Common_register_access_function
@@ -1277,7 +1469,7 @@ void     WIZCHIP_WRITE_BUF(uint32_t AddrSel, uint8_t* pBuf, uint16_t len);
  * @sa setGAR()
  */
 #define getGAR(gar) \
-		WIZCHIP_READ_BUF(GAR,gar,4)
+		wiz_shadow_read_buf(GAR,gar,4)
 
 /**
  * @ingroup Common_register_access_function
@@ -1286,7 +1478,7 @@ void     WIZCHIP_WRITE_BUF(uint32_t AddrSel, uint8_t* pBuf, uint16_t len);
  * @sa getSUBR()
  */
 #define setSUBR(subr) \
-		WIZCHIP_WRITE_BUF(SUBR, subr,4)
+		wiz_shadow_write_buf(SUBR, subr,4)
 
 
 /**
@@ -1296,7 +1488,7 @@ void     WIZCHIP_WRITE_BUF(uint32_t AddrSel, uint8_t* pBuf, uint16_t len);
  * @sa setSUBR()
  */
 #define getSUBR(subr) \
-		WIZCHIP_READ_BUF(SUBR, subr, 4)
+		wiz_shadow_read_buf(SUBR, subr, 4)
 
 /**
  * @ingroup Common_register_access_function
@@ -1305,7 +1497,7 @@ void     WIZCHIP_WRITE_BUF(uint32_t AddrSel, uint8_t* pBuf, uint16_t len);
  * @sa getSHAR()
  */
 #define setSHAR(shar) \
-		WIZCHIP_WRITE_BUF(SHAR, shar, 6)
+		wiz_shadow_write_buf(SHAR, shar, 6)
 
 /**
  * @ingroup Common_register_access_function
@@ -1314,7 +1506,7 @@ void     WIZCHIP_WRITE_BUF(uint32_t AddrSel, uint8_t* pBuf, uint16_t len);
  * @sa setSHAR()
  */
 #define getSHAR(shar) \
-		WIZCHIP_READ_BUF(SHAR, shar, 6)
+		wiz_shadow_read_buf(SHAR, shar, 6)
 
 /**
  * @ingroup Common_register_access_function
@@ -1323,7 +1515,7 @@ void     WIZCHIP_WRITE_BUF(uint32_t AddrSel, uint8_t* pBuf, uint16_t len);
  * @sa getSIPR()
  */
 #define setSIPR(sipr) \
-		WIZCHIP_WRITE_BUF(SIPR, sipr, 4)
+		wiz_shadow_write_buf(SIPR, sipr, 4)
 
 /**
  * @ingroup Common_register_access_function
@@ -1332,7 +1524,7 @@ void     WIZCHIP_WRITE_BUF(uint32_t AddrSel, uint8_t* pBuf, uint16_t len);
  * @sa setSIPR()
  */
 #define getSIPR(sipr) \
-		WIZCHIP_READ_BUF(SIPR, sipr, 4)
+		wiz_shadow_read_buf(SIPR, sipr, 4)
 
 /**
  * @ingroup Common_register_access_function
@@ -1646,7 +1838,7 @@ void     WIZCHIP_WRITE_BUF(uint32_t AddrSel, uint8_t* pBuf, uint16_t len);
  * @sa getSn_MR()
  */
 #define setSn_MR(sn, mr) \
-		WIZCHIP_WRITE(Sn_MR(sn),mr)
+		wiz_shadow_write(Sn_MR(sn),mr)
 
 /**
  * @ingroup Socket_register_access_function
@@ -1656,7 +1848,7 @@ void     WIZCHIP_WRITE_BUF(uint32_t AddrSel, uint8_t* pBuf, uint16_t len);
  * @sa setSn_MR()
  */
 #define getSn_MR(sn) \
-	WIZCHIP_READ(Sn_MR(sn))
+	wiz_shadow_read(Sn_MR(sn))
 
 /**
  * @ingroup Socket_register_access_function
@@ -1685,8 +1877,13 @@ void     WIZCHIP_WRITE_BUF(uint32_t AddrSel, uint8_t* pBuf, uint16_t len);
  * @param (uint8_t)ir Value to set @ref Sn_IR
  * @sa getSn_IR()
  */
+// IsolatedEthernet - also clears the wiz_latch_sn_ir() latch
+/*
 #define setSn_IR(sn, ir) \
 		WIZCHIP_WRITE(Sn_IR(sn), (ir & 0x1F))
+*/
+#define setSn_IR(sn, ir) \
+		wiz_set_sn_ir(sn, (ir & 0x1F))
 
 /**
  * @ingroup Socket_register_access_function
@@ -1695,8 +1892,13 @@ void     WIZCHIP_WRITE_BUF(uint32_t AddrSel, uint8_t* pBuf, uint16_t len);
  * @return uint8_t. Value of @ref Sn_IR.
  * @sa setSn_IR()
  */
+// IsolatedEthernet - includes the wiz_latch_sn_ir() latch
+/*
 #define getSn_IR(sn) \
 		(WIZCHIP_READ(Sn_IR(sn)) & 0x1F)
+*/
+#define getSn_IR(sn) \
+		(wiz_get_sn_ir(sn) & 0x1F)
 
 /**
  * @ingroup Socket_register_access_function
@@ -1734,10 +1936,8 @@ void     WIZCHIP_WRITE_BUF(uint32_t AddrSel, uint8_t* pBuf, uint16_t len);
  * @param (uint16_t)port Value to set @ref Sn_PORT.
  * @sa getSn_PORT()
  */
-#define setSn_PORT(sn, port)  { \
-		WIZCHIP_WRITE(Sn_PORT(sn),   (uint8_t)(port >> 8)); \
-		WIZCHIP_WRITE(WIZCHIP_OFFSET_INC(Sn_PORT(sn),1), (uint8_t) port); \
-	}
+#define setSn_PORT(sn, port) \
+		wiz_shadow_setSn_PORT(sn, port)
 
 /**
  * @ingroup Socket_register_access_function
@@ -1752,7 +1952,7 @@ void     WIZCHIP_WRITE_BUF(uint32_t AddrSel, uint8_t* pBuf, uint16_t len);
 		((WIZCHIP_READ(Sn_PORT(sn)) << 8) + WIZCHIP_READ(WIZCHIP_OFFSET_INC(Sn_PORT(sn),1)))
 */
 #define getSn_PORT(sn) \
-		(((uint16_t)WIZCHIP_READ(Sn_PORT(sn)) << 8) + WIZCHIP_READ(WIZCHIP_OFFSET_INC(Sn_PORT(sn),1)))		
+		wiz_shadow_getSn_PORT(sn)
 
 /**
  * @ingroup Socket_register_access_function
@@ -1898,7 +2098,7 @@ void     WIZCHIP_WRITE_BUF(uint32_t AddrSel, uint8_t* pBuf, uint16_t len);
  * @sa getSn_RXBUF_SIZE()
  */
 #define setSn_RXBUF_SIZE(sn, rxbufsize) \
-		WIZCHIP_WRITE(Sn_RXBUF_SIZE(sn),rxbufsize)
+		wiz_shadow_write(Sn_RXBUF_SIZE(sn),rxbufsize)
 
 
 /**
@@ -1909,7 +2109,7 @@ void     WIZCHIP_WRITE_BUF(uint32_t AddrSel, uint8_t* pBuf, uint16_t len);
  * @sa setSn_RXBUF_SIZE()
  */
 #define getSn_RXBUF_SIZE(sn) \
-		WIZCHIP_READ(Sn_RXBUF_SIZE(sn))
+		wiz_shadow_read(Sn_RXBUF_SIZE(sn))
 
 /**
  * @ingroup Socket_register_access_function
@@ -1919,7 +2119,7 @@ void     WIZCHIP_WRITE_BUF(uint32_t AddrSel, uint8_t* pBuf, uint16_t len);
  * @sa getSn_TXBUF_SIZE()
  */
 #define setSn_TXBUF_SIZE(sn, txbufsize) \
-		WIZCHIP_WRITE(Sn_TXBUF_SIZE(sn), txbufsize)
+		wiz_shadow_write(Sn_TXBUF_SIZE(sn), txbufsize)
 
 /**
  * @ingroup Socket_register_access_function
@@ -1929,7 +2129,7 @@ void     WIZCHIP_WRITE_BUF(uint32_t AddrSel, uint8_t* pBuf, uint16_t len);
  * @sa setSn_TXBUF_SIZE()
  */
 #define getSn_TXBUF_SIZE(sn) \
-		WIZCHIP_READ(Sn_TXBUF_SIZE(sn))
+		wiz_shadow_read(Sn_TXBUF_SIZE(sn))
 
 /**
  * @ingroup Socket_register_access_function
@@ -1950,8 +2150,13 @@ uint16_t getSn_TX_FSR(uint8_t sn);
 #define getSn_TX_RD(sn) \
 		((WIZCHIP_READ(Sn_TX_RD(sn)) << 8) + WIZCHIP_READ(WIZCHIP_OFFSET_INC(Sn_TX_RD(sn),1)))
 */
+/*
 #define getSn_TX_RD(sn) \
 		(((uint16_t)WIZCHIP_READ(Sn_TX_RD(sn)) << 8) + WIZCHIP_READ(WIZCHIP_OFFSET_INC(Sn_TX_RD(sn),1)))		
+*/
+// IsolatedEthernet - 2-byte burst reads instead of pairs of single-byte reads
+#define getSn_TX_RD(sn) \
+		WIZCHIP_READ_16_STABLE(Sn_TX_RD(sn))
 
 /**
  * @ingroup Socket_register_access_function
@@ -1977,8 +2182,13 @@ uint16_t getSn_TX_FSR(uint8_t sn);
 #define getSn_TX_WR(sn) \
 		((WIZCHIP_READ(Sn_TX_WR(sn)) << 8) + WIZCHIP_READ(WIZCHIP_OFFSET_INC(Sn_TX_WR(sn),1)))
 */
+/*
 #define getSn_TX_WR(sn) \
 		(((uint16_t)WIZCHIP_READ(Sn_TX_WR(sn)) << 8) + WIZCHIP_READ(WIZCHIP_OFFSET_INC(Sn_TX_WR(sn),1)))		
+*/
+// IsolatedEthernet - 2-byte burst reads instead of pairs of single-byte reads
+#define getSn_TX_WR(sn) \
+		WIZCHIP_READ_16(Sn_TX_WR(sn))
 
 
 /**
@@ -2014,8 +2224,13 @@ uint16_t getSn_RX_RSR(uint8_t sn);
 #define getSn_RX_RD(sn) \
 		((WIZCHIP_READ(Sn_RX_RD(sn)) << 8) + WIZCHIP_READ(WIZCHIP_OFFSET_INC(Sn_RX_RD(sn),1)))
 */		
+/*
 #define getSn_RX_RD(sn) \
 		(((uint16_t)WIZCHIP_READ(Sn_RX_RD(sn)) << 8) + WIZCHIP_READ(WIZCHIP_OFFSET_INC(Sn_RX_RD(sn),1)))		
+*/
+// IsolatedEthernet - 2-byte burst reads instead of pairs of single-byte reads
+#define getSn_RX_RD(sn) \
+		WIZCHIP_READ_16(Sn_RX_RD(sn))
 
 /**
  * @ingroup Socket_register_access_function
@@ -2028,8 +2243,13 @@ uint16_t getSn_RX_RSR(uint8_t sn);
 #define getSn_RX_WR(sn) \
 		((WIZCHIP_READ(Sn_RX_WR(sn)) << 8) + WIZCHIP_READ(WIZCHIP_OFFSET_INC(Sn_RX_WR(sn),1)))
 */		
+/*
 #define getSn_RX_WR(sn) \
 		(((uint16_t)WIZCHIP_READ(Sn_RX_WR(sn)) << 8) + WIZCHIP_READ(WIZCHIP_OFFSET_INC(Sn_RX_WR(sn),1)))		
+*/
+// IsolatedEthernet - 2-byte burst reads instead of pairs of single-byte reads
+#define getSn_RX_WR(sn) \
+		WIZCHIP_READ_16_STABLE(Sn_RX_WR(sn))
 
 /**
  * @ingroup Socket_register_access_function
@@ -2080,6 +2300,105 @@ uint16_t getSn_RX_RSR(uint8_t sn);
 
 //////////////////////////////////////
 
+//////////////////////////////////////////////
+// Socket register window burst read        //
+// Added for IsolatedEthernet               //
+//////////////////////////////////////////////
+
+/**
+ * @ingroup Socket_register_access_function
+ * @brief Length of the contiguous socket register window from @ref Sn_MR through @ref Sn_RX_WR
+ */
+#define _W5500_SN_REGS_LEN_         0x2C
+
+/**
+ * @ingroup DATA_TYPE
+ * @brief Snapshot of the socket register window read by getSn_REGS()
+ *
+ * @details The W5500 lays out @ref Sn_MR through @ref Sn_RX_WR contiguously, so a single
+ * burst read returns the mode, status, interrupt, buffer size, free size, received size
+ * and pointer registers of a socket. Use the getSn_REGS_xxx() accessors to pull fields
+ * out of the snapshot instead of indexing it directly.
+ */
+typedef struct wiz_SockRegs_t
+{
+   uint8_t raw[_W5500_SN_REGS_LEN_];  ///< Register bytes, indexed by offset within the socket block
+} wiz_SockRegs;
+
+#define _W5500_SN_REGS_U16_(regs, ofs) \
+		((((uint16_t)(regs)->raw[ofs]) << 8) + (regs)->raw[(ofs) + 1])
+
+#define getSn_REGS_MR(regs)         ((regs)->raw[0x00])                         ///< @ref Sn_MR from a snapshot
+#define getSn_REGS_IR(regs)         ((regs)->raw[0x02] & 0x1F)                  ///< @ref Sn_IR from a snapshot
+#define getSn_REGS_SR(regs)         ((regs)->raw[0x03])                         ///< @ref Sn_SR from a snapshot
+#define getSn_REGS_PORT(regs)       _W5500_SN_REGS_U16_(regs, 0x04)             ///< @ref Sn_PORT from a snapshot
+#define getSn_REGS_DPORT(regs)      _W5500_SN_REGS_U16_(regs, 0x10)             ///< @ref Sn_DPORT from a snapshot
+#define getSn_REGS_RxMAX(regs)      (((uint16_t)(regs)->raw[0x1E]) << 10)       ///< Socket RX buffer size in bytes from a snapshot
+#define getSn_REGS_TxMAX(regs)      (((uint16_t)(regs)->raw[0x1F]) << 10)       ///< Socket TX buffer size in bytes from a snapshot
+#define getSn_REGS_TX_FSR(regs)     _W5500_SN_REGS_U16_(regs, 0x20)             ///< @ref Sn_TX_FSR from a snapshot
+#define getSn_REGS_TX_RD(regs)      _W5500_SN_REGS_U16_(regs, 0x22)             ///< @ref Sn_TX_RD from a snapshot
+#define getSn_REGS_TX_WR(regs)      _W5500_SN_REGS_U16_(regs, 0x24)             ///< @ref Sn_TX_WR from a snapshot
+#define getSn_REGS_RX_RSR(regs)     _W5500_SN_REGS_U16_(regs, 0x26)             ///< @ref Sn_RX_RSR from a snapshot
+#define getSn_REGS_RX_RD(regs)      _W5500_SN_REGS_U16_(regs, 0x28)             ///< @ref Sn_RX_RD from a snapshot
+#define getSn_REGS_RX_WR(regs)      _W5500_SN_REGS_U16_(regs, 0x2A)             ///< @ref Sn_RX_WR from a snapshot
+
+/**
+ * @ingroup Socket_register_access_function
+ * @brief Read the socket register window of socket sn in one SPI burst
+ *
+ * @details Replaces the separate single-byte reads of @ref Sn_MR, @ref Sn_SR, @ref Sn_IR,
+ * @ref Sn_TX_FSR, @ref Sn_RX_RSR and the pointer registers with one transaction. Because
+ * @ref Sn_TX_FSR and @ref Sn_RX_RSR can change while they are being clocked out, the
+ * 8 bytes covering them are re-read in a second short burst and the window is retried
+ * until two consecutive samples agree.
+ *
+ * @param (uint8_t)sn Socket number. It should be <b>0 ~ 7</b>.
+ * @param regs Snapshot to fill in
+ */
+void getSn_REGS(uint8_t sn, wiz_SockRegs *regs);
+
+/**
+ * @ingroup Basic_IO_function
+ * @brief Same as wiz_send_data() but with a known @ref Sn_TX_WR value
+ *
+ * @details Used when the caller already has @ref Sn_TX_WR from getSn_REGS(), which saves
+ * re-reading the pointer before the copy. Added for IsolatedEthernet.
+ *
+ * @param (uint8_t)sn Socket number. It should be <b>0 ~ 7</b>.
+ * @param ptr Current value of @ref Sn_TX_WR
+ * @param wizdata Pointer buffer to write data
+ * @param len Data length
+ */
+void wiz_send_data_at(uint8_t sn, uint16_t ptr, uint8_t *wizdata, uint16_t len);
+
+/**
+ * @ingroup Basic_IO_function
+ * @brief Copies data into the TX buffer memory of a socket without updating @ref Sn_TX_WR
+ *
+ * @details Lets several pieces be written before one @ref Sn_TX_WR update and SEND. The W5500
+ * wraps the offset within the socket's TX buffer, so ptr can run past the end. Added for IsolatedEthernet.
+ *
+ * @param (uint8_t)sn Socket number. It should be <b>0 ~ 7</b>.
+ * @param ptr TX buffer offset to write at, based on @ref Sn_TX_WR
+ * @param wizdata Pointer buffer to write data
+ * @param len Data length
+ */
+void wiz_write_tx(uint8_t sn, uint16_t ptr, uint8_t *wizdata, uint16_t len);
+
+/**
+ * @ingroup Basic_IO_function
+ * @brief Same as wiz_recv_data() but with a known @ref Sn_RX_RD value
+ *
+ * @details Used when the caller already has @ref Sn_RX_RD from getSn_REGS(). Added for IsolatedEthernet.
+ *
+ * @param (uint8_t)sn Socket number. It should be <b>0 ~ 7</b>.
+ * @param ptr Current value of @ref Sn_RX_RD
+ * @param wizdata Pointer buffer to read data
+ * @param len Data length
+ * @return The new value of @ref Sn_RX_RD
+ */
+uint16_t wiz_recv_data_at(uint8_t sn, uint16_t ptr, uint8_t *wizdata, uint16_t len);
+
 /////////////////////////////////////
 // Sn_TXBUF & Sn_RXBUF IO function //
 /////////////////////////////////////
@@ -461,7 +461,7 @@ int16_t dns_makequery(uint16_t op, char * name, uint8_t * buf, uint16_t len)
 	cp = put16(cp, 0x0001);				/* type */
 	cp = put16(cp, 0x0001);				/* class */
 
-	return ((int16_t)((uint32_t)(cp) - (uint32_t)(buf)));
+	return ((int16_t)(cp - buf)); // IsolatedEthernet - pointer difference instead of casting pointers to uint32_t
 }
 
 /*
@@ -63,9 +63,15 @@ using namespace wiznet; // Added for IsolatedEthernet
 //#define SOCK_ANY_PORT_NUM  0xC000;
 #define SOCK_ANY_PORT_NUM  0xC000
 
-static uint16_t sock_any_port = SOCK_ANY_PORT_NUM;
+// IsolatedEthernet - port 0 uses wizchip_ephemeral_port() instead
+//static uint16_t sock_any_port = SOCK_ANY_PORT_NUM;
 static uint16_t sock_io_mode = 0;
 static uint16_t sock_is_sending = 0;
+static uint16_t sock_send_pending = 0; // IsolatedEthernet - data appended to the TX buffer while a SEND was in flight or corked
+static uint16_t sock_send_corked = 0;  // IsolatedEthernet - send_cork(), hold appended data until send_flush()
+static uint16_t sock_send_push = 0;    // IsolatedEthernet - send_flush() was called while a SEND was in flight
+static uint16_t sock_send_wr[_WIZCHIP_SOCK_NUM_] = {0,};   // IsolatedEthernet - Sn_TX_WR after the last send()
+static uint16_t sock_send_mark[_WIZCHIP_SOCK_NUM_] = {0,}; // IsolatedEthernet - Sn_TX_WR at the last SEND
 
 static uint16_t sock_remained_size[_WIZCHIP_SOCK_NUM_] = {0,0,};
 
@@ -84,6 +90,18 @@ uint8_t  sock_pack_info[_WIZCHIP_SOCK_NUM_] = {0,};
 #endif
 
 
+// Added for IsolatedEthernet
+// Holds the bus for the duration of a socket operation so the register accesses inside
+// it don't each lock and reconfigure SPI. Release the bus with yield() in loops that 
+// wait on the chip so other threads can get to it.
+class BusSession
+{
+public:
+   BusSession()  { WIZCHIP_CRITICAL_ENTER(); }
+   ~BusSession() { WIZCHIP_CRITICAL_EXIT(); }
+   void yield()  { WIZCHIP_CRITICAL_EXIT(); WIZCHIP_CRITICAL_ENTER(); }
+};
+
 #define CHECK_SOCKNUM()   \
    do{                    \
       if(sn > _WIZCHIP_SOCK_NUM_) return SOCKERR_SOCKNUM;   \
@@ -108,6 +126,7 @@ uint8_t  sock_pack_info[_WIZCHIP_SOCK_NUM_] = {0,};
 
 int8_t socket(uint8_t sn, uint8_t protocol, uint16_t port, uint8_t flag)
 {
+   BusSession session; // IsolatedEthernet
 	CHECK_SOCKNUM();
 	switch(protocol)
 	{
@@ -179,8 +198,10 @@ int8_t socket(uint8_t sn, uint8_t protocol, uint16_t port, uint8_t flag)
     #endif
 	if(!port)
 	{
-	   port = sock_any_port++;
-	   if(sock_any_port == 0xFFF0) sock_any_port = SOCK_ANY_PORT_NUM;
+	   // IsolatedEthernet - randomized ephemeral port instead of a counter from 0xC000
+	   //port = sock_any_port++;
+	   //if(sock_any_port == 0xFFF0) sock_any_port = SOCK_ANY_PORT_NUM;
+	   port = wizchip_ephemeral_port(sn);
 	}
    setSn_PORT(sn,port);	
    setSn_CR(sn,Sn_CR_OPEN);
@@ -190,6 +211,9 @@ int8_t socket(uint8_t sn, uint8_t protocol, uint16_t port, uint8_t flag)
    //
 	sock_io_mode |= ((flag & SF_IO_NONBLOCK) << sn);   
    sock_is_sending &= ~(1<<sn);
+   sock_send_pending &= ~(1<<sn); // IsolatedEthernet
+   sock_send_corked &= ~(1<<sn);  // IsolatedEthernet
+   sock_send_push &= ~(1<<sn);    // IsolatedEthernet
    sock_remained_size[sn] = 0;
    //M20150601 : repalce 0 with PACK_COMPLETED
    //sock_pack_info[sn] = 0;
@@ -236,6 +260,9 @@ int8_t close(uint8_t sn)
 	sock_io_mode &= ~(1<<sn);
 	//
 	sock_is_sending &= ~(1<<sn);
+	sock_send_pending &= ~(1<<sn); // IsolatedEthernet
+	sock_send_corked &= ~(1<<sn);  // IsolatedEthernet
+	sock_send_push &= ~(1<<sn);    // IsolatedEthernet
 	sock_remained_size[sn] = 0;
 	sock_pack_info[sn] = 0;
 	while(getSn_SR(sn) != SOCK_CLOSED);
@@ -301,8 +328,19 @@ int8_t connect(uint8_t sn, uint8_t * addr, uint16_t port)
 
 int8_t disconnect(uint8_t sn)
 {
+   int8_t ret; // IsolatedEthernet
+
    CHECK_SOCKNUM();
    CHECK_SOCKMODE(Sn_MR_TCP);
+   // IsolatedEthernet - data held back by send() must be sent before the FIN. The SEND in flight ends with
+   // SENDOK or TIMEOUT. In non-block io mode, returns SOCK_BUSY without DISCON until then; call it again or
+   // close() to discard the data.
+   while((ret = send_flush(sn)) != SOCK_OK)
+   {
+      if(ret < 0) return ret;
+      if(sock_io_mode & (1<<sn)) return SOCK_BUSY;
+      wizchip_yield();
+   }
 	setSn_CR(sn,Sn_CR_DISCON);
 	/* wait to process the command... */
 	while(getSn_CR(sn));
@@ -319,47 +357,84 @@ int8_t disconnect(uint8_t sn)
 	return SOCK_OK;
 }
 
-int32_t send(uint8_t sn, uint8_t * buf, uint16_t len)
+// IsolatedEthernet - checks the SEND in flight on a TCP socket using the Sn_IR value ir. Once SENDOK arrives,
+// issues one SEND for the data send() appended to the TX buffer in the meantime, unless the socket is corked
+// and force is 0 and send_flush() has not been called. Returns SOCK_OK if no SEND is in flight anymore or a
+// new one was just issued, SOCK_BUSY if the SEND is still in progress, or SOCKERR_TIMEOUT if it timed out
+// (the socket is closed).
+static int8_t send_progress(uint8_t sn, uint8_t ir, uint8_t force)
 {
-   uint8_t tmp=0;
-   uint16_t freesize=0;
-   
-   CHECK_SOCKNUM();
-   CHECK_SOCKMODE(Sn_MR_TCP);
-   CHECK_SOCKDATA();
-   tmp = getSn_SR(sn);
-   if(tmp != SOCK_ESTABLISHED && tmp != SOCK_CLOSE_WAIT) return SOCKERR_SOCKSTATUS;
-   if( sock_is_sending & (1<<sn) )
+   if(sock_is_sending & (1<<sn))
    {
-      tmp = getSn_IR(sn);
-      if(tmp & Sn_IR_SENDOK)
+      if(ir & Sn_IR_SENDOK)
       {
          setSn_IR(sn, Sn_IR_SENDOK);
-         //M20150401 : Typing Error
-         //#if _WZICHIP_ == 5200
-         #if _WIZCHIP_ == 5200
-            if(getSn_TX_RD(sn) != sock_next_rd[sn])
-            {
-               setSn_CR(sn,Sn_CR_SEND);
-               while(getSn_CR(sn));
-               return SOCK_BUSY;
-            }
-         #endif
-         sock_is_sending &= ~(1<<sn);         
+         sock_is_sending &= ~(1<<sn);
       }
-      else if(tmp & Sn_IR_TIMEOUT)
+      else if(ir & Sn_IR_TIMEOUT)
       {
          close(sn);
          return SOCKERR_TIMEOUT;
       }
       else return SOCK_BUSY;
    }
-   freesize = getSn_TxMAX(sn);
+   if((sock_send_pending & (1<<sn)) && (force || !(sock_send_corked & (1<<sn)) || (sock_send_push & (1<<sn))))
+   {
+      sock_send_pending &= ~(1<<sn);
+      sock_send_push &= ~(1<<sn);
+      sock_send_mark[sn] = sock_send_wr[sn];
+      setSn_CR(sn,Sn_CR_SEND);
+      while(getSn_CR(sn));
+      sock_is_sending |= (1<<sn);
+   }
+   return SOCK_OK;
+}
+
+// IsolatedEthernet - bookkeeping after len bytes were appended at Sn_TX_WR value wr and Sn_TX_WR was
+// updated. Issues the SEND unless one is in flight or the socket is corked.
+static void send_appended(uint8_t sn, uint16_t wr, uint16_t len)
+{
+   sock_send_wr[sn] = wr + len;
+   if(!(sock_send_pending & (1<<sn))) sock_send_mark[sn] = wr;
+   if((sock_is_sending & (1<<sn)) || (sock_send_corked & (1<<sn)))
+   {
+      sock_send_pending |= (1<<sn);
+      return;
+   }
+
+   sock_send_mark[sn] = sock_send_wr[sn];
+   setSn_CR(sn,Sn_CR_SEND);
+   /* wait to process the command... */
+   while(getSn_CR(sn));
+   sock_is_sending |= (1 << sn);
+}
+
+int32_t send(uint8_t sn, uint8_t * buf, uint16_t len)
+{
+   uint8_t tmp=0;
+   uint16_t freesize=0;
+   uint16_t tmp16; // IsolatedEthernet
+   wiz_SockRegs regs; // IsolatedEthernet - one burst read of the socket registers
+   BusSession session; // IsolatedEthernet
+   
+   CHECK_SOCKNUM();
+   CHECK_SOCKDATA();
+   getSn_REGS(sn, &regs);
+   if((getSn_REGS_MR(&regs) & 0x0F) != Sn_MR_TCP) return SOCKERR_SOCKMODE;
+   tmp = getSn_REGS_SR(&regs);
+   if(tmp != SOCK_ESTABLISHED && tmp != SOCK_CLOSE_WAIT) return SOCKERR_SOCKSTATUS;
+   // IsolatedEthernet - a SEND in flight no longer makes send() return SOCK_BUSY. New data is appended to
+   // the TX buffer behind it and sent with one SEND once SENDOK arrives (send_progress()).
+   if(send_progress(sn, getSn_REGS_IR(&regs), 0) == SOCKERR_TIMEOUT) return SOCKERR_TIMEOUT;
+   freesize = getSn_REGS_TxMAX(&regs);
    if (len > freesize) len = freesize; // check size not to exceed MAX size.
    while(1)
    {
-      freesize = getSn_TX_FSR(sn);
-      tmp = getSn_SR(sn);
+      freesize = getSn_REGS_TX_FSR(&regs);
+      // IsolatedEthernet - also count data appended but not yet sent, however Sn_TX_FSR treats it
+      tmp16 = getSn_REGS_TxMAX(&regs) - (uint16_t)(getSn_REGS_TX_WR(&regs) - getSn_REGS_TX_RD(&regs));
+      if(tmp16 < freesize) freesize = tmp16;
+      tmp = getSn_REGS_SR(&regs);
       if ((tmp != SOCK_ESTABLISHED) && (tmp != SOCK_CLOSE_WAIT))
       {
          close(sn);
@@ -367,8 +442,12 @@ int32_t send(uint8_t sn, uint8_t * buf, uint16_t len)
       }
       if( (sock_io_mode & (1<<sn)) && (len > freesize) ) return SOCK_BUSY;
       if(len <= freesize) break;
+      session.yield();
+      getSn_REGS(sn, &regs);
+      // IsolatedEthernet - the space may be held by appended (or corked) data that needs a SEND
+      if(send_progress(sn, getSn_REGS_IR(&regs), 1) == SOCKERR_TIMEOUT) return SOCKERR_TIMEOUT;
    }
-   wiz_send_data(sn, buf, len);
+   wiz_send_data_at(sn, getSn_REGS_TX_WR(&regs), buf, len);
    #if _WIZCHIP_ == 5200
       sock_next_rd[sn] = getSn_TX_RD(sn) + len;
    #endif
@@ -377,10 +456,8 @@ int32_t send(uint8_t sn, uint8_t * buf, uint16_t len)
       setSn_TX_WRSR(sn,len);
    #endif
    
-   setSn_CR(sn,Sn_CR_SEND);
-   /* wait to process the command... */
-   while(getSn_CR(sn));
-   sock_is_sending |= (1 << sn);
+   // IsolatedEthernet - if a SEND is still in flight or the socket is corked, this data goes out with the next SEND
+   send_appended(sn, getSn_REGS_TX_WR(&regs), len);
    //M20150409 : Explicit Type Casting
    //return len;
    return (int32_t)len;
@@ -388,9 +465,17 @@ int32_t send(uint8_t sn, uint8_t * buf, uint16_t len)
 
 
 int32_t recv(uint8_t sn, uint8_t * buf, uint16_t len)
+{
+   return recv_regs(sn, buf, len, 0); // IsolatedEthernet
+}
+
+// IsolatedEthernet - the body of recv(), starting from the caller's getSn_REGS() if it has them
+int32_t recv_regs(uint8_t sn, uint8_t * buf, uint16_t len, const wiz_SockRegs *cached)
 {
    uint8_t  tmp = 0;
    uint16_t recvsize = 0;
+   wiz_SockRegs regs; // IsolatedEthernet - one burst read of the socket registers
+   BusSession session; // IsolatedEthernet
 //A20150601 : For integarating with W5300
 #if   _WIZCHIP_ == 5300
    uint8_t head[2];
@@ -398,10 +483,12 @@ int32_t recv(uint8_t sn, uint8_t * buf, uint16_t len)
 #endif
 //
    CHECK_SOCKNUM();
-   CHECK_SOCKMODE(Sn_MR_TCP);
    CHECK_SOCKDATA();
+   if(cached) regs = *cached;  // IsolatedEthernet
+   else getSn_REGS(sn, &regs);
+   if((getSn_REGS_MR(&regs) & 0x0F) != Sn_MR_TCP) return SOCKERR_SOCKMODE;
    
-   recvsize = getSn_RxMAX(sn);
+   recvsize = getSn_REGS_RxMAX(&regs);
    if(recvsize < len) len = recvsize;
       
 //A20150601 : For Integrating with W5300
@@ -413,14 +500,14 @@ int32_t recv(uint8_t sn, uint8_t * buf, uint16_t len)
 //
       while(1)
       {
-         recvsize = getSn_RX_RSR(sn);
-         tmp = getSn_SR(sn);
+         recvsize = getSn_REGS_RX_RSR(&regs);
+         tmp = getSn_REGS_SR(&regs);
          if (tmp != SOCK_ESTABLISHED)
          {
             if(tmp == SOCK_CLOSE_WAIT)
             {
                if(recvsize != 0) break;
-               else if(getSn_TX_FSR(sn) == getSn_TxMAX(sn))
+               else if(getSn_REGS_TX_FSR(&regs) == getSn_REGS_TxMAX(&regs))
                {
                   close(sn);
                   return SOCKERR_SOCKSTATUS;
@@ -434,6 +521,8 @@ int32_t recv(uint8_t sn, uint8_t * buf, uint16_t len)
          }
          if((sock_io_mode & (1<<sn)) && (recvsize == 0)) return SOCK_BUSY;
          if(recvsize != 0) break;
+         session.yield();
+         getSn_REGS(sn, &regs);
       };
 #if _WIZCHIP_ == 5300
    }
@@ -482,7 +571,7 @@ int32_t recv(uint8_t sn, uint8_t * buf, uint16_t len)
    //len = recvsize;
 #else   
    if(recvsize < len) len = recvsize;   
-   wiz_recv_data(sn, buf, len);
+   wiz_recv_data_at(sn, getSn_REGS_RX_RD(&regs), buf, len);
    setSn_CR(sn,Sn_CR_RECV);
    while(getSn_CR(sn));
 #endif
@@ -497,6 +586,7 @@ int32_t sendto(uint8_t sn, uint8_t * buf, uint16_t len, uint8_t * addr, uint16_t
    uint8_t tmp = 0;
    uint16_t freesize = 0;
    uint32_t taddr;
+   BusSession session; // IsolatedEthernet
 
    CHECK_SOCKNUM();
    switch(getSn_MR(sn) & 0x0F)
@@ -531,6 +621,13 @@ int32_t sendto(uint8_t sn, uint8_t * buf, uint16_t len, uint8_t * addr, uint16_t
 //#else
 //   if(tmp != SOCK_MACRAW && tmp != SOCK_UDP) return SOCKERR_SOCKSTATUS;
 //#endif
+   // IsolatedEthernet - in non-block io mode the previous datagram may still be in progress (ARP),
+   // and Sn_DIPR/Sn_DPORT must not change until it's done. Its result is available from sendto_status().
+   while((sock_is_sending & (1<<sn)) && (sendto_status(sn) == SOCK_BUSY))
+   {
+      if(sock_io_mode & (1<<sn)) return SOCK_BUSY;
+      session.yield();
+   }
       
    setSn_DIPR(sn,addr);
    setSn_DPORT(sn,port);      
@@ -542,6 +639,7 @@ int32_t sendto(uint8_t sn, uint8_t * buf, uint16_t len, uint8_t * addr, uint16_t
       if(getSn_SR(sn) == SOCK_CLOSED) return SOCKERR_SOCKCLOSED;
       if( (sock_io_mode & (1<<sn)) && (len > freesize) ) return SOCK_BUSY;
       if(len <= freesize) break;
+      session.yield(); // IsolatedEthernet
    };
 	wiz_send_data(sn, buf, len);
 
@@ -563,8 +661,15 @@ int32_t sendto(uint8_t sn, uint8_t * buf, uint16_t len, uint8_t * addr, uint16_t
 	setSn_CR(sn,Sn_CR_SEND);
 	/* wait to process the command... */
 	while(getSn_CR(sn));
+   // IsolatedEthernet - in non-block io mode return now and let the caller poll sendto_status()
+   if(sock_io_mode & (1<<sn))
+   {
+      sock_is_sending |= (1<<sn);
+      return (int32_t)len;
+   }
    while(1)
    {
+      session.yield(); // IsolatedEthernet - this can take as long as ARP resolution, don't hold the bus
       tmp = getSn_IR(sn);
       if(tmp & Sn_IR_SENDOK)
       {
@@ -595,6 +700,121 @@ int32_t sendto(uint8_t sn, uint8_t * buf, uint16_t len, uint8_t * addr, uint16_t
 }
 
 
+// Added for IsolatedEthernet
+int32_t send_reserve(uint8_t sn, uint16_t *ptr)
+{
+   uint8_t  tmp;
+   uint16_t freesize, tmp16;
+   wiz_SockRegs regs;
+   BusSession session;
+
+   CHECK_SOCKNUM();
+   getSn_REGS(sn, &regs);
+   if((getSn_REGS_MR(&regs) & 0x0F) != Sn_MR_TCP) return SOCKERR_SOCKMODE;
+   tmp = getSn_REGS_SR(&regs);
+   if(tmp != SOCK_ESTABLISHED && tmp != SOCK_CLOSE_WAIT) return SOCKERR_SOCKSTATUS;
+   if(send_progress(sn, getSn_REGS_IR(&regs), 0) == SOCKERR_TIMEOUT) return SOCKERR_TIMEOUT;
+
+   freesize = getSn_REGS_TX_FSR(&regs);
+   tmp16 = getSn_REGS_TxMAX(&regs) - (uint16_t)(getSn_REGS_TX_WR(&regs) - getSn_REGS_TX_RD(&regs));
+   if(tmp16 < freesize) freesize = tmp16;
+   *ptr = getSn_REGS_TX_WR(&regs);
+   return (int32_t)freesize;
+}
+
+// Added for IsolatedEthernet
+int32_t send_commit(uint8_t sn, uint16_t ptr, uint16_t len)
+{
+   uint8_t  tmp;
+   wiz_SockRegs regs;
+   BusSession session;
+
+   CHECK_SOCKNUM();
+   if(len == 0) return 0;
+   // The bus may have been released since send_reserve(), and the W5500 can close the socket meanwhile
+   getSn_REGS(sn, &regs);
+   if((getSn_REGS_MR(&regs) & 0x0F) != Sn_MR_TCP) return SOCKERR_SOCKMODE;
+   tmp = getSn_REGS_SR(&regs);
+   if(tmp != SOCK_ESTABLISHED && tmp != SOCK_CLOSE_WAIT) return SOCKERR_SOCKSTATUS;
+   setSn_TX_WR(sn, (uint16_t)(ptr + len));
+   send_appended(sn, ptr, len);
+   return (int32_t)len;
+}
+
+// Added for IsolatedEthernet
+int8_t send_flush(uint8_t sn)
+{
+   int8_t ret;
+
+   CHECK_SOCKNUM();
+   if(!(sock_send_pending & (1<<sn))) return SOCK_OK;
+
+   BusSession session;
+   ret = send_progress(sn, getSn_IR(sn), 1);
+   // Still in flight, the next send_poll() sends it even if corked
+   if(ret == SOCK_BUSY) sock_send_push |= (1<<sn);
+   return ret;
+}
+
+// Added for IsolatedEthernet
+int8_t send_poll(uint8_t sn)
+{
+   CHECK_SOCKNUM();
+   if(!(sock_send_pending & (1<<sn))) return SOCK_OK;
+   // Corked and nothing to wait for, no need to read Sn_IR
+   if(!(sock_is_sending & (1<<sn)) && (sock_send_corked & (1<<sn)) && !(sock_send_push & (1<<sn))) return SOCK_OK;
+
+   BusSession session;
+   return send_progress(sn, getSn_IR(sn), 0);
+}
+
+// Added for IsolatedEthernet
+int8_t send_cork(uint8_t sn, uint8_t cork)
+{
+   CHECK_SOCKNUM();
+   // socket() and close() on other threads change the same mask under the bus lock
+   BusSession session;
+   if(cork)
+   {
+      sock_send_corked |= (1<<sn);
+      return SOCK_OK;
+   }
+   sock_send_corked &= ~(1<<sn);
+   return send_flush(sn);
+}
+
+// Added for IsolatedEthernet
+uint16_t send_pending(uint8_t sn)
+{
+   if(sn >= _WIZCHIP_SOCK_NUM_) return 0;
+   if(!(sock_send_pending & (1<<sn))) return 0;
+   return (uint16_t)(sock_send_wr[sn] - sock_send_mark[sn]);
+}
+
+// Added for IsolatedEthernet
+int8_t sendto_status(uint8_t sn)
+{
+   uint8_t tmp;
+   BusSession session;
+
+   CHECK_SOCKNUM();
+   if(!(sock_is_sending & (1<<sn))) return SOCK_OK;
+   tmp = getSn_IR(sn);
+   if(tmp & Sn_IR_SENDOK)
+   {
+      setSn_IR(sn, Sn_IR_SENDOK);
+      sock_is_sending &= ~(1<<sn);
+      return SOCK_OK;
+   }
+   else if(tmp & Sn_IR_TIMEOUT)
+   {
+      setSn_IR(sn, Sn_IR_TIMEOUT);
+      sock_is_sending &= ~(1<<sn);
+      return SOCKERR_TIMEOUT;
+   }
+   return SOCK_BUSY;
+}
+
 
 int32_t recvfrom(uint8_t sn, uint8_t * buf, uint16_t len, uint8_t * addr, uint16_t *port)
 {
@@ -608,6 +828,9 @@ int32_t recvfrom(uint8_t sn, uint8_t * buf, uint16_t len, uint8_t * addr, uint16
 //   
    uint8_t  head[8];
 	uint16_t pack_len=0;
+   wiz_SockRegs regs;   // IsolatedEthernet - one burst read of the socket registers
+   uint16_t rx_rd;      // IsolatedEthernet - Sn_RX_RD tracked locally between header and data reads
+   BusSession session;  // IsolatedEthernet
 
    CHECK_SOCKNUM();
    //CHECK_SOCKMODE(Sn_MR_UDP);
@@ -616,7 +839,8 @@ int32_t recvfrom(uint8_t sn, uint8_t * buf, uint16_t len, uint8_t * addr, uint16
    mr1 = getMR();
 #endif   
 
-   switch((mr=getSn_MR(sn)) & 0x0F)
+   getSn_REGS(sn, &regs);
+   switch((mr=getSn_REGS_MR(&regs)) & 0x0F)
    {
       case Sn_MR_UDP:
 	  case Sn_MR_IPRAW:
@@ -634,12 +858,15 @@ int32_t recvfrom(uint8_t sn, uint8_t * buf, uint16_t len, uint8_t * addr, uint16
    {
       while(1)
       {
-         pack_len = getSn_RX_RSR(sn);
-         if(getSn_SR(sn) == SOCK_CLOSED) return SOCKERR_SOCKCLOSED;
+         pack_len = getSn_REGS_RX_RSR(&regs);
+         if(getSn_REGS_SR(&regs) == SOCK_CLOSED) return SOCKERR_SOCKCLOSED;
          if( (sock_io_mode & (1<<sn)) && (pack_len == 0) ) return SOCK_BUSY;
          if(pack_len != 0) break;
+         session.yield();
+         getSn_REGS(sn, &regs);
       };
    }
+   rx_rd = getSn_REGS_RX_RD(&regs);
 //D20150601 : Move it to bottom
 // sock_pack_info[sn] = PACK_COMPLETED;
 	switch (mr & 0x07)
@@ -647,7 +874,7 @@ int32_t recvfrom(uint8_t sn, uint8_t * buf, uint16_t len, uint8_t * addr, uint16
 	   case Sn_MR_UDP :
 	      if(sock_remained_size[sn] == 0)
 	      {
-   			wiz_recv_data(sn, head, 8);
+   			rx_rd = wiz_recv_data_at(sn, rx_rd, head, 8);
    			setSn_CR(sn,Sn_CR_RECV);
    			while(getSn_CR(sn));
    			// read peer's IP address, port number & packet length
@@ -696,7 +923,7 @@ int32_t recvfrom(uint8_t sn, uint8_t * buf, uint16_t len, uint8_t * addr, uint16
 			//
 			// Need to packet length check (default 1472)
 			//
-   		wiz_recv_data(sn, buf, pack_len); // data copy.
+   		wiz_recv_data_at(sn, rx_rd, buf, pack_len); // data copy.
 			break;
 	   case Sn_MR_MACRAW :
 	      if(sock_remained_size[sn] == 0)
@@ -221,6 +221,9 @@ int8_t  connect(uint8_t sn, uint8_t * addr, uint16_t port);
  * @note It is valid only in TCP server or client mode. \n
  *       In block io mode, it does not return until disconnection is completed. \n
  *       In Non-block io mode, it return @ref SOCK_BUSY immediately. \n
+ *       IsolatedEthernet - Data held back by send() is sent before the FIN. In non-block io mode, while that
+ *       data waits for the SEND in flight, it returns @ref SOCK_BUSY without disconnecting. Call it again, or
+ *       close() to discard the data. \n
 
  * @param sn Socket number. It should be <b>0 ~ @ref \_WIZCHIP_SOCK_NUM_</b>.
  * @return @b Success :   @ref SOCK_OK \n
@@ -238,6 +241,9 @@ int8_t  disconnect(uint8_t sn);
  * @note    It is valid only in TCP server or client mode. It can't send data greater than socket buffer size. \n
  *          In block io mode, It doesn't return until data send is completed - socket buffer size is greater than data. \n
  *          In non-block io mode, It return @ref SOCK_BUSY immediately when socket buffer is not enough. \n
+ *          IsolatedEthernet - If a previous SEND has not finished yet, the data is appended to the TX buffer and sent
+ *          with the next SEND once @ref Sn_IR_SENDOK arrives, instead of returning @ref SOCK_BUSY. That SEND is issued
+ *          by the next send(), send_poll(), send_flush() or disconnect() call. See also send_cork(). \n
  * @param sn Socket number. It should be <b>0 ~ @ref \_WIZCHIP_SOCK_NUM_</b>.
  * @param buf Pointer buffer containing data to be sent.
  * @param len The byte length of data in buf.
@@ -251,6 +257,89 @@ int8_t  disconnect(uint8_t sn);
  */
 int32_t send(uint8_t sn, uint8_t * buf, uint16_t len);
 
+/**
+ * @ingroup WIZnet_socket_APIs
+ * @brief	Starts a zero-copy send on a TCP socket.
+ * @details Added for IsolatedEthernet. Returns the TX buffer space available and the current @ref Sn_TX_WR.
+ *          Write up to that many bytes at ptr, ptr + n, ... using wiz_write_tx(), then call send_commit() once.
+ *          Nothing else may send on the socket in between.
+ *
+ * @param sn  Socket number. It should be <b>0 ~ @ref \_WIZCHIP_SOCK_NUM_</b>.
+ * @param ptr Filled in with the TX buffer offset to write at
+ * @return @b Success : Free bytes in the TX buffer, which can be 0 \n
+ *         @b Fail    : \n @ref SOCKERR_SOCKSTATUS - Invalid socket status for socket operation \n
+ *                          @ref SOCKERR_TIMEOUT    - The previous SEND timed out, the socket was closed \n
+ *                          @ref SOCKERR_SOCKMODE   - Invalid operation in the socket \n
+ *                          @ref SOCKERR_SOCKNUM    - Invalid socket number
+ */
+int32_t send_reserve(uint8_t sn, uint16_t *ptr);
+
+/**
+ * @ingroup WIZnet_socket_APIs
+ * @brief	Finishes a zero-copy send started by send_reserve().
+ * @details Added for IsolatedEthernet. Updates @ref Sn_TX_WR once and issues SEND, or holds the data the same way
+ *          send() does if a SEND is in flight or the socket is corked.
+ *
+ * @param sn  Socket number. It should be <b>0 ~ @ref \_WIZCHIP_SOCK_NUM_</b>.
+ * @param ptr The ptr value from send_reserve()
+ * @param len Number of bytes written at ptr, no more than send_reserve() returned
+ * @return @b Success : len \n
+ *         @b Fail    : \n @ref SOCKERR_SOCKSTATUS - The socket is no longer connected, nothing was sent \n
+ *                          @ref SOCKERR_SOCKMODE   - Invalid operation in the socket \n
+ *                          @ref SOCKERR_SOCKNUM    - Invalid socket number
+ */
+int32_t send_commit(uint8_t sn, uint16_t ptr, uint16_t len);
+
+/**
+ * @ingroup WIZnet_socket_APIs
+ * @brief	Issues the SEND for data that send() appended to the TX buffer but has not sent yet.
+ * @details Added for IsolatedEthernet. Data is held back while a previous SEND is in flight, or while the socket
+ *          is corked (send_cork()). This sends it even if the socket is corked. If a SEND is still in flight, the
+ *          data goes out with the next send_poll() after @ref Sn_IR_SENDOK. Does nothing, without any SPI access,
+ *          if there is no such data.
+ *
+ * @param sn Socket number. It should be <b>0 ~ @ref \_WIZCHIP_SOCK_NUM_</b>.
+ * @return @ref SOCK_OK             - Nothing is waiting, or the SEND was issued \n
+ *         @ref SOCK_BUSY           - The previous SEND is still in flight \n
+ *         @ref SOCKERR_TIMEOUT     - The previous SEND timed out, the socket was closed \n
+ *         @ref SOCKERR_SOCKNUM     - Invalid socket number
+ */
+int8_t  send_flush(uint8_t sn);
+
+/**
+ * @ingroup WIZnet_socket_APIs
+ * @brief	Issues the SEND for held data once the previous SEND is done, unless the socket is corked.
+ * @details Added for IsolatedEthernet. Call this periodically (the IsolatedEthernet worker thread does) so data
+ *          appended behind a SEND in flight goes out even if the application stops calling send(). Does nothing,
+ *          without any SPI access, if there is no held data or the socket is corked with nothing in flight.
+ *
+ * @param sn Socket number. It should be <b>0 ~ @ref \_WIZCHIP_SOCK_NUM_</b>.
+ * @return Same as send_flush()
+ */
+int8_t  send_poll(uint8_t sn);
+
+/**
+ * @ingroup WIZnet_socket_APIs
+ * @brief	Corks or uncorks a TCP socket.
+ * @details Added for IsolatedEthernet. While corked, send() appends to the TX buffer without issuing SEND, so
+ *          small writes go out together in full segments. The data is sent by send_flush(), by uncorking, by
+ *          disconnect(), or by send() itself when it needs the buffer space.
+ *
+ * @param sn Socket number. It should be <b>0 ~ @ref \_WIZCHIP_SOCK_NUM_</b>.
+ * @param cork 1 to cork, 0 to uncork and send_flush()
+ * @return Same as send_flush()
+ */
+int8_t  send_cork(uint8_t sn, uint8_t cork);
+
+/**
+ * @ingroup WIZnet_socket_APIs
+ * @brief	Returns the number of bytes send() appended to the TX buffer that are waiting for a SEND.
+ * @details Added for IsolatedEthernet.
+ *
+ * @param sn Socket number. It should be <b>0 ~ @ref \_WIZCHIP_SOCK_NUM_</b>.
+ */
+uint16_t send_pending(uint8_t sn);
+
 /**
  * @ingroup WIZnet_socket_APIs
  * @brief	Receive data from the connected peer.
@@ -273,6 +362,20 @@ int32_t send(uint8_t sn, uint8_t * buf, uint16_t len);
  */
 int32_t recv(uint8_t sn, uint8_t * buf, uint16_t len);
 
+/**
+ * @ingroup WIZnet_socket_APIs
+ * @brief	recv() using socket registers the caller already read.
+ * @details Added for IsolatedEthernet. The caller reads the registers with getSn_REGS() and checks them,
+ *          then calls this while still holding the bus, which saves reading them again.\n
+ *
+ * @param sn   Socket number. It should be <b>0 ~ @ref \_WIZCHIP_SOCK_NUM_</b>.
+ * @param buf  Pointer buffer to read incoming data.
+ * @param len  The max data length of data in buf.
+ * @param regs Registers from getSn_REGS(), or 0 to read them, as recv() does.
+ * @return	Same as recv()
+ */
+int32_t recv_regs(uint8_t sn, uint8_t * buf, uint16_t len, const wiz_SockRegs *regs);
+
 /**
  * @ingroup WIZnet_socket_APIs
  * @brief	Sends datagram to the peer with destination IP address and port number passed as parameter.
@@ -281,6 +384,9 @@ int32_t recv(uint8_t sn, uint8_t * buf, uint16_t len);
  *          the address and port number parameters override the destination address for that particular datagram only.
  * @note    In block io mode, It doesn't return until data send is completed - socket buffer size is greater than <I>len</I>.
  *          In non-block io mode, It return @ref SOCK_BUSY immediately when socket buffer is not enough.
+ *          IsolatedEthernet - In non-block io mode, it also returns right after issuing @ref Sn_CR_SEND instead of
+ *          waiting for @ref Sn_IR_SENDOK, which can take as long as ARP resolution. Use sendto_status() to get the
+ *          result. The next sendto() on the socket returns @ref SOCK_BUSY until the previous datagram is done.
  *
  * @param sn    Socket number. It should be <b>0 ~ @ref \_WIZCHIP_SOCK_NUM_</b>.
  * @param buf   Pointer buffer to send outgoing data.
@@ -301,6 +407,21 @@ int32_t recv(uint8_t sn, uint8_t * buf, uint16_t len);
  */
 int32_t sendto(uint8_t sn, uint8_t * buf, uint16_t len, uint8_t * addr, uint16_t port);
 
+/**
+ * @ingroup WIZnet_socket_APIs
+ * @brief	Gets the result of a datagram sent by sendto() in non-block io mode.
+ * @details Added for IsolatedEthernet. Clears @ref Sn_IR_SENDOK or @ref Sn_IR_TIMEOUT once the send is done,
+ *          so each result is returned once.
+ *
+ * @param sn    Socket number. It should be <b>0 ~ @ref \_WIZCHIP_SOCK_NUM_</b>.
+ *
+ * @return @ref SOCK_OK             - Sent, or no send in progress \n
+ *         @ref SOCK_BUSY           - Still sending (ARP or transmission in progress) \n
+ *         @ref SOCKERR_TIMEOUT     - ARP or send timed out, the datagram was not sent \n
+ *         @ref SOCKERR_SOCKNUM     - Invalid socket number
+ */
+int8_t  sendto_status(uint8_t sn);
+
 /**
  * @ingroup WIZnet_socket_APIs
  * @brief Receive datagram of UDP or MACRAW
@@ -502,6 +623,17 @@ void wizchip_debug(const char *fmt, ...);
  */
 void wizchip_yield();
 
+/**
+ * @brief Returns the local port for socket() when port 0 is passed
+ * 
+ * @param sn The socket being opened
+ * 
+ * Called with the bus locked, so the port must already have been chosen.
+ * 
+ * Added for IsolatedEthernet
+ */
+uint16_t wizchip_ephemeral_port(uint8_t sn);
+
 #ifdef __cplusplus
  }
 #endif
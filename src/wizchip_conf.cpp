@@ -140,6 +140,18 @@ void 	wizchip_spi_readburst(uint8_t* pBuf, uint16_t len) 	{}
 //void 	wizchip_spi_writeburst(uint8_t* pBuf, uint16_t len) {};
 void 	wizchip_spi_writeburst(uint8_t* pBuf, uint16_t len) {}
 
+/**
+ * @brief Default function to burst read with scatter-gather in SPI interface. Added for IsolatedEthernet.
+ * @note Always returns -1 so the separate address and data phase burst functions are used.
+ */
+int 	wizchip_spi_readburst_sg(uint8_t* pHdr, uint16_t hdrLen, uint8_t* pBuf, uint16_t len) {return -1;}
+
+/**
+ * @brief Default function to burst write with scatter-gather in SPI interface. Added for IsolatedEthernet.
+ * @note Always returns -1 so the separate address and data phase burst functions are used.
+ */
+int 	wizchip_spi_writeburst_sg(uint8_t* pHdr, uint16_t hdrLen, uint8_t* pBuf, uint16_t len) {return -1;}
+
 /**
  * @\ref _WIZCHIP instance
  */
@@ -281,6 +293,23 @@ void reg_wizchip_spiburst_cbfunc(void (*spi_rb)(uint8_t* pBuf, uint16_t len), vo
    }
 }
 
+// Added for IsolatedEthernet
+void reg_wizchip_spiburst_sg_cbfunc(int (*spi_rb)(uint8_t* pHdr, uint16_t hdrLen, uint8_t* pBuf, uint16_t len), int (*spi_wb)(uint8_t* pHdr, uint16_t hdrLen, uint8_t* pBuf, uint16_t len))
+{
+   while(!(WIZCHIP.if_mode & _WIZCHIP_IO_MODE_SPI_));
+
+   if(!spi_rb || !spi_wb)
+   {
+      WIZCHIP.IF.SPI._read_burst_sg   = wizchip_spi_readburst_sg;
+      WIZCHIP.IF.SPI._write_burst_sg  = wizchip_spi_writeburst_sg;
+   }
+   else
+   {
+      WIZCHIP.IF.SPI._read_burst_sg   = spi_rb;
+      WIZCHIP.IF.SPI._write_burst_sg  = spi_wb;
+   }
+}
+
 int8_t ctlwizchip(ctlwizchip_type cwtype, void* arg)
 {
 #if	_WIZCHIP_ == W5100S || _WIZCHIP_ == W5200 || _WIZCHIP_ == W5500
@@ -406,6 +435,7 @@ void wizchip_sw_reset(void)
    getGAR(gw);  getSUBR(sn);  getSIPR(sip);
    setMR(MR_RST);
    getMR(); // for delay
+   wizchip_shadow_invalidate(); // Added for IsolatedEthernet
 //A2015051 : For indirect bus mode 
 #if _WIZCHIP_IO_MODE_  == _WIZCHIP_IO_MODE_BUS_INDIR_
    setMR(mr | MR_IND);
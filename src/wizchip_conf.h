@@ -279,6 +279,10 @@ typedef struct __WIZCHIP
          void    (*_write_byte)  (uint8_t wb);
          void    (*_read_burst)  (uint8_t* pBuf, uint16_t len);
          void    (*_write_burst) (uint8_t* pBuf, uint16_t len);
+         // Added for IsolatedEthernet: address phase and data phase in a single transfer. Return 0 if handled,
+         // non-zero to fall back to separate _write_burst/_read_burst calls.
+         int     (*_read_burst_sg)  (uint8_t* pHdr, uint16_t hdrLen, uint8_t* pBuf, uint16_t len);
+         int     (*_write_burst_sg) (uint8_t* pHdr, uint16_t hdrLen, uint8_t* pBuf, uint16_t len);
       }SPI;
       // To be added
       //
@@ -504,6 +508,17 @@ void reg_wizchip_spi_cbfunc(uint8_t (*spi_rb)(void), void (*spi_wb)(uint8_t wb))
  */
 void reg_wizchip_spiburst_cbfunc(void (*spi_rb)(uint8_t* pBuf, uint16_t len), void (*spi_wb)(uint8_t* pBuf, uint16_t len));
 
+/**
+ *@brief Registers scatter-gather call back functions for SPI interface. Added for IsolatedEthernet.
+ *@param spi_rb : callback function to write the address phase and read the data phase in one transfer
+ *@param spi_wb : callback function to write the address phase and the data phase in one transfer
+ *@details The callbacks return 0 if the transfer was done, or non-zero if it could not be done (for
+ *example, the data is larger than the staging buffer). In that case WIZCHIP_READ_BUF and WIZCHIP_WRITE_BUF
+ *fall back to the separate burst callbacks registered with \ref reg_wizchip_spiburst_cbfunc.
+ *@note If you do not register, the default functions always fall back.
+ */
+void reg_wizchip_spiburst_sg_cbfunc(int (*spi_rb)(uint8_t* pHdr, uint16_t hdrLen, uint8_t* pBuf, uint16_t len), int (*spi_wb)(uint8_t* pHdr, uint16_t hdrLen, uint8_t* pBuf, uint16_t len));
+
 /**
  * @ingroup extra_functions
  * @brief Controls to the WIZCHIP.